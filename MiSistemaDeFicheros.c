@@ -1,30 +1,489 @@
 #include "common.h"
 #include "parse.h"
 #include "util.h"
+#include "metadatos.h"
+#include "cache.h"
+#include "uring.h"
+#include "lote.h"
+#include "stats.h"
+#include "sumas.h"
+#include "fsck.h"
+#include "defrag.h"
 #include <readline/readline.h>
+#include <limits.h>
+
+// Lo cogen los comandos mientras se ejecutan y el hilo de desfragmentación
+// de fondo mientras mueve un archivo
+static pthread_mutex_t cerrojoComandos = PTHREAD_MUTEX_INITIALIZER;
+// Con -script no hay a quién preguntar: export sobreescribe sin más
+static BOOLEAN enScript = false;
+
+// Ejecuta un comando. Devuelve 0, el código de error de la operación o -1
+// si el comando no existe o le faltan o sobran argumentos.
+static int ejecutaComando(MiSistemaDeFicheros* miSistemaDeFicheros, struct commandType* comando) {
+    int ret = 0;
+    BOOLEAN reparar;
+
+    if (strcmp(comando->command, "import-many") == 0) { // IMPORT-MANY
+        if (comando->VarNum != 2 && comando->VarNum != 3) {
+            fprintf(stderr, "import-many listaArchivos [numHilos]\n");
+            ret = -1;
+        } else {
+        	ret = myImportMany(miSistemaDeFicheros, comando->VarList[1], comando->VarNum == 3 ? atoi(comando->VarList[2]) : sysconf(_SC_NPROCESSORS_ONLN));
+            if (ret) {
+                fprintf(stderr, "Incapaz de importar todos los archivos de %s, código de error: %d\n", comando->VarList[1], ret);
+            }
+        }
+    } else if (strncmp(comando->command, "import", strlen("import")) == 0) { // IMPORT
+        if (comando->VarNum != 3) {
+            fprintf(stderr, "import nombreArchivoExterno nombreArchivoInterno\n");
+            ret = -1;
+        } else {
+        	ret = myImport(comando->VarList[1], miSistemaDeFicheros, comando->VarList[2]);
+            if (ret) {
+                fprintf(stderr, "Incapaz de importar el fichero externo %s en nuestro sistema de ficheros como %s. código de error: %d\n", comando->VarList[1], comando->VarList[2], ret);
+            }
+        }
+    } else if (strncmp(comando->command, "export", strlen("export")) == 0) { // EXPORT
+        if (comando->VarNum != 3) {
+            fprintf(stderr, "export nombreArchivoInterno nombreArchivoExterno \n");
+            ret = -1;
+        } else {
+        	ret = myExport(miSistemaDeFicheros, comando->VarList[1], comando->VarList[2], !enScript);
+            if (ret) {
+                fprintf(stderr, "Incapaz de exportar el archivo interno %s a el archivo externo %s, código de error: %d\n", comando->VarList[1], comando->VarList[2], ret);
+            }
+        }
+    } else if (strcmp(comando->command, "rmdir") == 0) { // RMDIR
+        if (comando->VarNum != 2) {
+            fprintf(stderr, "rmdir rutaDirectorio\n");
+            ret = -1;
+        } else {
+        	ret = myRmdir(miSistemaDeFicheros, comando->VarList[1]);
+            if (ret) {
+                fprintf(stderr, "Incapaz de borrar el directorio %s, código de error: %d\n", comando->VarList[1], ret);
+            }
+        }
+    } else if (strcmp(comando->command, "mkdir") == 0) { // MKDIR
+        if (comando->VarNum != 2) {
+            fprintf(stderr, "mkdir rutaDirectorio\n");
+            ret = -1;
+        } else {
+        	ret = myMkdir(miSistemaDeFicheros, comando->VarList[1]);
+            if (ret) {
+                fprintf(stderr, "Incapaz de crear el directorio %s, código de error: %d\n", comando->VarList[1], ret);
+            }
+        }
+    } else if (strncmp(comando->command, "rm", strlen("rm")) == 0) { // RM
+        if (comando->VarNum != 2) {
+            fprintf(stderr, "rm nombreArchivo\n");
+            ret = -1;
+        } else {
+        	ret = myRm(miSistemaDeFicheros, comando->VarList[1]);
+            if (ret) {
+                fprintf(stderr, "Incapaz de borrar el archivo %s, código de error: %d\n", comando->VarList[1], ret);
+            }
+        }
+    } else if (strncmp(comando->command, "ls", strlen("ls")) == 0) { // LS
+        if (comando->VarNum > 2) {
+            fprintf(stderr, "ls [rutaDirectorio]\n");
+            ret = -1;
+        } else {
+        	ret = myLs(miSistemaDeFicheros, comando->VarNum == 2 ? comando->VarList[1] : "/");
+        }
+    } else if (strncmp(comando->command, "quota", strlen("quota")) == 0) { // QUOTA
+        int free_blocks = myQuota(miSistemaDeFicheros);
+        fprintf(stderr, "Espacio libre: %lld bytes, %d bloques\n", (long long) free_blocks * TAM_BLOQUE_BYTES, free_blocks);
+    } else if (strcmp(comando->command, "cache") == 0) { // CACHE
+        myCache(miSistemaDeFicheros);
+    } else if (strcmp(comando->command, "stats") == 0) { // STATS
+        if (comando->VarNum > 2) {
+            fprintf(stderr, "stats [on|off|reset]\n");
+            ret = -1;
+        } else {
+            ret = myStats(miSistemaDeFicheros, comando->VarNum == 2 ? comando->VarList[1] : NULL);
+            if (ret == 3) {
+                fprintf(stderr, "stats [on|off|reset]\n");
+                ret = -1;
+            }
+        }
+    } else if (strncmp(comando->command, "sync", strlen("sync")) == 0) { // SYNC
+        if (confirmaMetadatos(miSistemaDeFicheros)) {
+            fprintf(stderr, "Incapaz de confirmar las operaciones pendientes\n");
+            ret = 1;
+        }
+    } else if (strcmp(comando->command, "scrub") == 0) { // SCRUB
+        if (comando->VarNum > 2) {
+            fprintf(stderr, "scrub [numHilos]\n");
+            ret = -1;
+        } else {
+        	ret = myScrub(miSistemaDeFicheros, comando->VarNum == 2 ? atoi(comando->VarList[1]) : sysconf(_SC_NPROCESSORS_ONLN));
+            if (ret) {
+                fprintf(stderr, "La comprobación de la imagen ha fallado, código de error: %d\n", ret);
+            }
+        }
+    } else if (strcmp(comando->command, "fsck") == 0) { // FSCK
+        reparar = comando->VarNum > 1 && strcmp(comando->VarList[1], "reparar") == 0;
+        if (comando->VarNum > 2 + reparar) {
+            fprintf(stderr, "fsck [reparar] [numHilos]\n");
+            ret = -1;
+        } else {
+        	ret = myFsck(miSistemaDeFicheros, reparar, comando->VarNum == 2 + reparar ? atoi(comando->VarList[1 + reparar]) : sysconf(_SC_NPROCESSORS_ONLN));
+            if (ret) {
+                fprintf(stderr, "La revisión de los metadatos ha encontrado errores, código de error: %d\n", ret);
+            }
+        }
+    } else if (strcmp(comando->command, "defrag") == 0) { // DEFRAG
+        if (comando->VarNum == 3 && strcmp(comando->VarList[1], "fondo") == 0 && strcmp(comando->VarList[2], "on") == 0) {
+            ret = iniciaDefragFondo(miSistemaDeFicheros, &cerrojoComandos) ? 1 : 0;
+        } else if (comando->VarNum == 3 && strcmp(comando->VarList[1], "fondo") == 0 && strcmp(comando->VarList[2], "off") == 0) {
+            paraDefragFondo();
+        } else if (comando->VarNum > 2) {
+            fprintf(stderr, "defrag [ruta | fondo on|off]\n");
+            ret = -1;
+        } else {
+            ret = myDefrag(miSistemaDeFicheros, comando->VarNum == 2 ? comando->VarList[1] : NULL);
+            if (ret) {
+                fprintf(stderr, "La desfragmentación no ha sido completa, código de error: %d\n", ret);
+            }
+        }
+    } else if (strncmp(comando->command, "exit", strlen("exit")) == 0) { // EXIT
+        paraDefragFondo();
+    	myExit(miSistemaDeFicheros);
+    } else {
+        fprintf(stderr, "Comando desconocido: %s\n", comando->command);
+        fprintf(stderr, "\tPrueba con: import, import-many, export, ls, rm, mkdir, rmdir, quota, cache, stats, sync, scrub, fsck, defrag, exit\n");
+        ret = -1;
+    }
+
+    return ret;
+}
+
+// Pone el archivo nombre en el descriptor fd (la entrada o la salida
+// estándar) y devuelve una copia del que había, para restauraDescriptor, o
+// -1 si falla
+static int redirigeDescriptor(const char* nombre, int fd, int flags) {
+    int archivo = open(nombre, flags, 0644);
+    int copia;
+
+    if (archivo == -1) {
+        perror(nombre);
+        return -1;
+    }
+    fflush(stdout);
+    copia = dup(fd);
+    if (copia == -1 || dup2(archivo, fd) == -1) {
+        perror("No se puede redirigir");
+        if (copia != -1) {
+            close(copia);
+        }
+        copia = -1;
+    }
+    close(archivo);
+    return copia;
+}
+
+static void restauraDescriptor(int copia, int fd) {
+    if (copia == -1) {
+        return;
+    }
+    fflush(stdout);
+    dup2(copia, fd);
+    close(copia);
+    clearerr(stdin);
+}
+
+// Ejecuta el comando de una línea ya analizada, con la entrada (<) y la
+// salida (>) redirigidas si la línea lo pide, y lo mide. Devuelve lo mismo
+// que ejecutaComando.
+static int ejecutaLinea(MiSistemaDeFicheros* miSistemaDeFicheros, parseInfo* info) {
+    struct commandType* comando = &info->CommArray[0];
+    int entrada = -1, salida = -1, ret;
+    uint64_t t0;
+
+    if (info->pipeNum > 0) {
+        fprintf(stderr, "No se pueden encadenar comandos con |\n");
+        return -1;
+    }
+    if (info->boolInfile && (entrada = redirigeDescriptor(info->inFile, STDIN_FILENO, O_RDONLY)) == -1) {
+        return -1;
+    }
+    if (info->boolOutfile && (salida = redirigeDescriptor(info->outFile, STDOUT_FILENO, O_WRONLY | O_CREAT | O_TRUNC)) == -1) {
+        restauraDescriptor(entrada, STDIN_FILENO);
+        return -1;
+    }
+    pthread_mutex_lock(&cerrojoComandos);
+    t0 = empiezaMedida(miSistemaDeFicheros);
+    ret = ejecutaComando(miSistemaDeFicheros, comando);
+    // Si se acaba de activar, t0 es 0 y no cuenta
+    terminaMedida(miSistemaDeFicheros, estadisticaComando(comando->command), t0, 0);
+    pthread_mutex_unlock(&cerrojoComandos);
+    restauraDescriptor(salida, STDOUT_FILENO);
+    restauraDescriptor(entrada, STDIN_FILENO);
+    return ret;
+}
+
+static void escribeCadenaJSON(FILE* f, const char* cadena) {
+    fputc('"', f);
+    for (; *cadena; cadena++) {
+        if (*cadena == '"' || *cadena == '\\') {
+            fprintf(f, "\\%c", *cadena);
+        } else if ((unsigned char) *cadena < 0x20) {
+            fprintf(f, "\\u%04x", *cadena);
+        } else {
+            fputc(*cadena, f);
+        }
+    }
+    fputc('"', f);
+}
+
+// Ejecuta los comandos de script uno detrás de otro, sin readline, hasta el
+// final o hasta exit, y desmonta. Por cada comando escribe una línea JSON en
+// resultados con su número de línea, el comando, el código que devuelve (0
+// si va bien, -1 si no existe o está mal escrito) y lo que ha tardado. Al
+// final escribe otra con los totales. Las líneas vacías y las que empiezan
+// por # no cuentan. Devuelve 0 si todo ha ido bien.
+static int ejecutaScript(MiSistemaDeFicheros* miSistemaDeFicheros, FILE* script, FILE* resultados) {
+    char* linea = NULL;
+    size_t tamLinea = 0;
+    parseInfo* info;
+    struct commandType* comando;
+    int numLinea = 0, numComandos = 0, numErrores = 0, ret;
+    uint64_t inicio = relojNs(), t0;
+    char* p;
+
+    enScript = true;
+    while (getline(&linea, &tamLinea, script) != -1) {
+        numLinea++;
+        for (p = linea; isspace((unsigned char) *p); p++)
+            ;
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        t0 = relojNs();
+        info = parse(linea);
+        comando = info != NULL ? &info->CommArray[0] : NULL;
+        if (comando != NULL && comando->command != NULL && strcmp(comando->command, "exit") == 0) {
+            free_info(info);
+            break;
+        }
+        ret = comando != NULL && comando->command != NULL ? ejecutaLinea(miSistemaDeFicheros, info) : -1;
+        numComandos++;
+        if (ret != 0) {
+            numErrores++;
+        }
+        fprintf(resultados, "{\"linea\": %d, \"comando\": ", numLinea);
+        escribeCadenaJSON(resultados, comando != NULL && comando->command != NULL ? comando->command : "");
+        fprintf(resultados, ", \"codigo\": %d, \"us\": %.1f}\n", ret, (relojNs() - t0) / 1e3);
+        free_info(info);
+    }
+    free(linea);
+    pthread_mutex_lock(&cerrojoComandos);
+    paraDefragFondo();
+    pthread_mutex_unlock(&cerrojoComandos);
+    // Lo que quede sin confirmar se confirma aquí
+    ret = myUmount(miSistemaDeFicheros);
+    fprintf(resultados, "{\"comandos\": %d, \"errores\": %d, \"desmontaje\": %d, \"segundos\": %.3f}\n",
+            numComandos, numErrores, ret, (relojNs() - inicio) / 1e9);
+    fflush(resultados);
+    return numErrores > 0 || ret != 0;
+}
 
 int main(int argc, char** argv) {
     MiSistemaDeFicheros miSistemaDeFicheros;
-    miSistemaDeFicheros.numNodosLibres = MAX_NODOSI;
+    miSistemaDeFicheros.mapaDeBits = NULL;
+    miSistemaDeFicheros.mapaNodosI = NULL;
+    miSistemaDeFicheros.bloquesNodosI = NULL;
+    miSistemaDeFicheros.bloquesHuellas = NULL;
+    miSistemaDeFicheros.bloquesSumas = NULL;
+    miSistemaDeFicheros.directorios = NULL;
+    miSistemaDeFicheros.usoDirectorios = 0;
+    miSistemaDeFicheros.modoAcceso = ACCESO_FD;
+    miSistemaDeFicheros.imagen = NULL;
+    miSistemaDeFicheros.tamImagen = 0;
+    miSistemaDeFicheros.anillo = NULL;
+    miSistemaDeFicheros.estadisticas = NULL;
+    initMetadatos(&miSistemaDeFicheros);
 
     char* lineaComando;
     parseInfo* info; // Almacena toda la información que retorna el parser
     struct commandType* comando; // Almacena el comando y la lista de argumentos
     int ret; // Código de retorno de las llamadas a funciones
+    int bytesPorNodoI = BYTES_POR_NODOI_DEFECTO;
+    BOOLEAN deduplicar = false;
+    BOOLEAN comprimir = false;
+    BOOLEAN sumas = true;
+    int marcosCache = MARCOS_CACHE_DEFECTO;
+    int profundidad = PROFUNDIDAD_URING_DEFECTO;
+    char* nombreScript = NULL;
+    FILE* script = NULL;
+    FILE* resultados = NULL;
+    struct stat stScript;
+    BOOLEAN grupoDado = false;
+
+    // Opciones finales: -grupo N confirma las operaciones de N en N;
+    // -bytesPorNodoI N formatea con un nodo-i por cada N bytes de disco;
+    // -dedup on formatea con índice de huellas para deduplicar los bloques;
+    // -compresion on formatea comprimiendo lo que se importe; -sumas off
+    // formatea sin sumas de comprobación de los bloques;
+    // -cache N guarda hasta N bloques de metadatos en memoria; -acceso mmap
+    // proyecta la imagen en memoria en lugar de usar pread/pwrite;
+    // -acceso uring copia los datos con io_uring, con -profundidad N trozos
+    // en vuelo, y -stats on mide las llamadas a la imagen y los comandos
+    // (-stats archivo, además, los escribe en archivo al salir); -script
+    // archivo ejecuta los comandos de archivo (- para la entrada estándar)
+    // en lugar de preguntarlos
+    while (argc >= 4) {
+        if (strcmp(argv[argc-2], "-grupo") == 0) {
+            miSistemaDeFicheros.opsPorGrupo = atoi(argv[argc-1]);
+            grupoDado = true;
+            if (miSistemaDeFicheros.opsPorGrupo < 1) {
+                fprintf(stderr, "-grupo necesita un número de operaciones mayor que 0\n");
+                exit(-1);
+            }
+        } else if (strcmp(argv[argc-2], "-bytesPorNodoI") == 0) {
+            bytesPorNodoI = atoi(argv[argc-1]);
+            if (bytesPorNodoI < MIN_BYTES_POR_NODOI) {
+                fprintf(stderr, "-bytesPorNodoI necesita al menos %d bytes\n", MIN_BYTES_POR_NODOI);
+                exit(-1);
+            }
+        } else if (strcmp(argv[argc-2], "-dedup") == 0) {
+            if (strcmp(argv[argc-1], "on") == 0) {
+                deduplicar = true;
+            } else if (strcmp(argv[argc-1], "off") == 0) {
+                deduplicar = false;
+            } else {
+                fprintf(stderr, "-dedup puede ser on u off\n");
+                exit(-1);
+            }
+        } else if (strcmp(argv[argc-2], "-compresion") == 0) {
+            if (strcmp(argv[argc-1], "on") == 0) {
+                comprimir = true;
+            } else if (strcmp(argv[argc-1], "off") == 0) {
+                comprimir = false;
+            } else {
+                fprintf(stderr, "-compresion puede ser on u off\n");
+                exit(-1);
+            }
+        } else if (strcmp(argv[argc-2], "-sumas") == 0) {
+            if (strcmp(argv[argc-1], "on") == 0) {
+                sumas = true;
+            } else if (strcmp(argv[argc-1], "off") == 0) {
+                sumas = false;
+            } else {
+                fprintf(stderr, "-sumas puede ser on u off\n");
+                exit(-1);
+            }
+        } else if (strcmp(argv[argc-2], "-acceso") == 0) {
+            if (strcmp(argv[argc-1], "mmap") == 0) {
+                miSistemaDeFicheros.modoAcceso = ACCESO_MMAP;
+            } else if (strcmp(argv[argc-1], "uring") == 0) {
+                miSistemaDeFicheros.modoAcceso = ACCESO_URING;
+            } else if (strcmp(argv[argc-1], "fd") == 0) {
+                miSistemaDeFicheros.modoAcceso = ACCESO_FD;
+            } else {
+                fprintf(stderr, "-acceso puede ser fd, mmap o uring\n");
+                exit(-1);
+            }
+        } else if (strcmp(argv[argc-2], "-profundidad") == 0) {
+            profundidad = atoi(argv[argc-1]);
+            if (profundidad < 1) {
+                fprintf(stderr, "-profundidad necesita al menos un trozo\n");
+                exit(-1);
+            }
+        } else if (strcmp(argv[argc-2], "-stats") == 0) {
+            if (activaEstadisticas(&miSistemaDeFicheros)) {
+                exit(-1);
+            }
+            if (strcmp(argv[argc-1], "on") != 0) {
+                vuelcaEstadisticasAlSalir(&miSistemaDeFicheros, argv[argc-1]);
+            }
+        } else if (strcmp(argv[argc-2], "-script") == 0) {
+            nombreScript = argv[argc-1];
+        } else if (strcmp(argv[argc-2], "-cache") == 0) {
+            marcosCache = atoi(argv[argc-1]);
+            if (marcosCache < MIN_MARCOS_CACHE) {
+                fprintf(stderr, "-cache necesita al menos %d bloques\n", MIN_MARCOS_CACHE);
+                exit(-1);
+            }
+        } else {
+            break;
+        }
+        argc -= 2;
+    }
+    if (initCache(&miSistemaDeFicheros, marcosCache)) {
+        exit(-1);
+    }
+    if (miSistemaDeFicheros.modoAcceso == ACCESO_URING
+            && initAnillo(&miSistemaDeFicheros, profundidad)) {
+        fprintf(stderr, "io_uring no disponible, se usa pread/pwrite\n");
+        miSistemaDeFicheros.modoAcceso = ACCESO_FD;
+    }
+
+    if (nombreScript != NULL) {
+        // Sin -grupo, las operaciones se confirman al final (o cuando se llene
+        // el diario)
+        if (!grupoDado) {
+            miSistemaDeFicheros.opsPorGrupo = INT_MAX;
+            miSistemaDeFicheros.segundosPorGrupo = 0;
+        }
+        // Si el script llega por la entrada estándar se lee por su cuenta, y
+        // los comandos (import -, la pregunta de export) leen de /dev/null o
+        // de lo que se redirija con <
+        if (strcmp(nombreScript, "-") == 0) {
+            int copia = dup(STDIN_FILENO);
+            script = copia != -1 ? fdopen(copia, "r") : NULL;
+            if (freopen("/dev/null", "r", stdin) == NULL) {
+                script = NULL;
+            }
+        } else {
+            script = fopen(nombreScript, "r");
+        }
+        int copiaSalida = dup(STDOUT_FILENO);
+        resultados = copiaSalida != -1 ? fdopen(copiaSalida, "w") : NULL;
+        if (script == NULL || resultados == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+            perror(nombreScript);
+            exit(-1);
+        }
+        // Si los comandos llegan poco a poco, los resultados también
+        if (fstat(fileno(script), &stScript) == 0 && !S_ISREG(stScript.st_mode)) {
+            setvbuf(resultados, NULL, _IOLBF, 0);
+        }
+    }
 
     if ((argc == 4) && (strcmp(argv[1],"-mkfs")==0)) {
         // ./MiSistemaDeFicheros -mkfs tamDisco nombreArchivo
-    	ret = myMkfs(&miSistemaDeFicheros, atoi(argv[2]), argv[3]);
+    	ret = myMkfs(&miSistemaDeFicheros, strtoll(argv[2], NULL, 10), bytesPorNodoI, deduplicar, comprimir, sumas, argv[3]);
         if (ret) {
             fprintf(stderr, "Incapaz de formatear, código de error: %d\n", ret);
             exit(-1);
         }
+    } else if ((argc == 3) && (strcmp(argv[1],"-mount")==0)) {
+        // ./MiSistemaDeFicheros -mount nombreArchivo
+    	ret = myMount(&miSistemaDeFicheros, argv[2]);
+        if (ret) {
+            fprintf(stderr, "Incapaz de montar, código de error: %d\n", ret);
+            exit(-1);
+        }
     } else {
         fprintf(stderr, "Error, debes introducir el tamaño del disco y su nombre: ./MiSistemaDeFicheros -mkfs tamDisco nombreArchivo\n");
+        fprintf(stderr, "o una imagen ya formateada: ./MiSistemaDeFicheros -mount nombreArchivo\n");
+        fprintf(stderr, "Con -grupo N al final las operaciones se confirman de N en N\n");
+        fprintf(stderr, "Con -bytesPorNodoI N al final se formatea con un nodo-i por cada N bytes (%d por defecto)\n", BYTES_POR_NODOI_DEFECTO);
+        fprintf(stderr, "Con -dedup on al final se formatea deduplicando los bloques de datos de los archivos importados (off por defecto)\n");
+        fprintf(stderr, "Con -compresion on al final se formatea comprimiendo los archivos importados (off por defecto)\n");
+        fprintf(stderr, "Con -sumas off al final se formatea sin sumas de comprobación de los bloques, que usa scrub (on por defecto)\n");
+        fprintf(stderr, "Con -acceso mmap al final la imagen se proyecta en memoria (-acceso fd por defecto)\n");
+        fprintf(stderr, "Con -acceso uring al final los datos se copian con io_uring, con -profundidad N trozos en vuelo (%d por defecto)\n", PROFUNDIDAD_URING_DEFECTO);
+        fprintf(stderr, "Con -stats on al final se miden los tiempos, que muestra el comando stats; con -stats archivo se escriben además en archivo al salir (- para la salida de error)\n");
+        fprintf(stderr, "Con -script archivo al final se ejecutan los comandos de archivo (- para la entrada estándar) y se sale. Por la salida estándar sale una línea JSON por comando; lo que escriben los comandos solo se ve redirigido con >. Sin -grupo, todo se confirma al final\n");
+        fprintf(stderr, "Con -cache N al final se guardan hasta N bloques de metadatos en memoria (%d por defecto)\n", MARCOS_CACHE_DEFECTO);
         exit(-1);
     }
-    initNodosI(&miSistemaDeFicheros);
     fprintf(stderr, "Sistema de ficheros disponible\n");
+    if (script != NULL) {
+        exit(ejecutaScript(&miSistemaDeFicheros, script, resultados));
+    }
 
     while (1) {
         lineaComando = readline("% ");
@@ -46,44 +505,7 @@ int main(int argc, char** argv) {
             continue;
         }
 
-        if (strncmp(comando->command, "import", strlen("import")) == 0) { // IMPORT
-            if (comando->VarNum != 3) {
-                fprintf(stderr, "import nombreArchivoExterno nombreArchivoInterno\n");
-            } else {
-            	ret = myImport(comando->VarList[1], &miSistemaDeFicheros, comando->VarList[2]);
-                if (ret) {
-                    fprintf(stderr, "Incapaz de importar el fichero externo %s en nuestro sistema de ficheros como %s. código de error: %d\n", comando->VarList[1], comando->VarList[2], ret);
-                }
-            }
-        } else if (strncmp(comando->command, "export", strlen("export")) == 0) { // EXPORT
-            if (comando->VarNum != 3) {
-                fprintf(stderr, "export nombreArchivoInterno nombreArchivoExterno \n");
-            } else {
-            	ret = myExport(&miSistemaDeFicheros, comando->VarList[1], comando->VarList[2]);
-                if (ret) {
-                    fprintf(stderr, "Incapaz de exportar el archivo interno %s a el archivo externo %s, código de error: %d\n", comando->VarList[1], comando->VarList[2], ret);
-                }
-            }
-        } else if (strncmp(comando->command, "rm", strlen("rm")) == 0) { // RM
-            if (comando->VarNum != 2) {
-                fprintf(stderr, "rm nombreArchivo\n");
-            } else {
-            	ret = myRm(&miSistemaDeFicheros, comando->VarList[1]);
-                if (ret) {
-                    fprintf(stderr, "Incapaz de borrar el archivo %s, código de error: %d\n", comando->VarList[1], ret);
-                }
-            }
-        } else if (strncmp(comando->command, "ls", strlen("ls")) == 0) { // LS
-            myLs(&miSistemaDeFicheros);
-        } else if (strncmp(comando->command, "quota", strlen("quota")) == 0) { // QUOTA
-            int free_blocks = myQuota(&miSistemaDeFicheros);
-            fprintf(stderr, "Espacio libre: %d bytes, %d bloques\n", free_blocks * TAM_BLOQUE_BYTES, free_blocks);
-        } else if (strncmp(comando->command, "exit", strlen("exit")) == 0) { // EXIT
-        	myExit(&miSistemaDeFicheros);
-        } else {
-            fprintf(stderr, "Comando desconocido: %s\n", comando->command);
-            fprintf(stderr, "\tPrueba con: import, export, ls, rm, quota, exit\n");
-        }
+        ejecutaLinea(&miSistemaDeFicheros, info);
         free_info(info);
         free(lineaComando);
     }
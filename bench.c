@@ -0,0 +1,608 @@
+// Banco de pruebas de las operaciones del sistema de ficheros: mide myMkfs,
+// myImport, myExport, myRm, myLs y myQuota con una carga sintética y da,
+// para cada escenario y operación, el número de operaciones, el caudal y
+// las latencias p50, p99 y p999 en JSON.
+//
+//   ./bench-sf [-acceso fd|mmap|uring|todos] [-archivos N] [-grupo N]
+//              [-tamImagen MB] [-semilla N] [-json archivo]
+//
+// Los escenarios son:
+//   mkfs              formatea la imagen varias veces
+//   tam-<distribución> importa archivos de una distribución de tamaños
+//                     (vacíos, pequeños, medianos, grandes), los exporta,
+//                     lista el directorio, pide la cuota y los borra
+//   tam-maximo        un solo archivo que ocupa todo el espacio libre
+//   lleno-<N>         lo mismo con archivos medianos en una imagen ya llena
+//                     al N % con archivos de relleno
+//   fragmentado       lo mismo después de varias rondas de importar y
+//                     borrar archivos al azar, con el espacio libre troceado
+//   ls-masivo         ls y quota con un directorio de muchos archivos vacíos
+//
+// Los tamaños y el orden salen de un generador con semilla, así que dos
+// ejecuciones con la misma semilla hacen exactamente lo mismo. Los archivos
+// de origen se crean en DIR_BENCH con contenido aleatorio. El JSON sale por
+// la salida estándar (o a -json archivo) y un resumen por la de error.
+#include "common.h"
+#include "util.h"
+#include "cache.h"
+#include "uring.h"
+#include "metadatos.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define IMAGEN_BENCH "bench-sf.img"
+#define DIR_BENCH "bench-sf.d"
+#define DESTINO_BENCH DIR_BENCH "/destino"
+#define MAXIMO_BENCH DIR_BENCH "/maximo"
+
+#define NUM_ORIGENES 32           // Archivos de origen por distribución
+#define REPETICIONES_MKFS 10
+#define REPETICIONES_LS 10
+#define REPETICIONES_QUOTA 1000
+#define RONDAS_FRAGMENTACION 4
+#define MARGEN_BLOQUES 64         // Bloques libres que se dejan para metadatos
+
+// Tamaños log-uniformes entre min y max bytes (ambos incluidos)
+typedef struct Distribucion {
+	const char* nombre;
+	off_t min;
+	off_t max;
+} Distribucion;
+
+// MAXIMO no tiene orígenes propios: es un archivo que se crea en su
+// escenario del tamaño del espacio libre
+enum { VACIOS, PEQUENOS, MEDIANOS, GRANDES, MIXTOS, MAXIMO, NUM_DISTRIBUCIONES };
+
+static const Distribucion distribuciones[NUM_DISTRIBUCIONES] = {
+	{ "vacios", 0, 0 },
+	{ "pequenos", 1, 16 << 10 },
+	{ "medianos", 16 << 10, 1 << 20 },
+	{ "grandes", 1 << 20, 32 << 20 },
+	{ "mixtos", 0, 8 << 20 },
+	{ "maximo", 0, 0 },
+};
+
+// Latencias de una operación en un escenario
+typedef struct Medidas {
+	double* tiempos;                  // En segundos
+	int num;
+	int max;
+	long long bytes;
+	double inicio;
+} Medidas;
+
+typedef struct Bench {
+	MiSistemaDeFicheros miSistemaDeFicheros;
+	int modoAcceso;
+	int grupo;
+	int numArchivos;
+	off_t tamImagen;
+	unsigned long long semilla;
+	unsigned long long estado;        // Del generador
+	off_t tamOrigenes[MAXIMO][NUM_ORIGENES];
+	off_t tamMaximo;
+	Medidas medidas;
+	FILE* json;
+	int filas;
+} Bench;
+
+static const char* nombresAcceso[] = { "fd", "mmap", "uring" };
+
+static double ahora(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// splitmix64: basta para repartir tamaños y es igual en todas partes
+static unsigned long long aleatorio(Bench* b) {
+	unsigned long long z = (b->estado += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// Reinicia el generador para un escenario, así cada escenario hace lo mismo
+// se ejecuten o no los demás
+static void siembra(Bench* b, const char* escenario) {
+	b->estado = b->semilla;
+	while (*escenario)
+		b->estado = b->estado * 31 + (unsigned char) *escenario++;
+	aleatorio(b);
+}
+
+static off_t tamAleatorio(Bench* b, const Distribucion* d) {
+	double u = (aleatorio(b) >> 11) * (1.0 / (1ULL << 53));
+	double lmin = log(d->min + 1.0), lmax = log(d->max + 1.0);
+	off_t tam = (off_t) (exp(lmin + u * (lmax - lmin)) - 1);
+
+	return tam < d->min ? d->min : tam > d->max ? d->max : tam;
+}
+
+// Crea un archivo externo de tam bytes aleatorios
+static void creaOrigen(Bench* b, const char* nombre, off_t tam) {
+	static unsigned long long buffer[1 << 17];
+	FILE* f = fopen(nombre, "w");
+	off_t hechos;
+	size_t n, i;
+
+	if (f == NULL) {
+		perror(nombre);
+		exit(-1);
+	}
+	for (hechos = 0; hechos < tam; hechos += n) {
+		n = tam - hechos < (off_t) sizeof(buffer) ? tam - hechos : sizeof(buffer);
+		for (i = 0; i < (n + 7) / 8; i++)
+			buffer[i] = aleatorio(b);
+		if (fwrite(buffer, 1, n, f) != n) {
+			perror(nombre);
+			exit(-1);
+		}
+	}
+	fclose(f);
+}
+
+static void nombreOrigen(char* nombre, int distribucion, int i) {
+	sprintf(nombre, DIR_BENCH "/%s-%d", distribuciones[distribucion].nombre, i);
+}
+
+static void creaOrigenes(Bench* b) {
+	char nombre[64];
+	int d, i;
+
+	if (mkdir(DIR_BENCH, 0700) == -1 && errno != EEXIST) {
+		perror(DIR_BENCH);
+		exit(-1);
+	}
+	siembra(b, "origenes");
+	for (d = 0; d < MAXIMO; d++) {
+		for (i = 0; i < NUM_ORIGENES; i++) {
+			b->tamOrigenes[d][i] = tamAleatorio(b, &distribuciones[d]);
+			nombreOrigen(nombre, d, i);
+			creaOrigen(b, nombre, b->tamOrigenes[d][i]);
+		}
+	}
+}
+
+static void borraOrigenes(void) {
+	char nombre[64];
+	int d, i;
+
+	for (d = 0; d < MAXIMO; d++) {
+		for (i = 0; i < NUM_ORIGENES; i++) {
+			nombreOrigen(nombre, d, i);
+			unlink(nombre);
+		}
+	}
+	rmdir(DIR_BENCH);
+}
+
+static void empieza(Bench* b) {
+	b->medidas.num = 0;
+	b->medidas.bytes = 0;
+	b->medidas.inicio = ahora();
+}
+
+static void anota(Bench* b, double t0, long long bytes) {
+	Medidas* m = &b->medidas;
+	double* nuevos;
+
+	if (m->num == m->max) {
+		nuevos = realloc(m->tiempos, (m->max * 2 + 1024) * sizeof(double));
+		if (nuevos == NULL) {
+			perror("Falló realloc en anota");
+			exit(-1);
+		}
+		m->tiempos = nuevos;
+		m->max = m->max * 2 + 1024;
+	}
+	m->tiempos[m->num++] = ahora() - t0;
+	m->bytes += bytes;
+}
+
+static int comparaTiempos(const void* a, const void* b) {
+	double x = *(const double*) a, y = *(const double*) b;
+
+	return x < y ? -1 : x > y;
+}
+
+// Percentil p (entre 0 y 1) de tiempos ordenados, por rango más cercano
+static double percentil(const double* tiempos, int num, double p) {
+	int i = (int) ceil(p * num) - 1;
+
+	return tiempos[i < 0 ? 0 : i];
+}
+
+// Cierra la medida: confirma lo pendiente (dentro del tiempo total, no de
+// ninguna operación) y escribe la fila
+static void informa(Bench* b, const char* escenario, const char* operacion) {
+	Medidas* m = &b->medidas;
+	double total, p50, p99, p999;
+
+	if (confirmaMetadatos(&b->miSistemaDeFicheros) == -1)
+		exit(-1);
+	total = ahora() - m->inicio;
+	if (m->num == 0)
+		return;
+	qsort(m->tiempos, m->num, sizeof(double), comparaTiempos);
+	p50 = percentil(m->tiempos, m->num, 0.5) * 1e6;
+	p99 = percentil(m->tiempos, m->num, 0.99) * 1e6;
+	p999 = percentil(m->tiempos, m->num, 0.999) * 1e6;
+
+	fprintf(b->json, "%s\n    {\"acceso\": \"%s\", \"escenario\": \"%s\", "
+			"\"operacion\": \"%s\", \"ops\": %d, \"bytes\": %lld, "
+			"\"segundos\": %.6f, \"opsPorSegundo\": %.1f, "
+			"\"mbPorSegundo\": %.2f, \"p50us\": %.1f, \"p99us\": %.1f, "
+			"\"p999us\": %.1f, \"maxus\": %.1f}", b->filas++ ? "," : "",
+			nombresAcceso[b->modoAcceso], escenario, operacion, m->num,
+			m->bytes, total, m->num / total, m->bytes / total / (1 << 20), p50,
+			p99, p999, m->tiempos[m->num - 1] * 1e6);
+	fprintf(stderr, "%-5s %-14s %-7s %7d ops %10.1f ops/s %8.1f MB/s"
+			"  p50 %8.1f  p99 %8.1f  p999 %8.1f us\n",
+			nombresAcceso[b->modoAcceso], escenario, operacion, m->num,
+			m->num / total, m->bytes / total / (1 << 20), p50, p99, p999);
+}
+
+static void initSistema(Bench* b) {
+	MiSistemaDeFicheros* miSistemaDeFicheros = &b->miSistemaDeFicheros;
+
+	miSistemaDeFicheros->mapaDeBits = NULL;
+	miSistemaDeFicheros->mapaNodosI = NULL;
+	miSistemaDeFicheros->bloquesNodosI = NULL;
+	miSistemaDeFicheros->bloquesHuellas = NULL;
+	miSistemaDeFicheros->bloquesSumas = NULL;
+	miSistemaDeFicheros->directorios = NULL;
+	miSistemaDeFicheros->usoDirectorios = 0;
+	miSistemaDeFicheros->modoAcceso = b->modoAcceso;
+	miSistemaDeFicheros->imagen = NULL;
+	miSistemaDeFicheros->tamImagen = 0;
+	miSistemaDeFicheros->anillo = NULL;
+	miSistemaDeFicheros->estadisticas = NULL;
+	initMetadatos(miSistemaDeFicheros);
+	miSistemaDeFicheros->opsPorGrupo = b->grupo;
+	if (initCache(miSistemaDeFicheros, MARCOS_CACHE_DEFECTO) == -1)
+		exit(-1);
+	if (b->modoAcceso == ACCESO_URING && initAnillo(miSistemaDeFicheros,
+			PROFUNDIDAD_URING_DEFECTO) == -1)
+		miSistemaDeFicheros->modoAcceso = ACCESO_FD;
+}
+
+// Formatea la imagen y crea los directorios d y relleno
+static void formatea(Bench* b) {
+	initSistema(b);
+	if (myMkfs(&b->miSistemaDeFicheros, b->tamImagen, BYTES_POR_NODOI_DEFECTO,
+			false, false, true, IMAGEN_BENCH) != 0
+			|| myMkdir(&b->miSistemaDeFicheros, "d") != 0
+			|| myMkdir(&b->miSistemaDeFicheros, "relleno") != 0) {
+		fprintf(stderr, "No se puede formatear " IMAGEN_BENCH "\n");
+		exit(-1);
+	}
+}
+
+static void desmonta(Bench* b) {
+	if (myUmount(&b->miSistemaDeFicheros) != 0)
+		exit(-1);
+}
+
+static off_t bytesLibres(Bench* b) {
+	off_t libres = myQuota(&b->miSistemaDeFicheros) - MARGEN_BLOQUES;
+
+	return libres > 0 ? libres * TAM_BLOQUE_BYTES : 0;
+}
+
+// Importa en dir/f<primero>, dir/f<primero+1>... hasta numArchivos archivos
+// de la distribución, limiteBytes bytes o hasta que no quepa el siguiente.
+// Con medir anota cada importación. Devuelve cuántos ha importado.
+static int importa(Bench* b, const char* dir, int distribucion, int primero,
+		int numArchivos, off_t limiteBytes, int medir) {
+	char externo[64], interno[64];
+	off_t tam, bytes = 0;
+	double t0;
+	int i, o, ret;
+
+	for (i = 0; i < numArchivos; i++) {
+		if (distribucion == MAXIMO) {
+			strcpy(externo, MAXIMO_BENCH);
+			tam = b->tamMaximo;
+		} else {
+			o = aleatorio(b) % NUM_ORIGENES;
+			nombreOrigen(externo, distribucion, o);
+			tam = b->tamOrigenes[distribucion][o];
+		}
+		if (bytes + tam > limiteBytes || tam > bytesLibres(b)
+				|| b->miSistemaDeFicheros.superBloque.numNodosLibres == 0)
+			break;
+		sprintf(interno, "%s/f%d", dir, primero + i);
+		t0 = ahora();
+		ret = myImport(externo, &b->miSistemaDeFicheros, interno);
+		if (ret != 0) {
+			fprintf(stderr, "Falló import %s: %d\n", interno, ret);
+			exit(-1);
+		}
+		if (medir)
+			anota(b, t0, tam);
+		bytes += tam;
+	}
+	return i;
+}
+
+static void exporta(Bench* b, int numArchivos) {
+	char interno[64];
+	struct stat st;
+	double t0;
+	int i, ret;
+
+	for (i = 0; i < numArchivos; i++) {
+		sprintf(interno, "d/f%d", i);
+		t0 = ahora();
+		ret = myExport(&b->miSistemaDeFicheros, interno, DESTINO_BENCH, false);
+		if (ret != 0 || stat(DESTINO_BENCH, &st) == -1) {
+			fprintf(stderr, "Falló export %s: %d\n", interno, ret);
+			exit(-1);
+		}
+		anota(b, t0, st.st_size);
+		unlink(DESTINO_BENCH);
+	}
+}
+
+static void borra(Bench* b, const char* dir, int i, int medir) {
+	char interno[64];
+	double t0 = ahora();
+	int ret;
+
+	sprintf(interno, "%s/f%d", dir, i);
+	ret = myRm(&b->miSistemaDeFicheros, interno);
+	if (ret != 0) {
+		fprintf(stderr, "Falló rm %s: %d\n", interno, ret);
+		exit(-1);
+	}
+	if (medir)
+		anota(b, t0, 0);
+}
+
+static void listaYCuota(Bench* b, const char* escenario) {
+	double t0;
+	int i;
+
+	empieza(b);
+	for (i = 0; i < REPETICIONES_LS; i++) {
+		t0 = ahora();
+		myLs(&b->miSistemaDeFicheros, "d");
+		anota(b, t0, 0);
+	}
+	informa(b, escenario, "ls");
+	empieza(b);
+	for (i = 0; i < REPETICIONES_QUOTA; i++) {
+		t0 = ahora();
+		myQuota(&b->miSistemaDeFicheros);
+		anota(b, t0, 0);
+	}
+	informa(b, escenario, "quota");
+}
+
+// Importa, exporta, lista y borra archivos de la distribución en d, con la
+// imagen como esté
+static void mideArchivos(Bench* b, const char* escenario, int distribucion,
+		int numArchivos, off_t limiteBytes) {
+	int i;
+
+	empieza(b);
+	numArchivos = importa(b, "d", distribucion, 0, numArchivos, limiteBytes,
+			1);
+	informa(b, escenario, "import");
+	empieza(b);
+	exporta(b, numArchivos);
+	informa(b, escenario, "export");
+	listaYCuota(b, escenario);
+	empieza(b);
+	for (i = 0; i < numArchivos; i++)
+		borra(b, "d", i, 1);
+	informa(b, escenario, "rm");
+}
+
+static void escenarioMkfs(Bench* b) {
+	double t0;
+	int i;
+
+	empieza(b);
+	for (i = 0; i < REPETICIONES_MKFS; i++) {
+		initSistema(b);
+		t0 = ahora();
+		if (myMkfs(&b->miSistemaDeFicheros, b->tamImagen,
+				BYTES_POR_NODOI_DEFECTO, false, false, true, IMAGEN_BENCH) != 0)
+			exit(-1);
+		anota(b, t0, 0);
+		if (i < REPETICIONES_MKFS - 1)
+			desmonta(b);
+	}
+	informa(b, "mkfs", "mkfs");
+	desmonta(b);
+}
+
+static void escenarioTamanos(Bench* b, int distribucion) {
+	char escenario[32];
+
+	sprintf(escenario, "tam-%s", distribuciones[distribucion].nombre);
+	siembra(b, escenario);
+	formatea(b);
+	// Como mucho la mitad de la imagen, para que quepan
+	mideArchivos(b, escenario, distribucion, b->numArchivos,
+			b->tamImagen / 2);
+	desmonta(b);
+}
+
+static void escenarioMaximo(Bench* b) {
+	siembra(b, "tam-maximo");
+	formatea(b);
+	b->tamMaximo = bytesLibres(b);
+	creaOrigen(b, MAXIMO_BENCH, b->tamMaximo);
+	mideArchivos(b, "tam-maximo", MAXIMO, 1, b->tamMaximo);
+	unlink(MAXIMO_BENCH);
+	desmonta(b);
+}
+
+// Llena relleno/ con archivos de la distribución hasta que queden libres como mucho
+// objetivo bloques. Devuelve cuántos ha importado.
+static int llena(Bench* b, int distribucion, int primero, int objetivo) {
+	int n = 0, fallos = 0;
+
+	// Cuando un archivo no cabe se prueba con otro, hasta que no quepa ninguno
+	while (myQuota(&b->miSistemaDeFicheros) > objetivo && fallos < 100) {
+		if (importa(b, "relleno", distribucion, primero + n, 1,
+				(off_t) (myQuota(&b->miSistemaDeFicheros) - objetivo)
+						* TAM_BLOQUE_BYTES, 0) == 1) {
+			n++;
+			fallos = 0;
+		} else {
+			fallos++;
+		}
+	}
+	return n;
+}
+
+static void escenarioLleno(Bench* b, int porcentaje) {
+	char escenario[32];
+	int libres;
+
+	sprintf(escenario, "lleno-%d", porcentaje);
+	siembra(b, escenario);
+	formatea(b);
+	libres = myQuota(&b->miSistemaDeFicheros);
+	llena(b, MIXTOS, 0, libres - (long long) libres * porcentaje / 100);
+	if (confirmaMetadatos(&b->miSistemaDeFicheros) == -1)
+		exit(-1);
+	mideArchivos(b, escenario, MEDIANOS, b->numArchivos, bytesLibres(b) / 2);
+	desmonta(b);
+}
+
+// Rondas de llenar la imagen hasta el 80 % con archivos mixtos y borrar la mitad al azar: el espacio libre queda en huecos sueltos, y lo
+// que se importa después se parte en muchas extensiones
+static void escenarioFragmentado(Bench* b) {
+	char* vivos = NULL;
+	int libres, ronda, i, numRelleno = 0, n;
+
+	siembra(b, "fragmentado");
+	formatea(b);
+	libres = myQuota(&b->miSistemaDeFicheros);
+	for (ronda = 0; ronda < RONDAS_FRAGMENTACION; ronda++) {
+		n = llena(b, MIXTOS, numRelleno, libres / 5);
+		vivos = realloc(vivos, numRelleno + n);
+		if (vivos == NULL) {
+			perror("Falló realloc en escenarioFragmentado");
+			exit(-1);
+		}
+		memset(vivos + numRelleno, 1, n);
+		numRelleno += n;
+		for (i = 0; i < numRelleno; i++) {
+			if (vivos[i] && aleatorio(b) % 2) {
+				borra(b, "relleno", i, 0);
+				vivos[i] = 0;
+			}
+		}
+	}
+	free(vivos);
+	if (confirmaMetadatos(&b->miSistemaDeFicheros) == -1)
+		exit(-1);
+	mideArchivos(b, "fragmentado", MEDIANOS, b->numArchivos,
+			bytesLibres(b) / 2);
+	desmonta(b);
+}
+
+static void escenarioLsMasivo(Bench* b) {
+	siembra(b, "ls-masivo");
+	formatea(b);
+	mideArchivos(b, "ls-masivo", VACIOS, b->numArchivos * 10, b->tamImagen);
+	desmonta(b);
+}
+
+static void uso(const char* programa) {
+	fprintf(stderr, "%s [-acceso fd|mmap|uring|todos] [-archivos N] [-grupo N]"
+			" [-tamImagen MB] [-semilla N] [-json archivo]\n", programa);
+	exit(-1);
+}
+
+int main(int argc, char** argv) {
+	Bench b;
+	int primerModo = ACCESO_FD, ultimoModo = ACCESO_URING;
+	int salida, i, d;
+
+	memset(&b, 0, sizeof(b));
+	b.grupo = 1;
+	b.numArchivos = 1000;
+	b.tamImagen = 512LL << 20;
+	b.semilla = 1;
+	b.json = NULL;
+	for (i = 1; i < argc; i += 2) {
+		if (i + 1 == argc)
+			uso(argv[0]);
+		if (strcmp(argv[i], "-acceso") == 0) {
+			if (strcmp(argv[i + 1], "todos") == 0) {
+				primerModo = ACCESO_FD;
+				ultimoModo = ACCESO_URING;
+			} else {
+				for (d = ACCESO_FD; d <= ACCESO_URING; d++)
+					if (strcmp(argv[i + 1], nombresAcceso[d]) == 0)
+						break;
+				if (d > ACCESO_URING)
+					uso(argv[0]);
+				primerModo = ultimoModo = d;
+			}
+		} else if (strcmp(argv[i], "-archivos") == 0) {
+			b.numArchivos = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "-grupo") == 0) {
+			b.grupo = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "-tamImagen") == 0) {
+			b.tamImagen = strtoll(argv[i + 1], NULL, 10) << 20;
+		} else if (strcmp(argv[i], "-semilla") == 0) {
+			b.semilla = strtoull(argv[i + 1], NULL, 10);
+		} else if (strcmp(argv[i], "-json") == 0) {
+			if ((b.json = fopen(argv[i + 1], "w")) == NULL) {
+				perror(argv[i + 1]);
+				return -1;
+			}
+		} else {
+			uso(argv[0]);
+		}
+	}
+	if (b.numArchivos < 1 || b.grupo < 1 || b.tamImagen < (64LL << 20))
+		uso(argv[0]);
+
+	// Lo que imprimen las operaciones no interesa aquí; el JSON va a la
+	// salida estándar de verdad
+	if (b.json == NULL && ((salida = dup(STDOUT_FILENO)) == -1
+			|| (b.json = fdopen(salida, "w")) == NULL)) {
+		perror("No se puede duplicar la salida estándar");
+		return -1;
+	}
+	if (freopen("/dev/null", "w", stdout) == NULL)
+		return -1;
+	creaOrigenes(&b);
+
+	fprintf(b.json, "{\"semilla\": %llu, \"grupo\": %d, \"archivos\": %d, "
+			"\"tamImagen\": %lld, \"tamBloque\": %d, \"resultados\": [",
+			b.semilla, b.grupo, b.numArchivos, (long long) b.tamImagen,
+			TAM_BLOQUE_BYTES);
+	for (b.modoAcceso = primerModo; b.modoAcceso <= ultimoModo;
+			b.modoAcceso++) {
+		escenarioMkfs(&b);
+		for (d = VACIOS; d <= GRANDES; d++)
+			escenarioTamanos(&b, d);
+		escenarioMaximo(&b);
+		escenarioLleno(&b, 50);
+		escenarioLleno(&b, 90);
+		escenarioFragmentado(&b);
+		escenarioLsMasivo(&b);
+	}
+	fprintf(b.json, "\n]}\n");
+	fclose(b.json);
+
+	unlink(IMAGEN_BENCH);
+	borraOrigenes();
+	free(b.medidas.tiempos);
+	return 0;
+}
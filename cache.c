@@ -0,0 +1,367 @@
+#include "cache.h"
+#include "sumas.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DATOS_MARCO(cache, m) ((cache)->datos + (size_t) (m) * TAM_BLOQUE_BYTES)
+
+int initCache(MiSistemaDeFicheros* miSistemaDeFicheros, int numMarcos) {
+	CacheBloques* cache = &miSistemaDeFicheros->cache;
+	int i;
+
+	memset(cache, 0, sizeof(CacheBloques));
+	// Al menos dos listas por marco, para que sean cortas
+	for (cache->tamHash = 1; cache->tamHash < 2 * numMarcos; cache->tamHash *= 2)
+		;
+	cache->marcos = malloc(numMarcos * sizeof(MarcoCache));
+	cache->datos = malloc((size_t) numMarcos * TAM_BLOQUE_BYTES);
+	cache->hash = malloc(cache->tamHash * sizeof(int));
+	if (cache->marcos == NULL || cache->datos == NULL || cache->hash == NULL) {
+		perror("Falló malloc en initCache");
+		liberaCache(miSistemaDeFicheros);
+		return -1;
+	}
+	for (i = 0; i < numMarcos; i++) {
+		cache->marcos[i].idxBloque = -1;
+		cache->marcos[i].fijado = 0;
+		cache->marcos[i].sucio = false;
+		cache->marcos[i].usado = false;
+		cache->marcos[i].anticipado = false;
+	}
+	for (i = 0; i < cache->tamHash; i++)
+		cache->hash[i] = -1;
+	cache->numMarcos = numMarcos;
+	cache->finUltimoFallo = -1;
+	return 0;
+}
+
+void liberaCache(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	CacheBloques* cache = &miSistemaDeFicheros->cache;
+
+	free(cache->marcos);
+	free(cache->datos);
+	free(cache->hash);
+	memset(cache, 0, sizeof(CacheBloques));
+}
+
+static unsigned posHash(CacheBloques* cache, DISK_LBA idxBloque) {
+	return ((unsigned) idxBloque * 2654435761u) & (cache->tamHash - 1);
+}
+
+// Marco que tiene el bloque idxBloque, o -1 si no está
+static int buscaMarco(CacheBloques* cache, DISK_LBA idxBloque) {
+	int m;
+
+	for (m = cache->hash[posHash(cache, idxBloque)]; m != -1;
+			m = cache->marcos[m].siguiente) {
+		if (cache->marcos[m].idxBloque == idxBloque)
+			return m;
+	}
+	return -1;
+}
+
+static void asignaMarco(CacheBloques* cache, int m, DISK_LBA idxBloque) {
+	unsigned pos = posHash(cache, idxBloque);
+
+	cache->marcos[m].idxBloque = idxBloque;
+	cache->marcos[m].siguiente = cache->hash[pos];
+	cache->hash[pos] = m;
+}
+
+// Deja libre el marco m, sin escribirlo
+static void vaciaMarco(CacheBloques* cache, int m) {
+	MarcoCache* marco = &cache->marcos[m];
+	int* p = &cache->hash[posHash(cache, marco->idxBloque)];
+
+	while (*p != m)
+		p = &cache->marcos[*p].siguiente;
+	*p = marco->siguiente;
+	if (marco->sucio)
+		cache->numSucios--;
+	marco->idxBloque = -1;
+	marco->sucio = false;
+	marco->usado = false;
+	marco->anticipado = false;
+}
+
+// Devuelve un marco libre. Si no hay, lo saca el reloj, escribiendo antes
+// el bloque si está sucio. -1 si todos están fijados o falla la escritura.
+static int reservaMarco(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	CacheBloques* cache = &miSistemaDeFicheros->cache;
+	MarcoCache* marco;
+	int vueltas, m;
+
+	// En dos vueltas la manecilla ha quitado todos los bits de uso
+	for (vueltas = 0; vueltas < 2 * cache->numMarcos; vueltas++) {
+		m = cache->manecilla;
+		cache->manecilla = (m + 1) % cache->numMarcos;
+		marco = &cache->marcos[m];
+		if (marco->idxBloque == -1)
+			return m;
+		if (marco->fijado > 0)
+			continue;
+		if (marco->usado) {
+			marco->usado = false;
+			continue;
+		}
+		if (marco->sucio) {
+			if (escribeBloques(miSistemaDeFicheros, marco->idxBloque, 1,
+					DATOS_MARCO(cache, m)) == -1)
+				return -1;
+			cache->escrituras++;
+		}
+		vaciaMarco(cache, m);
+		cache->expulsiones++;
+		return m;
+	}
+	fprintf(stderr, "Todos los marcos de la caché están fijados\n");
+	return -1;
+}
+
+// Lee el bloque idxBloque, que no está en la caché, y si el fallo sigue al
+// anterior también los siguientes. Devuelve su marco, ya fijado.
+static int cargaBloques(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA idxBloque) {
+	CacheBloques* cache = &miSistemaDeFicheros->cache;
+	int marcos[MAX_LECTURA_ANTICIPADA];
+	struct iovec iov[MAX_LECTURA_ANTICIPADA];
+	int n, i;
+
+	if (idxBloque == cache->finUltimoFallo) {
+		cache->ventana *= 2;
+		if (cache->ventana > MAX_LECTURA_ANTICIPADA)
+			cache->ventana = MAX_LECTURA_ANTICIPADA;
+	} else {
+		cache->ventana = 1;
+	}
+	// Sin pasar del final del disco ni de lo que ya está en la caché, y sin
+	// ocupar más de una cuarta parte de ella
+	n = cache->ventana;
+	if (n > cache->numMarcos / 4)
+		n = cache->numMarcos / 4;
+	if (n > miSistemaDeFicheros->superBloque.tamDiscoEnBloques - idxBloque)
+		n = miSistemaDeFicheros->superBloque.tamDiscoEnBloques - idxBloque;
+	for (i = 1; i < n; i++) {
+		if (buscaMarco(cache, idxBloque + i) != -1)
+			break;
+	}
+	n = i;
+
+	// Se fijan según se reservan, para que el reloj no vuelva a darlos
+	for (i = 0; i < n; i++) {
+		if ((marcos[i] = reservaMarco(miSistemaDeFicheros)) == -1)
+			break;
+		asignaMarco(cache, marcos[i], idxBloque + i);
+		cache->marcos[marcos[i]].fijado = 1;
+		iov[i].iov_base = DATOS_MARCO(cache, marcos[i]);
+		iov[i].iov_len = TAM_BLOQUE_BYTES;
+	}
+	if (i == 0)
+		return -1;
+	n = i;
+
+	// Los leídos por adelantado se comprueban si llegan a usarse
+	if (leeDiscoVector(miSistemaDeFicheros, iov, n, (off_t) idxBloque
+			* TAM_BLOQUE_BYTES) == -1 || compruebaSumas(miSistemaDeFicheros,
+			idxBloque, 1, iov[0].iov_base) == -1)
+		goto error;
+
+	for (i = 1; i < n; i++) {
+		cache->marcos[marcos[i]].fijado = 0;
+		cache->marcos[marcos[i]].anticipado = true;
+	}
+	cache->marcos[marcos[0]].usado = true;
+	cache->anticipados += n - 1;
+	cache->finUltimoFallo = idxBloque + n;
+	return marcos[0];
+
+	error: for (i = 0; i < n; i++) {
+		cache->marcos[marcos[i]].fijado = 0;
+		vaciaMarco(cache, marcos[i]);
+	}
+	return -1;
+}
+
+char* fijaBloque(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA idxBloque) {
+	CacheBloques* cache = &miSistemaDeFicheros->cache;
+	MarcoCache* marco;
+	int m;
+
+	// Con la imagen proyectada el bloque ya está en memoria, en su sitio
+	if (miSistemaDeFicheros->imagen != NULL) {
+		if (idxBloque < 0 || (size_t) (idxBloque + 1) * TAM_BLOQUE_BYTES
+				> miSistemaDeFicheros->tamImagen) {
+			fprintf(stderr, "Bloque %d fuera de la imagen\n", idxBloque);
+			return NULL;
+		}
+		return miSistemaDeFicheros->imagen + (size_t) idxBloque
+				* TAM_BLOQUE_BYTES;
+	}
+	m = buscaMarco(cache, idxBloque);
+	if (m == -1) {
+		cache->fallos++;
+		if ((m = cargaBloques(miSistemaDeFicheros, idxBloque)) == -1)
+			return NULL;
+		return DATOS_MARCO(cache, m);
+	}
+	cache->aciertos++;
+	marco = &cache->marcos[m];
+	if (marco->anticipado) {
+		if (compruebaSumas(miSistemaDeFicheros, idxBloque, 1, DATOS_MARCO(
+				cache, m)) == -1)
+			return NULL;
+		marco->anticipado = false;
+		cache->anticipadosUsados++;
+	}
+	marco->usado = true;
+	marco->fijado++;
+	return DATOS_MARCO(cache, m);
+}
+
+void sueltaBloque(MiSistemaDeFicheros* miSistemaDeFicheros, const void* bloque) {
+	CacheBloques* cache = &miSistemaDeFicheros->cache;
+	const char* p = bloque;
+
+	if (p < cache->datos || p >= DATOS_MARCO(cache, cache->numMarcos))
+		return;
+	cache->marcos[(p - cache->datos) / TAM_BLOQUE_BYTES].fijado--;
+}
+
+int leeBloqueCache(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA idxBloque, void* buffer) {
+	char* bloque = fijaBloque(miSistemaDeFicheros, idxBloque);
+
+	if (bloque == NULL)
+		return -1;
+	memcpy(buffer, bloque, TAM_BLOQUE_BYTES);
+	sueltaBloque(miSistemaDeFicheros, bloque);
+	return 0;
+}
+
+int leeBloquesCache(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA inicio, int numBloques, void* buffer) {
+	CacheBloques* cache = &miSistemaDeFicheros->cache;
+	int i, m;
+
+	BOOLEAN sumas = tieneSumas(miSistemaDeFicheros);
+
+	if (leeBloques(miSistemaDeFicheros, inicio, numBloques, buffer) == -1)
+		return -1;
+	// Un bloque de la caché puede ser más nuevo que el del disco. Los que
+	// no están en ella son los del disco: se comprueban.
+	for (i = 0; i < numBloques && (cache->numSucios > 0 || sumas); i++) {
+		m = buscaMarco(cache, inicio + i);
+		if (m != -1 && cache->marcos[m].sucio)
+			memcpy((char*) buffer + (size_t) i * TAM_BLOQUE_BYTES,
+					DATOS_MARCO(cache, m), TAM_BLOQUE_BYTES);
+		else if (sumas && compruebaSumas(miSistemaDeFicheros, inicio + i, 1,
+				(char*) buffer + (size_t) i * TAM_BLOQUE_BYTES) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+int guardaBloqueCache(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA idxBloque, const void* buffer, BOOLEAN sucio) {
+	CacheBloques* cache = &miSistemaDeFicheros->cache;
+	MarcoCache* marco;
+	int m;
+
+	// Con la imagen proyectada, escribirlo en su sitio es solo una copia
+	if (miSistemaDeFicheros->imagen != NULL)
+		return escribeBloques(miSistemaDeFicheros, idxBloque, 1, buffer);
+	if ((m = buscaMarco(cache, idxBloque)) == -1) {
+		if ((m = reservaMarco(miSistemaDeFicheros)) == -1)
+			// Sin marco, un bloque sucio se escribe directamente
+			return sucio ? escribeBloques(miSistemaDeFicheros, idxBloque, 1,
+					buffer) : 0;
+		asignaMarco(cache, m, idxBloque);
+	}
+	marco = &cache->marcos[m];
+	memcpy(DATOS_MARCO(cache, m), buffer, TAM_BLOQUE_BYTES);
+	if (sucio && !marco->sucio)
+		cache->numSucios++;
+	else if (!sucio && marco->sucio)
+		cache->numSucios--;
+	marco->sucio = sucio;
+	marco->usado = true;
+	marco->anticipado = false;
+	return 0;
+}
+
+void olvidaBloques(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio,
+		int numBloques) {
+	CacheBloques* cache = &miSistemaDeFicheros->cache;
+	DISK_LBA idxBloque;
+	int m;
+
+	// Para rachas largas es más rápido mirar todos los marcos
+	if (numBloques > cache->numMarcos) {
+		for (m = 0; m < cache->numMarcos; m++) {
+			idxBloque = cache->marcos[m].idxBloque;
+			if (idxBloque != -1 && idxBloque >= inicio && idxBloque - inicio
+					< numBloques)
+				vaciaMarco(cache, m);
+		}
+		return;
+	}
+	for (idxBloque = inicio; idxBloque < inicio + numBloques; idxBloque++) {
+		if ((m = buscaMarco(cache, idxBloque)) != -1)
+			vaciaMarco(cache, m);
+	}
+}
+
+// Marco sucio con su bloque, para ordenarlos sin mirar la caché
+typedef struct MarcoSucio {
+	DISK_LBA idxBloque;
+	int marco;
+} MarcoSucio;
+
+static int comparaMarcos(const void* a, const void* b) {
+	DISK_LBA idxA = ((const MarcoSucio*) a)->idxBloque;
+	DISK_LBA idxB = ((const MarcoSucio*) b)->idxBloque;
+	return (idxA > idxB) - (idxA < idxB);
+}
+
+int vaciaCache(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	CacheBloques* cache = &miSistemaDeFicheros->cache;
+	struct iovec iov[MAX_BLOQUES_POR_ES];
+	MarcoSucio* sucios;
+	int numSucios = 0;
+	int i, j, n;
+
+	if (cache->numSucios == 0)
+		return 0;
+	if ((sucios = malloc(cache->numSucios * sizeof(MarcoSucio))) == NULL) {
+		perror("Falló malloc en vaciaCache");
+		return -1;
+	}
+	for (i = 0; i < cache->numMarcos; i++) {
+		if (cache->marcos[i].sucio) {
+			sucios[numSucios].idxBloque = cache->marcos[i].idxBloque;
+			sucios[numSucios++].marco = i;
+		}
+	}
+	qsort(sucios, numSucios, sizeof(MarcoSucio), comparaMarcos);
+
+	// Cada racha de bloques consecutivos se escribe con una llamada
+	for (i = 0; i < numSucios; i += n) {
+		for (n = 0; i + n < numSucios && n < MAX_BLOQUES_POR_ES; n++) {
+			if (n > 0 && sucios[i + n].idxBloque != sucios[i].idxBloque + n)
+				break;
+			iov[n].iov_base = DATOS_MARCO(cache, sucios[i + n].marco);
+			iov[n].iov_len = TAM_BLOQUE_BYTES;
+		}
+		if (escribeDiscoVector(miSistemaDeFicheros, iov, n, (off_t)
+				sucios[i].idxBloque * TAM_BLOQUE_BYTES) == -1) {
+			free(sucios);
+			return -1;
+		}
+		for (j = 0; j < n; j++)
+			cache->marcos[sucios[i + j].marco].sucio = false;
+		cache->numSucios -= n;
+		cache->escrituras += n;
+	}
+	free(sucios);
+	return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef CACHE_H
+#define	CACHE_H
+
+#include "common.h"
+
+// Caché de bloques de metadatos.
+//
+// Guarda los bloques que se leen con leeBloqueMetadatos (nodos del árbol de
+// extensiones y bloques de los directorios) en un número fijo de marcos,
+// localizados por su bloque en disco con una tabla hash. Cuando no queda
+// ninguno libre se reutiliza el que elija el reloj (CLOCK): la manecilla
+// recorre los marcos quitando el bit de uso y se queda con el primero que
+// no se ha usado desde la vuelta anterior y no está fijado.
+//
+// Las copias de una transacción, una vez confirmada en el diario, pasan a la
+// caché como bloques sucios en lugar de escribirse en su sitio. Se escriben
+// al reutilizar su marco o en el checkpoint (vaciaCache), así que un bloque
+// que se modifica en muchas transacciones seguidas solo se escribe una vez.
+// Mientras tanto el diario los tiene, y no hace falta sincronizarlos.
+//
+// Cuando los fallos piden bloques consecutivos, cada uno lee también los
+// siguientes con la misma llamada, doblando la ventana en cada fallo
+// secuencial hasta MAX_LECTURA_ANTICIPADA. Lo leído por adelantado entra sin
+// el bit de uso: si no se pide, es lo primero que se reutiliza.
+//
+// Los datos de los archivos no pasan por aquí: se leen y escriben por
+// extensiones enteras, y solo echarían de la caché a los metadatos.
+//
+// Con la imagen proyectada (ACCESO_MMAP) no se usan los marcos: fijaBloque
+// devuelve el bloque en la proyección y guardaBloqueCache lo copia allí.
+
+// Crea la caché con numMarcos marcos vacíos
+int initCache(MiSistemaDeFicheros* miSistemaDeFicheros, int numMarcos);
+// Libera los marcos sin escribir los sucios (ver vaciaCache)
+void liberaCache(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+// Devuelve el bloque idxBloque, leyéndolo si no está, fijado en su marco
+// hasta que se llame a sueltaBloque. NULL si no se puede leer.
+char* fijaBloque(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA idxBloque);
+// Suelta un bloque fijado. Cualquier otro puntero se ignora.
+void sueltaBloque(MiSistemaDeFicheros* miSistemaDeFicheros, const void* bloque);
+// Copia el bloque idxBloque en buffer, pasando por la caché
+int leeBloqueCache(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA idxBloque, void* buffer);
+// Lee numBloques bloques seguidos con una sola llamada, sin ocupar marcos,
+// pero con el contenido de los que estén en la caché
+int leeBloquesCache(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio, int numBloques, void* buffer);
+
+// Pone buffer como contenido del bloque idxBloque. Si sucio, queda
+// pendiente de escribir; si no, es que ya está así en disco.
+int guardaBloqueCache(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA idxBloque, const void* buffer, BOOLEAN sucio);
+// Saca de la caché los bloques de la racha, sin escribirlos (al liberarlos
+// o al escribir en ellos por otro camino)
+void olvidaBloques(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio, int numBloques);
+// Escribe todos los bloques sucios, ordenados y juntando los consecutivos
+int vaciaCache(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+#endif	/* CACHE_H */
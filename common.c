@@ -1,42 +1,103 @@
 #include "common.h"
+#include "metadatos.h"
+#include "cache.h"
+#include "uring.h"
+#include "stats.h"
+#include "huellas.h"
+#include "compresion.h"
+#include "sumas.h"
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 int escribeMapaDeBits(MiSistemaDeFicheros* miSistemaDeFicheros) {
-	if (lseek(miSistemaDeFicheros->discoVirtual, TAM_BLOQUE_BYTES
-			* MAPA_BITS_IDX, SEEK_SET) == (off_t) -1) {
-		perror("Falló lseek en escribeMapaDeBits");
-		return -1;
-	}
-	if (write(miSistemaDeFicheros->discoVirtual,
-			miSistemaDeFicheros->mapaDeBits, sizeof(BIT) * NUM_BITS) == -1) {
-		perror("Falló write en escribeMapaDeBits");
-		return -1;
-	}
-	return 0;
+	return marcaSucio(miSistemaDeFicheros, (off_t) MAPA_BITS_IDX
+			* TAM_BLOQUE_BYTES, miSistemaDeFicheros->mapaDeBits,
+			miSistemaDeFicheros->numPalabrasMapa * sizeof(BIT));
+}
+
+// Anota las palabras del mapa de bits que contienen los bits
+// [inicio, inicio+numBloques)
+static void marcaSucioMapa(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA inicio, int numBloques) {
+	size_t primera = inicio / BITS_POR_PALABRA;
+	size_t ultima = (inicio + numBloques - 1) / BITS_POR_PALABRA;
+
+	marcaSucioCampo(miSistemaDeFicheros, MAPA_BITS_IDX,
+			miSistemaDeFicheros->mapaDeBits,
+			&miSistemaDeFicheros->mapaDeBits[primera], (ultima - primera + 1)
+					* sizeof(BIT));
+}
+
+int leeBitMapa(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA numBloque) {
+	assert(numBloque >= 0 && numBloque < miSistemaDeFicheros->numPalabrasMapa
+			* BITS_POR_PALABRA);
+	return (miSistemaDeFicheros->mapaDeBits[numBloque / BITS_POR_PALABRA]
+			>> (numBloque % BITS_POR_PALABRA)) & 1;
+}
+
+void marcaBitMapa(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA numBloque) {
+	assert(numBloque >= 0 && numBloque < miSistemaDeFicheros->numPalabrasMapa
+			* BITS_POR_PALABRA);
+	miSistemaDeFicheros->mapaDeBits[numBloque / BITS_POR_PALABRA]
+			|= (BIT) 1 << (numBloque % BITS_POR_PALABRA);
+	marcaSucioMapa(miSistemaDeFicheros, numBloque, 1);
+}
+
+void liberaBitMapa(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA numBloque) {
+	assert(numBloque >= 0 && numBloque < miSistemaDeFicheros->numPalabrasMapa
+			* BITS_POR_PALABRA);
+	miSistemaDeFicheros->mapaDeBits[numBloque / BITS_POR_PALABRA]
+			&= ~((BIT) 1 << (numBloque % BITS_POR_PALABRA));
+	marcaSucioMapa(miSistemaDeFicheros, numBloque, 1);
 }
 
 int escribeNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, int numNodoI,
 		EstructuraNodoI* nodoI) {
-	int posNodoI;
-	assert(numNodoI < MAX_NODOSI);
-	posNodoI = calculaPosNodoI(numNodoI);
+	EstructuraNodoI* ranura;
+	assert(numNodoI >= 0 && numNodoI < miSistemaDeFicheros->superBloque.numNodosI);
 
-	if (lseek(miSistemaDeFicheros->discoVirtual, posNodoI, SEEK_SET)
-			== (off_t) -1) {
-		perror("Falló lseek en escribeNodoI");
-		return -1;
-	}
-	if (write(miSistemaDeFicheros->discoVirtual, nodoI, sizeof(EstructuraNodoI))
-			== -1) {
-		perror("Falló write en escribeNodoI");
+	// La tabla en memoria es la copia de referencia del disco
+	ranura = ranuraNodoI(miSistemaDeFicheros, numNodoI);
+	if (nodoI != ranura)
+		copiaNodoI(ranura, nodoI);
+
+	return marcaSucio(miSistemaDeFicheros, calculaPosNodoI(miSistemaDeFicheros,
+			numNodoI), ranura, sizeof(EstructuraNodoI));
+}
+
+int escribeMapaNodosI(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	return marcaSucio(miSistemaDeFicheros, (off_t) TAM_BLOQUE_BYTES
+			* miSistemaDeFicheros->superBloque.idxMapaNodosI,
+			miSistemaDeFicheros->mapaNodosI,
+			miSistemaDeFicheros->numPalabrasMapaNodosI * sizeof(BIT));
+}
+
+// Marca en uso (o libre) el bit del nodo-i y actualiza el contador de
+// nodos-i libres
+static void cambiaBitNodoI(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int numNodoI, BOOLEAN ocupado) {
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	BIT* palabra = &miSistemaDeFicheros->mapaNodosI[numNodoI / BITS_POR_PALABRA];
+	BIT mascara = (BIT) 1 << (numNodoI % BITS_POR_PALABRA);
+
+	assert(numNodoI >= 0 && numNodoI < sb->numNodosI);
+	assert(((*palabra & mascara) != 0) != ocupado);
+	if (ocupado) {
+		*palabra |= mascara;
+		sb->numNodosLibres--;
+	} else {
+		*palabra &= ~mascara;
+		sb->numNodosLibres++;
 	}
-	sync();
-	return 1;
+	marcaSucioCampo(miSistemaDeFicheros, SUPERBLOQUE_IDX, sb,
+			&sb->numNodosLibres, sizeof(int));
+	marcaSucioCampo(miSistemaDeFicheros, sb->idxMapaNodosI,
+			miSistemaDeFicheros->mapaNodosI, palabra, sizeof(BIT));
 }
 
 /* Inicializa el superbloque */
-void initSuperBloque(MiSistemaDeFicheros* miSistemaDeFicheros, int tamDisco) {
+void initSuperBloque(MiSistemaDeFicheros* miSistemaDeFicheros, off_t tamDisco) {
 	miSistemaDeFicheros->superBloque.tamDiscoEnBloques = tamDisco
 			/ TAM_BLOQUE_BYTES;
 	miSistemaDeFicheros->superBloque.numBloquesLibres = myQuota(
@@ -56,136 +117,711 @@ void initSuperBloque(MiSistemaDeFicheros* miSistemaDeFicheros, int tamDisco) {
 }
 
 int escribeSuperBloque(MiSistemaDeFicheros* miSistemaDeFicheros) {
-	if (lseek(miSistemaDeFicheros->discoVirtual, TAM_BLOQUE_BYTES
-			* SUPERBLOQUE_IDX, SEEK_SET) == (off_t) -1) {
-		perror("Falló lseek en escribeSuperBloque");
-		return -1;
+	return marcaSucio(miSistemaDeFicheros, (off_t) TAM_BLOQUE_BYTES
+			* SUPERBLOQUE_IDX, &miSistemaDeFicheros->superBloque,
+			sizeof(EstructuraSuperBloque));
+}
+
+ssize_t leeCompleto(int fd, void* buffer, size_t tam) {
+	size_t total = 0;
+	ssize_t leidos;
+
+	while (total < tam) {
+		leidos = read(fd, (char*) buffer + total, tam - total);
+		if (leidos == -1)
+			return -1;
+		if (leidos == 0)
+			break;
+		total += leidos;
 	}
-	if (write(miSistemaDeFicheros->discoVirtual,
-			&(miSistemaDeFicheros->superBloque), sizeof(EstructuraSuperBloque))
-			== -1) {
-		perror("Falló write en escribeSuperBloque");
-		return -1;
+	return total;
+}
+
+// Escribe tam bytes en el descriptor, reintentando las escrituras parciales
+static int escribeCompleto(int fd, const void* buffer, size_t tam) {
+	size_t total = 0;
+	ssize_t escritos;
+
+	while (total < tam) {
+		escritos = write(fd, (const char*) buffer + total, tam - total);
+		if (escritos == -1)
+			return -1;
+		total += escritos;
 	}
 	return 0;
 }
 
-int escribeDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros) {
-	if (lseek(miSistemaDeFicheros->discoVirtual, TAM_BLOQUE_BYTES
-			* DIRECTORIO_IDX, SEEK_SET) == (off_t) -1) {
-		perror("Falló lseek en escribeDirectorio");
+int proyectaImagen(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	size_t tam = (size_t) miSistemaDeFicheros->superBloque.tamDiscoEnBloques
+			* TAM_BLOQUE_BYTES;
+	int err;
+
+	// La imagen es dispersa: si al escribir en un hueco a través de la
+	// proyección no quedara espacio, llegaría un SIGBUS en lugar de un error.
+	// Reservándolo ahora, el fallo se ve aquí.
+	if ((err = posix_fallocate(miSistemaDeFicheros->discoVirtual, 0, tam)) != 0) {
+		fprintf(stderr, "Falló posix_fallocate en proyectaImagen: %s\n",
+				strerror(err));
 		return -1;
 	}
-	if (write(miSistemaDeFicheros->discoVirtual,
-			&(miSistemaDeFicheros->directorio), sizeof(EstructuraDirectorio))
-			== -1) {
-		perror("Falló write en escribeDirectorio");
+	miSistemaDeFicheros->imagen = mmap(NULL, tam, PROT_READ | PROT_WRITE,
+			MAP_SHARED, miSistemaDeFicheros->discoVirtual, 0);
+	if (miSistemaDeFicheros->imagen == MAP_FAILED) {
+		perror("Falló mmap en proyectaImagen");
+		miSistemaDeFicheros->imagen = NULL;
 		return -1;
 	}
+	miSistemaDeFicheros->tamImagen = tam;
 	return 0;
 }
 
-int escribeDatos(MiSistemaDeFicheros* miSistemaDeFicheros, int archivoExterno,
-		int numNodoI) {
-	int i;
-	char buffer[TAM_BLOQUE_BYTES];
-	EstructuraNodoI* temp = miSistemaDeFicheros->nodosI[numNodoI];
-	int bytesRestantes = miSistemaDeFicheros->superBloque.tamBloque
-			- (temp->numBloques * miSistemaDeFicheros->superBloque.tamBloque
-					- temp->tamArchivo);
-	for (i = 0; i < temp->numBloques - 1; i++) {
-		if (read(archivoExterno, &buffer, TAM_BLOQUE_BYTES) == -1) {
-			perror("Falló read en escribeDatos");
+void cierraImagen(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	if (miSistemaDeFicheros->imagen != NULL)
+		munmap(miSistemaDeFicheros->imagen, miSistemaDeFicheros->tamImagen);
+	miSistemaDeFicheros->imagen = NULL;
+	miSistemaDeFicheros->tamImagen = 0;
+	close(miSistemaDeFicheros->discoVirtual);
+}
+
+int leeDisco(MiSistemaDeFicheros* miSistemaDeFicheros, off_t pos,
+		void* buffer, size_t tam) {
+	size_t total = 0;
+	ssize_t leidos;
+	uint64_t t0;
+
+	if (miSistemaDeFicheros->imagen != NULL) {
+		if ((size_t) pos < miSistemaDeFicheros->tamImagen)
+			total = miSistemaDeFicheros->tamImagen - pos < tam
+					? miSistemaDeFicheros->tamImagen - pos : tam;
+		memcpy(buffer, miSistemaDeFicheros->imagen + pos, total);
+		memset((char*) buffer + total, 0, tam - total);
+		return 0;
+	}
+	while (total < tam) {
+		t0 = empiezaMedida(miSistemaDeFicheros);
+		leidos = pread(miSistemaDeFicheros->discoVirtual, (char*) buffer + total,
+				tam - total, pos + total);
+		terminaMedida(miSistemaDeFicheros, EST_PREAD, t0, leidos > 0 ? leidos : 0);
+		if (leidos == -1) {
+			perror("Falló pread en leeDisco");
 			return -1;
 		}
-		if (lseek(miSistemaDeFicheros->discoVirtual, temp->idxBloques[i]
-				* TAM_BLOQUE_BYTES, SEEK_SET) == (off_t) -1) {
-			perror("Falló lseek en escribeDatos");
+		if (leidos == 0) {
+			// Más allá del final del archivo imagen el disco está a cero
+			memset((char*) buffer + total, 0, tam - total);
+			break;
+		}
+		total += leidos;
+	}
+	return 0;
+}
+
+int escribeDisco(MiSistemaDeFicheros* miSistemaDeFicheros, off_t pos,
+		const void* buffer, size_t tam) {
+	size_t total = 0;
+	ssize_t escritos;
+	uint64_t t0;
+
+	if (miSistemaDeFicheros->imagen != NULL) {
+		if ((size_t) pos + tam > miSistemaDeFicheros->tamImagen) {
+			fprintf(stderr, "Escritura fuera de la imagen proyectada\n");
 			return -1;
 		}
-		if (write(miSistemaDeFicheros->discoVirtual, &buffer, TAM_BLOQUE_BYTES)
-				== -1) {
-			perror("Falló write en escribeDatos");
+		memcpy(miSistemaDeFicheros->imagen + pos, buffer, tam);
+		return 0;
+	}
+	while (total < tam) {
+		t0 = empiezaMedida(miSistemaDeFicheros);
+		escritos = pwrite(miSistemaDeFicheros->discoVirtual,
+				(const char*) buffer + total, tam - total, pos + total);
+		terminaMedida(miSistemaDeFicheros, EST_PWRITE, t0,
+				escritos > 0 ? escritos : 0);
+		if (escritos == -1) {
+			perror("Falló pwrite en escribeDisco");
 			return -1;
 		}
+		total += escritos;
 	}
-	if (read(archivoExterno, &buffer, bytesRestantes) == -1) {
-		perror("Falló read (2) en escribeDatos");
-		return -1;
+	return 0;
+}
+
+int leeDiscoVector(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const struct iovec* vector, int n, off_t pos) {
+	ssize_t leidos = 0;
+	uint64_t t0;
+	int i;
+
+	if (miSistemaDeFicheros->imagen == NULL) {
+		t0 = empiezaMedida(miSistemaDeFicheros);
+		leidos = preadv(miSistemaDeFicheros->discoVirtual, vector, n, pos);
+		terminaMedida(miSistemaDeFicheros, EST_PREADV, t0,
+				leidos > 0 ? leidos : 0);
+		if (leidos == -1) {
+			perror("Falló preadv en leeDiscoVector");
+			return -1;
+		}
+	}
+	// Lo que no haya leído preadv (una lectura corta o el final de la
+	// imagen), o todo si está proyectada, se completa trozo a trozo
+	for (i = 0; i < n; pos += vector[i].iov_len, i++) {
+		if ((size_t) leidos >= vector[i].iov_len) {
+			leidos -= vector[i].iov_len;
+			continue;
+		}
+		if (leeDisco(miSistemaDeFicheros, pos + leidos,
+				(char*) vector[i].iov_base + leidos, vector[i].iov_len - leidos)
+				== -1)
+			return -1;
+		leidos = 0;
 	}
-	if (lseek(miSistemaDeFicheros->discoVirtual, temp->idxBloques[i]
-			* TAM_BLOQUE_BYTES, SEEK_SET) == (off_t) -1) {
-		perror("Falló lseek (2) en escribeDatos");
+	return 0;
+}
+
+int escribeDiscoVector(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const struct iovec* vector, int n, off_t pos) {
+	ssize_t escritos = 0;
+	uint64_t t0;
+	int i;
+
+	if (miSistemaDeFicheros->imagen == NULL) {
+		t0 = empiezaMedida(miSistemaDeFicheros);
+		escritos = pwritev(miSistemaDeFicheros->discoVirtual, vector, n, pos);
+		terminaMedida(miSistemaDeFicheros, EST_PWRITEV, t0,
+				escritos > 0 ? escritos : 0);
+		if (escritos == -1) {
+			perror("Falló pwritev en escribeDiscoVector");
+			return -1;
+		}
+	}
+	for (i = 0; i < n; pos += vector[i].iov_len, i++) {
+		if ((size_t) escritos >= vector[i].iov_len) {
+			escritos -= vector[i].iov_len;
+			continue;
+		}
+		if (escribeDisco(miSistemaDeFicheros, pos + escritos,
+				(const char*) vector[i].iov_base + escritos, vector[i].iov_len
+						- escritos) == -1)
+			return -1;
+		escritos = 0;
+	}
+	return 0;
+}
+
+int sincronizaDisco(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	uint64_t t0 = empiezaMedida(miSistemaDeFicheros);
+	int ret;
+
+	if (miSistemaDeFicheros->imagen != NULL) {
+		ret = msync(miSistemaDeFicheros->imagen, miSistemaDeFicheros->tamImagen,
+				MS_SYNC);
+		terminaMedida(miSistemaDeFicheros, EST_MSYNC, t0, 0);
+	} else {
+		ret = fdatasync(miSistemaDeFicheros->discoVirtual);
+		terminaMedida(miSistemaDeFicheros, EST_FDATASYNC, t0, 0);
+	}
+	return ret;
+}
+
+int leeBloques(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio,
+		int numBloques, void* buffer) {
+	return leeDisco(miSistemaDeFicheros, (off_t) inicio * TAM_BLOQUE_BYTES,
+			buffer, (size_t) numBloques * TAM_BLOQUE_BYTES);
+}
+
+int escribeBloques(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio,
+		int numBloques, const void* buffer) {
+	return escribeDisco(miSistemaDeFicheros, (off_t) inicio * TAM_BLOQUE_BYTES,
+			buffer, (size_t) numBloques * TAM_BLOQUE_BYTES);
+}
+
+int escribeDatos(MiSistemaDeFicheros* miSistemaDeFicheros, int archivoExterno,
+		int numNodoI) {
+	int bloque, n;
+	ssize_t leidos;
+	DISK_LBA idxBloque;
+	char* destino;
+	EstructuraNodoI* temp = obtenNodoI(miSistemaDeFicheros, numNodoI);
+	char* buffer;
+	CursorExtensiones* cursor;
+
+	// Un archivo de un solo trozo no tiene nada que solapar
+	if (miSistemaDeFicheros->anillo != NULL
+			&& temp->numBloques > BLOQUES_POR_PETICION)
+		return escribeDatosAnillo(miSistemaDeFicheros, archivoExterno, temp);
+	buffer = malloc(MAX_BLOQUES_POR_ES * TAM_BLOQUE_BYTES);
+	cursor = malloc(sizeof(CursorExtensiones));
+	if (buffer == NULL || cursor == NULL) {
+		perror("Falló malloc en escribeDatos");
+		free(buffer);
+		free(cursor);
 		return -1;
 	}
-	if (write(miSistemaDeFicheros->discoVirtual, &buffer, bytesRestantes) == -1) {
-		perror("Falló write (2) en escribeDatos");
+	initCursorExtensiones(cursor);
+	// El archivo externo se lee de principio a fin: que el núcleo lea por
+	// delante con la ventana más grande
+	posix_fadvise(archivoExterno, 0, 0, POSIX_FADV_SEQUENTIAL);
+	// Cada extensión se copia con una sola escritura (o una por cada
+	// MAX_BLOQUES_POR_ES bloques si es más grande que el buffer)
+	for (bloque = 0; bloque < temp->numBloques; bloque += n) {
+		idxBloque = buscaBloqueNodoI(miSistemaDeFicheros, temp, bloque, &n,
+				cursor);
+		if (idxBloque == -1)
+			goto error;
+		if (n > MAX_BLOQUES_POR_ES)
+			n = MAX_BLOQUES_POR_ES;
+		// Con la imagen proyectada se lee directamente en su sitio
+		destino = miSistemaDeFicheros->imagen != NULL
+				? miSistemaDeFicheros->imagen + (size_t) idxBloque
+						* TAM_BLOQUE_BYTES : buffer;
+		leidos = leeCompleto(archivoExterno, destino, n * TAM_BLOQUE_BYTES);
+		if (leidos == -1) {
+			perror("Falló read en escribeDatos");
+			goto error;
+		}
+		// El último bloque se rellena con ceros
+		memset(destino + leidos, 0, n * TAM_BLOQUE_BYTES - leidos);
+		// Los bloques pueden haber sido metadatos, o haberse leído por
+		// adelantado, y la caché no debe conservar su contenido anterior
+		olvidaBloques(miSistemaDeFicheros, idxBloque, n);
+		if (destino == buffer && escribeBloques(miSistemaDeFicheros, idxBloque,
+				n, buffer) == -1)
+			goto error;
+		if (anotaSumas(miSistemaDeFicheros, idxBloque, n, destino) == -1)
+			goto error;
+	}
+	free(buffer);
+	free(cursor);
+	return 0;
+
+	error: free(buffer);
+	free(cursor);
+	return -1;
+}
+
+// Reserva numBloques bloques al final del nodo-i y escribe en ellos el
+// buffer. Con huellas, mete cada bloque escrito en el índice de huellas.
+// Devuelve 0, -1 si falla la escritura o -2 si no queda sitio.
+static int escribeTrozo(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraNodoI* nodoI, const char* buffer, int numBloques,
+		uint64_t (*huellas)[2]) {
+	CursorExtensiones cursor;
+	DISK_LBA idxBloque;
+	int primero = nodoI->numBloques, hechos, n, i;
+
+	if (reservaBloquesNodosI(miSistemaDeFicheros, nodoI, numBloques) == -1)
+		return -2;
+	// Lo reservado puede haber quedado en varias extensiones
+	initCursorExtensiones(&cursor);
+	for (hechos = 0; hechos < numBloques; hechos += n) {
+		idxBloque = buscaBloqueNodoI(miSistemaDeFicheros, nodoI,
+				primero + hechos, &n, &cursor);
+		if (idxBloque == -1)
+			return -1;
+		if (n > numBloques - hechos)
+			n = numBloques - hechos;
+		olvidaBloques(miSistemaDeFicheros, idxBloque, n);
+		if (escribeBloques(miSistemaDeFicheros, idxBloque, n, buffer
+				+ (size_t) hechos * TAM_BLOQUE_BYTES) == -1
+				|| anotaSumas(miSistemaDeFicheros, idxBloque, n, buffer
+						+ (size_t) hechos * TAM_BLOQUE_BYTES) == -1)
+			return -1;
+		for (i = 0; huellas != NULL && i < n; i++)
+			anotaHuella(miSistemaDeFicheros, huellas[hechos + i], idxBloque + i);
+	}
+	return 0;
+}
+
+// Cierto si el bloque idxBloque contiene lo mismo que bloque. Que las
+// huellas coincidan no basta: dos bloques distintos podrían tener la misma.
+static BOOLEAN mismoContenido(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA idxBloque, const char* bloque) {
+	char leido[TAM_BLOQUE_BYTES];
+
+	return leeBloques(miSistemaDeFicheros, idxBloque, 1, leido) == 0
+			&& memcmp(leido, bloque, TAM_BLOQUE_BYTES) == 0;
+}
+
+// Como escribeTrozo, pero los bloques que ya están en el índice de huellas,
+// con el mismo contenido, no se escriben: el nodo-i apunta al que ya había.
+// Los demás se escriben en rachas, que se cortan también en un bloque igual
+// al anterior (así una racha de ceros ocupa un solo bloque).
+static int escribeTrozoDeduplicado(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraNodoI* nodoI, const char* buffer, int numBloques,
+		uint64_t (*huellas)[2]) {
+	DISK_LBA idxBloque;
+	int i, fin, ret;
+
+	for (i = 0; i < numBloques; i++)
+		calculaHuella(buffer + (size_t) i * TAM_BLOQUE_BYTES, huellas[i]);
+	for (i = 0; i < numBloques; i = fin) {
+		idxBloque = -1;
+		for (fin = i; fin < numBloques; fin++) {
+			if (fin > i && memcmp(huellas[fin], huellas[fin - 1],
+					sizeof(huellas[fin])) == 0)
+				break;
+			if ((idxBloque = buscaHuella(miSistemaDeFicheros, huellas[fin]))
+					!= -1 && mismoContenido(miSistemaDeFicheros, idxBloque,
+					buffer + (size_t) fin * TAM_BLOQUE_BYTES))
+				break;
+			idxBloque = -1;
+		}
+		if (fin > i && (ret = escribeTrozo(miSistemaDeFicheros, nodoI, buffer
+				+ (size_t) i * TAM_BLOQUE_BYTES, fin - i, huellas + i)) != 0)
+			return ret;
+		if (idxBloque != -1) {
+			if (anadeExtensionNodoI(miSistemaDeFicheros, nodoI, idxBloque, 1)
+					== -1)
+				return -2;
+			sumaReferencia(miSistemaDeFicheros, idxBloque);
+			fin++;
+		}
 	}
 	return 0;
 }
 
+// Escribe numBloques bloques del buffer al final del nodo-i, compartiendo
+// los que ya estén en el índice si hay huellas. Devuelve 0, -1 si falla la
+// escritura o -2 si no queda sitio.
+static int guardaBloques(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraNodoI* nodoI, const char* buffer, int numBloques,
+		uint64_t (*huellas)[2]) {
+	if (numBloques == 0)
+		return 0;
+	if (numBloques > MAX_BLOQUES_POR_ARCHIVO - nodoI->numBloques)
+		return -2;
+	if (huellas != NULL)
+		return escribeTrozoDeduplicado(miSistemaDeFicheros, nodoI, buffer,
+				numBloques, huellas);
+	return escribeTrozo(miSistemaDeFicheros, nodoI, buffer, numBloques, NULL);
+}
+
+int escribeFlujo(MiSistemaDeFicheros* miSistemaDeFicheros, int archivoExterno,
+		int numNodoI) {
+	EstructuraNodoI* nodoI = obtenNodoI(miSistemaDeFicheros, numNodoI);
+	size_t tamTrozo = BLOQUES_POR_TROZO_FLUJO * TAM_BLOQUE_BYTES;
+	// Comprimiendo, lo que se escribe son las tramas de cada trozo detrás
+	// de lo que no llenó un bloque en el anterior
+	size_t tamSalida = comprime(miSistemaDeFicheros) ? TAM_BLOQUE_BYTES
+			+ MAX_TAM_TRAMAS(tamTrozo) : tamTrozo;
+	int maxBloques = (tamSalida + TAM_BLOQUE_BYTES - 1) / TAM_BLOQUE_BYTES;
+	char* buffer = malloc(tamTrozo);
+	char* salida = buffer;
+	uint64_t (*huellas)[2] = NULL;
+	size_t pendientes = 0, tamTramas = 0, tam;
+	ssize_t leidos;
+	int numBloques, ret = 0;
+
+	if (comprime(miSistemaDeFicheros))
+		salida = malloc((size_t) maxBloques * TAM_BLOQUE_BYTES);
+	if (deduplica(miSistemaDeFicheros))
+		huellas = malloc(maxBloques * sizeof(*huellas));
+	if (buffer == NULL || salida == NULL || (deduplica(miSistemaDeFicheros)
+			&& huellas == NULL)) {
+		perror("Falló malloc en escribeFlujo");
+		if (salida != buffer)
+			free(salida);
+		free(buffer);
+		free(huellas);
+		return -1;
+	}
+	do {
+		// leeCompleto solo se queda corto al final del flujo, así que cada
+		// trozo empieza en un bloque nuevo (o, comprimiendo, en una trama
+		// nueva)
+		leidos = leeCompleto(archivoExterno, buffer, tamTrozo);
+		if (leidos == -1) {
+			perror("Falló read en escribeFlujo");
+			ret = -1;
+			break;
+		}
+		if (leidos == 0)
+			break;
+		// Si todo el flujo cabe en el nodo-i, no se reserva nada
+		if (nodoI->tamArchivo == 0 && leidos <= MAX_TAM_EN_LINEA) {
+			memcpy(nodoI->enLinea, buffer, leidos);
+			nodoI->tamArchivo = leidos;
+			break;
+		}
+		if (salida != buffer) {
+			tamTramas = comprimeTramas(buffer, leidos, salida + pendientes);
+			tam = pendientes + tamTramas;
+			numBloques = tam / TAM_BLOQUE_BYTES;
+		} else {
+			numBloques = (leidos + TAM_BLOQUE_BYTES - 1) / TAM_BLOQUE_BYTES;
+			memset(buffer + leidos, 0, numBloques * TAM_BLOQUE_BYTES - leidos);
+			tam = (size_t) numBloques * TAM_BLOQUE_BYTES;
+		}
+		ret = guardaBloques(miSistemaDeFicheros, nodoI, salida, numBloques,
+				huellas);
+		if (ret == 0) {
+			nodoI->tamArchivo += leidos;
+			nodoI->tamComprimido += tamTramas;
+			// Lo que no llena un bloque espera al siguiente trozo
+			pendientes = tam - (size_t) numBloques * TAM_BLOQUE_BYTES;
+			memmove(salida, salida + (size_t) numBloques * TAM_BLOQUE_BYTES,
+					pendientes);
+		}
+	} while (ret == 0 && leidos == (ssize_t) tamTrozo);
+	// El final de las últimas tramas, con el resto del bloque a ceros
+	if (ret == 0 && pendientes > 0) {
+		memset(salida + pendientes, 0, TAM_BLOQUE_BYTES - pendientes);
+		ret = guardaBloques(miSistemaDeFicheros, nodoI, salida, 1, huellas);
+	}
+	escribeNodoI(miSistemaDeFicheros, numNodoI, nodoI);
+	if (salida != buffer)
+		free(salida);
+	free(buffer);
+	free(huellas);
+	return ret;
+}
+
+// Exporta un archivo comprimido: lee sus bloques de principio a fin y
+// descomprime las tramas según se completan, a un buffer que se escribe
+// cuando se llena
+static int exportaComprimido(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int handle, EstructuraNodoI* nodoI) {
+	// Además de lo leído, el final de una trama que no se completó
+	char* entrada = malloc(MAX_BLOQUES_POR_ES * TAM_BLOQUE_BYTES
+			+ sizeof(EstructuraTrama) + TAM_TRAMA);
+	char* salida = malloc(MAX_BLOQUES_POR_ES * TAM_BLOQUE_BYTES);
+	CursorExtensiones* cursor = malloc(sizeof(CursorExtensiones));
+	int64_t restantes = nodoI->tamComprimido;
+	size_t disponibles, guardados = 0, usados, tamSalida = 0;
+	EstructuraTrama trama;
+	DISK_LBA idxBloque;
+	int bloque, n, original, ret = -1;
+
+	if (entrada == NULL || salida == NULL || cursor == NULL) {
+		perror("Falló malloc en exportaComprimido");
+		goto fin;
+	}
+	initCursorExtensiones(cursor);
+	for (bloque = 0; bloque < nodoI->numBloques && restantes > 0; bloque
+			+= n) {
+		idxBloque = buscaBloqueNodoI(miSistemaDeFicheros, nodoI, bloque, &n,
+				cursor);
+		if (idxBloque == -1)
+			goto fin;
+		if (n > MAX_BLOQUES_POR_ES)
+			n = MAX_BLOQUES_POR_ES;
+		if (leeBloques(miSistemaDeFicheros, idxBloque, n, entrada + guardados)
+				== -1 || compruebaSumas(miSistemaDeFicheros, idxBloque, n,
+				entrada + guardados) == -1)
+			goto fin;
+		guardados += (size_t) n * TAM_BLOQUE_BYTES;
+		disponibles = (int64_t) guardados < restantes ? guardados : restantes;
+		for (usados = 0; disponibles - usados >= sizeof(trama); usados
+				+= sizeof(trama) + trama.tamGuardado) {
+			memcpy(&trama, entrada + usados, sizeof(trama));
+			if (trama.tamGuardado > TAM_TRAMA)
+				goto corrupto;
+			if (sizeof(trama) + trama.tamGuardado > disponibles - usados)
+				break;
+			if (tamSalida + TAM_TRAMA > MAX_BLOQUES_POR_ES * TAM_BLOQUE_BYTES) {
+				if (escribeCompleto(handle, salida, tamSalida) == -1)
+					goto errorEscritura;
+				tamSalida = 0;
+			}
+			original = descomprimeTrama(entrada + usados, disponibles - usados,
+					salida + tamSalida);
+			if (original == -1)
+				goto corrupto;
+			tamSalida += original;
+		}
+		restantes -= usados;
+		guardados -= usados;
+		memmove(entrada, entrada + usados, guardados);
+	}
+	if (restantes > 0)
+		goto corrupto;
+	if (escribeCompleto(handle, salida, tamSalida) == -1)
+		goto errorEscritura;
+	ret = 0;
+	goto fin;
+
+	errorEscritura: perror("Falló write en exportaComprimido");
+	goto fin;
+	corrupto: fprintf(stderr, "Los datos comprimidos del archivo no son válidos\n");
+	fin: free(entrada);
+	free(salida);
+	free(cursor);
+	return ret;
+}
+
 int exportaDatos(MiSistemaDeFicheros* miSistemaDeFicheros, int handle,
 		int idxNodoI) {
-	int i;
-	char buffer[TAM_BLOQUE_BYTES];
-	EstructuraNodoI* temp = miSistemaDeFicheros->nodosI[idxNodoI];
-	int bytesRestantes = miSistemaDeFicheros->superBloque.tamBloque
-			- (temp->numBloques * miSistemaDeFicheros->superBloque.tamBloque
-					- temp->tamArchivo);
-	for (i = 0; i < miSistemaDeFicheros->nodosI[idxNodoI]->numBloques - 1; ++i) {
-		if (write(handle, &buffer, TAM_BLOQUE_BYTES) == -1) {
+	int bloque, n, siguientes;
+	size_t tam;
+	DISK_LBA idxBloque, idxSiguiente;
+	char* datos;
+	EstructuraNodoI* temp = obtenNodoI(miSistemaDeFicheros, idxNodoI);
+	int64_t bytesRestantes = temp->tamArchivo;
+	char* buffer;
+	CursorExtensiones* cursor;
+
+	// Sin leer ningún bloque
+	if (estaEnLinea(temp)) {
+		if (escribeCompleto(handle, temp->enLinea, temp->tamArchivo) == -1) {
 			perror("Falló write en exportaDatos");
 			return -1;
 		}
-
+		return 0;
 	}
-
-	if (write(handle, &buffer, bytesRestantes) == -1) {
-		perror("Falló write (2) en exportaDatos");
+	if (temp->tamComprimido > 0)
+		return exportaComprimido(miSistemaDeFicheros, handle, temp);
+	// Un archivo de un solo trozo no tiene nada que solapar
+	if (miSistemaDeFicheros->anillo != NULL
+			&& temp->numBloques > BLOQUES_POR_PETICION)
+		return exportaDatosAnillo(miSistemaDeFicheros, handle, temp);
+	buffer = malloc(MAX_BLOQUES_POR_ES * TAM_BLOQUE_BYTES);
+	cursor = malloc(sizeof(CursorExtensiones));
+	if (buffer == NULL || cursor == NULL) {
+		perror("Falló malloc en exportaDatos");
+		free(buffer);
+		free(cursor);
 		return -1;
 	}
-
+	initCursorExtensiones(cursor);
+	for (bloque = 0; bloque < temp->numBloques && bytesRestantes > 0; bloque
+			+= n) {
+		idxBloque = buscaBloqueNodoI(miSistemaDeFicheros, temp, bloque, &n,
+				cursor);
+		if (idxBloque == -1)
+			goto error;
+		if (n > MAX_BLOQUES_POR_ES)
+			n = MAX_BLOQUES_POR_ES;
+		// Con la imagen proyectada se escribe directamente desde su sitio
+		if (miSistemaDeFicheros->imagen != NULL)
+			datos = miSistemaDeFicheros->imagen + (size_t) idxBloque
+					* TAM_BLOQUE_BYTES;
+		else if (leeBloques(miSistemaDeFicheros, idxBloque, n, buffer) == -1)
+			goto error;
+		else
+			datos = buffer;
+		if (compruebaSumas(miSistemaDeFicheros, idxBloque, n, datos) == -1)
+			goto error;
+		// Si lo siguiente no está a continuación en disco, el núcleo no lo
+		// va a leer por delante: se le pide ya, para que la lectura se
+		// solape con la escritura de lo que acabamos de leer
+		if (bloque + n < temp->numBloques && (size_t) (bloque + n)
+				* TAM_BLOQUE_BYTES < temp->tamArchivo) {
+			idxSiguiente = buscaBloqueNodoI(miSistemaDeFicheros, temp, bloque
+					+ n, &siguientes, cursor);
+			if (idxSiguiente != -1 && idxSiguiente != idxBloque + n) {
+				if (siguientes > MAX_BLOQUES_POR_ES)
+					siguientes = MAX_BLOQUES_POR_ES;
+				if (miSistemaDeFicheros->imagen != NULL)
+					madvise(miSistemaDeFicheros->imagen + (size_t) idxSiguiente
+							* TAM_BLOQUE_BYTES, (size_t) siguientes
+							* TAM_BLOQUE_BYTES, MADV_WILLNEED);
+				else
+					posix_fadvise(miSistemaDeFicheros->discoVirtual, (off_t)
+							idxSiguiente * TAM_BLOQUE_BYTES, (off_t) siguientes
+							* TAM_BLOQUE_BYTES, POSIX_FADV_WILLNEED);
+			}
+		}
+		tam = (size_t) n * TAM_BLOQUE_BYTES;
+		if (tam > bytesRestantes)
+			tam = bytesRestantes;
+		if (escribeCompleto(handle, datos, tam) == -1) {
+			perror("Falló write en exportaDatos");
+			goto error;
+		}
+		bytesRestantes -= tam;
+	}
+	free(buffer);
+	free(cursor);
 	return 0;
+
+	error: free(buffer);
+	free(cursor);
+	return -1;
 }
 
-int calculaPosNodoI(int numNodoI) {
+off_t calculaPosNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, int numNodoI) {
 	int whichInodeBlock;
 	int whichInodeInBlock;
-	int inodeLocation;
+	off_t inodeLocation;
 
 	whichInodeBlock = numNodoI / NODOSI_POR_BLOQUE;
 	whichInodeInBlock = numNodoI % NODOSI_POR_BLOQUE;
 
-	inodeLocation = (NODOI_IDX + whichInodeBlock) * TAM_BLOQUE_BYTES
+	inodeLocation = (off_t) (miSistemaDeFicheros->superBloque.idxNodosI
+			+ whichInodeBlock) * TAM_BLOQUE_BYTES
 			+ whichInodeInBlock * sizeof(EstructuraNodoI);
 	return inodeLocation;
 }
 
-void initNodosI(MiSistemaDeFicheros* miSistemaDeFicheros) {
-	int numNodoI;
-	EstructuraNodoI* temp = malloc(sizeof(EstructuraNodoI));
+int initNodosI(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	liberaNodosI(miSistemaDeFicheros);
+	miSistemaDeFicheros->bloquesNodosI = calloc(
+			miSistemaDeFicheros->superBloque.numBloquesNodosI, sizeof(char*));
+	if (miSistemaDeFicheros->bloquesNodosI == NULL) {
+		perror("Falló calloc en initNodosI");
+		return -1;
+	}
+	miSistemaDeFicheros->pistaNodoLibre = 0;
+	return 0;
+}
 
-	for (numNodoI = 0; numNodoI < MAX_NODOSI; numNodoI++) {
-		leeNodoI(miSistemaDeFicheros, numNodoI, temp);
-		if (temp->libre) {
-			miSistemaDeFicheros->nodosI[numNodoI] = NULL;
-		} else {
-			miSistemaDeFicheros->numNodosLibres--;
-			miSistemaDeFicheros->nodosI[numNodoI] = malloc(
-					sizeof(EstructuraNodoI));
-			copiaNodoI(miSistemaDeFicheros->nodosI[numNodoI], temp);
+void liberaNodosI(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	int i;
+
+	if (miSistemaDeFicheros->bloquesNodosI == NULL)
+		return;
+	for (i = 0; i < miSistemaDeFicheros->superBloque.numBloquesNodosI; i++)
+		free(miSistemaDeFicheros->bloquesNodosI[i]);
+	free(miSistemaDeFicheros->bloquesNodosI);
+	miSistemaDeFicheros->bloquesNodosI = NULL;
+}
+
+EstructuraNodoI* ranuraNodoI(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int numNodoI) {
+	int idxBloque = numNodoI / NODOSI_POR_BLOQUE;
+	char* bloque;
+
+	assert(numNodoI >= 0 && numNodoI < miSistemaDeFicheros->superBloque.numNodosI);
+	bloque = miSistemaDeFicheros->bloquesNodosI[idxBloque];
+	if (bloque == NULL) {
+		// Lo que está en disco es lo último confirmado: los cambios en el
+		// bloque solo se anotan después de haberlo leído
+		bloque = malloc(TAM_BLOQUE_BYTES);
+		if (bloque == NULL) {
+			perror("Falló malloc en ranuraNodoI");
+			return NULL;
 		}
+		if (leeBloques(miSistemaDeFicheros,
+				miSistemaDeFicheros->superBloque.idxNodosI + idxBloque, 1,
+				bloque) == -1 || compruebaSumas(miSistemaDeFicheros,
+				miSistemaDeFicheros->superBloque.idxNodosI + idxBloque, 1,
+				bloque) == -1) {
+			free(bloque);
+			return NULL;
+		}
+		miSistemaDeFicheros->bloquesNodosI[idxBloque] = bloque;
 	}
+	return (EstructuraNodoI*) (bloque + (numNodoI % NODOSI_POR_BLOQUE)
+			* sizeof(EstructuraNodoI));
+}
+
+EstructuraNodoI* obtenNodoI(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int numNodoI) {
+	if (numNodoI < 0 || numNodoI >= miSistemaDeFicheros->superBloque.numNodosI
+			|| !((miSistemaDeFicheros->mapaNodosI[numNodoI / BITS_POR_PALABRA]
+					>> (numNodoI % BITS_POR_PALABRA)) & 1))
+		return NULL;
+	return ranuraNodoI(miSistemaDeFicheros, numNodoI);
 }
 
 int leeNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, int numNodoI,
 		EstructuraNodoI* nodoI) {
-	int posNodoI;
-	assert(numNodoI < MAX_NODOSI);
-	posNodoI = calculaPosNodoI(numNodoI);
+	off_t posNodoI;
+	assert(numNodoI >= 0 && numNodoI < miSistemaDeFicheros->superBloque.numNodosI);
+	posNodoI = calculaPosNodoI(miSistemaDeFicheros, numNodoI);
 
-	lseek(miSistemaDeFicheros->discoVirtual, posNodoI, SEEK_SET);
-	read(miSistemaDeFicheros->discoVirtual, nodoI, sizeof(EstructuraNodoI));
+	if (leeDisco(miSistemaDeFicheros, posNodoI, nodoI, sizeof(EstructuraNodoI))
+			== -1)
+		return -1;
 	return 1;
 }
 
@@ -193,51 +829,509 @@ void copiaNodoI(EstructuraNodoI* dest, EstructuraNodoI* src) {
 	int i;
 
 	dest->numBloques = src->numBloques;
+	dest->tipo = src->tipo;
 	dest->tamArchivo = src->tamArchivo;
+	dest->tamComprimido = src->tamComprimido;
 	dest->tiempoModificado = src->tiempoModificado;
-	dest->libre = src->libre;
 
-	for (i = 0; i < MAX_BLOQUES_POR_ARCHIVO; i++)
-		dest->idxBloques[i] = src->idxBloques[i];
+	dest->cabecera = src->cabecera;
+	if (estaEnLinea(src))
+		memcpy(dest->enLinea, src->enLinea, src->tamArchivo);
+	for (i = 0; i < src->cabecera.numEntradas; i++)
+		dest->extensiones[i] = src->extensiones[i];
+}
+
+BOOLEAN estaEnLinea(const EstructuraNodoI* nodoI) {
+	return nodoI->tipo == TIPO_ARCHIVO && nodoI->numBloques == 0
+			&& nodoI->tamArchivo > 0;
+}
+
+void initNodoI(EstructuraNodoI* nodoI) {
+	memset(nodoI, 0, sizeof(EstructuraNodoI));
+	nodoI->tipo = TIPO_ARCHIVO;
+	nodoI->cabecera.numEntradas = 0;
+	nodoI->cabecera.maxEntradas = EXTENSIONES_EN_NODOI;
+	nodoI->cabecera.profundidad = 0;
+	nodoI->tiempoModificado = time(0);
 }
 
 int buscaNodoLibre(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	size_t numPalabras = miSistemaDeFicheros->numPalabrasMapaNodosI;
+	size_t palabra = miSistemaDeFicheros->pistaNodoLibre;
+	size_t i;
+	BIT bits;
+
+	// Con el contador no hace falta recorrer el mapa para saber que está
+	// lleno. Los bits que quedan fuera de la tabla están a 1 desde myMkfs.
+	if (miSistemaDeFicheros->superBloque.numNodosLibres == 0)
+		return -1;
+	for (i = 0; i < numPalabras; i++) {
+		bits = ~miSistemaDeFicheros->mapaNodosI[palabra];
+		if (bits != 0) {
+			miSistemaDeFicheros->pistaNodoLibre = palabra;
+			return palabra * BITS_POR_PALABRA + __builtin_ctzll(bits);
+		}
+		if (++palabra == numPalabras)
+			palabra = 0;
+	}
+	return -1;
+}
+
+EstructuraNodoI* ocupaNodoI(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int numNodoI) {
+	EstructuraNodoI* nodoI = ranuraNodoI(miSistemaDeFicheros, numNodoI);
+
+	if (nodoI == NULL)
+		return NULL;
+	initNodoI(nodoI);
+	cambiaBitNodoI(miSistemaDeFicheros, numNodoI, true);
+	// Todo el nodo-i cambia: la suma de su bloque se calcula con él
+	if (marcaSucio(miSistemaDeFicheros, calculaPosNodoI(miSistemaDeFicheros,
+			numNodoI), nodoI, sizeof(EstructuraNodoI)) == -1)
+		return NULL;
+	return nodoI;
+}
+
+void liberaNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, int numNodoI) {
+	cambiaBitNodoI(miSistemaDeFicheros, numNodoI, false);
+	// Se ha truncado en memoria: si no se escribe, la suma de su bloque (que
+	// se calcula con la tabla en memoria) no coincide con el disco
+	escribeNodoI(miSistemaDeFicheros, numNodoI, ranuraNodoI(miSistemaDeFicheros,
+			numNodoI));
+	// Así los huecos que quedan al borrar se reutilizan antes
+	if (numNodoI / BITS_POR_PALABRA < miSistemaDeFicheros->pistaNodoLibre)
+		miSistemaDeFicheros->pistaNodoLibre = numNodoI / BITS_POR_PALABRA;
+}
+
+void cambiaRachaMapa(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA inicio, int numBloques, BOOLEAN ocupado) {
+	miSistemaDeFicheros->superBloque.numBloquesLibres += ocupado ? -numBloques
+			: numBloques;
+	marcaSucioCampo(miSistemaDeFicheros, SUPERBLOQUE_IDX,
+			&miSistemaDeFicheros->superBloque,
+			&miSistemaDeFicheros->superBloque.numBloquesLibres, sizeof(int));
+	marcaSucioMapa(miSistemaDeFicheros, inicio, numBloques);
+	while (numBloques > 0) {
+		int bit = inicio % BITS_POR_PALABRA;
+		int n = BITS_POR_PALABRA - bit;
+		BIT mascara;
+
+		if (n > numBloques)
+			n = numBloques;
+		mascara = (n == BITS_POR_PALABRA) ? ~(BIT) 0 : (((BIT) 1 << n) - 1)
+				<< bit;
+		if (ocupado)
+			miSistemaDeFicheros->mapaDeBits[inicio / BITS_POR_PALABRA] |= mascara;
+		else
+			miSistemaDeFicheros->mapaDeBits[inicio / BITS_POR_PALABRA]
+					&= ~mascara;
+		inicio += n;
+		numBloques -= n;
+	}
+}
+
+DISK_LBA buscaRachaLibre(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA desde, int* longitud) {
+	size_t palabra = desde / BITS_POR_PALABRA;
+	size_t numPalabras = miSistemaDeFicheros->numPalabrasMapa;
+	BIT bits;
+	DISK_LBA inicio, fin;
+
+	if (palabra >= numPalabras)
+		return -1;
+	// Primer bit a 0 a partir de desde
+	bits = ~miSistemaDeFicheros->mapaDeBits[palabra] & (~(BIT) 0 << (desde
+			% BITS_POR_PALABRA));
+	while (bits == 0) {
+		if (++palabra == numPalabras)
+			return -1;
+		bits = ~miSistemaDeFicheros->mapaDeBits[palabra];
+	}
+	inicio = palabra * BITS_POR_PALABRA + __builtin_ctzll(bits);
+
+	// Primer bit a 1 a partir de inicio
+	bits = miSistemaDeFicheros->mapaDeBits[palabra] & (~(BIT) 0 << (inicio
+			% BITS_POR_PALABRA));
+	while (bits == 0) {
+		if (++palabra == numPalabras)
+			break;
+		bits = miSistemaDeFicheros->mapaDeBits[palabra];
+	}
+	if (bits == 0)
+		fin = numPalabras * BITS_POR_PALABRA;
+	else
+		fin = palabra * BITS_POR_PALABRA + __builtin_ctzll(bits);
+
+	*longitud = fin - inicio;
+	return inicio;
+}
+
+DISK_LBA primeraRachaLibre(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int numBloques) {
+	int longitud;
+	DISK_LBA inicio = buscaRachaLibre(miSistemaDeFicheros, 0, &longitud);
+
+	while (inicio != -1 && longitud < numBloques)
+		inicio = buscaRachaLibre(miSistemaDeFicheros, inicio + longitud,
+				&longitud);
+	return inicio;
+}
+
+// Reserva un bloque para un nodo del árbol de extensiones
+static DISK_LBA reservaBloqueArbol(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	int longitud;
+	DISK_LBA idxBloque = buscaRachaLibre(miSistemaDeFicheros, 0, &longitud);
+
+	if (idxBloque != -1)
+		cambiaRachaMapa(miSistemaDeFicheros, idxBloque, 1, true);
+	return idxBloque;
+}
+
+void initCursorExtensiones(CursorExtensiones* cursor) {
+	cursor->idxHoja = -1;
+}
+
+// Devuelve la última entrada que empieza en bloqueLogico o antes
+static int buscaEntrada(EstructuraExtension* entradas, int numEntradas,
+		int bloqueLogico) {
+	int izq = 0;
+	int der = numEntradas - 1;
+
+	while (izq < der) {
+		int medio = (izq + der + 1) / 2;
+		if (entradas[medio].bloqueLogico <= bloqueLogico)
+			izq = medio;
+		else
+			der = medio - 1;
+	}
+	return izq;
+}
+
+DISK_LBA buscaBloqueNodoI(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraNodoI* nodoI, int bloqueLogico, int* contiguos,
+		CursorExtensiones* cursor) {
+	EstructuraCabeceraArbol* cab = &nodoI->cabecera;
+	EstructuraExtension* entradas = nodoI->extensiones;
+	EstructuraBloqueArbol* buffer = NULL;
+	EstructuraExtension* e;
+	DISK_LBA idxBloque = -1;
 	int i;
-	for (i = 0; i < MAX_NODOSI; i++) {
-		if (miSistemaDeFicheros->nodosI[i] == NULL)
-			return i;
+
+	if (bloqueLogico < 0 || bloqueLogico >= nodoI->numBloques)
+		return -1;
+
+	// Si el bloque cae en la hoja que tiene cargada el cursor, no hace falta
+	// bajar desde la raíz
+	if (cursor != NULL && cursor->idxHoja != -1
+			&& cursor->hoja.cabecera.numEntradas > 0) {
+		e = &cursor->hoja.entradas[cursor->hoja.cabecera.numEntradas - 1];
+		if (bloqueLogico >= cursor->hoja.entradas[0].bloqueLogico
+				&& bloqueLogico < e->bloqueLogico + e->numBloques) {
+			cab = &cursor->hoja.cabecera;
+			entradas = cursor->hoja.entradas;
+		}
+	}
+
+	while (cab->profundidad > 0) {
+		if (buffer == NULL) {
+			if (cursor != NULL) {
+				buffer = &cursor->hoja;
+				cursor->idxHoja = -1;
+			} else if ((buffer = malloc(sizeof(EstructuraBloqueArbol))) == NULL) {
+				perror("Falló malloc en buscaBloqueNodoI");
+				return -1;
+			}
+		}
+		i = buscaEntrada(entradas, cab->numEntradas, bloqueLogico);
+		idxBloque = entradas[i].inicio;
+		if (leeBloqueMetadatos(miSistemaDeFicheros, idxBloque, buffer) == -1) {
+			idxBloque = -1;
+			goto fin;
+		}
+		cab = &buffer->cabecera;
+		entradas = buffer->entradas;
+	}
+
+	i = buscaEntrada(entradas, cab->numEntradas, bloqueLogico);
+	e = &entradas[i];
+	if (cab->numEntradas == 0 || bloqueLogico - e->bloqueLogico
+			>= e->numBloques) {
+		fprintf(stderr, "Árbol de extensiones inconsistente\n");
+		idxBloque = -1;
+		goto fin;
+	}
+	if (cursor != NULL && buffer != NULL)
+		cursor->idxHoja = idxBloque;
+	if (contiguos != NULL)
+		*contiguos = e->numBloques - (bloqueLogico - e->bloqueLogico);
+	idxBloque = e->inicio + (bloqueLogico - e->bloqueLogico);
+
+	fin: if (cursor == NULL)
+		free(buffer);
+	return idxBloque;
+}
+
+int anadeExtensionNodoI(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraNodoI* nodoI, DISK_LBA inicio, int numBloques) {
+	EstructuraBloqueArbol* camino;
+	DISK_LBA idxCamino[MAX_PROFUNDIDAD_ARBOL];
+	EstructuraCabeceraArbol* cab = &nodoI->cabecera;
+	EstructuraExtension* entradas = nodoI->extensiones;
+	EstructuraExtension nueva;
+	EstructuraExtension* ultima;
+	int profundidad = nodoI->cabecera.profundidad;
+	int nivel, necesarios;
+
+	camino = malloc((MAX_PROFUNDIDAD_ARBOL + 1) * sizeof(EstructuraBloqueArbol));
+	if (camino == NULL) {
+		perror("Falló malloc en anadeExtensionNodoI");
+		return -1;
+	}
+
+	nueva.bloqueLogico = nodoI->numBloques;
+	nueva.inicio = inicio;
+	nueva.numBloques = numBloques;
+
+	// Bajamos por la rama derecha hasta la última hoja
+	for (nivel = 0; nivel < profundidad; nivel++) {
+		idxCamino[nivel] = entradas[cab->numEntradas - 1].inicio;
+		if (leeBloqueMetadatos(miSistemaDeFicheros, idxCamino[nivel],
+				&camino[nivel]) == -1)
+			goto error;
+		cab = &camino[nivel].cabecera;
+		entradas = camino[nivel].entradas;
 	}
-	return -1; // NO hay nodos-i libres. Esto no debería ocurrir.
+
+	// Si la racha sigue a la última extensión en disco, basta con alargarla
+	if (cab->numEntradas > 0) {
+		ultima = &entradas[cab->numEntradas - 1];
+		if (ultima->inicio + ultima->numBloques == inicio) {
+			ultima->numBloques += numBloques;
+			if (profundidad > 0 && escribeBloqueMetadatos(miSistemaDeFicheros,
+					idxCamino[profundidad - 1], &camino[profundidad - 1])
+					== -1)
+				goto error;
+			goto fin;
+		}
+	}
+
+	// Hace falta un bloque nuevo por cada nodo lleno desde la hoja hacia
+	// arriba; comprobándolo antes no hay que deshacer nada a medias
+	for (nivel = profundidad, necesarios = 0; nivel >= 0; nivel--) {
+		cab = nivel == 0 ? &nodoI->cabecera : &camino[nivel - 1].cabecera;
+		if (cab->numEntradas < cab->maxEntradas)
+			break;
+		necesarios++;
+	}
+	if (miSistemaDeFicheros->superBloque.numBloquesLibres < necesarios)
+		goto error;
+
+	// Si no, la insertamos subiendo mientras los nodos estén llenos.
+	// camino[profundidad] queda libre y sirve para construir nodos nuevos.
+	for (nivel = profundidad;; nivel--) {
+		EstructuraBloqueArbol* nuevo = &camino[profundidad];
+		DISK_LBA idxNuevo;
+
+		if (nivel == 0) {
+			cab = &nodoI->cabecera;
+			entradas = nodoI->extensiones;
+		} else {
+			cab = &camino[nivel - 1].cabecera;
+			entradas = camino[nivel - 1].entradas;
+		}
+		if (cab->numEntradas < cab->maxEntradas) {
+			entradas[cab->numEntradas++] = nueva;
+			if (nivel > 0 && escribeBloqueMetadatos(miSistemaDeFicheros,
+					idxCamino[nivel - 1], &camino[nivel - 1]) == -1)
+				goto error;
+			break;
+		}
+		if (nivel == 0 && profundidad + 1 >= MAX_PROFUNDIDAD_ARBOL) {
+			fprintf(stderr, "Árbol de extensiones demasiado profundo\n");
+			goto error;
+		}
+		if ((idxNuevo = reservaBloqueArbol(miSistemaDeFicheros)) == -1)
+			goto error;
+		if (nivel == 0) {
+			// La raíz está llena: su contenido baja a un bloque nuevo, que
+			// tiene sitio de sobra para la entrada, y la raíz apunta a él
+			nuevo->cabecera = nodoI->cabecera;
+			nuevo->cabecera.maxEntradas = EXTENSIONES_POR_BLOQUE;
+			memcpy(nuevo->entradas, nodoI->extensiones,
+					nodoI->cabecera.numEntradas * sizeof(EstructuraExtension));
+			nuevo->entradas[nuevo->cabecera.numEntradas++] = nueva;
+			if (escribeBloqueMetadatos(miSistemaDeFicheros, idxNuevo, nuevo) == -1)
+				goto error;
+			nodoI->cabecera.profundidad++;
+			nodoI->cabecera.numEntradas = 1;
+			nodoI->extensiones[0].bloqueLogico = nuevo->entradas[0].bloqueLogico;
+			nodoI->extensiones[0].inicio = idxNuevo;
+			nodoI->extensiones[0].numBloques = 0;
+			break;
+		}
+		// Nodo lleno: la entrada va a un hermano nuevo, que a su vez hay que
+		// colgar del padre
+		nuevo->cabecera.numEntradas = 1;
+		nuevo->cabecera.maxEntradas = EXTENSIONES_POR_BLOQUE;
+		nuevo->cabecera.profundidad = profundidad - nivel;
+		nuevo->entradas[0] = nueva;
+		if (escribeBloqueMetadatos(miSistemaDeFicheros, idxNuevo, nuevo) == -1)
+			goto error;
+		nueva.inicio = idxNuevo;
+		nueva.numBloques = 0;
+	}
+
+	fin: nodoI->numBloques += numBloques;
+	free(camino);
+	return 0;
+
+	error: free(camino);
+	return -1;
 }
 
-void reservaBloquesNodosI(MiSistemaDeFicheros* miSistemaDeFicheros,
-		DISK_LBA idxBloques[], int numBloques) {
-	int i = 0;
+static int reservaBloques(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraNodoI* nodoI, int numBloques) {
+	DISK_LBA inicio;
+	int longitud;
+	int numBloquesAntes = nodoI->numBloques;
 	int bloqueActual = 0;
 
-	while ((bloqueActual < numBloques) && (i < NUM_BITS)) {
-		if (miSistemaDeFicheros->mapaDeBits[i] == 0) {
-			miSistemaDeFicheros->mapaDeBits[i] = 1;
-			idxBloques[bloqueActual] = i;
-			bloqueActual++;
+	if (numBloques == 0)
+		return 0;
+	if (numBloques > miSistemaDeFicheros->superBloque.numBloquesLibres)
+		return -1;
+
+	// Primero intentamos dar todos los bloques en una única extensión
+	inicio = primeraRachaLibre(miSistemaDeFicheros, numBloques);
+	if (inicio != -1) {
+		cambiaRachaMapa(miSistemaDeFicheros, inicio, numBloques, true);
+		if (anadeExtensionNodoI(miSistemaDeFicheros, nodoI, inicio, numBloques)
+				== -1) {
+			cambiaRachaMapa(miSistemaDeFicheros, inicio, numBloques, false);
+			return -1;
+		}
+		return 0;
+	}
+
+	// Si no, vamos cogiendo rachas libres en orden hasta completar
+	inicio = buscaRachaLibre(miSistemaDeFicheros, 0, &longitud);
+	while (inicio != -1 && bloqueActual < numBloques) {
+		if (longitud > numBloques - bloqueActual)
+			longitud = numBloques - bloqueActual;
+		cambiaRachaMapa(miSistemaDeFicheros, inicio, longitud, true);
+		if (anadeExtensionNodoI(miSistemaDeFicheros, nodoI, inicio, longitud)
+				== -1) {
+			cambiaRachaMapa(miSistemaDeFicheros, inicio, longitud, false);
+			break;
 		}
-		++i;
+		bloqueActual += longitud;
+		inicio = buscaRachaLibre(miSistemaDeFicheros, inicio + longitud,
+				&longitud);
 	}
+	if (bloqueActual < numBloques) {
+		// No hay sitio: deshacemos lo reservado
+		truncaNodoI(miSistemaDeFicheros, nodoI, numBloquesAntes);
+		return -1;
+	}
+	return 0;
 }
 
-int buscaPosDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros, char* nombre) {
-	int i;
+int reservaBloquesNodosI(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraNodoI* nodoI, int numBloques) {
+	uint64_t t0 = empiezaMedida(miSistemaDeFicheros);
+	int ret = reservaBloques(miSistemaDeFicheros, nodoI, numBloques);
+
+	terminaMedida(miSistemaDeFicheros, EST_RESERVA_BLOQUES, t0,
+			(uint64_t) numBloques * TAM_BLOQUE_BYTES);
+	return ret;
+}
+
+// Libera los bloques de una extensión: los de un archivo pueden estar
+// compartidos con otros (ver huellas.h)
+static void liberaExtension(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA inicio, int numBloques, BOOLEAN enDiario) {
+	if (enDiario)
+		liberaRachaDiferida(miSistemaDeFicheros, inicio, numBloques, true);
+	else
+		liberaRachaDatos(miSistemaDeFicheros, inicio, numBloques);
+}
 
-	for (i = 0; i < MAX_ARCHIVOS_POR_DIRECTORIO; i++) {
-		if (miSistemaDeFicheros->directorio.archivos[i].libre == false) {
-			if (strcmp(nombre,
-					miSistemaDeFicheros->directorio.archivos[i].nombreArchivo)
-					== 0)
-				return i;
+// Quita del nodo del árbol las entradas a partir del bloque lógico desde,
+// liberando sus bloques. enDiario indica que los bloques de datos son
+// metadatos (los de un directorio). Devuelve las entradas que le quedan o
+// -1 si falla.
+static int truncaNodo(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraCabeceraArbol* cab, EstructuraExtension* entradas, int desde,
+		BOOLEAN enDiario) {
+	EstructuraBloqueArbol* hijo = NULL;
+	EstructuraExtension* e;
+	int i, restantes;
+
+	for (i = cab->numEntradas - 1; i >= 0; i--) {
+		e = &entradas[i];
+		if (cab->profundidad == 0) {
+			if (e->bloqueLogico >= desde) {
+				liberaExtension(miSistemaDeFicheros, e->inicio, e->numBloques,
+						enDiario);
+				cab->numEntradas--;
+				continue;
+			}
+			restantes = e->bloqueLogico + e->numBloques - desde;
+			if (restantes > 0) {
+				liberaExtension(miSistemaDeFicheros, e->inicio
+						+ e->numBloques - restantes, restantes, enDiario);
+				e->numBloques -= restantes;
+			}
+			break;
+		}
+		if (hijo == NULL && (hijo = malloc(sizeof(EstructuraBloqueArbol)))
+				== NULL) {
+			perror("Falló malloc en truncaNodo");
+			return -1;
+		}
+		if (leeBloqueMetadatos(miSistemaDeFicheros, e->inicio, hijo) == -1)
+			goto error;
+		restantes = truncaNodo(miSistemaDeFicheros, &hijo->cabecera,
+				hijo->entradas, desde, enDiario);
+		if (restantes == -1)
+			goto error;
+		if (restantes == 0) {
+			liberaRachaDiferida(miSistemaDeFicheros, e->inicio, 1, true);
+			cab->numEntradas--;
+		} else if (escribeBloqueMetadatos(miSistemaDeFicheros, e->inicio, hijo)
+				== -1) {
+			goto error;
 		}
+		if (e->bloqueLogico < desde)
+			break;
 	}
+	free(hijo);
+	return cab->numEntradas;
+
+	error: free(hijo);
 	return -1;
 }
+
+int truncaNodoI(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraNodoI* nodoI, int numBloques) {
+	if (numBloques >= nodoI->numBloques)
+		return 0;
+	if (truncaNodo(miSistemaDeFicheros, &nodoI->cabecera, nodoI->extensiones,
+			numBloques, nodoI->tipo == TIPO_DIRECTORIO) == -1)
+		return -1;
+	if (nodoI->cabecera.numEntradas == 0) {
+		nodoI->cabecera.profundidad = 0;
+		nodoI->cabecera.maxEntradas = EXTENSIONES_EN_NODOI;
+	}
+	nodoI->numBloques = numBloques;
+	return 0;
+}
+
+void liberaBloquesNodoI(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraNodoI* nodoI) {
+	truncaNodoI(miSistemaDeFicheros, nodoI, 0);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 // Devuelve el no de bloques libres en el FS.
@@ -245,13 +1339,12 @@ int buscaPosDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros, char* nombre) {
 int myQuota(MiSistemaDeFicheros* miSistemaDeFicheros) {
 	int freeCount = 0;
 	int i;
-	// Calculamos el número de bloques libres
-	for (i = 0; i < miSistemaDeFicheros->superBloque.tamDiscoEnBloques; i++) {
-		// Ahora estamos usando uint para representar cada bit.
-		// Podríamos usar todos los bits para mejorar el almacenamiento
-		if (miSistemaDeFicheros->mapaDeBits[i] == 0) {
-			freeCount++;
-		}
+	// Calculamos el número de bloques libres contando los bits a 1 de cada
+	// palabra. Los bits que quedan fuera del disco se marcan como ocupados
+	// en myMkfs, así que no hace falta tratar la última palabra aparte.
+	for (i = 0; i < miSistemaDeFicheros->numPalabrasMapa; i++) {
+		freeCount += BITS_POR_PALABRA
+				- __builtin_popcountll(miSistemaDeFicheros->mapaDeBits[i]);
 	}
 	return freeCount;
 }
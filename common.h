@@ -6,49 +6,158 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
 #define false 0
 #define true 1
 
-#define BIT unsigned 
+#define BIT uint64_t
 #define TAM_BLOQUE_BYTES 4096
-#define NUM_BITS (TAM_BLOQUE_BYTES/sizeof(BIT))
-#define MAX_BLOQUES_CON_NODOSI 5
-#define MAX_BLOQUES_POR_ARCHIVO 100
-#define MAX_ARCHIVOS_POR_DIRECTORIO 100
-#define MAX_TAM_NOMBRE_ARCHIVO 15
+#define BITS_POR_PALABRA (8 * sizeof(BIT))
+#define PALABRAS_POR_BLOQUE_MAPA (TAM_BLOQUE_BYTES/sizeof(BIT))
+#define BITS_POR_BLOQUE_MAPA (PALABRAS_POR_BLOQUE_MAPA * BITS_POR_PALABRA)
+#define MAX_BLOQUES_DISCO INT32_MAX
+#define MAX_BLOQUES_POR_ARCHIVO INT32_MAX
+#define EXTENSIONES_EN_NODOI 8
+#define MAX_TAM_EN_LINEA 96 // Archivos que se guardan en el propio nodo-i (el sitio de sus extensiones)
+#define MAX_PROFUNDIDAD_ARBOL 5
+#define MAX_BLOQUES_POR_ES 256
+#define BLOQUES_POR_TROZO_FLUJO 1024 // Lo que se lee y reserva de una vez al importar de un flujo (4 MB)
+#define MAX_PROFUNDIDAD_DIRECTORIO 20 // La tabla de cubetas tiene como mucho 2^20 entradas
+#define MAX_TAM_NOMBRE_ARCHIVO 255 // Por componente de la ruta
+#define MAX_DIRECTORIOS_ABIERTOS 32 // Directorios con la tabla en memoria
+#define MARCOS_CACHE_DEFECTO 1024 // Bloques de la caché de metadatos (4 MB)
+#define MIN_MARCOS_CACHE 16
+#define MAX_LECTURA_ANTICIPADA 32 // Bloques leídos de una vez en un fallo secuencial
 #define DISK_LBA int
 #define BOOLEAN int
 
+#define NUMERO_MAGICO 0x31534653 // "SFS1"
+#define VERSION_FORMATO 9
+
 #define SUPERBLOQUE_IDX 0
 #define MAPA_BITS_IDX 1
-#define DIRECTORIO_IDX 2
-#define NODOI_IDX 3
+#define NODOI_RAIZ 0 // Nodo-i del directorio raíz
+
+#define TIPO_ARCHIVO 0
+#define TIPO_DIRECTORIO 1
+
+#define MIN_BLOQUES_DIARIO 16
+#define MAX_BLOQUES_DIARIO 1024
+#define BLOQUES_DISCO_POR_BLOQUE_DIARIO 128 // Tamaño del diario respecto al disco
+
+#define ACCESO_FD 0   // pread/pwrite y fdatasync sobre el descriptor
+#define ACCESO_MMAP 1 // La imagen entera proyectada en memoria, con msync
+#define ACCESO_URING 2 // Como ACCESO_FD, pero los datos se copian con io_uring (ver uring.h)
+#define PROFUNDIDAD_URING_DEFECTO 16 // Trozos en vuelo con ACCESO_URING
+#define BLOQUES_POR_PETICION 64 // Bloques por trozo con ACCESO_URING (256 KB)
+
+#define BYTES_POR_NODOI_DEFECTO 16384 // Un nodo-i por cada tantos bytes de disco
+#define MIN_BYTES_POR_NODOI 1024
 
 // ESTRUCTURAS
-typedef struct EstructuraArchivo {
-  int  idxNodoI;                                // Nodo-i asociado
-  char nombreArchivo[MAX_TAM_NOMBRE_ARCHIVO+1]; // Nombre archivo
-  BOOLEAN libre;                                // Archivo libre
-} EstructuraArchivo;
 
+// Cada directorio es un archivo más, de tipo TIPO_DIRECTORIO, organizado
+// como una tabla hash extensible (ver directorio.h). Su bloque lógico 0 es
+// la cabecera; el resto son cubetas y la tabla que las indexa. El raíz es el
+// nodo-i NODOI_RAIZ.
+#define MAGICO_DIRECTORIO 0x44534653 // "SFSD"
+
+// Las entradas tienen longitud variable y van una detrás de otra en la
+// cubeta; el nombre acaba en '\0' y la entrada se alinea a 4 bytes
+typedef struct EstructuraEntradaDirectorio {
+  uint32_t hash;                                // hashNombre(nombreArchivo)
+  int idxNodoI;                                 // Nodo-i asociado
+  unsigned short tamEntrada;                    // Bytes que ocupa la entrada
+  unsigned short tamNombre;                     // Longitud del nombre
+  char nombreArchivo[];                         // Nombre archivo
+} EstructuraEntradaDirectorio;
+
+#define TAM_ENTRADA_DIRECTORIO(tamNombre) \
+    ((sizeof(EstructuraEntradaDirectorio) + (tamNombre) + 1 + 3) & ~(size_t) 3)
+
+// Cubeta: bloque con las entradas cuyo hash acaba en los mismos
+// profundidadLocal bits
+typedef struct EstructuraCubeta {
+  int profundidadLocal;                         // Bits del hash que comparten
+  int numEntradas;                              // Núm. entradas usadas
+  int bytesUsados;                              // Bytes ocupados de entradas
+  char entradas[TAM_BLOQUE_BYTES - 3 * sizeof(int)];
+} EstructuraCubeta;
+
+typedef struct EstructuraCabeceraDirectorio {
+  unsigned numeroMagico;                        // MAGICO_DIRECTORIO
+  int numArchivos;                              // Núm. archivos
+  int profundidadGlobal;                        // La tabla tiene 2^profundidadGlobal entradas
+  int numCubetas;                               // Núm. cubetas
+  int bloqueTabla;                              // Primer bloque lógico de la tabla
+  int numBloquesTabla;                          // Bloques lógicos que ocupa
+  int bloqueReciclado;                          // Bloques lógicos libres (de una
+  int numBloquesReciclados;                     // tabla anterior) para cubetas nuevas
+} EstructuraCabeceraDirectorio;
+
+// La cabecera ocupa un bloque entero para leerla y escribirla directamente
 typedef struct EstructuraDirectorio {
-  int numArchivos;                                         // Núm. archivos
-  EstructuraArchivo archivos[MAX_ARCHIVOS_POR_DIRECTORIO]; // Archivos
+  EstructuraCabeceraDirectorio cabecera;
+  char relleno[TAM_BLOQUE_BYTES - sizeof(EstructuraCabeceraDirectorio)];
 } EstructuraDirectorio;
 
+#define ENTRADAS_TABLA_POR_BLOQUE (TAM_BLOQUE_BYTES / sizeof(DISK_LBA))
+
+// Una extensión es una racha de bloques contiguos del archivo. En los nodos
+// índice del árbol de extensiones, inicio apunta al bloque hijo y numBloques
+// no se usa.
+typedef struct EstructuraExtension {
+  int bloqueLogico;                             // Primer bloque del archivo que cubre
+  DISK_LBA inicio;                              // Primer bloque en disco
+  int numBloques;                               // Núm. bloques contiguos
+} EstructuraExtension;
+
+typedef struct EstructuraCabeceraArbol {
+  int numEntradas;                              // Núm. entradas usadas
+  int maxEntradas;                              // Capacidad del nodo
+  int profundidad;                              // 0 si las entradas son extensiones
+} EstructuraCabeceraArbol;
+
+#define EXTENSIONES_POR_BLOQUE ((TAM_BLOQUE_BYTES - sizeof(EstructuraCabeceraArbol)) \
+    / sizeof(EstructuraExtension))
+
+// Nodo del árbol de extensiones guardado en un bloque propio. Ocupa
+// exactamente un bloque para poder leerlo y escribirlo directamente.
+typedef struct EstructuraBloqueArbol {
+  EstructuraCabeceraArbol cabecera;
+  EstructuraExtension entradas[EXTENSIONES_POR_BLOQUE];
+  char relleno[TAM_BLOQUE_BYTES - sizeof(EstructuraCabeceraArbol)
+      - EXTENSIONES_POR_BLOQUE * sizeof(EstructuraExtension)];
+} EstructuraBloqueArbol;
+
 typedef struct EstructuraNodoI {
   int numBloques;                               // Núm. bloques
-  int tamArchivo;                               // Tamaño archivo
+  int tipo;                                     // TIPO_ARCHIVO o TIPO_DIRECTORIO
+  int64_t tamArchivo;                           // Tamaño archivo
+  int64_t tamComprimido;                        // Bytes de sus tramas, 0 si no está comprimido (ver compresion.h)
   time_t tiempoModificado;                      // Tiempo de modificación
-  DISK_LBA idxBloques[MAX_BLOQUES_POR_ARCHIVO]; // Bloques
-  BOOLEAN libre;                                // Nodo libre
+  EstructuraCabeceraArbol cabecera;             // Raíz del árbol de extensiones
+  union {
+    EstructuraExtension extensiones[EXTENSIONES_EN_NODOI]; // Entradas de la raíz
+    char enLinea[MAX_TAM_EN_LINEA];             // Los datos, si el archivo no tiene bloques (ver estaEnLinea)
+  };
 } EstructuraNodoI;
 
+// Recuerda la última hoja del árbol leída, para no volver a leerla al
+// recorrer un archivo secuencialmente
+typedef struct CursorExtensiones {
+  DISK_LBA idxHoja;                             // Bloque de la hoja cargada (-1 si ninguna)
+  EstructuraBloqueArbol hoja;
+} CursorExtensiones;
+
 #define NODOSI_POR_BLOQUE (TAM_BLOQUE_BYTES/sizeof(EstructuraNodoI))
-#define MAX_NODOSI (NODOSI_POR_BLOQUE * MAX_BLOQUES_CON_NODOSI)
+#define MAX_NODOSI (1 << 27)
 
 typedef struct EstructuraSuperBloque {
+  unsigned numeroMagico;    // NUMERO_MAGICO
+  int version;              // VERSION_FORMATO
   int tamSuperBloque;       // Tamaño de la info. de superbloque
   int tamDirectorio;        // Tamaño de la info. de directorio
   int tamNodoI;             // Tamaño de la info. de nodo-i
@@ -59,33 +168,211 @@ typedef struct EstructuraSuperBloque {
   int tamBloque;            // Tamaño de bloque
   int maxTamNombreArchivo;  // Tamaño máx. de nombre de archivo
   int maxBloquesPorArchivo; // Tamaño máx. de bloques por archivo
+
+  int numBloquesMapaBits;   // Núm. de bloques del mapa de bits
+  int idxMapaNodosI;        // Primer bloque del mapa de nodos-i
+  int numBloquesMapaNodosI; // Núm. de bloques del mapa de nodos-i
+  int idxNodosI;            // Primer bloque de nodos-i
+  int numBloquesNodosI;     // Núm. de bloques de nodos-i
+  int numNodosI;            // Núm. de nodos-i
+  int numNodosLibres;       // Núm. de nodos-i libres
+  int bytesPorNodoI;        // Bytes de disco por nodo-i con que se formateó
+  int idxDiario;            // Primer bloque del diario (ver diario.h)
+  int numBloquesDiario;     // Núm. de bloques del diario
+  int idxHuellas;           // Primer bloque del índice de huellas (ver huellas.h)
+  int numBloquesHuellas;    // Núm. de bloques del índice (0 si no se deduplica)
+  int numBloquesInverso;    // Núm. de bloques del inverso, detrás del índice
+  int comprimir;            // Se comprime lo que se importa (ver compresion.h)
+  int idxSumas;             // Primer bloque de la tabla de sumas (ver sumas.h)
+  int numBloquesSumas;      // Núm. de bloques de la tabla (0 si no hay sumas)
 } EstructuraSuperBloque;
 
+// Bytes de metadatos modificados en memoria y pendientes de escribir
+// (ver metadatos.h)
+typedef struct RangoSucio {
+  off_t pos;                                    // Posición en disco
+  const char* memoria;                          // Copia en memoria
+  size_t tam;                                   // Núm. de bytes
+  BOOLEAN propio;                               // La memoria es una copia de la lista
+} RangoSucio;
+
+// Racha de bloques liberada que no se puede reutilizar hasta que se
+// confirme la transacción que la libera
+typedef struct RachaPendiente {
+  DISK_LBA inicio;
+  int numBloques;
+} RachaPendiente;
+
+// Directorio con la cabecera y la tabla de cubetas cargadas en memoria
+typedef struct DirectorioAbierto {
+  int idxNodoI;                                 // -1 si la ranura está libre
+  DISK_LBA idxCabecera;                         // Bloque en disco de la cabecera
+  EstructuraCabeceraDirectorio cabecera;
+  DISK_LBA* tabla;                              // Tabla de cubetas (bloques en disco)
+  unsigned ultimoUso;                           // Para elegir cuál sacar de memoria
+} DirectorioAbierto;
+
+// Marco de la caché de bloques (ver cache.h)
+typedef struct MarcoCache {
+  DISK_LBA idxBloque;                           // -1 si el marco está libre
+  int fijado;                                   // Usuarios que lo tienen fijado
+  BOOLEAN sucio;                                // Hay que escribirlo antes de reutilizarlo
+  BOOLEAN usado;                                // Bit de referencia del reloj
+  BOOLEAN anticipado;                           // Leído por adelantado y aún sin usar
+  int siguiente;                                // Siguiente marco de la misma lista del hash
+} MarcoCache;
+
+typedef struct CacheBloques {
+  int numMarcos;                                // 0 si aún no se ha creado
+  MarcoCache* marcos;
+  char* datos;                                  // Los numMarcos bloques, seguidos
+  int* hash;                                    // Primer marco de cada lista (-1 si vacía)
+  int tamHash;                                  // Potencia de 2
+  int manecilla;                                // Siguiente marco que mira el reloj
+  int numSucios;
+  DISK_LBA finUltimoFallo;                      // Bloque que sigue al último leído en un fallo
+  int ventana;                                  // Bloques leídos en ese fallo
+  unsigned long long aciertos;                  // Contadores, para dimensionarla
+  unsigned long long fallos;
+  unsigned long long anticipados;               // Bloques leídos por adelantado
+  unsigned long long anticipadosUsados;         // ... que luego se han pedido
+  unsigned long long expulsiones;
+  unsigned long long escrituras;                // Bloques sucios llevados a disco
+} CacheBloques;
+
 typedef struct MiSistemaDeFicheros {
     int discoVirtual;                    // Archivo que almacena el sistema de ficheros
+    int modoAcceso;                      // ACCESO_FD o ACCESO_MMAP
+    char* imagen;                        // La imagen proyectada (NULL si no lo está)
+    size_t tamImagen;
+    struct AnilloES* anillo;             // io_uring para los datos (NULL si no se usa)
+    struct Estadisticas* estadisticas;   // Lo que se mide (NULL si no se mide, ver stats.h)
     EstructuraSuperBloque superBloque;   // Superbloque
-    BIT mapaDeBits[NUM_BITS];       // Mapa de bits
-    EstructuraDirectorio directorio;     // Directorio raíz
-    EstructuraNodoI* nodosI[MAX_NODOSI]; // Nodos-i
-    int numNodosLibres;                  // Número de nodos-i libres
+    BIT* mapaDeBits;                     // Mapa de bits (1 bit por bloque)
+    size_t numPalabrasMapa;              // Núm. de palabras del mapa de bits
+    DirectorioAbierto* directorios;      // Directorios cargados (ver abreDirectorio)
+    unsigned usoDirectorios;             // Reloj para ultimoUso
+    BIT* mapaNodosI;                     // Mapa de nodos-i (1 bit por nodo-i, a 1 si está en uso)
+    size_t numPalabrasMapaNodosI;
+    size_t pistaNodoLibre;               // Palabra del mapa donde buscar el siguiente libre
+    char** bloquesNodosI;                // Bloques de nodos-i leídos, tal cual están en
+                                         // disco (NULL si aún no se ha leído)
+    char** bloquesHuellas;               // Igual, los del índice de huellas y su inverso
+    char** bloquesSumas;                 // Igual, los de la tabla de sumas
+    CacheBloques cache;                  // Bloques de metadatos leídos (ver cache.h)
+    RangoSucio* rangosSucios;            // Metadatos pendientes de escribir
+    int numRangosSucios;
+    int maxRangosSucios;
+    int* indiceCopias;                   // Hash bloque -> rango de las copias propias
+    int tamIndiceCopias;                 // (potencia de 2, 0 si no hay índice)
+    int numCopias;
+    size_t bytesPendientes;              // Bytes anotados desde la última confirmación
+    RachaPendiente* liberaciones;        // Bloques liberados sin confirmar
+    int numLiberaciones;
+    int maxLiberaciones;
+    int opsPorGrupo;                     // Operaciones por confirmación (ver cierraOperacion)
+    int segundosPorGrupo;                // Antigüedad máx. de una sin confirmar (0: sin límite)
+    int opsPendientes;                   // Operaciones sin confirmar
+    int opsAbiertas;                     // Operaciones a medias (ver importaLote)
+    time_t inicioGrupo;                  // Cuándo empezó la primera de ellas
+    BOOLEAN diarioActivo;                // Los metadatos pasan por el diario
+    BOOLEAN checkpointPendiente;         // Se han liberado bloques que están en el diario
+    int posDiario;                       // Siguiente bloque libre del diario
+    unsigned secuenciaDiario;            // Secuencia de la siguiente transacción
 } MiSistemaDeFicheros;
 
+// Las funciones escribe* de metadatos anotan los cambios; se llevan a disco
+// con confirmaMetadatos (ver metadatos.h)
 int escribeMapaDeBits(MiSistemaDeFicheros* miSistemaDeFicheros);
+// Consulta, marca como ocupado o libera el bit del bloque numBloque
+int leeBitMapa(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA numBloque);
+// Marca como ocupados (o libres) numBloques bits a partir de inicio,
+// palabra a palabra, y actualiza el contador de bloques libres
+void cambiaRachaMapa(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio, int numBloques, BOOLEAN ocupado);
+void marcaBitMapa(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA numBloque);
+void liberaBitMapa(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA numBloque);
 int escribeNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, int numNodoI, EstructuraNodoI* nodoI);
 // Inicializa el superbloque
-void initSuperBloque(MiSistemaDeFicheros* miSistemaDeFicheros, int tamDisco);
+void initSuperBloque(MiSistemaDeFicheros* miSistemaDeFicheros, off_t tamDisco);
 int escribeSuperBloque(MiSistemaDeFicheros* miSistemaDeFicheros);
-int escribeDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros);
+// Anota todo el mapa de nodos-i (para myMkfs)
+int escribeMapaNodosI(MiSistemaDeFicheros* miSistemaDeFicheros);
 int escribeDatos(MiSistemaDeFicheros* miSistemaDeFicheros, int archivoExterno, int numNodoI);
+// Como escribeDatos para un archivo externo de tamaño desconocido (una
+// tubería, un socket): lee hasta el final de trozo en trozo, reservando los
+// bloques de cada uno al llegar y alargando el nodo-i (o guardándolo en
+// el nodo-i si no pasa de MAX_TAM_EN_LINEA bytes). Si falla, lo ya
+// reservado sigue en el nodo-i: se deshace borrando el archivo. Devuelve 0,
+// -1 si falla la lectura o -2 si no queda sitio.
+int escribeFlujo(MiSistemaDeFicheros* miSistemaDeFicheros, int archivoExterno, int numNodoI);
+// Lee del descriptor hasta llenar tam bytes o llegar al final del archivo.
+// Devuelve los bytes leídos o -1 en caso de error.
+ssize_t leeCompleto(int fd, void* buffer, size_t tam);
 int exportaDatos(MiSistemaDeFicheros* miSistemaDeFicheros, int handle,
 		int idxNodoI);
-int calculaPosNodoI(int numNodoI);
-void initNodosI(MiSistemaDeFicheros* miSistemaDeFicheros);
+off_t calculaPosNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, int numNodoI);
+// Prepara la tabla de nodos-i vacía: sus bloques se leen al consultarlos
+int initNodosI(MiSistemaDeFicheros* miSistemaDeFicheros);
+void liberaNodosI(MiSistemaDeFicheros* miSistemaDeFicheros);
+// Devuelve la copia en memoria del nodo-i numNodoI, leyendo su bloque si
+// hace falta, o NULL si no se puede leer
+EstructuraNodoI* ranuraNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, int numNodoI);
+// Devuelve el nodo-i numNodoI, o NULL si está libre
+EstructuraNodoI* obtenNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, int numNodoI);
 int leeNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, int numNodoI, EstructuraNodoI* nodoI);
 void copiaNodoI(EstructuraNodoI* dest, EstructuraNodoI* src);
+// Deja el nodo-i vacío, con el árbol de extensiones sin entradas
+void initNodoI(EstructuraNodoI* nodoI);
+// Cierto si los datos del archivo están en nodoI->enLinea: un archivo que
+// no está vacío pero no tiene bloques
+BOOLEAN estaEnLinea(const EstructuraNodoI* nodoI);
+// Devuelve un nodo-i libre, o -1 si no quedan. Busca palabra a palabra en
+// el mapa a partir de donde encontró el anterior.
 int buscaNodoLibre(MiSistemaDeFicheros* miSistemaDeFicheros);
-void reservaBloquesNodosI(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA idxBloques[], int numBloques);
-int buscaPosDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros, char* nombre);
+// Marca en uso el nodo-i numNodoI, libre, y lo devuelve vacío (o NULL si no
+// se puede leer su bloque)
+EstructuraNodoI* ocupaNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, int numNodoI);
+// Marca libre el nodo-i numNodoI; sus bloques hay que liberarlos antes
+void liberaNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, int numNodoI);
+// Busca la primera racha de bloques libres que empieza en desde o después.
+// Devuelve su primer bloque (o -1 si no hay) y su longitud en *longitud.
+DISK_LBA buscaRachaLibre(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA desde, int* longitud);
+// Primer bloque de la primera racha de al menos numBloques bloques libres,
+// o -1 si no hay ninguna
+DISK_LBA primeraRachaLibre(MiSistemaDeFicheros* miSistemaDeFicheros, int numBloques);
+// Añade numBloques bloques al final del nodo-i, en el menor número de
+// extensiones posible. Si no hay sitio deja el nodo-i y el mapa como estaban
+// y devuelve -1.
+int reservaBloquesNodosI(MiSistemaDeFicheros* miSistemaDeFicheros, EstructuraNodoI* nodoI, int numBloques);
+// Deja el nodo-i con numBloques bloques, liberando los de detrás y los
+// nodos del árbol de extensiones que queden vacíos
+int truncaNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, EstructuraNodoI* nodoI, int numBloques);
+void liberaBloquesNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, EstructuraNodoI* nodoI);
+// Añade la racha [inicio, inicio+numBloques) al final del árbol de extensiones
+int anadeExtensionNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, EstructuraNodoI* nodoI, DISK_LBA inicio, int numBloques);
+// Traduce un bloque del archivo a bloque del disco en O(log n). En
+// *contiguos (si no es NULL) deja cuántos bloques siguen contiguos a partir
+// de él. cursor puede ser NULL.
+DISK_LBA buscaBloqueNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, EstructuraNodoI* nodoI, int bloqueLogico, int* contiguos, CursorExtensiones* cursor);
+void initCursorExtensiones(CursorExtensiones* cursor);
+// Acceso a la imagen. Con ACCESO_MMAP, una vez proyectada, las lecturas y
+// escrituras son copias de memoria y sincronizaDisco es un msync; si no,
+// son pread/pwrite y fdatasync. Leer más allá del final devuelve ceros.
+// Proyecta la imagen entera (tras leer el superbloque)
+int proyectaImagen(MiSistemaDeFicheros* miSistemaDeFicheros);
+// Deshace la proyección, si la hay, y cierra la imagen
+void cierraImagen(MiSistemaDeFicheros* miSistemaDeFicheros);
+int leeDisco(MiSistemaDeFicheros* miSistemaDeFicheros, off_t pos, void* buffer, size_t tam);
+int escribeDisco(MiSistemaDeFicheros* miSistemaDeFicheros, off_t pos, const void* buffer, size_t tam);
+// Igual, repartiendo los bytes entre los n trozos de vector (una sola
+// llamada en el caso normal)
+int leeDiscoVector(MiSistemaDeFicheros* miSistemaDeFicheros, const struct iovec* vector, int n, off_t pos);
+int escribeDiscoVector(MiSistemaDeFicheros* miSistemaDeFicheros, const struct iovec* vector, int n, off_t pos);
+// Hace duradero todo lo escrito en la imagen
+int sincronizaDisco(MiSistemaDeFicheros* miSistemaDeFicheros);
+// Leen/escriben numBloques bloques consecutivos del disco virtual con una sola llamada
+int leeBloques(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio, int numBloques, void* buffer);
+int escribeBloques(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio, int numBloques, const void* buffer);
 ////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////
 // Devuelve el núm. de bloques libres en el FS.
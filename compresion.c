@@ -0,0 +1,247 @@
+#include "compresion.h"
+#include <string.h>
+
+// Formato de bloque de LZ4: cada secuencia es un byte de control (longitud
+// de los literales en los 4 bits altos y de la coincidencia menos
+// MIN_COINCIDENCIA en los bajos, con 15 seguido de bytes de 255 y el resto
+// si no caben), los literales, la distancia (2 bytes) y la longitud que
+// sobre de la coincidencia. La última secuencia es solo de literales.
+#define BITS_HASH_LZ 14
+#define MIN_COINCIDENCIA 4
+#define MAX_DISTANCIA 65535
+#define LITERALES_FINALES 5       // Los últimos bytes siempre son literales
+#define MARGEN_FINAL 12           // Ninguna coincidencia empieza más cerca del final
+
+BOOLEAN comprime(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	return miSistemaDeFicheros->superBloque.comprimir;
+}
+
+static inline uint32_t lee32(const char* p) {
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t lee64(const char* p) {
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline int hashLZ(uint32_t v) {
+	return (v * 2654435761U) >> (32 - BITS_HASH_LZ);
+}
+
+// Escribe lo que no cabe en los 4 bits del byte de control
+static char* escribeLongitud(char* p, int longitud) {
+	for (; longitud >= 255; longitud -= 255)
+		*p++ = (char) 255;
+	*p++ = longitud;
+	return p;
+}
+
+// Cierto si una secuencia con esos literales y esa longitud de más de la
+// coincidencia no cabe antes de fin
+static inline BOOLEAN noCabe(const char* p, int literales, int longitud,
+		const char* fin) {
+	return fin - p < 1 + literales / 255 + 1 + literales + 2 + longitud / 255
+			+ 1;
+}
+
+int comprimeLZ(const char* origen, int tam, char* destino, int maxDestino) {
+	// Posición de la última vez que se vio cada hash de 4 bytes
+	int tabla[1 << BITS_HASH_LZ];
+	const char* ip = origen + 1;
+	const char* ancla = origen;
+	const char* fin = origen + tam;
+	const char* limite = fin - MARGEN_FINAL;
+	const char* limiteCoincidencia = fin - LITERALES_FINALES;
+	const char* ref;
+	const char* p;
+	const char* q;
+	char* op = destino;
+	char* finDestino = destino + maxDestino;
+	uint64_t diferencia;
+	uint32_t v;
+	int h, fallos = 0, literales, longitud;
+
+	if (tam > MARGEN_FINAL) {
+		memset(tabla, 0, sizeof(tabla));
+		while (ip < limite) {
+			v = lee32(ip);
+			h = hashLZ(v);
+			ref = origen + tabla[h];
+			tabla[h] = ip - origen;
+			// Cuanto más tiempo sin encontrar nada, más largo el salto: lo
+			// que no se comprime se recorre deprisa
+			if (ip - ref > MAX_DISTANCIA || lee32(ref) != v) {
+				ip += 1 + (fallos++ >> 6);
+				continue;
+			}
+			fallos = 0;
+			while (ip > ancla && ref > origen && ip[-1] == ref[-1]) {
+				ip--;
+				ref--;
+			}
+			// Se alarga de 8 en 8 bytes; el primero distinto es el bit
+			// más bajo a 1 de la diferencia
+			p = ip + MIN_COINCIDENCIA;
+			q = ref + MIN_COINCIDENCIA;
+			while (p + sizeof(uint64_t) <= limiteCoincidencia) {
+				diferencia = lee64(p) ^ lee64(q);
+				if (diferencia != 0) {
+					p += __builtin_ctzll(diferencia) >> 3;
+					goto alargada;
+				}
+				p += sizeof(uint64_t);
+				q += sizeof(uint64_t);
+			}
+			while (p < limiteCoincidencia && *p == *q) {
+				p++;
+				q++;
+			}
+
+			alargada: literales = ip - ancla;
+			longitud = p - ip - MIN_COINCIDENCIA;
+			if (noCabe(op, literales, longitud, finDestino))
+				return 0;
+			*op = (literales < 15 ? literales : 15) << 4;
+			*op |= longitud < 15 ? longitud : 15;
+			op++;
+			if (literales >= 15)
+				op = escribeLongitud(op, literales - 15);
+			memcpy(op, ancla, literales);
+			op += literales;
+			*op++ = (ip - ref) & 0xff;
+			*op++ = (ip - ref) >> 8;
+			if (longitud >= 15)
+				op = escribeLongitud(op, longitud - 15);
+			ip = ancla = p;
+			if (ip < limite)
+				tabla[hashLZ(lee32(ip - 2))] = ip - 2 - origen;
+		}
+	}
+	literales = fin - ancla;
+	if (noCabe(op, literales, 0, finDestino))
+		return 0;
+	*op++ = (literales < 15 ? literales : 15) << 4;
+	if (literales >= 15)
+		op = escribeLongitud(op, literales - 15);
+	memcpy(op, ancla, literales);
+	op += literales;
+	return op - destino;
+}
+
+// Lee la longitud que sigue al byte de control. Devuelve -1 si se sale.
+static int leeLongitud(const unsigned char** ip, const unsigned char* fin,
+		int longitud) {
+	unsigned char b;
+
+	do {
+		if (*ip >= fin)
+			return -1;
+		b = *(*ip)++;
+		longitud += b;
+	} while (b == 255);
+	return longitud;
+}
+
+int descomprimeLZ(const char* origen, int tamOrigen, char* destino,
+		int tamDestino) {
+	const unsigned char* ip = (const unsigned char*) origen;
+	const unsigned char* finOrigen = ip + tamOrigen;
+	char* op = destino;
+	char* finDestino = destino + tamDestino;
+	const char* ref;
+	int control, literales, longitud, distancia;
+
+	for (;;) {
+		if (ip >= finOrigen)
+			return -1;
+		control = *ip++;
+		literales = control >> 4;
+		if (literales == 15 && (literales = leeLongitud(&ip, finOrigen,
+				literales)) == -1)
+			return -1;
+		if (literales > finOrigen - ip || literales > finDestino - op)
+			return -1;
+		memcpy(op, ip, literales);
+		op += literales;
+		ip += literales;
+		if (ip == finOrigen)
+			break;
+
+		if (finOrigen - ip < 2)
+			return -1;
+		distancia = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (distancia == 0 || distancia > op - destino)
+			return -1;
+		longitud = (control & 15) + MIN_COINCIDENCIA;
+		if ((control & 15) == 15 && (longitud = leeLongitud(&ip, finOrigen,
+				longitud)) == -1)
+			return -1;
+		if (longitud > finDestino - op)
+			return -1;
+		ref = op - distancia;
+		// Con la distancia de 8 o más, cada trozo de 8 bytes ya está escrito
+		// antes de copiarlo; si no, la coincidencia se repite a sí misma
+		if (distancia >= (int) sizeof(uint64_t)) {
+			for (; longitud >= (int) sizeof(uint64_t); longitud
+					-= sizeof(uint64_t)) {
+				memcpy(op, ref, sizeof(uint64_t));
+				op += sizeof(uint64_t);
+				ref += sizeof(uint64_t);
+			}
+		}
+		for (; longitud > 0; longitud--)
+			*op++ = *ref++;
+	}
+	return op - destino;
+}
+
+size_t comprimeTramas(const char* datos, size_t tam, char* salida) {
+	EstructuraTrama trama;
+	size_t hecho, escrito = 0;
+	int n;
+
+	for (hecho = 0; hecho < tam; hecho += trama.tamOriginal) {
+		trama.tamOriginal = tam - hecho < TAM_TRAMA ? tam - hecho : TAM_TRAMA;
+		// Solo vale si mengua
+		n = comprimeLZ(datos + hecho, trama.tamOriginal, salida + escrito
+				+ sizeof(trama), trama.tamOriginal - 1);
+		if (n == 0) {
+			memcpy(salida + escrito + sizeof(trama), datos + hecho,
+					trama.tamOriginal);
+			trama.tamGuardado = trama.tamOriginal;
+		} else
+			trama.tamGuardado = n;
+		memcpy(salida + escrito, &trama, sizeof(trama));
+		escrito += sizeof(trama) + trama.tamGuardado;
+	}
+	return escrito;
+}
+
+int descomprimeTrama(const char* guardado, size_t tamGuardado,
+		char* original) {
+	EstructuraTrama trama;
+
+	if (tamGuardado < sizeof(trama))
+		return -1;
+	memcpy(&trama, guardado, sizeof(trama));
+	if (trama.tamOriginal == 0 || trama.tamOriginal > TAM_TRAMA
+			|| trama.tamGuardado > trama.tamOriginal
+			|| trama.tamGuardado > tamGuardado - sizeof(trama))
+		return -1;
+	guardado += sizeof(trama);
+	if (trama.tamGuardado == trama.tamOriginal) {
+		memcpy(original, guardado, trama.tamOriginal);
+		return trama.tamOriginal;
+	}
+	if (descomprimeLZ(guardado, trama.tamGuardado, original,
+			trama.tamOriginal) != (int) trama.tamOriginal)
+		return -1;
+	return trama.tamOriginal;
+}
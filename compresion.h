@@ -0,0 +1,53 @@
+#ifndef COMPRESION_H
+#define	COMPRESION_H
+
+#include "common.h"
+
+// Compresión de los datos de los archivos (opcional: -compresion on al
+// formatear).
+//
+// Con la compresión activada, lo que se importa se parte en tramas de
+// TAM_TRAMA bytes y cada una se comprime con un LZ77 rápido que escribe el
+// formato de bloque de LZ4 (secuencias de literales y coincidencias de al
+// menos 4 bytes, a menos de 64 KB). Cada trama va precedida de su
+// EstructuraTrama y las tramas se guardan seguidas, sin alinear, en los
+// bloques del archivo; lo que sobra del último se rellena con ceros. Una
+// trama que no mengua se guarda tal cual.
+//
+// El nodo-i de un archivo comprimido tiene en tamArchivo el tamaño original
+// y en tamComprimido los bytes de las tramas; sus bloques (numBloques)
+// cubren tamComprimido. Exportarlo lee esos bloques de principio a fin y
+// descomprime trama a trama en memoria. libsfs lee una trama por cada
+// TAM_TRAMA bytes del archivo y, antes de modificarlo, lo descomprime a
+// bloques normales.
+
+#define TAM_TRAMA (16 * TAM_BLOQUE_BYTES)
+
+typedef struct EstructuraTrama {
+  uint32_t tamGuardado;     // Bytes que siguen a la cabecera
+  uint32_t tamOriginal;     // TAM_TRAMA salvo en la última (igual a tamGuardado si no se comprimió)
+} EstructuraTrama;
+
+// Lo más que pueden ocupar las tramas de tam bytes
+#define MAX_TAM_TRAMAS(tam) ((tam) + ((tam) + TAM_TRAMA - 1) / TAM_TRAMA \
+    * sizeof(EstructuraTrama))
+
+// Cierto si la imagen se formateó con compresión
+BOOLEAN comprime(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+// Comprime tam bytes de origen en destino, que tiene sitio para
+// maxDestino. Devuelve los bytes escritos o 0 si no caben.
+int comprimeLZ(const char* origen, int tam, char* destino, int maxDestino);
+// Descomprime en destino, que tiene sitio para tamDestino bytes. Devuelve
+// los bytes escritos o -1 si los datos no son válidos.
+int descomprimeLZ(const char* origen, int tamOrigen, char* destino, int tamDestino);
+
+// Parte tam bytes de datos en tramas, con sus cabeceras, y las escribe en
+// salida (con sitio para MAX_TAM_TRAMAS(tam)). Devuelve los bytes escritos.
+size_t comprimeTramas(const char* datos, size_t tam, char* salida);
+// Descomprime la trama que empieza en guardado, con tamGuardado bytes
+// disponibles, en original (con sitio para TAM_TRAMA). Devuelve los bytes
+// originales o -1 si la trama no es válida.
+int descomprimeTrama(const char* guardado, size_t tamGuardado, char* original);
+
+#endif	/* COMPRESION_H */
@@ -0,0 +1,386 @@
+#include "defrag.h"
+#include "metadatos.h"
+#include "cache.h"
+#include "directorio.h"
+#include "huellas.h"
+#include "sumas.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// El modo de fondo (solo hay uno)
+typedef struct DefragFondo {
+	MiSistemaDeFicheros* miSistemaDeFicheros;
+	pthread_mutex_t* cerrojo;         // El de los comandos
+	pthread_t hilo;
+	BOOLEAN enMarcha;
+	pthread_mutex_t espera;           // Protege parar
+	pthread_cond_t despierta;         // Para que deje de esperar al pararlo
+	BOOLEAN parar;
+	int siguiente;                    // Siguiente nodo-i que mirar
+	int movidos;
+	long long bloquesMovidos;
+} DefragFondo;
+
+static DefragFondo fondo = {
+	.espera = PTHREAD_MUTEX_INITIALIZER,
+	.despierta = PTHREAD_COND_INITIALIZER
+};
+
+static BOOLEAN nodoIEnUso(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int numNodoI) {
+	return (miSistemaDeFicheros->mapaNodosI[numNodoI / BITS_POR_PALABRA]
+			>> (numNodoI % BITS_POR_PALABRA)) & 1;
+}
+
+// Cuenta las rachas del disco que ocupa el nodo-i, juntando las extensiones
+// seguidas. Si rachas no es NULL las guarda en *rachas, en orden. Devuelve
+// cuántas son o -1 si falla.
+static int rachasArchivo(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraNodoI* nodoI, RachaPendiente** rachas, int* maxRachas) {
+	CursorExtensiones cursor;
+	RachaPendiente* nuevas;
+	DISK_LBA idxBloque, fin = -1;
+	int bloque, n, numRachas = 0;
+
+	initCursorExtensiones(&cursor);
+	for (bloque = 0; bloque < nodoI->numBloques; bloque += n) {
+		idxBloque = buscaBloqueNodoI(miSistemaDeFicheros, nodoI, bloque, &n,
+				&cursor);
+		if (idxBloque == -1)
+			return -1;
+		if (idxBloque == fin) {
+			if (rachas != NULL)
+				(*rachas)[numRachas - 1].numBloques += n;
+			fin += n;
+			continue;
+		}
+		if (rachas != NULL && numRachas == *maxRachas) {
+			nuevas = realloc(*rachas, (*maxRachas * 2 + 16)
+					* sizeof(RachaPendiente));
+			if (nuevas == NULL) {
+				perror("Falló realloc en rachasArchivo");
+				return -1;
+			}
+			*rachas = nuevas;
+			*maxRachas = *maxRachas * 2 + 16;
+		}
+		if (rachas != NULL) {
+			(*rachas)[numRachas].inicio = idxBloque;
+			(*rachas)[numRachas].numBloques = n;
+		}
+		numRachas++;
+		fin = idxBloque + n;
+	}
+	return numRachas;
+}
+
+int mideFragmentacion(MiSistemaDeFicheros* miSistemaDeFicheros,
+		Fragmentacion* f) {
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	EstructuraNodoI* nodoI;
+	DISK_LBA idxBloque;
+	int i, n, racha = 0;
+
+	memset(f, 0, sizeof(Fragmentacion));
+	for (i = 0; i < sb->numNodosI; i++) {
+		if (!nodoIEnUso(miSistemaDeFicheros, i))
+			continue;
+		nodoI = obtenNodoI(miSistemaDeFicheros, i);
+		if (nodoI == NULL || nodoI->tipo != TIPO_ARCHIVO
+				|| nodoI->numBloques == 0)
+			continue;
+		if ((n = rachasArchivo(miSistemaDeFicheros, nodoI, NULL, NULL)) == -1)
+			return -1;
+		f->archivos++;
+		f->fragmentados += n > 1;
+		f->rachas += n;
+		f->bloques += nodoI->numBloques;
+	}
+	for (idxBloque = 0; idxBloque < sb->tamDiscoEnBloques; idxBloque++) {
+		if (leeBitMapa(miSistemaDeFicheros, idxBloque)) {
+			racha = 0;
+			continue;
+		}
+		if (racha++ == 0)
+			f->rachasLibres++;
+		if (racha > f->mayorRachaLibre)
+			f->mayorRachaLibre = racha;
+	}
+	return 0;
+}
+
+double puntuacionFragmentacion(const Fragmentacion* f) {
+	return f->bloques > f->archivos ? 100.0 * (f->rachas - f->archivos)
+			/ (f->bloques - f->archivos) : 0.0;
+}
+
+// Copia los bloques de las rachas, en orden, a partir de destino. Lo que se
+// lee se comprueba con sus sumas y lo que se escribe anota las suyas.
+static int copiaRachas(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const RachaPendiente* rachas, int numRachas, DISK_LBA destino,
+		char* buffer) {
+	DISK_LBA origen;
+	int i, hechos, n, enBuffer = 0;
+
+	for (i = 0; i < numRachas; i++) {
+		for (hechos = 0; hechos < rachas[i].numBloques; hechos += n) {
+			n = rachas[i].numBloques - hechos;
+			if (n > MAX_BLOQUES_POR_ES - enBuffer)
+				n = MAX_BLOQUES_POR_ES - enBuffer;
+			origen = rachas[i].inicio + hechos;
+			if (leeBloques(miSistemaDeFicheros, origen, n, buffer
+					+ (size_t) enBuffer * TAM_BLOQUE_BYTES) == -1
+					|| compruebaSumas(miSistemaDeFicheros, origen, n, buffer
+							+ (size_t) enBuffer * TAM_BLOQUE_BYTES) == -1)
+				return -1;
+			enBuffer += n;
+			// Se escribe de una vez cuando se llena el buffer o al final
+			if (enBuffer < MAX_BLOQUES_POR_ES && (i < numRachas - 1 || hechos
+					+ n < rachas[i].numBloques))
+				continue;
+			// Los bloques pueden haber sido metadatos, o haberse leído por
+			// adelantado, y la caché no debe conservar su contenido anterior
+			olvidaBloques(miSistemaDeFicheros, destino, enBuffer);
+			if (escribeBloques(miSistemaDeFicheros, destino, enBuffer, buffer)
+					== -1 || anotaSumas(miSistemaDeFicheros, destino, enBuffer,
+					buffer) == -1)
+				return -1;
+			destino += enBuffer;
+			enBuffer = 0;
+		}
+	}
+	return 0;
+}
+
+// Pasa las huellas de los bloques de las rachas a los copiados a partir de
+// destino o, si deVuelta, al revés
+static void mueveHuellas(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const RachaPendiente* rachas, int numRachas, DISK_LBA destino,
+		BOOLEAN deVuelta) {
+	int i, j;
+
+	for (i = 0; i < numRachas; destino += rachas[i].numBloques, i++)
+		for (j = 0; j < rachas[i].numBloques; j++)
+			mueveHuella(miSistemaDeFicheros, deVuelta ? destino + j
+					: rachas[i].inicio + j, deVuelta ? rachas[i].inicio + j
+					: destino + j);
+}
+
+int desfragmentaNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, int numNodoI) {
+	EstructuraNodoI* nodoI = obtenNodoI(miSistemaDeFicheros, numNodoI);
+	RachaPendiente* rachas = NULL;
+	char* buffer = NULL;
+	DISK_LBA destino;
+	int maxRachas = 0, numRachas, numBloques, i, j, ret = -1;
+
+	if (nodoI == NULL || nodoI->tipo != TIPO_ARCHIVO || nodoI->numBloques == 0)
+		return 0;
+	numBloques = nodoI->numBloques;
+	if ((numRachas = rachasArchivo(miSistemaDeFicheros, nodoI, &rachas,
+			&maxRachas)) == -1)
+		goto fin;
+	ret = 0;
+	if (numRachas <= 1)
+		goto fin;
+	// Un bloque compartido se queda donde está, y con él todo el archivo
+	ret = 2;
+	for (i = 0; deduplica(miSistemaDeFicheros) && i < numRachas; i++)
+		for (j = 0; j < rachas[i].numBloques; j++)
+			if (referenciasBloque(miSistemaDeFicheros, rachas[i].inicio + j)
+					!= 1)
+				goto fin;
+	if ((destino = primeraRachaLibre(miSistemaDeFicheros, numBloques)) == -1)
+		goto fin;
+
+	ret = -1;
+	if ((buffer = malloc(MAX_BLOQUES_POR_ES * TAM_BLOQUE_BYTES)) == NULL) {
+		perror("Falló malloc en desfragmentaNodoI");
+		goto fin;
+	}
+	cambiaRachaMapa(miSistemaDeFicheros, destino, numBloques, true);
+	if (copiaRachas(miSistemaDeFicheros, rachas, numRachas, destino, buffer)
+			== -1) {
+		fprintf(stderr, "Incapaz de mover los bloques del nodo-i %d\n",
+				numNodoI);
+		cambiaRachaMapa(miSistemaDeFicheros, destino, numBloques, false);
+		goto fin;
+	}
+
+	// Las huellas pasan a los bloques nuevos; así los de antes ya no están
+	// en el índice y se liberan con el árbol
+	mueveHuellas(miSistemaDeFicheros, rachas, numRachas, destino, false);
+	if (truncaNodoI(miSistemaDeFicheros, nodoI, 0) == -1) {
+		fprintf(stderr, "Incapaz de cambiar el árbol del nodo-i %d\n",
+				numNodoI);
+		mueveHuellas(miSistemaDeFicheros, rachas, numRachas, destino, true);
+		cambiaRachaMapa(miSistemaDeFicheros, destino, numBloques, false);
+		goto fin;
+	}
+	// Sin extensiones la raíz tiene sitio: no hace falta anadeExtensionNodoI
+	nodoI->extensiones[0].bloqueLogico = 0;
+	nodoI->extensiones[0].inicio = destino;
+	nodoI->extensiones[0].numBloques = numBloques;
+	nodoI->cabecera.numEntradas = 1;
+	nodoI->numBloques = numBloques;
+	escribeNodoI(miSistemaDeFicheros, numNodoI, nodoI);
+	escribeSuperBloque(miSistemaDeFicheros);
+	ret = 1;
+
+	fin: free(buffer);
+	free(rachas);
+	return ret;
+}
+
+static void escribeFragmentacion(const char* cuando, const Fragmentacion* f) {
+	printf("Fragmentación %s: %.1f (%d de %d archivos fragmentados, %lld rachas para %lld bloques); espacio libre en %lld rachas, la mayor de %d bloques\n",
+			cuando, puntuacionFragmentacion(f), f->fragmentados, f->archivos,
+			f->rachas, f->bloques, f->rachasLibres, f->mayorRachaLibre);
+}
+
+int myDefrag(MiSistemaDeFicheros* miSistemaDeFicheros, char* ruta) {
+	Fragmentacion f;
+	struct timespec t0, t1;
+	EstructuraNodoI* nodoI;
+	long long bloquesMovidos = 0;
+	int i, primero = 0, ultimo, ret, movidos = 0, quedan = 0, fallos = 0;
+
+	ultimo = miSistemaDeFicheros->superBloque.numNodosI - 1;
+	if (ruta != NULL) {
+		primero = ultimo = buscaRuta(miSistemaDeFicheros, ruta);
+		if (primero == -1 || obtenNodoI(miSistemaDeFicheros, primero)->tipo
+				!= TIPO_ARCHIVO) {
+			fprintf(stderr, "%s no es un archivo\n", ruta);
+			return 1;
+		}
+	}
+	if (mideFragmentacion(miSistemaDeFicheros, &f) == -1)
+		return 3;
+	escribeFragmentacion("antes", &f);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = primero; i <= ultimo; i++) {
+		if (!nodoIEnUso(miSistemaDeFicheros, i))
+			continue;
+		ret = desfragmentaNodoI(miSistemaDeFicheros, i);
+		if (ret == -1)
+			fallos++;
+		else if (ret == 2)
+			quedan++;
+		else if (ret == 1) {
+			nodoI = obtenNodoI(miSistemaDeFicheros, i);
+			movidos++;
+			bloquesMovidos += nodoI->numBloques;
+			// Cada archivo movido es una operación
+			cierraOperacion(miSistemaDeFicheros);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	printf("Movidos %d archivos (%lld MB) en %.3f s\n", movidos,
+			bloquesMovidos * TAM_BLOQUE_BYTES >> 20, (t1.tv_sec - t0.tv_sec)
+					+ (t1.tv_nsec - t0.tv_nsec) / 1e9);
+	if (quedan > 0)
+		printf("%d archivos fragmentados se quedan como estaban: comparten bloques o no hay una racha libre tan larga\n",
+				quedan);
+	if (mideFragmentacion(miSistemaDeFicheros, &f) == -1)
+		return 3;
+	escribeFragmentacion("después", &f);
+	return fallos > 0 ? 3 : quedan > 0 ? 2 : 0;
+}
+
+// Mira hasta NODOSI_POR_PASO_FONDO nodos-i a partir de fondo.siguiente y
+// mueve como mucho un archivo. Devuelve si lo ha movido; en *finVuelta,
+// si ha llegado al último nodo-i.
+static BOOLEAN pasoFondo(BOOLEAN* finVuelta) {
+	MiSistemaDeFicheros* miSistemaDeFicheros = fondo.miSistemaDeFicheros;
+	int i, mirados;
+
+	*finVuelta = false;
+	for (mirados = 0; mirados < NODOSI_POR_PASO_FONDO && !*finVuelta;
+			mirados++) {
+		i = fondo.siguiente++;
+		if (fondo.siguiente == miSistemaDeFicheros->superBloque.numNodosI) {
+			fondo.siguiente = 0;
+			*finVuelta = true;
+		}
+		if (!nodoIEnUso(miSistemaDeFicheros, i)
+				|| desfragmentaNodoI(miSistemaDeFicheros, i) != 1)
+			continue;
+		fondo.movidos++;
+		fondo.bloquesMovidos += obtenNodoI(miSistemaDeFicheros, i)->numBloques;
+		cierraOperacion(miSistemaDeFicheros);
+		return true;
+	}
+	return false;
+}
+
+static void* hiloFondo(void* arg) {
+	struct timespec hasta;
+	BOOLEAN movido, finVuelta, vueltaVacia;
+	int movidosVuelta = 0;
+
+	pthread_mutex_lock(&fondo.espera);
+	while (!fondo.parar) {
+		pthread_mutex_unlock(&fondo.espera);
+		pthread_mutex_lock(fondo.cerrojo);
+		movido = pasoFondo(&finVuelta);
+		pthread_mutex_unlock(fondo.cerrojo);
+
+		// Tras mover un archivo se deja pasar a los comandos; tras una
+		// vuelta entera sin mover ninguno se espera más
+		movidosVuelta += movido;
+		vueltaVacia = finVuelta && movidosVuelta == 0;
+		if (finVuelta)
+			movidosVuelta = 0;
+		clock_gettime(CLOCK_REALTIME, &hasta);
+		if (vueltaVacia)
+			hasta.tv_sec += SEGUNDOS_DEFRAG_FONDO;
+		else {
+			hasta.tv_nsec += PAUSA_DEFRAG_FONDO_MS * 1000000L;
+			hasta.tv_sec += hasta.tv_nsec / 1000000000L;
+			hasta.tv_nsec %= 1000000000L;
+		}
+		pthread_mutex_lock(&fondo.espera);
+		if ((movido || vueltaVacia) && !fondo.parar)
+			pthread_cond_timedwait(&fondo.despierta, &fondo.espera, &hasta);
+	}
+	pthread_mutex_unlock(&fondo.espera);
+	return NULL;
+}
+
+int iniciaDefragFondo(MiSistemaDeFicheros* miSistemaDeFicheros,
+		pthread_mutex_t* cerrojo) {
+	if (fondo.enMarcha) {
+		fprintf(stderr, "La desfragmentación de fondo ya está en marcha\n");
+		return -1;
+	}
+	fondo.miSistemaDeFicheros = miSistemaDeFicheros;
+	fondo.cerrojo = cerrojo;
+	fondo.parar = false;
+	fondo.siguiente = 0;
+	fondo.movidos = 0;
+	fondo.bloquesMovidos = 0;
+	if (pthread_create(&fondo.hilo, NULL, hiloFondo, NULL) != 0) {
+		fprintf(stderr, "No se puede crear el hilo de desfragmentación\n");
+		return -1;
+	}
+	fondo.enMarcha = true;
+	return 0;
+}
+
+void paraDefragFondo(void) {
+	if (!fondo.enMarcha)
+		return;
+	pthread_mutex_lock(&fondo.espera);
+	fondo.parar = true;
+	pthread_cond_signal(&fondo.despierta);
+	pthread_mutex_unlock(&fondo.espera);
+	// El hilo puede estar esperando el cerrojo para dar el siguiente paso
+	pthread_mutex_unlock(fondo.cerrojo);
+	pthread_join(fondo.hilo, NULL);
+	pthread_mutex_lock(fondo.cerrojo);
+	fondo.enMarcha = false;
+	printf("Desfragmentación de fondo: %d archivos movidos (%lld MB)\n",
+			fondo.movidos, fondo.bloquesMovidos * TAM_BLOQUE_BYTES >> 20);
+}
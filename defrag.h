@@ -0,0 +1,65 @@
+#ifndef DEFRAG_H
+#define	DEFRAG_H
+
+#include "common.h"
+#include <pthread.h>
+
+// Desfragmentación de los archivos.
+//
+// Un archivo está fragmentado si sus bloques ocupan más de una racha del
+// disco (dos extensiones seguidas en disco cuentan como una). Para
+// desfragmentarlo se busca la primera racha libre donde quepa entero, se
+// copian sus bloques en ella de MAX_BLOQUES_POR_ES en MAX_BLOQUES_POR_ES
+// (una lectura por racha de origen y una escritura por trozo) y su árbol de
+// extensiones se cambia por una sola extensión. Es una operación más: el
+// nodo-i, el árbol, el mapa de bits y las huellas cambian a la vez al
+// confirmarla, y los bloques de antes no se reutilizan hasta entonces (ver
+// liberaRachaDiferida), así que si el sistema se cae el archivo sigue
+// donde estaba.
+//
+// Como la racha se busca desde el principio del disco, los archivos se van
+// juntando allí y el espacio libre queda en rachas más largas.
+//
+// No se mueven los directorios (su tabla de cubetas apunta a bloques del
+// disco), los archivos guardados en el nodo-i ni los que comparten algún
+// bloque con otros (ver huellas.h). Los comprimidos se copian tal cual.
+
+#define PAUSA_DEFRAG_FONDO_MS 50 // Entre dos archivos, en el modo de fondo
+#define SEGUNDOS_DEFRAG_FONDO 10 // Espera tras una vuelta sin nada que mover
+#define NODOSI_POR_PASO_FONDO 4096 // Nodos-i que se miran con el cerrojo cogido
+
+typedef struct Fragmentacion {
+	int archivos;                     // Archivos con bloques
+	int fragmentados;                 // ... en más de una racha
+	long long rachas;                 // Rachas de todos ellos
+	long long bloques;                // Bloques de todos ellos
+	long long rachasLibres;           // Rachas de bloques libres
+	int mayorRachaLibre;
+} Fragmentacion;
+
+// Recorre todos los archivos y el mapa de bits. Devuelve -1 si falla.
+int mideFragmentacion(MiSistemaDeFicheros* miSistemaDeFicheros, Fragmentacion* f);
+// De 0 (cada archivo en una racha) a 100 (cada bloque en la suya): las
+// rachas de más sobre las que podría haber
+double puntuacionFragmentacion(const Fragmentacion* f);
+
+// Mueve el archivo numNodoI a una sola racha, sin cerrar la operación.
+// Devuelve 1 si lo ha movido, 0 si no hacía falta, 2 si no se puede (ver
+// arriba, o no hay una racha libre tan larga) o -1 si falla.
+int desfragmentaNodoI(MiSistemaDeFicheros* miSistemaDeFicheros, int numNodoI);
+
+// Desfragmenta el archivo ruta o, si es NULL, todos, y escribe la
+// fragmentación antes y después. Devuelve 0, 1 si ruta no es un archivo, 2
+// si algún archivo fragmentado se ha quedado como estaba o 3 si falla.
+int myDefrag(MiSistemaDeFicheros* miSistemaDeFicheros, char* ruta);
+
+// Modo de fondo: un hilo que recorre los nodos-i sin parar y desfragmenta
+// los archivos de uno en uno. Lo hace con cerrojo cogido, el mismo que
+// cogen los comandos, y lo suelta entre archivo y archivo para que pasen.
+// Devuelve -1 si ya está en marcha o no se puede crear el hilo.
+int iniciaDefragFondo(MiSistemaDeFicheros* miSistemaDeFicheros, pthread_mutex_t* cerrojo);
+// Para el hilo, si está en marcha, y escribe lo que ha movido. Se llama con
+// el cerrojo cogido.
+void paraDefragFondo(void);
+
+#endif	/* DEFRAG_H */
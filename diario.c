@@ -0,0 +1,366 @@
+#include "diario.h"
+#include "cache.h"
+#include "metadatos.h"
+#include "sumas.h"
+#include <stdlib.h>
+#include <string.h>
+
+// CRC32C, como los bloques (ver sumas.h)
+static uint32_t sumaDiario(const void* datos, size_t tam) {
+	return crc32c(0, datos, tam);
+}
+
+static int escribeCabeceraDiario(MiSistemaDeFicheros* miSistemaDeFicheros,
+		unsigned secuencia) {
+	char bloque[TAM_BLOQUE_BYTES];
+	EstructuraCabeceraDiario* cab = (EstructuraCabeceraDiario*) bloque;
+
+	memset(bloque, 0, TAM_BLOQUE_BYTES);
+	cab->numeroMagico = MAGICO_DIARIO;
+	cab->secuencia = secuencia;
+	return escribeBloques(miSistemaDeFicheros,
+			miSistemaDeFicheros->superBloque.idxDiario, 1, bloque);
+}
+
+int initDiario(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	if (escribeCabeceraDiario(miSistemaDeFicheros, 1) == -1)
+		return -1;
+	miSistemaDeFicheros->posDiario = 1;
+	miSistemaDeFicheros->secuenciaDiario = 1;
+	return 0;
+}
+
+// Busca fuera del diario rachas libres para numBloques bloques y las anota en
+// rachas (como mucho max). No valen los bloques que libera la propia
+// transacción, a los que lo confirmado sigue apuntando hasta que se confirme.
+// Devuelve cuántas rachas ha anotado o -1 si no hay sitio.
+static int buscaSitioFuera(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int numBloques, EstructuraRangoDiario* rachas, int max) {
+	DISK_LBA desde = 0;
+	DISK_LBA inicio, fin;
+	int longitud, i, n = 0;
+
+	while (numBloques > 0) {
+		inicio = buscaRachaLibre(miSistemaDeFicheros, desde, &longitud);
+		if (inicio == -1)
+			return -1;
+		fin = inicio + longitud;
+		desde = fin;
+		for (i = 0; i < miSistemaDeFicheros->numLiberaciones; i++) {
+			RachaPendiente* l = &miSistemaDeFicheros->liberaciones[i];
+			if (l->inicio <= inicio && inicio < l->inicio + l->numBloques) {
+				// Liberada en esta transacción: se sigue detrás de ella
+				desde = l->inicio + l->numBloques;
+				fin = inicio;
+				break;
+			}
+			if (l->inicio > inicio && l->inicio < fin)
+				desde = fin = l->inicio;
+		}
+		if (fin == inicio)
+			continue;
+		if (n == max)
+			return -1;
+		if (fin - inicio > numBloques)
+			fin = inicio + numBloques;
+		rachas[n].pos = inicio;
+		rachas[n].tam = fin - inicio;
+		numBloques -= fin - inicio;
+		n++;
+	}
+	return n;
+}
+
+// Escribe fuera del diario la transacción que no cabe en él y deja en el
+// diario, vacío, un registro con las rachas donde está. Devuelve 1 si no hay
+// sitio para ella y -1 si falla.
+static int escribeFuera(MiSistemaDeFicheros* miSistemaDeFicheros,
+		char* buffer, int numBloques) {
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	EstructuraTransaccion* t;
+	EstructuraRangoDiario* rachas;
+	char* registro;
+	int max = ((size_t) (sb->numBloquesDiario - 1) * TAM_BLOQUE_BYTES
+			- sizeof(EstructuraTransaccion)) / sizeof(EstructuraRangoDiario);
+	int n, i, numBloquesRegistro;
+	int ret = 1;
+
+	// Reproducir lo anterior pisaría los bloques libres que vamos a usar
+	if (miSistemaDeFicheros->posDiario > 1 && reproduceDiario(
+			miSistemaDeFicheros) == -1)
+		return -1;
+
+	registro = calloc(sb->numBloquesDiario - 1, TAM_BLOQUE_BYTES);
+	if (registro == NULL) {
+		perror("Falló calloc en escribeFuera");
+		return -1;
+	}
+	t = (EstructuraTransaccion*) registro;
+	rachas = (EstructuraRangoDiario*) (t + 1);
+	n = buscaSitioFuera(miSistemaDeFicheros, numBloques, rachas, max);
+	if (n == -1)
+		goto fin;
+
+	// La transacción y los datos que hay debajo tienen que ser duraderos
+	// antes que el registro que apunta a ellos
+	ret = -1;
+	for (i = 0; i < n; i++) {
+		if (escribeBloques(miSistemaDeFicheros, rachas[i].pos, rachas[i].tam,
+				buffer) == -1)
+			goto fin;
+		buffer += rachas[i].tam * TAM_BLOQUE_BYTES;
+	}
+	if (sincronizaDisco(miSistemaDeFicheros) == -1) {
+		perror("Falló la sincronización en escribeFuera");
+		goto fin;
+	}
+
+	numBloquesRegistro = (sizeof(EstructuraTransaccion) + n
+			* sizeof(EstructuraRangoDiario) + TAM_BLOQUE_BYTES - 1)
+			/ TAM_BLOQUE_BYTES;
+	t->numeroMagico = MAGICO_TRANSACCION_FUERA;
+	t->secuencia = miSistemaDeFicheros->secuenciaDiario;
+	t->numRangos = n;
+	t->numBloques = numBloquesRegistro;
+	t->suma = sumaDiario(registro, (size_t) numBloquesRegistro
+			* TAM_BLOQUE_BYTES);
+	if (escribeBloques(miSistemaDeFicheros, sb->idxDiario
+			+ miSistemaDeFicheros->posDiario, numBloquesRegistro, registro) == -1)
+		goto fin;
+	if (sincronizaDisco(miSistemaDeFicheros) == -1) {
+		perror("Falló la sincronización en escribeFuera");
+		goto fin;
+	}
+	miSistemaDeFicheros->posDiario += numBloquesRegistro;
+	miSistemaDeFicheros->secuenciaDiario++;
+	// Los bloques que ocupa siguen libres: hay que llevarla a su sitio antes
+	// de que se reutilicen
+	miSistemaDeFicheros->checkpointPendiente = true;
+	ret = 0;
+
+	fin: free(registro);
+	return ret;
+}
+
+int escribeTransaccion(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const RangoSucio* rangos, int n) {
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	size_t tam = sizeof(EstructuraTransaccion) + n
+			* sizeof(EstructuraRangoDiario);
+	EstructuraTransaccion* t;
+	EstructuraRangoDiario* r;
+	char* buffer;
+	char* p;
+	int numBloques, i, ret;
+
+	for (i = 0; i < n; i++)
+		tam += rangos[i].tam;
+	numBloques = (tam + TAM_BLOQUE_BYTES - 1) / TAM_BLOQUE_BYTES;
+
+	buffer = calloc(numBloques, TAM_BLOQUE_BYTES);
+	if (buffer == NULL) {
+		perror("Falló calloc en escribeTransaccion");
+		return -1;
+	}
+	t = (EstructuraTransaccion*) buffer;
+	t->numeroMagico = MAGICO_TRANSACCION;
+	t->secuencia = miSistemaDeFicheros->secuenciaDiario;
+	t->numRangos = n;
+	t->numBloques = numBloques;
+	r = (EstructuraRangoDiario*) (t + 1);
+	p = (char*) (r + n);
+	for (i = 0; i < n; i++) {
+		r[i].pos = rangos[i].pos;
+		r[i].tam = rangos[i].tam;
+		memcpy(p, rangos[i].memoria, rangos[i].tam);
+		p += rangos[i].tam;
+	}
+	t->suma = sumaDiario(buffer, (size_t) numBloques * TAM_BLOQUE_BYTES);
+
+	if (numBloques > sb->numBloquesDiario - 1) {
+		ret = escribeFuera(miSistemaDeFicheros, buffer, numBloques);
+		free(buffer);
+		return ret;
+	}
+	if (miSistemaDeFicheros->posDiario + numBloques > sb->numBloquesDiario
+			&& reproduceDiario(miSistemaDeFicheros) == -1) {
+		free(buffer);
+		return -1;
+	}
+
+	// Los datos escritos antes sobre la imagen tienen que ser duraderos antes
+	// que la transacción que apunta a ellos: si no, tras una caída podría
+	// quedar confirmado un nodo-i con bloques de basura
+	if (sincronizaDisco(miSistemaDeFicheros) == -1) {
+		perror("Falló la sincronización en escribeTransaccion");
+		free(buffer);
+		return -1;
+	}
+	ret = escribeBloques(miSistemaDeFicheros, sb->idxDiario
+			+ miSistemaDeFicheros->posDiario, numBloques, buffer);
+	free(buffer);
+	if (ret == -1)
+		return -1;
+	// Esta sincronización confirma la transacción
+	if (sincronizaDisco(miSistemaDeFicheros) == -1) {
+		perror("Falló la sincronización en escribeTransaccion");
+		return -1;
+	}
+	miSistemaDeFicheros->posDiario += numBloques;
+	miSistemaDeFicheros->secuenciaDiario++;
+	return 0;
+}
+
+// Comprueba que t es una transacción completa con ese número mágico y esa
+// secuencia que ocupa como mucho max bloques
+static BOOLEAN transaccionValida(EstructuraTransaccion* t, unsigned magico,
+		unsigned secuencia, int max) {
+	uint32_t suma;
+
+	if (t->numeroMagico != magico || t->secuencia != secuencia
+			|| t->numBloques < 1 || t->numBloques > max)
+		return false;
+	suma = t->suma;
+	t->suma = 0;
+	return sumaDiario(t, (size_t) t->numBloques * TAM_BLOQUE_BYTES) == suma;
+}
+
+// Aplica los rangos de la transacción t, que ya se ha comprobado
+static int aplicaTransaccion(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraTransaccion* t) {
+	EstructuraRangoDiario* r = (EstructuraRangoDiario*) (t + 1);
+	char* fin = (char*) t + (size_t) t->numBloques * TAM_BLOQUE_BYTES;
+	char* p = (char*) (r + t->numRangos);
+	RangoSucio rango;
+	int i;
+
+	if (t->numRangos < 0 || p > fin)
+		return -1;
+	for (i = 0; i < t->numRangos; i++) {
+		if (r[i].tam < 0 || r[i].tam > fin - p)
+			return -1;
+		rango.pos = r[i].pos;
+		rango.memoria = p;
+		rango.tam = r[i].tam;
+		rango.propio = false;
+		if (escribeRangos(miSistemaDeFicheros, &rango, 1) == -1)
+			return -1;
+		p += r[i].tam;
+	}
+	return 0;
+}
+
+// Lee de las rachas del registro t la transacción que se escribió fuera del
+// diario y la aplica. Con el registro confirmado tiene que estar entera.
+static int aplicaFuera(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraTransaccion* t) {
+	EstructuraRangoDiario* rachas = (EstructuraRangoDiario*) (t + 1);
+	char* fin = (char*) t + (size_t) t->numBloques * TAM_BLOQUE_BYTES;
+	int tamDisco = miSistemaDeFicheros->superBloque.tamDiscoEnBloques;
+	int64_t numBloques = 0;
+	char* buffer;
+	char* p;
+	int i;
+	int ret = -1;
+
+	if (t->numRangos < 1 || (char*) (rachas + t->numRangos) > fin)
+		return -1;
+	for (i = 0; i < t->numRangos; i++) {
+		if (rachas[i].pos < 0 || rachas[i].tam < 1 || rachas[i].tam > tamDisco
+				- rachas[i].pos)
+			return -1;
+		numBloques += rachas[i].tam;
+	}
+	if (numBloques > tamDisco)
+		return -1;
+
+	buffer = malloc((size_t) numBloques * TAM_BLOQUE_BYTES);
+	if (buffer == NULL) {
+		perror("Falló malloc en aplicaFuera");
+		return -1;
+	}
+	for (i = 0, p = buffer; i < t->numRangos; i++) {
+		if (leeBloques(miSistemaDeFicheros, rachas[i].pos, rachas[i].tam, p)
+				== -1)
+			goto fin;
+		p += rachas[i].tam * TAM_BLOQUE_BYTES;
+	}
+	if (transaccionValida((EstructuraTransaccion*) buffer, MAGICO_TRANSACCION,
+			t->secuencia, numBloques))
+		ret = aplicaTransaccion(miSistemaDeFicheros,
+				(EstructuraTransaccion*) buffer);
+
+	fin: free(buffer);
+	return ret;
+}
+
+int reproduceDiario(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	EstructuraCabeceraDiario cab;
+	EstructuraTransaccion* t;
+	char* buffer;
+	unsigned secuencia;
+	int aplicadas = 0;
+	int ret;
+	int pos = 1;
+	// Montando no sabemos dónde acaba el diario: se lee entero
+	int numBloques = miSistemaDeFicheros->posDiario > 0
+			? miSistemaDeFicheros->posDiario : sb->numBloquesDiario;
+
+	buffer = malloc((size_t) numBloques * TAM_BLOQUE_BYTES);
+	if (buffer == NULL) {
+		perror("Falló malloc en reproduceDiario");
+		return -1;
+	}
+	if (leeBloques(miSistemaDeFicheros, sb->idxDiario, numBloques, buffer)
+			== -1)
+		goto error;
+	memcpy(&cab, buffer, sizeof(EstructuraCabeceraDiario));
+	if (cab.numeroMagico != MAGICO_DIARIO) {
+		fprintf(stderr, "Cabecera del diario dañada\n");
+		goto error;
+	}
+
+	// Se aplican en orden mientras haya transacciones completas
+	for (secuencia = cab.secuencia; pos < numBloques; secuencia++) {
+		t = (EstructuraTransaccion*) (buffer + (size_t) pos * TAM_BLOQUE_BYTES);
+		if (t->numeroMagico == MAGICO_TRANSACCION_FUERA) {
+			if (!transaccionValida(t, MAGICO_TRANSACCION_FUERA, secuencia,
+					numBloques - pos))
+				break;
+			ret = aplicaFuera(miSistemaDeFicheros, t);
+		} else {
+			if (!transaccionValida(t, MAGICO_TRANSACCION, secuencia, numBloques
+					- pos))
+				break;
+			ret = aplicaTransaccion(miSistemaDeFicheros, t);
+		}
+		if (ret == -1) {
+			fprintf(stderr, "Transacción %u del diario dañada\n", secuencia);
+			goto error;
+		}
+		pos += t->numBloques;
+		aplicadas++;
+	}
+
+	// Lo aplicado tiene que ser duradero antes de vaciar el diario, y el
+	// diario tiene que estar vacío antes de volver a escribir en él. Los
+	// bloques sucios de la caché son posteriores a lo aplicado y van después.
+	if (vaciaCache(miSistemaDeFicheros) == -1)
+		goto error;
+	if (aplicadas > 0) {
+		if (sincronizaDisco(miSistemaDeFicheros) == -1
+				|| escribeCabeceraDiario(miSistemaDeFicheros, secuencia) == -1
+				|| sincronizaDisco(miSistemaDeFicheros) == -1) {
+			perror("Falló el checkpoint del diario");
+			goto error;
+		}
+	}
+	free(buffer);
+	miSistemaDeFicheros->posDiario = 1;
+	miSistemaDeFicheros->secuenciaDiario = secuencia;
+	return aplicadas;
+
+	error: free(buffer);
+	return -1;
+}
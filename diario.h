@@ -0,0 +1,68 @@
+#ifndef DIARIO_H
+#define	DIARIO_H
+
+#include "common.h"
+
+// Diario de metadatos (write-ahead log).
+//
+// Ocupa numBloquesDiario bloques a partir de idxDiario. El primero es la
+// cabecera, con la secuencia de la primera transacción que falta por llevar
+// a su sitio; detrás van las transacciones, una tras otra:
+//
+//   EstructuraTransaccion | numRangos x EstructuraRangoDiario | datos | relleno
+//
+// Cada transacción se escribe con una sola llamada y la suma de
+// comprobación, calculada sobre toda ella, hace de registro de confirmación:
+// si una escritura se queda a medias, la transacción no cuenta. Antes de
+// escribirla se sincroniza la imagen, para que los datos a los que apunta
+// sean duraderos antes que ella.
+//
+// Una transacción que no cabe en el diario vacío se escribe en bloques
+// libres de la imagen, y en el diario queda solo un registro con la misma
+// cabecera (numeroMagico MAGICO_TRANSACCION_FUERA, numRangos rachas) seguida
+// de las rachas donde está, en bloques. Los bloques siguen libres en el mapa,
+// así que se lleva a su sitio nada más confirmarla.
+//
+// Los metadatos confirmados solo se llevan a su sitio en el checkpoint
+// (reproduceDiario), cuando el diario se llena y al desmontar. Al montar se
+// hace lo mismo con lo que haya quedado en el diario.
+
+#define MAGICO_DIARIO 0x4a534653            // "SFSJ"
+#define MAGICO_TRANSACCION 0x54534653       // "SFST"
+#define MAGICO_TRANSACCION_FUERA 0x46534653 // "SFSF"
+
+typedef struct EstructuraCabeceraDiario {
+  unsigned numeroMagico;    // MAGICO_DIARIO
+  unsigned secuencia;       // Secuencia de la primera transacción
+} EstructuraCabeceraDiario;
+
+typedef struct EstructuraTransaccion {
+  unsigned numeroMagico;    // MAGICO_TRANSACCION
+  unsigned secuencia;       // Una más que la anterior
+  int numRangos;            // Núm. de rangos
+  int numBloques;           // Bloques que ocupa, cabecera incluida
+  uint32_t suma;            // Suma de comprobación (con este campo a 0)
+  int relleno;              // Alinea los rangos que van detrás
+} EstructuraTransaccion;
+
+typedef struct EstructuraRangoDiario {
+  int64_t pos;              // Posición en disco
+  int64_t tam;              // Núm. de bytes
+} EstructuraRangoDiario;
+
+// Deja vacío el diario de una imagen recién formateada
+int initDiario(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+// Añade una transacción con los rangos y la hace duradera. Si el diario no
+// tiene sitio hace antes un checkpoint, y si no cabría ni con el diario vacío
+// la escribe fuera de él y deja checkpointPendiente. Devuelve 1 si tampoco
+// hay bloques libres para ella (el diario queda vacío y los rangos hay que
+// escribirlos en su sitio, sin protección frente a caídas) y -1 si falla.
+int escribeTransaccion(MiSistemaDeFicheros* miSistemaDeFicheros, const RangoSucio* rangos, int n);
+
+// Lleva a su sitio las transacciones completas del diario, en orden, y lo
+// vacía. Devuelve cuántas ha aplicado o -1 si falla.
+int reproduceDiario(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+#endif	/* DIARIO_H */
+
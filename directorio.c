@@ -0,0 +1,643 @@
+#include "directorio.h"
+#include "metadatos.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MASCARA(bits) (((uint32_t) 1 << (bits)) - 1)
+#define ENTRADA(cubeta, pos) ((EstructuraEntradaDirectorio*) ((cubeta)->entradas + (pos)))
+
+uint32_t hashNombre(const char* nombre) {
+	uint32_t h = 2166136261u;
+
+	// FNV-1a, con la mezcla final de MurmurHash3 para que los bits bajos,
+	// que son los que indexan la tabla, salgan bien repartidos
+	while (*nombre) {
+		h ^= (unsigned char) *nombre++;
+		h *= 16777619u;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+
+static DISK_LBA bloqueDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DirectorioAbierto* d, int bloqueLogico) {
+	return buscaBloqueNodoI(miSistemaDeFicheros, obtenNodoI(
+			miSistemaDeFicheros, d->idxNodoI), bloqueLogico, NULL, NULL);
+}
+
+// Añade numBloques bloques al final del archivo del directorio. Devuelve el
+// primero (bloque lógico) o -1 si no hay sitio.
+static int creceDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DirectorioAbierto* d, int numBloques) {
+	EstructuraNodoI* nodoI = obtenNodoI(miSistemaDeFicheros, d->idxNodoI);
+	int bloqueLogico = nodoI->numBloques;
+
+	if (reservaBloquesNodosI(miSistemaDeFicheros, nodoI, numBloques) == -1) {
+		fprintf(stderr, "No hay sitio para ampliar el directorio\n");
+		return -1;
+	}
+	nodoI->tamArchivo = (int64_t) nodoI->numBloques * TAM_BLOQUE_BYTES;
+	nodoI->tiempoModificado = time(NULL);
+	escribeNodoI(miSistemaDeFicheros, d->idxNodoI, nodoI);
+	return bloqueLogico;
+}
+
+static int escribeCabeceraDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DirectorioAbierto* d) {
+	EstructuraDirectorio bloque;
+
+	memset(&bloque, 0, sizeof(EstructuraDirectorio));
+	bloque.cabecera = d->cabecera;
+	return escribeBloqueMetadatos(miSistemaDeFicheros, d->idxCabecera, &bloque);
+}
+
+// Escribe los bloques de la tabla que contienen las entradas desde,
+// desde+paso, desde+2*paso... hasta el final de la tabla
+static int escribeTablaDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DirectorioAbierto* d, uint32_t desde, uint32_t paso) {
+	uint32_t numEntradas = (uint32_t) 1 << d->cabecera.profundidadGlobal;
+	int ultimo = -1;
+	int k;
+	uint32_t i;
+	DISK_LBA idxBloque;
+
+	for (i = desde; i < numEntradas; i += paso) {
+		k = i / ENTRADAS_TABLA_POR_BLOQUE;
+		if (k == ultimo)
+			continue;
+		idxBloque = bloqueDirectorio(miSistemaDeFicheros, d,
+				d->cabecera.bloqueTabla + k);
+		if (idxBloque == -1 || escribeBloqueMetadatos(miSistemaDeFicheros,
+				idxBloque, d->tabla + (size_t) k * ENTRADAS_TABLA_POR_BLOQUE)
+				== -1)
+			return -1;
+		ultimo = k;
+	}
+	return 0;
+}
+
+static BOOLEAN cubetaValida(const EstructuraCubeta* cubeta, DISK_LBA idxCubeta) {
+	if (cubeta->bytesUsados < 0 || cubeta->bytesUsados
+			> (int) sizeof(cubeta->entradas)) {
+		fprintf(stderr, "Cubeta %d del directorio dañada\n", idxCubeta);
+		return false;
+	}
+	return true;
+}
+
+static int leeCubeta(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA idxCubeta, EstructuraCubeta* cubeta) {
+	if (leeBloqueMetadatos(miSistemaDeFicheros, idxCubeta, cubeta) == -1
+			|| !cubetaValida(cubeta, idxCubeta))
+		return -1;
+	return 0;
+}
+
+// Devuelve la entrada que empieza en *pos y deja en *pos la siguiente, o
+// NULL al llegar al final de la cubeta (o a una entrada dañada)
+static EstructuraEntradaDirectorio* siguienteEntrada(EstructuraCubeta* cubeta,
+		int* pos) {
+	EstructuraEntradaDirectorio* e;
+
+	if (*pos + (int) sizeof(EstructuraEntradaDirectorio) > cubeta->bytesUsados)
+		return NULL;
+	e = ENTRADA(cubeta, *pos);
+	if (e->tamEntrada < TAM_ENTRADA_DIRECTORIO(e->tamNombre) || *pos
+			+ e->tamEntrada > cubeta->bytesUsados)
+		return NULL;
+	*pos += e->tamEntrada;
+	return e;
+}
+
+// Posición del nombre en la cubeta, o -1 si no está
+static int buscaEnCubeta(EstructuraCubeta* cubeta, uint32_t hash,
+		const char* nombre) {
+	EstructuraEntradaDirectorio* e;
+	int pos = 0;
+
+	while ((e = siguienteEntrada(cubeta, &pos)) != NULL) {
+		if (e->hash == hash && strcmp(e->nombreArchivo, nombre) == 0)
+			return pos - e->tamEntrada;
+	}
+	return -1;
+}
+
+// Busca el directorio entre los abiertos. Si no está, devuelve vacía la
+// ranura donde cargarlo: una libre o la del que lleve más tiempo sin usarse.
+static DirectorioAbierto* ranuraDirectorio(
+		MiSistemaDeFicheros* miSistemaDeFicheros, int idxNodoI,
+		BOOLEAN* abierto) {
+	DirectorioAbierto* d = miSistemaDeFicheros->directorios;
+	DirectorioAbierto* victima = NULL;
+	int i;
+
+	if (d == NULL) {
+		d = malloc(MAX_DIRECTORIOS_ABIERTOS * sizeof(DirectorioAbierto));
+		if (d == NULL) {
+			perror("Falló malloc en ranuraDirectorio");
+			return NULL;
+		}
+		for (i = 0; i < MAX_DIRECTORIOS_ABIERTOS; i++) {
+			d[i].idxNodoI = -1;
+			d[i].tabla = NULL;
+			d[i].ultimoUso = 0;
+		}
+		miSistemaDeFicheros->directorios = d;
+	}
+	for (i = 0; i < MAX_DIRECTORIOS_ABIERTOS; i++) {
+		if (d[i].idxNodoI == idxNodoI) {
+			*abierto = true;
+			return &d[i];
+		}
+		if (victima == NULL || (victima->idxNodoI != -1 && (d[i].idxNodoI
+				== -1 || d[i].ultimoUso < victima->ultimoUso)))
+			victima = &d[i];
+	}
+	free(victima->tabla);
+	victima->tabla = NULL;
+	victima->idxNodoI = -1;
+	*abierto = false;
+	return victima;
+}
+
+// Lee la cabecera y la tabla de cubetas del directorio idxNodoI en d
+static int cargaDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DirectorioAbierto* d, int idxNodoI) {
+	EstructuraCabeceraDirectorio* cab = &d->cabecera;
+	EstructuraNodoI* nodoI = obtenNodoI(miSistemaDeFicheros, idxNodoI);
+	EstructuraDirectorio* bloque = malloc(sizeof(EstructuraDirectorio));
+	CursorExtensiones* cursor = malloc(sizeof(CursorExtensiones));
+	DISK_LBA idxBloque;
+	int k, contiguos;
+
+	if (bloque == NULL || cursor == NULL) {
+		perror("Falló malloc en cargaDirectorio");
+		goto error;
+	}
+	d->idxNodoI = idxNodoI;
+	if (nodoI->numBloques < 3 || (d->idxCabecera = bloqueDirectorio(
+			miSistemaDeFicheros, d, 0)) == -1 || leeBloqueMetadatos(
+			miSistemaDeFicheros, d->idxCabecera, bloque) == -1)
+		goto danado;
+	*cab = bloque->cabecera;
+	if (cab->numeroMagico != MAGICO_DIRECTORIO || cab->profundidadGlobal < 0
+			|| cab->profundidadGlobal > MAX_PROFUNDIDAD_DIRECTORIO
+			|| (size_t) cab->numBloquesTabla * ENTRADAS_TABLA_POR_BLOQUE
+					< (size_t) 1 << cab->profundidadGlobal
+			|| cab->bloqueTabla + cab->numBloquesTabla > nodoI->numBloques)
+		goto danado;
+
+	// La tabla se lee en tantas llamadas como rachas contiguas tenga
+	d->tabla = malloc((size_t) cab->numBloquesTabla * TAM_BLOQUE_BYTES);
+	if (d->tabla == NULL) {
+		perror("Falló malloc en cargaDirectorio");
+		goto error;
+	}
+	initCursorExtensiones(cursor);
+	for (k = 0; k < cab->numBloquesTabla; k += contiguos) {
+		idxBloque = buscaBloqueNodoI(miSistemaDeFicheros, nodoI,
+				cab->bloqueTabla + k, &contiguos, cursor);
+		if (contiguos > cab->numBloquesTabla - k)
+			contiguos = cab->numBloquesTabla - k;
+		if (idxBloque == -1 || leeBloquesMetadatos(miSistemaDeFicheros,
+				idxBloque, contiguos, d->tabla + (size_t) k
+						* ENTRADAS_TABLA_POR_BLOQUE) == -1)
+			goto error;
+	}
+	free(bloque);
+	free(cursor);
+	return 0;
+
+	danado: fprintf(stderr, "Cabecera del directorio %d dañada\n", idxNodoI);
+	error: free(bloque);
+	free(cursor);
+	free(d->tabla);
+	d->tabla = NULL;
+	d->idxNodoI = -1;
+	return -1;
+}
+
+int creaDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros, int idxNodoI) {
+	EstructuraNodoI* nodoI;
+	EstructuraCabeceraDirectorio* cab;
+	EstructuraCubeta* cubeta;
+	DirectorioAbierto* d;
+	BOOLEAN abierto;
+
+	d = ranuraDirectorio(miSistemaDeFicheros, idxNodoI, &abierto);
+	if (d == NULL)
+		return -1;
+	free(d->tabla);
+	d->tabla = calloc(1, TAM_BLOQUE_BYTES);
+	cubeta = calloc(1, sizeof(EstructuraCubeta));
+	if (d->tabla == NULL || cubeta == NULL) {
+		perror("Falló calloc en creaDirectorio");
+		free(cubeta);
+		d->idxNodoI = -1;
+		return -1;
+	}
+	if ((nodoI = ocupaNodoI(miSistemaDeFicheros, idxNodoI)) == NULL) {
+		free(cubeta);
+		d->idxNodoI = -1;
+		return -1;
+	}
+	nodoI->tipo = TIPO_DIRECTORIO;
+	d->idxNodoI = idxNodoI;
+	d->ultimoUso = ++miSistemaDeFicheros->usoDirectorios;
+
+	// Cabecera, tabla con una sola entrada y la primera cubeta
+	if (creceDirectorio(miSistemaDeFicheros, d, 3) == -1) {
+		liberaNodoI(miSistemaDeFicheros, idxNodoI);
+		d->idxNodoI = -1;
+		free(cubeta);
+		return -1;
+	}
+	cab = &d->cabecera;
+	memset(cab, 0, sizeof(EstructuraCabeceraDirectorio));
+	cab->numeroMagico = MAGICO_DIRECTORIO;
+	cab->numArchivos = 0;
+	cab->profundidadGlobal = 0;
+	cab->numCubetas = 1;
+	cab->bloqueTabla = 1;
+	cab->numBloquesTabla = 1;
+	d->idxCabecera = bloqueDirectorio(miSistemaDeFicheros, d, 0);
+	d->tabla[0] = bloqueDirectorio(miSistemaDeFicheros, d, 2);
+
+	if (escribeBloqueMetadatos(miSistemaDeFicheros, d->tabla[0], cubeta) == -1
+			|| escribeTablaDirectorio(miSistemaDeFicheros, d, 0, 1) == -1
+			|| escribeCabeceraDirectorio(miSistemaDeFicheros, d) == -1) {
+		// Se deshace todo, como si no se hubiera creado
+		liberaBloquesNodoI(miSistemaDeFicheros, nodoI);
+		liberaNodoI(miSistemaDeFicheros, idxNodoI);
+		d->idxNodoI = -1;
+		free(cubeta);
+		return -1;
+	}
+	free(cubeta);
+	return 0;
+}
+
+DirectorioAbierto* abreDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int idxNodoI) {
+	EstructuraNodoI* nodoI = obtenNodoI(miSistemaDeFicheros, idxNodoI);
+	DirectorioAbierto* d;
+	BOOLEAN abierto;
+
+	if (nodoI == NULL || nodoI->tipo != TIPO_DIRECTORIO)
+		return NULL;
+	d = ranuraDirectorio(miSistemaDeFicheros, idxNodoI, &abierto);
+	if (d == NULL || (!abierto && cargaDirectorio(miSistemaDeFicheros, d,
+			idxNodoI) == -1))
+		return NULL;
+	d->ultimoUso = ++miSistemaDeFicheros->usoDirectorios;
+	return d;
+}
+
+void cierraDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros, int idxNodoI) {
+	int i;
+
+	if (miSistemaDeFicheros->directorios == NULL)
+		return;
+	for (i = 0; i < MAX_DIRECTORIOS_ABIERTOS; i++) {
+		if (miSistemaDeFicheros->directorios[i].idxNodoI == idxNodoI) {
+			free(miSistemaDeFicheros->directorios[i].tabla);
+			miSistemaDeFicheros->directorios[i].tabla = NULL;
+			miSistemaDeFicheros->directorios[i].idxNodoI = -1;
+		}
+	}
+}
+
+void liberaDirectorios(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	int i;
+
+	if (miSistemaDeFicheros->directorios == NULL)
+		return;
+	for (i = 0; i < MAX_DIRECTORIOS_ABIERTOS; i++)
+		free(miSistemaDeFicheros->directorios[i].tabla);
+	free(miSistemaDeFicheros->directorios);
+	miSistemaDeFicheros->directorios = NULL;
+}
+
+// Duplica la tabla. Si deja de caber en sus bloques se copia a otros nuevos
+// al final del directorio, y los antiguos se reciclan como cubetas.
+static int duplicaTabla(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DirectorioAbierto* d) {
+	EstructuraCabeceraDirectorio* cab = &d->cabecera;
+	size_t numEntradas = (size_t) 1 << cab->profundidadGlobal;
+	int numBloques = (2 * numEntradas + ENTRADAS_TABLA_POR_BLOQUE - 1)
+			/ ENTRADAS_TABLA_POR_BLOQUE;
+	DISK_LBA* tabla;
+	int primero;
+
+	if (numBloques > cab->numBloquesTabla) {
+		tabla = realloc(d->tabla, (size_t) numBloques * TAM_BLOQUE_BYTES);
+		if (tabla == NULL) {
+			perror("Falló realloc en duplicaTabla");
+			return -1;
+		}
+		d->tabla = tabla;
+		if ((primero = creceDirectorio(miSistemaDeFicheros, d, numBloques))
+				== -1)
+			return -1;
+		// Si quedaban bloques reciclados sin usar se pierden; es raro, porque
+		// la división que provoca esta duplicación ya gasta uno
+		cab->bloqueReciclado = cab->bloqueTabla;
+		cab->numBloquesReciclados = cab->numBloquesTabla;
+		cab->bloqueTabla = primero;
+		cab->numBloquesTabla = numBloques;
+	}
+	memcpy(d->tabla + numEntradas, d->tabla, numEntradas * sizeof(DISK_LBA));
+	cab->profundidadGlobal++;
+	if (escribeTablaDirectorio(miSistemaDeFicheros, d, 0, 1) == -1)
+		return -1;
+	return escribeCabeceraDirectorio(miSistemaDeFicheros, d);
+}
+
+// Bloque en disco para una cubeta nueva
+static DISK_LBA nuevaCubeta(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DirectorioAbierto* d) {
+	EstructuraCabeceraDirectorio* cab = &d->cabecera;
+	int bloqueLogico;
+
+	if (cab->numBloquesReciclados > 0) {
+		bloqueLogico = cab->bloqueReciclado++;
+		cab->numBloquesReciclados--;
+	} else if ((bloqueLogico = creceDirectorio(miSistemaDeFicheros, d, 1))
+			== -1) {
+		return -1;
+	}
+	return bloqueDirectorio(miSistemaDeFicheros, d, bloqueLogico);
+}
+
+// Divide la cubeta a la que apunta la entrada i de la tabla, que está en
+// cubeta, repartiendo sus entradas con nueva según un bit más del hash
+static int divideCubeta(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DirectorioAbierto* d, uint32_t i, EstructuraCubeta* cubeta,
+		EstructuraCubeta* nueva) {
+	EstructuraCabeceraDirectorio* cab = &d->cabecera;
+	int profundidad = cubeta->profundidadLocal;
+	DISK_LBA idxCubeta = d->tabla[i];
+	DISK_LBA idxNueva;
+	EstructuraEntradaDirectorio* e;
+	uint32_t j, desde, paso;
+	int pos, tam, usados, quedan;
+
+	if (profundidad == cab->profundidadGlobal) {
+		if (cab->profundidadGlobal == MAX_PROFUNDIDAD_DIRECTORIO) {
+			fprintf(stderr, "Directorio lleno\n");
+			return -1;
+		}
+		if (duplicaTabla(miSistemaDeFicheros, d) == -1)
+			return -1;
+	}
+	if ((idxNueva = nuevaCubeta(miSistemaDeFicheros, d)) == -1)
+		return -1;
+
+	// Las que se quedan se compactan al principio de la cubeta; nunca pisan
+	// a una que quede por mirar
+	memset(nueva, 0, sizeof(EstructuraCubeta));
+	nueva->profundidadLocal = cubeta->profundidadLocal = profundidad + 1;
+	pos = usados = quedan = 0;
+	while ((e = siguienteEntrada(cubeta, &pos)) != NULL) {
+		tam = e->tamEntrada;
+		if ((e->hash >> profundidad) & 1) {
+			memcpy(nueva->entradas + nueva->bytesUsados, e, tam);
+			nueva->bytesUsados += tam;
+			nueva->numEntradas++;
+		} else {
+			memmove(cubeta->entradas + usados, e, tam);
+			usados += tam;
+			quedan++;
+		}
+	}
+	memset(cubeta->entradas + usados, 0, cubeta->bytesUsados - usados);
+	cubeta->bytesUsados = usados;
+	cubeta->numEntradas = quedan;
+	if (escribeBloqueMetadatos(miSistemaDeFicheros, idxCubeta, cubeta) == -1
+			|| escribeBloqueMetadatos(miSistemaDeFicheros, idxNueva, nueva)
+					== -1)
+		return -1;
+
+	// Las entradas de la tabla que compartían la cubeta y tienen a 1 el
+	// bit nuevo pasan a la cubeta nueva
+	desde = (i & MASCARA(profundidad)) | ((uint32_t) 1 << profundidad);
+	paso = (uint32_t) 1 << (profundidad + 1);
+	for (j = desde; j < (uint32_t) 1 << cab->profundidadGlobal; j += paso)
+		d->tabla[j] = idxNueva;
+	if (escribeTablaDirectorio(miSistemaDeFicheros, d, desde, paso) == -1)
+		return -1;
+	cab->numCubetas++;
+	return escribeCabeceraDirectorio(miSistemaDeFicheros, d);
+}
+
+int buscaEntradaDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int idxDirectorio, const char* nombre) {
+	uint64_t t0 = empiezaMedida(miSistemaDeFicheros);
+	DirectorioAbierto* d = abreDirectorio(miSistemaDeFicheros, idxDirectorio);
+	EstructuraCubeta* cubeta;
+	uint32_t hash = hashNombre(nombre);
+	DISK_LBA idxCubeta;
+	int pos, idxNodoI = -1;
+
+	if (d == NULL)
+		return -1;
+	// Solo se consulta, así que se busca sobre el bloque de la caché, sin
+	// copiarlo
+	idxCubeta = d->tabla[hash & MASCARA(d->cabecera.profundidadGlobal)];
+	cubeta = (EstructuraCubeta*) fijaBloqueMetadatos(miSistemaDeFicheros,
+			idxCubeta);
+	if (cubeta == NULL)
+		return -1;
+	if (cubetaValida(cubeta, idxCubeta) && (pos = buscaEnCubeta(cubeta, hash,
+			nombre)) != -1)
+		idxNodoI = ENTRADA(cubeta, pos)->idxNodoI;
+	sueltaBloqueMetadatos(miSistemaDeFicheros, cubeta);
+	terminaMedida(miSistemaDeFicheros, EST_BUSCA_DIRECTORIO, t0, 0);
+	return idxNodoI;
+}
+
+int anadeEntradaDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int idxDirectorio, const char* nombre, int idxNodoI) {
+	DirectorioAbierto* d = abreDirectorio(miSistemaDeFicheros, idxDirectorio);
+	EstructuraCubeta* cubetas;
+	EstructuraEntradaDirectorio* e;
+	uint32_t hash = hashNombre(nombre);
+	size_t tamNombre = strlen(nombre);
+	int tam = TAM_ENTRADA_DIRECTORIO(tamNombre);
+	uint32_t i;
+	int ret = -1;
+
+	if (d == NULL)
+		return -1;
+	if ((cubetas = malloc(2 * sizeof(EstructuraCubeta))) == NULL) {
+		perror("Falló malloc en anadeEntradaDirectorio");
+		return -1;
+	}
+	assert(tamNombre <= MAX_TAM_NOMBRE_ARCHIVO);
+
+	// Mientras la entrada no quepa en la cubeta la dividimos
+	for (;;) {
+		i = hash & MASCARA(d->cabecera.profundidadGlobal);
+		if (leeCubeta(miSistemaDeFicheros, d->tabla[i], &cubetas[0]) == -1)
+			goto fin;
+		if (cubetas[0].bytesUsados + tam <= (int) sizeof(cubetas[0].entradas))
+			break;
+		if (divideCubeta(miSistemaDeFicheros, d, i, &cubetas[0], &cubetas[1])
+				== -1)
+			goto fin;
+	}
+
+	e = ENTRADA(&cubetas[0], cubetas[0].bytesUsados);
+	memset(e, 0, tam);
+	e->hash = hash;
+	e->idxNodoI = idxNodoI;
+	e->tamEntrada = tam;
+	e->tamNombre = tamNombre;
+	memcpy(e->nombreArchivo, nombre, tamNombre + 1);
+	cubetas[0].bytesUsados += tam;
+	cubetas[0].numEntradas++;
+	if (escribeBloqueMetadatos(miSistemaDeFicheros, d->tabla[i], &cubetas[0])
+			== -1)
+		goto fin;
+	d->cabecera.numArchivos++;
+	ret = escribeCabeceraDirectorio(miSistemaDeFicheros, d);
+
+	fin: free(cubetas);
+	return ret;
+}
+
+int borraEntradaDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int idxDirectorio, const char* nombre) {
+	DirectorioAbierto* d = abreDirectorio(miSistemaDeFicheros, idxDirectorio);
+	EstructuraCubeta cubeta;
+	uint32_t hash = hashNombre(nombre);
+	DISK_LBA idxCubeta;
+	int pos, tam, idxNodoI;
+
+	if (d == NULL)
+		return -1;
+	idxCubeta = d->tabla[hash & MASCARA(d->cabecera.profundidadGlobal)];
+	if (leeCubeta(miSistemaDeFicheros, idxCubeta, &cubeta) == -1)
+		return -1;
+	if ((pos = buscaEnCubeta(&cubeta, hash, nombre)) == -1)
+		return -1;
+
+	// Las entradas de detrás se desplazan para tapar el hueco
+	idxNodoI = ENTRADA(&cubeta, pos)->idxNodoI;
+	tam = ENTRADA(&cubeta, pos)->tamEntrada;
+	memmove(cubeta.entradas + pos, cubeta.entradas + pos + tam,
+			cubeta.bytesUsados - pos - tam);
+	cubeta.bytesUsados -= tam;
+	cubeta.numEntradas--;
+	memset(cubeta.entradas + cubeta.bytesUsados, 0, tam);
+	if (escribeBloqueMetadatos(miSistemaDeFicheros, idxCubeta, &cubeta) == -1)
+		return -1;
+	d->cabecera.numArchivos--;
+	if (escribeCabeceraDirectorio(miSistemaDeFicheros, d) == -1)
+		return -1;
+	return idxNodoI;
+}
+
+static int comparaBloques(const void* a, const void* b) {
+	DISK_LBA x = *(const DISK_LBA*) a;
+	DISK_LBA y = *(const DISK_LBA*) b;
+	return (x > y) - (x < y);
+}
+
+int recorreDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int idxDirectorio, void (*funcion)(MiSistemaDeFicheros*,
+				EstructuraEntradaDirectorio*, void*), void* arg) {
+	DirectorioAbierto* d = abreDirectorio(miSistemaDeFicheros, idxDirectorio);
+	EstructuraCubeta* cubeta;
+	EstructuraEntradaDirectorio* e;
+	DISK_LBA* bloques;
+	size_t numEntradas, i;
+	int pos;
+
+	if (d == NULL)
+		return -1;
+	numEntradas = (size_t) 1 << d->cabecera.profundidadGlobal;
+	cubeta = malloc(sizeof(EstructuraCubeta));
+	bloques = malloc(numEntradas * sizeof(DISK_LBA));
+	if (cubeta == NULL || bloques == NULL) {
+		perror("Falló malloc en recorreDirectorio");
+		free(cubeta);
+		free(bloques);
+		return -1;
+	}
+	// Cada cubeta aparece en varias entradas de la tabla: ordenando sus
+	// bloques se visita una sola vez y en el orden del disco
+	memcpy(bloques, d->tabla, numEntradas * sizeof(DISK_LBA));
+	qsort(bloques, numEntradas, sizeof(DISK_LBA), comparaBloques);
+	for (i = 0; i < numEntradas; i++) {
+		if (i > 0 && bloques[i] == bloques[i - 1])
+			continue;
+		if (leeCubeta(miSistemaDeFicheros, bloques[i], cubeta) == -1)
+			break;
+		pos = 0;
+		while ((e = siguienteEntrada(cubeta, &pos)) != NULL)
+			funcion(miSistemaDeFicheros, e, arg);
+	}
+	free(cubeta);
+	free(bloques);
+	return i == numEntradas ? 0 : -1;
+}
+
+int resuelveRuta(MiSistemaDeFicheros* miSistemaDeFicheros, const char* ruta,
+		char* nombre) {
+	int idxDirectorio = NODOI_RAIZ;
+	const char* fin;
+	EstructuraNodoI* nodoI;
+	size_t tam;
+	int idx;
+
+	nombre[0] = '\0';
+	for (;;) {
+		while (*ruta == '/')
+			ruta++;
+		if (*ruta == '\0')
+			return idxDirectorio;
+		fin = strchr(ruta, '/');
+		tam = fin == NULL ? strlen(ruta) : (size_t) (fin - ruta);
+		if (tam > MAX_TAM_NOMBRE_ARCHIVO) {
+			fprintf(stderr, "Nombre demasiado largo (máx. %d caracteres)\n",
+					MAX_TAM_NOMBRE_ARCHIVO);
+			return -1;
+		}
+		memcpy(nombre, ruta, tam);
+		nombre[tam] = '\0';
+		ruta += tam;
+		while (*ruta == '/')
+			ruta++;
+		if (*ruta == '\0')
+			return idxDirectorio;
+
+		// No es el último: tiene que ser un directorio
+		idx = buscaEntradaDirectorio(miSistemaDeFicheros, idxDirectorio, nombre);
+		nodoI = idx == -1 ? NULL : obtenNodoI(miSistemaDeFicheros, idx);
+		if (nodoI == NULL) {
+			fprintf(stderr, "No existe el directorio %s\n", nombre);
+			return -1;
+		}
+		if (nodoI->tipo != TIPO_DIRECTORIO) {
+			fprintf(stderr, "%s no es un directorio\n", nombre);
+			return -1;
+		}
+		idxDirectorio = idx;
+	}
+}
+
+int buscaRuta(MiSistemaDeFicheros* miSistemaDeFicheros, const char* ruta) {
+	char nombre[MAX_TAM_NOMBRE_ARCHIVO + 1];
+	int idxDirectorio = resuelveRuta(miSistemaDeFicheros, ruta, nombre);
+
+	if (idxDirectorio == -1 || nombre[0] == '\0')
+		return idxDirectorio;
+	return buscaEntradaDirectorio(miSistemaDeFicheros, idxDirectorio, nombre);
+}
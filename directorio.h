@@ -0,0 +1,62 @@
+#ifndef DIRECTORIO_H
+#define	DIRECTORIO_H
+
+#include "common.h"
+
+// Directorios indexados por hash (hash extensible).
+//
+// Cada nombre se reduce a un hash de 32 bits. La tabla tiene
+// 2^profundidadGlobal entradas y la entrada i apunta a la cubeta donde van
+// los nombres cuyo hash acaba en los bits de i. Varias entradas pueden
+// compartir cubeta: una cubeta con profundidadLocal L recibe todos los
+// hashes que acaban en sus L bits.
+//
+// La tabla guarda directamente los bloques en disco de las cubetas y se
+// mantiene en memoria mientras el directorio está abierto, así que buscar,
+// añadir o borrar un nombre cuesta leer y escribir un único bloque, esté el
+// directorio como esté de lleno. Cuando una cubeta se llena se divide en
+// dos usando un bit más del hash, y si ya usaba todos los de la tabla, la
+// tabla se duplica. Las cubetas no se vuelven a juntar al borrar.
+//
+// Se mantienen abiertos hasta MAX_DIRECTORIOS_ABIERTOS directorios; al
+// abrir otro se cierra el que lleve más tiempo sin usarse. Todo lo que se
+// escribe de un directorio pasa por escribeBloqueMetadatos, así que cerrarlo
+// no pierde nada.
+//
+// Las rutas son relativas al raíz (la '/' inicial es opcional) y sus
+// componentes se separan con '/'.
+
+uint32_t hashNombre(const char* nombre);
+
+// Formatea un directorio vacío sobre el nodo-i idxNodoI, que debe estar libre
+int creaDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros, int idxNodoI);
+// Devuelve el directorio idxNodoI con la cabecera y la tabla en memoria, o
+// NULL si no es un directorio o no se puede leer
+DirectorioAbierto* abreDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros, int idxNodoI);
+// Saca de memoria el directorio idxNodoI, si está abierto (para borrarlo)
+void cierraDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros, int idxNodoI);
+void liberaDirectorios(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+// Devuelve el nodo-i de nombre dentro del directorio idxDirectorio, o -1 si
+// no existe
+int buscaEntradaDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros, int idxDirectorio, const char* nombre);
+// Añade nombre -> idxNodoI. El nombre no debe existir ya.
+int anadeEntradaDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros, int idxDirectorio, const char* nombre, int idxNodoI);
+// Quita nombre y devuelve su nodo-i, o -1 si no existe
+int borraEntradaDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros, int idxDirectorio, const char* nombre);
+
+// Llama a funcion con cada entrada del directorio, cubeta a cubeta
+int recorreDirectorio(MiSistemaDeFicheros* miSistemaDeFicheros, int idxDirectorio,
+		void (*funcion)(MiSistemaDeFicheros*, EstructuraEntradaDirectorio*, void*),
+		void* arg);
+
+// Recorre la ruta hasta su último componente, que copia en nombre (al menos
+// MAX_TAM_NOMBRE_ARCHIVO+1 bytes; queda vacío si la ruta es el raíz).
+// Devuelve el nodo-i del directorio que lo contiene, o -1 si algún
+// directorio intermedio no existe o un componente es demasiado largo.
+int resuelveRuta(MiSistemaDeFicheros* miSistemaDeFicheros, const char* ruta, char* nombre);
+// Devuelve el nodo-i al que lleva la ruta, o -1 si no existe
+int buscaRuta(MiSistemaDeFicheros* miSistemaDeFicheros, const char* ruta);
+
+#endif	/* DIRECTORIO_H */
+
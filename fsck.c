@@ -0,0 +1,809 @@
+#include "fsck.h"
+#include "metadatos.h"
+#include "diario.h"
+#include "directorio.h"
+#include "huellas.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ENTRADA(cubeta, pos) ((EstructuraEntradaDirectorio*) ((cubeta)->entradas + (pos)))
+
+// Un directorio encontrado al recorrer los nodos-i, con sus extensiones en
+// orden para leerlo sin volver al árbol
+typedef struct DirectorioFsck {
+	int idxNodoI;
+	EstructuraExtension* extensiones;
+	int numExtensiones;
+} DirectorioFsck;
+
+// Entrada de directorio que apunta a un nodo-i libre
+typedef struct EntradaColgada {
+	int idxDirectorio;
+	char nombre[MAX_TAM_NOMBRE_ARCHIVO + 1];
+} EntradaColgada;
+
+// Lo que comparten los hilos de myFsck. Como en myScrub, los trozos de la
+// tabla de nodos-i (y luego los directorios) se reparten de uno en uno.
+typedef struct Fsck {
+	MiSistemaDeFicheros* miSistemaDeFicheros;
+	pthread_mutex_t cerrojo;          // Protege los errores y las listas
+	DISK_LBA primerBloqueDatos;       // El primero detrás de los metadatos
+	uint32_t* refs;                   // Referencias a cada bloque del disco
+	int* enlaces;                     // Entradas que apuntan a cada nodo-i
+	int* padre;                       // Directorio de cada directorio (-1 si ninguno)
+	char* tipos;                      // TIPO_* + 1 de cada nodo-i sano, 0 si no
+	int numTrozos;
+	int siguiente;                    // Primer trozo (o directorio) sin repartir
+	DirectorioFsck* directorios;
+	int numDirectorios;
+	int maxDirectorios;
+	EntradaColgada* colgadas;
+	int numColgadas;
+	int maxColgadas;
+	int nodosEnUso;
+	int nodosDanados;                 // Sus bloques pueden no estar en refs
+	int directoriosDanados;
+	int errores;
+	BOOLEAN fallo;                    // Alguna lectura ha fallado
+} Fsck;
+
+// Lo que hace falta para revisar un nodo-i. Cada hilo tiene el suyo.
+typedef struct RevisionNodoI {
+	int idxNodoI;
+	int64_t siguiente;                // Bloque lógico que tiene que venir
+	BOOLEAN danado;
+	BOOLEAN directorio;               // Se guardan sus extensiones
+	EstructuraExtension* extensiones;
+	int numExtensiones;
+	int maxExtensiones;
+	EstructuraBloqueArbol nodos[MAX_PROFUNDIDAD_ARBOL]; // Uno leído por nivel
+} RevisionNodoI;
+
+// Cuenta un error y lo escribe, si no se han escrito ya MAX_ERRORES_FSCK
+static void anotaError(Fsck* f, const char* formato, ...) {
+	va_list args;
+
+	pthread_mutex_lock(&f->cerrojo);
+	if (++f->errores <= MAX_ERRORES_FSCK) {
+		va_start(args, formato);
+		vfprintf(stderr, formato, args);
+		va_end(args);
+	}
+	pthread_mutex_unlock(&f->cerrojo);
+}
+
+static BOOLEAN nodoIEnUso(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int numNodoI) {
+	return (miSistemaDeFicheros->mapaNodosI[numNodoI / BITS_POR_PALABRA]
+			>> (numNodoI % BITS_POR_PALABRA)) & 1;
+}
+
+// Solo se escribe el primer motivo de cada nodo-i
+static void nodoIDanado(Fsck* f, RevisionNodoI* r, const char* motivo) {
+	if (!r->danado) {
+		anotaError(f, "Nodo-i %d dañado: %s\n", r->idxNodoI, motivo);
+		__atomic_fetch_add(&f->nodosDanados, 1, __ATOMIC_RELAXED);
+	}
+	r->danado = true;
+}
+
+// Suma una referencia a cada bloque de la racha, si cae en la zona de datos
+static BOOLEAN cuentaRacha(Fsck* f, RevisionNodoI* r, DISK_LBA inicio,
+		int numBloques) {
+	int i;
+
+	if (numBloques <= 0 || inicio < f->primerBloqueDatos || (int64_t) inicio
+			+ numBloques > f->miSistemaDeFicheros->superBloque.tamDiscoEnBloques) {
+		nodoIDanado(f, r, "una racha cae fuera de la zona de datos");
+		return false;
+	}
+	for (i = 0; i < numBloques; i++)
+		__atomic_fetch_add(&f->refs[inicio + i], 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+static int guardaExtension(RevisionNodoI* r, const EstructuraExtension* e) {
+	EstructuraExtension* nuevas;
+
+	if (r->numExtensiones == r->maxExtensiones) {
+		nuevas = realloc(r->extensiones, (r->maxExtensiones * 2 + 16)
+				* sizeof(EstructuraExtension));
+		if (nuevas == NULL) {
+			perror("Falló realloc en guardaExtension");
+			return -1;
+		}
+		r->extensiones = nuevas;
+		r->maxExtensiones = r->maxExtensiones * 2 + 16;
+	}
+	r->extensiones[r->numExtensiones++] = *e;
+	return 0;
+}
+
+// Recorre un nodo del árbol de extensiones y, por debajo, sus hijos. Las
+// hojas tienen que venir en orden y sin huecos. Devuelve -1 solo si falla
+// la lectura.
+static int recorreArbol(Fsck* f, RevisionNodoI* r,
+		const EstructuraCabeceraArbol* cabecera,
+		const EstructuraExtension* entradas, int maxEntradas, int profundidad) {
+	EstructuraBloqueArbol* hijo;
+	int i;
+
+	if (cabecera->maxEntradas != maxEntradas || cabecera->numEntradas < 0
+			|| cabecera->numEntradas > maxEntradas || cabecera->profundidad
+			!= profundidad) {
+		nodoIDanado(f, r, "cabecera del árbol de extensiones");
+		return 0;
+	}
+	for (i = 0; i < cabecera->numEntradas; i++) {
+		if (profundidad > 0) {
+			if (!cuentaRacha(f, r, entradas[i].inicio, 1))
+				continue;
+			hijo = &r->nodos[profundidad - 1];
+			if (leeBloques(f->miSistemaDeFicheros, entradas[i].inicio, 1, hijo)
+					== -1 || recorreArbol(f, r, &hijo->cabecera, hijo->entradas,
+					EXTENSIONES_POR_BLOQUE, profundidad - 1) == -1)
+				return -1;
+			continue;
+		}
+		if (entradas[i].bloqueLogico != r->siguiente)
+			nodoIDanado(f, r, "extensiones fuera de orden");
+		if (cuentaRacha(f, r, entradas[i].inicio, entradas[i].numBloques)
+				&& r->directorio && guardaExtension(r, &entradas[i]) == -1)
+			return -1;
+		r->siguiente = (int64_t) entradas[i].bloqueLogico
+				+ entradas[i].numBloques;
+	}
+	return 0;
+}
+
+static int revisaNodoI(Fsck* f, RevisionNodoI* r, int idxNodoI,
+		const EstructuraNodoI* nodoI) {
+	DirectorioFsck* nuevos;
+	DirectorioFsck d;
+
+	r->idxNodoI = idxNodoI;
+	r->siguiente = 0;
+	r->danado = false;
+	r->directorio = nodoI->tipo == TIPO_DIRECTORIO;
+	r->numExtensiones = 0;
+	if (nodoI->tipo != TIPO_ARCHIVO && nodoI->tipo != TIPO_DIRECTORIO) {
+		nodoIDanado(f, r, "tipo desconocido");
+		return 0;
+	}
+	if (nodoI->numBloques < 0 || nodoI->tamArchivo < 0
+			|| nodoI->tamComprimido < 0 || (r->directorio
+			&& nodoI->tamComprimido != 0)) {
+		nodoIDanado(f, r, "tamaño no válido");
+		return 0;
+	}
+	if (estaEnLinea(nodoI)) {
+		if (nodoI->tamArchivo > MAX_TAM_EN_LINEA || nodoI->tamComprimido != 0
+				|| nodoI->cabecera.numEntradas != 0)
+			nodoIDanado(f, r, "datos en el nodo-i");
+		else
+			f->tipos[idxNodoI] = TIPO_ARCHIVO + 1;
+		return 0;
+	}
+	if (nodoI->cabecera.profundidad < 0 || nodoI->cabecera.profundidad
+			> MAX_PROFUNDIDAD_ARBOL) {
+		nodoIDanado(f, r, "profundidad del árbol de extensiones");
+		return 0;
+	}
+	if (recorreArbol(f, r, &nodoI->cabecera, nodoI->extensiones,
+			EXTENSIONES_EN_NODOI, nodoI->cabecera.profundidad) == -1)
+		return -1;
+	if (r->siguiente != nodoI->numBloques)
+		nodoIDanado(f, r, "el árbol de extensiones no tiene sus bloques");
+	else if ((nodoI->tamComprimido > 0 ? nodoI->tamComprimido
+			: nodoI->tamArchivo) > (int64_t) nodoI->numBloques
+			* TAM_BLOQUE_BYTES)
+		nodoIDanado(f, r, "más bytes de los que caben en sus bloques");
+	if (r->danado) {
+		if (r->directorio)
+			__atomic_fetch_add(&f->directoriosDanados, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	f->tipos[idxNodoI] = nodoI->tipo + 1;
+	if (!r->directorio)
+		return 0;
+
+	// El directorio se revisa después, cuando se conozcan todos los nodos-i
+	d.idxNodoI = idxNodoI;
+	d.numExtensiones = r->numExtensiones;
+	d.extensiones = malloc(r->numExtensiones * sizeof(EstructuraExtension));
+	if (d.extensiones == NULL) {
+		perror("Falló malloc en revisaNodoI");
+		return -1;
+	}
+	memcpy(d.extensiones, r->extensiones, r->numExtensiones
+			* sizeof(EstructuraExtension));
+	pthread_mutex_lock(&f->cerrojo);
+	if (f->numDirectorios == f->maxDirectorios) {
+		nuevos = realloc(f->directorios, (f->maxDirectorios * 2 + 64)
+				* sizeof(DirectorioFsck));
+		if (nuevos == NULL) {
+			pthread_mutex_unlock(&f->cerrojo);
+			perror("Falló realloc en revisaNodoI");
+			free(d.extensiones);
+			return -1;
+		}
+		f->directorios = nuevos;
+		f->maxDirectorios = f->maxDirectorios * 2 + 64;
+	}
+	f->directorios[f->numDirectorios++] = d;
+	pthread_mutex_unlock(&f->cerrojo);
+	return 0;
+}
+
+static void* trabajadorNodosI(void* arg) {
+	Fsck* f = arg;
+	MiSistemaDeFicheros* miSistemaDeFicheros = f->miSistemaDeFicheros;
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	char* buffer = malloc(MAX_BLOQUES_POR_ES * TAM_BLOQUE_BYTES);
+	RevisionNodoI* r = calloc(1, sizeof(RevisionNodoI));
+	const char* datos;
+	DISK_LBA idxBloque;
+	int t, n, i, primero, ultimo, enUso = 0;
+
+	if (buffer == NULL || r == NULL) {
+		perror("Falló malloc en trabajadorNodosI");
+		__atomic_store_n(&f->fallo, true, __ATOMIC_RELAXED);
+		free(buffer);
+		free(r);
+		return NULL;
+	}
+	while ((t = __atomic_fetch_add(&f->siguiente, 1, __ATOMIC_RELAXED))
+			< f->numTrozos) {
+		n = sb->numBloquesNodosI - t * MAX_BLOQUES_POR_ES;
+		if (n > MAX_BLOQUES_POR_ES)
+			n = MAX_BLOQUES_POR_ES;
+		primero = t * MAX_BLOQUES_POR_ES * NODOSI_POR_BLOQUE;
+		ultimo = primero + n * NODOSI_POR_BLOQUE;
+		if (ultimo > sb->numNodosI)
+			ultimo = sb->numNodosI;
+		// Los trozos sin nodos-i en uso no se leen
+		for (i = primero; i < ultimo && !nodoIEnUso(miSistemaDeFicheros, i);
+				i++)
+			;
+		if (i == ultimo)
+			continue;
+		idxBloque = sb->idxNodosI + t * MAX_BLOQUES_POR_ES;
+		if (miSistemaDeFicheros->imagen != NULL)
+			datos = miSistemaDeFicheros->imagen + (size_t) idxBloque
+					* TAM_BLOQUE_BYTES;
+		else if (leeBloques(miSistemaDeFicheros, idxBloque, n, buffer) == -1) {
+			__atomic_store_n(&f->fallo, true, __ATOMIC_RELAXED);
+			continue;
+		} else
+			datos = buffer;
+		for (; i < ultimo; i++) {
+			if (!nodoIEnUso(miSistemaDeFicheros, i))
+				continue;
+			enUso++;
+			if (revisaNodoI(f, r, i, (const EstructuraNodoI*) (datos
+					+ (size_t) (i - primero) / NODOSI_POR_BLOQUE
+							* TAM_BLOQUE_BYTES + (i - primero)
+					% NODOSI_POR_BLOQUE * sizeof(EstructuraNodoI))) == -1)
+				__atomic_store_n(&f->fallo, true, __ATOMIC_RELAXED);
+		}
+	}
+	__atomic_fetch_add(&f->nodosEnUso, enUso, __ATOMIC_RELAXED);
+	free(r->extensiones);
+	free(r);
+	free(buffer);
+	return NULL;
+}
+
+// Bloque en disco del bloque lógico del directorio, o -1 si no lo tiene. En
+// *contiguos (si no es NULL) deja cuántos siguen contiguos a partir de él.
+static DISK_LBA bloqueDirectorioFsck(const DirectorioFsck* d, int bloqueLogico,
+		int* contiguos) {
+	int izq = 0, der = d->numExtensiones - 1, medio;
+	const EstructuraExtension* e;
+
+	while (izq <= der) {
+		medio = (izq + der) / 2;
+		e = &d->extensiones[medio];
+		if (bloqueLogico < e->bloqueLogico)
+			der = medio - 1;
+		else if (bloqueLogico >= e->bloqueLogico + e->numBloques)
+			izq = medio + 1;
+		else {
+			if (contiguos != NULL)
+				*contiguos = e->bloqueLogico + e->numBloques - bloqueLogico;
+			return e->inicio + (bloqueLogico - e->bloqueLogico);
+		}
+	}
+	return -1;
+}
+
+static int comparaBloques(const void* a, const void* b) {
+	DISK_LBA x = *(const DISK_LBA*) a, y = *(const DISK_LBA*) b;
+
+	return (x > y) - (x < y);
+}
+
+static int comparaInicios(const void* a, const void* b) {
+	return comparaBloques(&((const EstructuraExtension*) a)->inicio,
+			&((const EstructuraExtension*) b)->inicio);
+}
+
+// Cierto si el bloque es de alguna de las extensiones, ordenadas por inicio
+static BOOLEAN esDelDirectorio(const EstructuraExtension* porInicio,
+		int numExtensiones, DISK_LBA idxBloque) {
+	int izq = 0, der = numExtensiones - 1, medio;
+
+	while (izq <= der) {
+		medio = (izq + der) / 2;
+		if (idxBloque < porInicio[medio].inicio)
+			der = medio - 1;
+		else if (idxBloque >= porInicio[medio].inicio
+				+ porInicio[medio].numBloques)
+			izq = medio + 1;
+		else
+			return true;
+	}
+	return false;
+}
+
+// Suma el enlace de la entrada a su nodo-i, o la apunta como colgada si el
+// nodo-i no está en uso
+static int revisaEnlace(Fsck* f, const DirectorioFsck* d,
+		const EstructuraEntradaDirectorio* e) {
+	MiSistemaDeFicheros* miSistemaDeFicheros = f->miSistemaDeFicheros;
+	EntradaColgada* nuevas;
+	int ret = 0;
+
+	if (e->idxNodoI >= 0 && e->idxNodoI
+			< miSistemaDeFicheros->superBloque.numNodosI && nodoIEnUso(
+			miSistemaDeFicheros, e->idxNodoI)) {
+		__atomic_fetch_add(&f->enlaces[e->idxNodoI], 1, __ATOMIC_RELAXED);
+		if (f->tipos[e->idxNodoI] == TIPO_DIRECTORIO + 1)
+			__atomic_store_n(&f->padre[e->idxNodoI], d->idxNodoI,
+					__ATOMIC_RELAXED);
+		return 0;
+	}
+	anotaError(f, "Directorio %d: %s apunta al nodo-i %d, que no está en uso\n",
+			d->idxNodoI, e->nombreArchivo, e->idxNodoI);
+	pthread_mutex_lock(&f->cerrojo);
+	if (f->numColgadas == f->maxColgadas) {
+		nuevas = realloc(f->colgadas, (f->maxColgadas * 2 + 16)
+				* sizeof(EntradaColgada));
+		if (nuevas == NULL) {
+			perror("Falló realloc en revisaEnlace");
+			ret = -1;
+			goto fin;
+		}
+		f->colgadas = nuevas;
+		f->maxColgadas = f->maxColgadas * 2 + 16;
+	}
+	f->colgadas[f->numColgadas].idxDirectorio = d->idxNodoI;
+	strcpy(f->colgadas[f->numColgadas].nombre, e->nombreArchivo);
+	f->numColgadas++;
+	fin: pthread_mutex_unlock(&f->cerrojo);
+	return ret;
+}
+
+// Revisa la cabecera, la tabla y las cubetas del directorio, y suma los
+// enlaces de sus entradas. Devuelve -1 solo si falla la lectura.
+static int revisaDirectorio(Fsck* f, const DirectorioFsck* d, char* bloque) {
+	MiSistemaDeFicheros* miSistemaDeFicheros = f->miSistemaDeFicheros;
+	EstructuraCabeceraDirectorio cab;
+	EstructuraCubeta* cubeta = (EstructuraCubeta*) bloque;
+	EstructuraEntradaDirectorio* e;
+	EstructuraExtension* porInicio = NULL;
+	DISK_LBA *tabla = NULL, *cubetas = NULL, idxBloque;
+	const char* motivo = NULL;
+	int k, contiguos, numTabla, numCubetas, entradas, numArchivos = 0;
+	int pos, ret = -1;
+
+	if ((idxBloque = bloqueDirectorioFsck(d, 0, NULL)) == -1) {
+		motivo = "no tiene cabecera";
+		goto danado;
+	}
+	if (leeBloques(miSistemaDeFicheros, idxBloque, 1, bloque) == -1)
+		goto fin;
+	cab = ((EstructuraDirectorio*) bloque)->cabecera;
+	if (cab.numeroMagico != MAGICO_DIRECTORIO || cab.profundidadGlobal < 0
+			|| cab.profundidadGlobal > MAX_PROFUNDIDAD_DIRECTORIO
+			|| cab.bloqueTabla < 1 || cab.numBloquesTabla < 1
+			|| (size_t) cab.numBloquesTabla * ENTRADAS_TABLA_POR_BLOQUE
+					< (size_t) 1 << cab.profundidadGlobal) {
+		motivo = "cabecera";
+		goto danado;
+	}
+
+	// La tabla se lee en tantas llamadas como rachas contiguas tenga
+	numTabla = 1 << cab.profundidadGlobal;
+	tabla = malloc((size_t) cab.numBloquesTabla * TAM_BLOQUE_BYTES);
+	cubetas = malloc(numTabla * sizeof(DISK_LBA));
+	porInicio = malloc(d->numExtensiones * sizeof(EstructuraExtension));
+	if (tabla == NULL || cubetas == NULL || porInicio == NULL) {
+		perror("Falló malloc en revisaDirectorio");
+		goto fin;
+	}
+	for (k = 0; k < cab.numBloquesTabla; k += contiguos) {
+		idxBloque = bloqueDirectorioFsck(d, cab.bloqueTabla + k, &contiguos);
+		if (idxBloque == -1) {
+			motivo = "la tabla de cubetas no está entera";
+			goto danado;
+		}
+		if (contiguos > cab.numBloquesTabla - k)
+			contiguos = cab.numBloquesTabla - k;
+		if (leeBloques(miSistemaDeFicheros, idxBloque, contiguos, tabla
+				+ (size_t) k * ENTRADAS_TABLA_POR_BLOQUE) == -1)
+			goto fin;
+	}
+
+	// Las cubetas distintas de la tabla, que tienen que ser del directorio
+	memcpy(porInicio, d->extensiones, d->numExtensiones
+			* sizeof(EstructuraExtension));
+	qsort(porInicio, d->numExtensiones, sizeof(EstructuraExtension),
+			comparaInicios);
+	memcpy(cubetas, tabla, numTabla * sizeof(DISK_LBA));
+	qsort(cubetas, numTabla, sizeof(DISK_LBA), comparaBloques);
+	for (k = 0, numCubetas = 0; k < numTabla; k++) {
+		if (k > 0 && cubetas[k] == cubetas[k - 1])
+			continue;
+		if (!esDelDirectorio(porInicio, d->numExtensiones, cubetas[k])) {
+			motivo = "la tabla apunta fuera del directorio";
+			goto danado;
+		}
+		cubetas[numCubetas++] = cubetas[k];
+	}
+	if (numCubetas != cab.numCubetas)
+		anotaError(f, "Directorio %d: la tabla tiene %d cubetas y la cabecera dice %d\n",
+				d->idxNodoI, numCubetas, cab.numCubetas);
+
+	for (k = 0; k < numCubetas; k++) {
+		if (leeBloques(miSistemaDeFicheros, cubetas[k], 1, cubeta) == -1)
+			goto fin;
+		if (cubeta->bytesUsados < 0 || cubeta->bytesUsados
+				> (int) sizeof(cubeta->entradas) || cubeta->profundidadLocal < 0
+				|| cubeta->profundidadLocal > cab.profundidadGlobal) {
+			motivo = "cabecera de una cubeta";
+			goto danado;
+		}
+		for (pos = 0, entradas = 0; pos < cubeta->bytesUsados; pos
+				+= e->tamEntrada, entradas++) {
+			e = ENTRADA(cubeta, pos);
+			if (pos + (int) sizeof(EstructuraEntradaDirectorio)
+					> cubeta->bytesUsados || e->tamNombre < 1 || e->tamNombre
+					> MAX_TAM_NOMBRE_ARCHIVO || e->tamEntrada
+					< TAM_ENTRADA_DIRECTORIO(e->tamNombre) || pos
+					+ e->tamEntrada > cubeta->bytesUsados || strnlen(
+					e->nombreArchivo, e->tamNombre + 1) != e->tamNombre) {
+				motivo = "entrada de una cubeta";
+				goto danado;
+			}
+			// Una entrada con otro hash no se encontraría al buscarla
+			if (e->hash != hashNombre(e->nombreArchivo) || tabla[e->hash
+					& (numTabla - 1)] != cubetas[k])
+				anotaError(f, "Directorio %d: %s no está en su cubeta\n",
+						d->idxNodoI, e->nombreArchivo);
+			if (revisaEnlace(f, d, e) == -1)
+				goto fin;
+		}
+		if (entradas != cubeta->numEntradas)
+			anotaError(f, "Directorio %d: la cubeta %d tiene %d entradas y dice %d\n",
+					d->idxNodoI, cubetas[k], entradas, cubeta->numEntradas);
+		numArchivos += entradas;
+	}
+	if (numArchivos != cab.numArchivos)
+		anotaError(f, "Directorio %d: tiene %d archivos y la cabecera dice %d\n",
+				d->idxNodoI, numArchivos, cab.numArchivos);
+	ret = 0;
+	goto fin;
+
+	danado: anotaError(f, "Directorio %d dañado: %s\n", d->idxNodoI, motivo);
+	__atomic_fetch_add(&f->directoriosDanados, 1, __ATOMIC_RELAXED);
+	ret = 0;
+	fin: free(tabla);
+	free(cubetas);
+	free(porInicio);
+	return ret;
+}
+
+static void* trabajadorDirectorios(void* arg) {
+	Fsck* f = arg;
+	char* bloque = malloc(TAM_BLOQUE_BYTES);
+	int i;
+
+	if (bloque == NULL) {
+		perror("Falló malloc en trabajadorDirectorios");
+		__atomic_store_n(&f->fallo, true, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	while ((i = __atomic_fetch_add(&f->siguiente, 1, __ATOMIC_RELAXED))
+			< f->numDirectorios) {
+		if (revisaDirectorio(f, &f->directorios[i], bloque) == -1)
+			__atomic_store_n(&f->fallo, true, __ATOMIC_RELAXED);
+	}
+	free(bloque);
+	return NULL;
+}
+
+// Reparte numTareas entre numHilos hilos (o las hace aquí si no se puede
+// crear ninguno). Devuelve los hilos usados.
+static int reparte(Fsck* f, void* (*trabajador)(void*), int numTareas,
+		int numHilos) {
+	pthread_t* hilos;
+	int i, creados = 0;
+
+	f->siguiente = 0;
+	if (numHilos > numTareas)
+		numHilos = numTareas;
+	hilos = numHilos > 0 ? malloc(numHilos * sizeof(pthread_t)) : NULL;
+	if (hilos != NULL) {
+		for (creados = 0; creados < numHilos; creados++) {
+			if (pthread_create(&hilos[creados], NULL, trabajador, f) != 0)
+				break;
+		}
+	}
+	if (creados == 0)
+		trabajador(f);
+	for (i = 0; i < creados; i++)
+		pthread_join(hilos[i], NULL);
+	free(hilos);
+	return creados > 0 ? creados : 1;
+}
+
+// Compara el mapa de bits con el que sale de las referencias, y el
+// contador de libres con el mapa. Con nodos-i dañados no se han contado
+// todos sus bloques, así que al reparar solo se marcan los que faltan.
+// Devuelve los bloques ocupados.
+static long long revisaMapa(Fsck* f, BOOLEAN reparar, int* reparados) {
+	MiSistemaDeFicheros* miSistemaDeFicheros = f->miSistemaDeFicheros;
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	long long sobran = 0, faltan = 0, libres = 0, libresEsperados = 0;
+	long long libresReparados = 0;
+	BOOLEAN liberar = f->nodosDanados == 0;
+	BIT esperada, hay;
+	int64_t idxBloque;
+	size_t p;
+	int b;
+
+	for (p = 0; p < miSistemaDeFicheros->numPalabrasMapa; p++) {
+		esperada = 0;
+		for (b = 0; b < (int) BITS_POR_PALABRA; b++) {
+			idxBloque = p * BITS_POR_PALABRA + b;
+			if (idxBloque < f->primerBloqueDatos || idxBloque
+					>= sb->tamDiscoEnBloques || f->refs[idxBloque] > 0)
+				esperada |= (BIT) 1 << b;
+		}
+		hay = miSistemaDeFicheros->mapaDeBits[p];
+		libres += __builtin_popcountll(~hay);
+		libresEsperados += __builtin_popcountll(~esperada);
+		sobran += __builtin_popcountll(hay & ~esperada);
+		faltan += __builtin_popcountll(esperada & ~hay);
+		if (reparar && hay != esperada)
+			miSistemaDeFicheros->mapaDeBits[p] = liberar ? esperada
+					: hay | esperada;
+		libresReparados += __builtin_popcountll(
+				~miSistemaDeFicheros->mapaDeBits[p]);
+	}
+	if (sobran > 0)
+		anotaError(f, "%lld bloques ocupados en el mapa de bits que no usa nadie\n",
+				sobran);
+	if (faltan > 0)
+		anotaError(f, "%lld bloques en uso libres en el mapa de bits\n", faltan);
+	if (reparar && sobran > 0 && !liberar)
+		fprintf(stderr, "Hay nodos-i dañados: no se liberan los bloques que el mapa de bits da por ocupados\n");
+	if (reparar && ((sobran > 0 && liberar) || faltan > 0)) {
+		escribeMapaDeBits(miSistemaDeFicheros);
+		*reparados += (sobran > 0 && liberar) + (faltan > 0);
+	}
+	if (sb->numBloquesLibres != libres) {
+		anotaError(f, "El superbloque dice que hay %d bloques libres y el mapa tiene %lld\n",
+				sb->numBloquesLibres, libres);
+		if (reparar)
+			(*reparados)++;
+	}
+	if (reparar && sb->numBloquesLibres != libresReparados) {
+		sb->numBloquesLibres = libresReparados;
+		escribeSuperBloque(miSistemaDeFicheros);
+	}
+	return sb->tamDiscoEnBloques - libresEsperados;
+}
+
+static void revisaNodosLibres(Fsck* f, BOOLEAN reparar, int* reparados) {
+	MiSistemaDeFicheros* miSistemaDeFicheros = f->miSistemaDeFicheros;
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	int libres = 0;
+	size_t p;
+
+	// Los bits de detrás del último nodo-i están a 1 desde myMkfs
+	for (p = 0; p < miSistemaDeFicheros->numPalabrasMapaNodosI; p++)
+		libres += __builtin_popcountll(~miSistemaDeFicheros->mapaNodosI[p]);
+	if (sb->numNodosLibres == libres)
+		return;
+	anotaError(f, "El superbloque dice que hay %d nodos-i libres y el mapa tiene %d\n",
+			sb->numNodosLibres, libres);
+	if (reparar) {
+		sb->numNodosLibres = libres;
+		escribeSuperBloque(miSistemaDeFicheros);
+		(*reparados)++;
+	}
+}
+
+// Comprueba que cada nodo-i esté en un solo directorio (el raíz en
+// ninguno) y que de cada directorio se llegue al raíz. Deja en *perdidos
+// los que no están en ninguno.
+static int revisaEnlaces(Fsck* f, int** perdidos) {
+	MiSistemaDeFicheros* miSistemaDeFicheros = f->miSistemaDeFicheros;
+	int numNodosI = miSistemaDeFicheros->superBloque.numNodosI;
+	int i, p, pasos, numPerdidos = 0;
+
+	*perdidos = NULL;
+	if (f->tipos[NODOI_RAIZ] != TIPO_DIRECTORIO + 1)
+		anotaError(f, "El raíz no es un directorio sano\n");
+	if (f->enlaces[NODOI_RAIZ] != 0)
+		anotaError(f, "El raíz está en %d directorios\n",
+				f->enlaces[NODOI_RAIZ]);
+	for (i = 0; i < numNodosI; i++) {
+		if (i == NODOI_RAIZ || !nodoIEnUso(miSistemaDeFicheros, i))
+			continue;
+		if (f->enlaces[i] > 1)
+			anotaError(f, "El nodo-i %d está en %d directorios\n", i,
+					f->enlaces[i]);
+		if (f->enlaces[i] > 0)
+			continue;
+		anotaError(f, "El nodo-i %d no está en ningún directorio\n", i);
+		if (*perdidos == NULL && (*perdidos = malloc(numNodosI * sizeof(int)))
+				== NULL) {
+			perror("Falló malloc en revisaEnlaces");
+			return -1;
+		}
+		(*perdidos)[numPerdidos++] = i;
+	}
+
+	// Un directorio de un ciclo tiene un enlace, pero subiendo no se llega
+	// nunca al raíz
+	for (i = 0; i < numNodosI; i++) {
+		if (i == NODOI_RAIZ || f->tipos[i] != TIPO_DIRECTORIO + 1
+				|| f->enlaces[i] != 1)
+			continue;
+		for (p = f->padre[i], pasos = 0; p != NODOI_RAIZ && p != -1 && pasos
+				<= f->numDirectorios; p = f->padre[p], pasos++)
+			;
+		if (pasos > f->numDirectorios)
+			anotaError(f, "El directorio %d no cuelga del raíz\n", i);
+	}
+	return numPerdidos;
+}
+
+// Borra las entradas colgadas y cuelga los nodos-i perdidos de /perdidos
+static void reparaDirectorios(Fsck* f, const int* perdidos, int numPerdidos,
+		int* reparados) {
+	MiSistemaDeFicheros* miSistemaDeFicheros = f->miSistemaDeFicheros;
+	char nombre[MAX_TAM_NOMBRE_ARCHIVO + 1];
+	int i, idxPerdidos;
+
+	if (f->directoriosDanados > 0) {
+		if (f->numColgadas > 0 || numPerdidos > 0)
+			fprintf(stderr, "Hay directorios dañados: no se tocan sus entradas ni se cuelgan los nodos-i perdidos\n");
+		return;
+	}
+	for (i = 0; i < f->numColgadas; i++)
+		if (borraEntradaDirectorio(miSistemaDeFicheros,
+				f->colgadas[i].idxDirectorio, f->colgadas[i].nombre) != -1)
+			(*reparados)++;
+	if (numPerdidos == 0)
+		return;
+
+	idxPerdidos = buscaEntradaDirectorio(miSistemaDeFicheros, NODOI_RAIZ,
+			"perdidos");
+	if (idxPerdidos == -1) {
+		if ((idxPerdidos = buscaNodoLibre(miSistemaDeFicheros)) == -1
+				|| creaDirectorio(miSistemaDeFicheros, idxPerdidos) == -1
+				|| anadeEntradaDirectorio(miSistemaDeFicheros, NODOI_RAIZ,
+						"perdidos", idxPerdidos) == -1) {
+			fprintf(stderr, "No se puede crear /perdidos\n");
+			return;
+		}
+	} else if (obtenNodoI(miSistemaDeFicheros, idxPerdidos)->tipo
+			!= TIPO_DIRECTORIO) {
+		fprintf(stderr, "/perdidos no es un directorio\n");
+		return;
+	}
+	for (i = 0; i < numPerdidos; i++) {
+		snprintf(nombre, sizeof(nombre), "#%d", perdidos[i]);
+		if (anadeEntradaDirectorio(miSistemaDeFicheros, idxPerdidos, nombre,
+				perdidos[i]) == 0)
+			(*reparados)++;
+	}
+}
+
+int myFsck(MiSistemaDeFicheros* miSistemaDeFicheros, BOOLEAN reparar,
+		int numHilos) {
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	struct timespec t0, t1;
+	double segundos;
+	long long ocupados = 0;
+	int* perdidos = NULL;
+	int i, hilos, numPerdidos = 0, reparados = 0, enHuellas, ret = 3;
+	Fsck f;
+
+	// Lo que se compruebe tiene que estar en su sitio, como en myScrub
+	if (confirmaMetadatos(miSistemaDeFicheros) == -1
+			|| (miSistemaDeFicheros->diarioActivo && reproduceDiario(
+					miSistemaDeFicheros) == -1))
+		return 3;
+
+	memset(&f, 0, sizeof(f));
+	f.miSistemaDeFicheros = miSistemaDeFicheros;
+	pthread_mutex_init(&f.cerrojo, NULL);
+	f.primerBloqueDatos = sb->idxSumas + sb->numBloquesSumas;
+	f.refs = calloc(sb->tamDiscoEnBloques, sizeof(uint32_t));
+	f.enlaces = calloc(sb->numNodosI, sizeof(int));
+	f.padre = malloc(sb->numNodosI * sizeof(int));
+	f.tipos = calloc(sb->numNodosI, 1);
+	if (f.refs == NULL || f.enlaces == NULL || f.padre == NULL
+			|| f.tipos == NULL) {
+		perror("Falló malloc en myFsck");
+		goto fin;
+	}
+	for (i = 0; i < sb->numNodosI; i++)
+		f.padre[i] = -1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	f.numTrozos = (sb->numBloquesNodosI + MAX_BLOQUES_POR_ES - 1)
+			/ MAX_BLOQUES_POR_ES;
+	hilos = reparte(&f, trabajadorNodosI, f.numTrozos, numHilos);
+	if (!f.fallo)
+		reparte(&f, trabajadorDirectorios, f.numDirectorios, numHilos);
+	if (f.fallo) {
+		fprintf(stderr, "No se han podido leer todos los metadatos\n");
+		goto fin;
+	}
+
+	ocupados = revisaMapa(&f, reparar, &reparados);
+	revisaNodosLibres(&f, reparar, &reparados);
+	if (deduplica(miSistemaDeFicheros)) {
+		// Las referencias de los bloques de nodos-i dañados faltan en refs
+		if (reparar && f.nodosDanados > 0)
+			fprintf(stderr, "Hay nodos-i dañados: no se repara el índice de huellas\n");
+		if ((enHuellas = compruebaHuellas(miSistemaDeFicheros, f.refs, reparar
+				&& f.nodosDanados == 0, MAX_ERRORES_FSCK - f.errores, &i)) == -1)
+			goto fin;
+		f.errores += enHuellas;
+		reparados += i;
+	} else {
+		for (i = 0; i < sb->tamDiscoEnBloques; i++)
+			if (f.refs[i] > 1)
+				anotaError(&f, "Bloque %d compartido por %u archivos\n", i,
+						f.refs[i]);
+	}
+	if ((numPerdidos = revisaEnlaces(&f, &perdidos)) == -1)
+		goto fin;
+	if (reparar)
+		reparaDirectorios(&f, perdidos, numPerdidos, &reparados);
+	if (reparar && reparados > 0 && confirmaMetadatos(miSistemaDeFicheros)
+			== -1)
+		goto fin;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	segundos = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	printf("Revisados %d nodos-i y %d directorios (%lld bloques ocupados) en %.3f s con %d hilos: %d errores, %d reparados\n",
+			f.nodosEnUso, f.numDirectorios, ocupados, segundos, hilos,
+			f.errores, reparados);
+	if (f.errores > MAX_ERRORES_FSCK)
+		fprintf(stderr, "(solo se han escrito los %d primeros errores)\n",
+				MAX_ERRORES_FSCK);
+	ret = f.errores == 0 ? 0 : reparados >= f.errores ? 2 : 1;
+
+	fin: for (i = 0; i < f.numDirectorios; i++)
+		free(f.directorios[i].extensiones);
+	free(f.directorios);
+	free(f.colgadas);
+	free(perdidos);
+	free(f.refs);
+	free(f.enlaces);
+	free(f.padre);
+	free(f.tipos);
+	pthread_mutex_destroy(&f.cerrojo);
+	return ret;
+}
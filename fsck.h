@@ -0,0 +1,36 @@
+#ifndef FSCK_H
+#define	FSCK_H
+
+#include "common.h"
+
+// Comprobación de la coherencia de los metadatos entre sí.
+//
+// Se lleva todo a su sitio, como en myScrub, y se lee directamente de la
+// imagen, sin pasar por la caché:
+//
+// 1. La tabla de nodos-i, de MAX_BLOQUES_POR_ES en MAX_BLOQUES_POR_ES
+//    bloques, repartida entre los hilos. De cada nodo-i en uso se recorre el
+//    árbol de extensiones y se cuenta cada bloque que usa (datos y nodos
+//    del árbol) en una tabla de referencias con un contador por bloque.
+// 2. Los directorios, repartidos también entre los hilos: la cabecera, la
+//    tabla de cubetas y cada cubeta. Cada entrada suma un enlace a su
+//    nodo-i.
+// 3. Con un solo hilo, lo que sale de juntarlo todo: el mapa de bits
+//    esperado (los metadatos y los bloques con alguna referencia) contra el
+//    que hay, los contadores del superbloque, los enlaces de cada nodo-i
+//    (uno, ninguno el raíz), que todo directorio cuelgue del raíz y, con
+//    deduplicación, el índice de huellas (ver compruebaHuellas).
+//
+// Las sumas de comprobación no se miran: de eso se encarga myScrub.
+
+#define MAX_ERRORES_FSCK 100 // Los que se escriben; del resto solo se cuentan
+
+// Comprueba la imagen con numHilos hilos. Si reparar, rehace el mapa de
+// bits y los contadores del superbloque, arregla el índice de huellas,
+// borra las entradas de directorio que apuntan a nodos-i libres y cuelga
+// los nodos-i sin enlaces de /perdidos con el nombre #numNodoI. Lo demás
+// solo se cuenta. Devuelve 0 si no hay errores, 1 si queda alguno, 2 si se
+// han reparado todos o 3 si falla la lectura.
+int myFsck(MiSistemaDeFicheros* miSistemaDeFicheros, BOOLEAN reparar, int numHilos);
+
+#endif	/* FSCK_H */
@@ -0,0 +1,422 @@
+#include "huellas.h"
+#include "metadatos.h"
+#include "sumas.h"
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint64_t rota(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t mezcla(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+void calculaHuella(const void* bloque, uint64_t huella[2]) {
+	const uint64_t c1 = 0x87c37b91114253d5ULL;
+	const uint64_t c2 = 0x4cf5ad432745937fULL;
+	const char* p = bloque;
+	uint64_t h1 = 0, h2 = 0, k1, k2;
+	int i;
+
+	// El bloque se parte en trozos de 16 bytes justos: no queda cola
+	for (i = 0; i < TAM_BLOQUE_BYTES; i += 16) {
+		memcpy(&k1, p + i, sizeof(k1));
+		memcpy(&k2, p + i + 8, sizeof(k2));
+		k1 *= c1;
+		k1 = rota(k1, 31);
+		k1 *= c2;
+		h1 ^= k1;
+		h1 = rota(h1, 27);
+		h1 += h2;
+		h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2;
+		k2 = rota(k2, 33);
+		k2 *= c1;
+		h2 ^= k2;
+		h2 = rota(h2, 31);
+		h2 += h1;
+		h2 = h2 * 5 + 0x38495ab5;
+	}
+	h1 ^= TAM_BLOQUE_BYTES;
+	h2 ^= TAM_BLOQUE_BYTES;
+	h1 += h2;
+	h2 += h1;
+	h1 = mezcla(h1);
+	h2 = mezcla(h2);
+	h1 += h2;
+	h2 += h1;
+	huella[0] = h1;
+	huella[1] = h2;
+}
+
+int bloquesIndiceHuellas(int numBloques) {
+	return (numBloques + HUELLAS_POR_BLOQUE - 1) / HUELLAS_POR_BLOQUE;
+}
+
+int bloquesInversoHuellas(int numBloques) {
+	return (numBloques + INVERSOS_POR_BLOQUE - 1) / INVERSOS_POR_BLOQUE;
+}
+
+BOOLEAN deduplica(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	return miSistemaDeFicheros->superBloque.numBloquesHuellas > 0;
+}
+
+static int numEntradas(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	return miSistemaDeFicheros->superBloque.numBloquesHuellas
+			* HUELLAS_POR_BLOQUE;
+}
+
+int initHuellas(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+
+	liberaHuellas(miSistemaDeFicheros);
+	if (!deduplica(miSistemaDeFicheros))
+		return 0;
+	miSistemaDeFicheros->bloquesHuellas = calloc(sb->numBloquesHuellas
+			+ sb->numBloquesInverso, sizeof(char*));
+	if (miSistemaDeFicheros->bloquesHuellas == NULL) {
+		perror("Falló calloc en initHuellas");
+		return -1;
+	}
+	return 0;
+}
+
+void liberaHuellas(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	int i;
+
+	if (miSistemaDeFicheros->bloquesHuellas == NULL)
+		return;
+	for (i = 0; i < sb->numBloquesHuellas + sb->numBloquesInverso; i++)
+		free(miSistemaDeFicheros->bloquesHuellas[i]);
+	free(miSistemaDeFicheros->bloquesHuellas);
+	miSistemaDeFicheros->bloquesHuellas = NULL;
+}
+
+// Bloque i de las tablas (el índice y, detrás, el inverso), leyéndolo si
+// aún no está en memoria. Como en ranuraNodoI, lo que hay en disco es lo
+// último confirmado.
+static char* bloqueTablas(MiSistemaDeFicheros* miSistemaDeFicheros, int i) {
+	char* bloque = miSistemaDeFicheros->bloquesHuellas[i];
+
+	if (bloque == NULL) {
+		bloque = malloc(TAM_BLOQUE_BYTES);
+		if (bloque == NULL) {
+			perror("Falló malloc en bloqueTablas");
+			return NULL;
+		}
+		if (leeBloques(miSistemaDeFicheros,
+				miSistemaDeFicheros->superBloque.idxHuellas + i, 1, bloque)
+				== -1 || compruebaSumas(miSistemaDeFicheros,
+				miSistemaDeFicheros->superBloque.idxHuellas + i, 1, bloque)
+				== -1) {
+			free(bloque);
+			return NULL;
+		}
+		miSistemaDeFicheros->bloquesHuellas[i] = bloque;
+	}
+	return bloque;
+}
+
+static EstructuraHuella* entradaHuella(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int e) {
+	char* bloque = bloqueTablas(miSistemaDeFicheros, e / HUELLAS_POR_BLOQUE);
+
+	return bloque == NULL ? NULL : (EstructuraHuella*) (bloque + (e
+			% HUELLAS_POR_BLOQUE) * sizeof(EstructuraHuella));
+}
+
+static void anotaEntrada(MiSistemaDeFicheros* miSistemaDeFicheros, int e,
+		const EstructuraHuella* entrada) {
+	marcaSucio(miSistemaDeFicheros, (off_t)
+			(miSistemaDeFicheros->superBloque.idxHuellas + e
+					/ HUELLAS_POR_BLOQUE) * TAM_BLOQUE_BYTES + (e
+			% HUELLAS_POR_BLOQUE) * sizeof(EstructuraHuella), entrada,
+			sizeof(EstructuraHuella));
+}
+
+static int* entradaInverso(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA bloque) {
+	char* b = bloqueTablas(miSistemaDeFicheros,
+			miSistemaDeFicheros->superBloque.numBloquesHuellas + bloque
+					/ INVERSOS_POR_BLOQUE);
+
+	return b == NULL ? NULL : (int*) b + bloque % INVERSOS_POR_BLOQUE;
+}
+
+static void cambiaInverso(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA bloque, int valor) {
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	int* inverso = entradaInverso(miSistemaDeFicheros, bloque);
+
+	if (inverso == NULL)
+		return;
+	*inverso = valor;
+	marcaSucio(miSistemaDeFicheros, (off_t) (sb->idxHuellas
+			+ sb->numBloquesHuellas) * TAM_BLOQUE_BYTES + (off_t) bloque
+			* sizeof(int), inverso, sizeof(int));
+}
+
+// Posición de la entrada con la huella o -1 si no está. En *libre deja la
+// primera entrada libre del recorrido (-1 si no hay ninguna a su alcance).
+static int buscaEntrada(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const uint64_t huella[2], int* libre) {
+	int n = numEntradas(miSistemaDeFicheros);
+	int e = huella[0] % n, i;
+	EstructuraHuella* entrada;
+
+	*libre = -1;
+	for (i = 0; i < MAX_SONDEOS_HUELLA; i++, e = (e + 1) % n) {
+		if ((entrada = entradaHuella(miSistemaDeFicheros, e)) == NULL)
+			return -1;
+		// Al borrar no se dejan huecos: la huella no está más allá
+		if (entrada->referencias == 0) {
+			*libre = e;
+			return -1;
+		}
+		if (entrada->huella[0] == huella[0] && entrada->huella[1] == huella[1])
+			return e;
+	}
+	return -1;
+}
+
+// Vacía la entrada e. Para no dejar un hueco en medio de un sondeo, trae
+// hacia atrás cada una de las siguientes que pueda ocuparlo.
+static void borraEntrada(MiSistemaDeFicheros* miSistemaDeFicheros, int e) {
+	EstructuraHuella* hueco = entradaHuella(miSistemaDeFicheros, e);
+	EstructuraHuella* siguiente;
+	int n = numEntradas(miSistemaDeFicheros);
+	int j, casa, vistas;
+
+	if (hueco == NULL)
+		return;
+	cambiaInverso(miSistemaDeFicheros, hueco->bloque, 0);
+	for (j = (e + 1) % n, vistas = 1; vistas < n; j = (j + 1) % n, vistas++) {
+		siguiente = entradaHuella(miSistemaDeFicheros, j);
+		if (siguiente == NULL || siguiente->referencias == 0)
+			break;
+		// Se queda donde está si el hueco cae antes de su posición inicial
+		casa = siguiente->huella[0] % n;
+		if ((j - casa + n) % n < (j - e + n) % n)
+			continue;
+		*hueco = *siguiente;
+		anotaEntrada(miSistemaDeFicheros, e, hueco);
+		cambiaInverso(miSistemaDeFicheros, hueco->bloque, e + 1);
+		hueco = siguiente;
+		e = j;
+	}
+	memset(hueco, 0, sizeof(EstructuraHuella));
+	anotaEntrada(miSistemaDeFicheros, e, hueco);
+}
+
+DISK_LBA buscaHuella(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const uint64_t huella[2]) {
+	int libre, e = buscaEntrada(miSistemaDeFicheros, huella, &libre);
+
+	return e == -1 ? -1 : entradaHuella(miSistemaDeFicheros, e)->bloque;
+}
+
+void anotaHuella(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const uint64_t huella[2], DISK_LBA bloque) {
+	EstructuraHuella* entrada;
+	int libre;
+
+	if (buscaEntrada(miSistemaDeFicheros, huella, &libre) != -1 || libre == -1)
+		return;
+	entrada = entradaHuella(miSistemaDeFicheros, libre);
+	entrada->huella[0] = huella[0];
+	entrada->huella[1] = huella[1];
+	entrada->bloque = bloque;
+	entrada->referencias = 1;
+	anotaEntrada(miSistemaDeFicheros, libre, entrada);
+	cambiaInverso(miSistemaDeFicheros, bloque, libre + 1);
+}
+
+// Entrada del bloque en el índice, NULL si no está o si falla la lectura
+static EstructuraHuella* entradaBloque(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA bloque, int* e) {
+	int* inverso = entradaInverso(miSistemaDeFicheros, bloque);
+
+	if (inverso == NULL || *inverso == 0)
+		return NULL;
+	*e = *inverso - 1;
+	return entradaHuella(miSistemaDeFicheros, *e);
+}
+
+int sumaReferencia(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA bloque) {
+	int e;
+	EstructuraHuella* entrada = entradaBloque(miSistemaDeFicheros, bloque, &e);
+
+	if (entrada == NULL)
+		return -1;
+	entrada->referencias++;
+	anotaEntrada(miSistemaDeFicheros, e, entrada);
+	return 0;
+}
+
+int referenciasBloque(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA bloque) {
+	int* inverso = entradaInverso(miSistemaDeFicheros, bloque);
+	EstructuraHuella* entrada;
+
+	if (inverso == NULL)
+		return -1;
+	if (*inverso == 0)
+		return 1;
+	entrada = entradaHuella(miSistemaDeFicheros, *inverso - 1);
+	return entrada == NULL ? -1 : entrada->referencias;
+}
+
+void quitaHuella(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA bloque) {
+	int e;
+
+	if (entradaBloque(miSistemaDeFicheros, bloque, &e) != NULL)
+		borraEntrada(miSistemaDeFicheros, e);
+}
+
+void mueveHuella(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA viejo,
+		DISK_LBA nuevo) {
+	EstructuraHuella* entrada;
+	int e;
+
+	if (!deduplica(miSistemaDeFicheros) || (entrada = entradaBloque(
+			miSistemaDeFicheros, viejo, &e)) == NULL)
+		return;
+	entrada->bloque = nuevo;
+	anotaEntrada(miSistemaDeFicheros, e, entrada);
+	cambiaInverso(miSistemaDeFicheros, viejo, 0);
+	cambiaInverso(miSistemaDeFicheros, nuevo, e + 1);
+}
+
+// Resta una referencia al bloque y devuelve las que le quedan (-1 si falla)
+static int restaReferencia(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA bloque) {
+	int* inverso = entradaInverso(miSistemaDeFicheros, bloque);
+	EstructuraHuella* entrada;
+	int e;
+
+	if (inverso == NULL)
+		return -1;
+	if (*inverso == 0)
+		return 0;
+	e = *inverso - 1;
+	if ((entrada = entradaHuella(miSistemaDeFicheros, e)) == NULL)
+		return -1;
+	if (--entrada->referencias > 0) {
+		anotaEntrada(miSistemaDeFicheros, e, entrada);
+		return entrada->referencias;
+	}
+	borraEntrada(miSistemaDeFicheros, e);
+	return 0;
+}
+
+void liberaRachaDatos(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA inicio, int numBloques) {
+	int i, desde = 0;
+
+	if (!deduplica(miSistemaDeFicheros)) {
+		liberaRachaDiferida(miSistemaDeFicheros, inicio, numBloques, false);
+		return;
+	}
+	// Si no se sabe cuántas le quedan, se pierde el bloque antes que
+	// liberar uno que otro archivo sigue usando
+	for (i = 0; i < numBloques; i++) {
+		if (restaReferencia(miSistemaDeFicheros, inicio + i) == 0)
+			continue;
+		if (i > desde)
+			liberaRachaDiferida(miSistemaDeFicheros, inicio + desde, i - desde,
+					false);
+		desde = i + 1;
+	}
+	if (numBloques > desde)
+		liberaRachaDiferida(miSistemaDeFicheros, inicio + desde, numBloques
+				- desde, false);
+}
+
+int compruebaHuellas(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const uint32_t* refs, BOOLEAN reparar, int maxEscritos, int* reparados) {
+	int n = numEntradas(miSistemaDeFicheros);
+	DISK_LBA bloque, tamDisco =
+			miSistemaDeFicheros->superBloque.tamDiscoEnBloques;
+	EstructuraHuella* entrada = NULL;
+	int* inverso;
+	int e, errores = 0;
+
+	*reparados = 0;
+	if (!deduplica(miSistemaDeFicheros))
+		return 0;
+	// El inverso de cada bloque tiene que apuntar a una entrada suya
+	for (bloque = 0; bloque < tamDisco; bloque++) {
+		if ((inverso = entradaInverso(miSistemaDeFicheros, bloque)) == NULL)
+			return -1;
+		if (*inverso == 0) {
+			if (refs[bloque] > 1) {
+				if (errores++ < maxEscritos)
+					fprintf(stderr, "Bloque %d compartido por %u archivos sin estar en el índice de huellas\n",
+							bloque, refs[bloque]);
+			}
+			continue;
+		}
+		if (*inverso > 0 && *inverso <= n && (entrada = entradaHuella(
+				miSistemaDeFicheros, *inverso - 1)) == NULL)
+			return -1;
+		if (*inverso < 0 || *inverso > n || entrada->referencias == 0
+				|| entrada->bloque != bloque) {
+			if (errores++ < maxEscritos)
+				fprintf(stderr, "El inverso del bloque %d apunta a la entrada %d del índice de huellas, que no es suya\n",
+						bloque, *inverso - 1);
+			if (reparar) {
+				cambiaInverso(miSistemaDeFicheros, bloque, 0);
+				(*reparados)++;
+			}
+		}
+	}
+
+	// Y cada entrada, a un bloque con tantas referencias como dice
+	for (e = 0; e < n; e++) {
+		if ((entrada = entradaHuella(miSistemaDeFicheros, e)) == NULL)
+			return -1;
+		if (entrada->referencias == 0)
+			continue;
+		bloque = entrada->bloque;
+		if (bloque < 0 || bloque >= tamDisco) {
+			if (errores++ < maxEscritos)
+				fprintf(stderr, "La entrada %d del índice de huellas apunta fuera del disco (bloque %d)\n",
+						e, bloque);
+			continue;
+		}
+		if ((inverso = entradaInverso(miSistemaDeFicheros, bloque)) == NULL)
+			return -1;
+		if (*inverso != e + 1) {
+			if (errores++ < maxEscritos)
+				fprintf(stderr, "El bloque %d está en la entrada %d del índice de huellas, pero su inverso no apunta a ella\n",
+						bloque, e);
+			if (!reparar)
+				continue;
+			cambiaInverso(miSistemaDeFicheros, bloque, e + 1);
+			(*reparados)++;
+		}
+		if ((uint32_t) entrada->referencias == refs[bloque])
+			continue;
+		if (errores++ < maxEscritos)
+			fprintf(stderr, "El bloque %d tiene %d referencias en el índice de huellas y %u en los archivos\n",
+					bloque, entrada->referencias, refs[bloque]);
+		if (!reparar)
+			continue;
+		(*reparados)++;
+		if (refs[bloque] > 0) {
+			entrada->referencias = refs[bloque];
+			anotaEntrada(miSistemaDeFicheros, e, entrada);
+		} else {
+			// borraEntrada trae aquí la siguiente del sondeo: se vuelve a mirar
+			borraEntrada(miSistemaDeFicheros, e);
+			e--;
+		}
+	}
+	return errores;
+}
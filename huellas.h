@@ -0,0 +1,80 @@
+#ifndef HUELLAS_H
+#define	HUELLAS_H
+
+#include "common.h"
+
+// Deduplicación de los bloques de datos (opcional: -dedup on al formatear).
+//
+// Cada bloque que se importa se identifica por su huella, un hash de 128
+// bits de su contenido (MurmurHash3 x64/128). El índice de huellas es una
+// tabla hash en disco, con sondeo lineal, de EstructuraHuella: la huella, el
+// bloque que tiene ese contenido y cuántas referencias tiene. Si un bloque
+// que se va a escribir ya está en el índice, el archivo apunta a ese bloque
+// y se le suma una referencia en vez de escribirlo otra vez (ver
+// escribeFlujo).
+//
+// Detrás del índice va el inverso: para cada bloque del disco, la posición
+// de su entrada en el índice más uno (0 si no está). Así, al liberar un
+// bloque se le resta una referencia sin leerlo, y solo vuelve al mapa de
+// bits cuando no le queda ninguna. Un bloque que no está en el índice
+// (metadatos, lo escrito con libsfs) tiene una sola referencia.
+//
+// Los bloques de las dos tablas se leen al consultarlos y se quedan en
+// memoria, como los de nodos-i; los cambios se anotan entrada a entrada con
+// marcaSucio y pasan por el diario con los demás metadatos.
+//
+// Una huella que no encuentra sitio en MAX_SONDEOS_HUELLA entradas a partir
+// de la suya no se indexa: ese bloque no se compartirá, pero nada más.
+
+#define MAX_SONDEOS_HUELLA 32
+
+typedef struct EstructuraHuella {
+  uint64_t huella[2];
+  DISK_LBA bloque;
+  int referencias;                              // 0 si la entrada está libre
+} EstructuraHuella;
+
+#define HUELLAS_POR_BLOQUE (TAM_BLOQUE_BYTES / sizeof(EstructuraHuella))
+#define INVERSOS_POR_BLOQUE (TAM_BLOQUE_BYTES / sizeof(int))
+
+// Bloques de las tablas para un disco de numBloques bloques
+int bloquesIndiceHuellas(int numBloques);
+int bloquesInversoHuellas(int numBloques);
+
+// Prepara las tablas vacías: sus bloques se leen al consultarlos
+int initHuellas(MiSistemaDeFicheros* miSistemaDeFicheros);
+void liberaHuellas(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+// Cierto si la imagen se formateó con deduplicación
+BOOLEAN deduplica(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+void calculaHuella(const void* bloque, uint64_t huella[2]);
+// Devuelve el bloque con esa huella o -1 si no está en el índice
+DISK_LBA buscaHuella(MiSistemaDeFicheros* miSistemaDeFicheros, const uint64_t huella[2]);
+// Mete en el índice el bloque, recién escrito, con una referencia
+void anotaHuella(MiSistemaDeFicheros* miSistemaDeFicheros, const uint64_t huella[2], DISK_LBA bloque);
+// Suma una referencia a un bloque del índice
+int sumaReferencia(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA bloque);
+// Referencias del bloque (1 si no está en el índice) o -1 si falla
+int referenciasBloque(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA bloque);
+// Saca del índice un bloque con una sola referencia, que se va a modificar
+void quitaHuella(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA bloque);
+
+// El contenido del bloque viejo, con una sola referencia, se ha copiado en
+// nuevo (al desfragmentar): su entrada pasa a nuevo
+void mueveHuella(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA viejo, DISK_LBA nuevo);
+
+// Como liberaRachaDiferida para los bloques de datos de un archivo: cada
+// bloque pierde una referencia y solo se liberan los que se quedan sin
+// ninguna
+void liberaRachaDatos(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio, int numBloques);
+
+// Para fsck: compara el índice y el inverso con las referencias que tiene
+// de verdad cada bloque (refs, una por bloque del disco) y cuenta lo que no
+// cuadra, escribiendo como mucho maxEscritos errores. Si reparar, ajusta las
+// referencias, borra las entradas de los bloques que ya no usa nadie y
+// arregla el inverso, y deja en *reparados cuántos errores ha corregido.
+// Devuelve el número de errores o -1 si falla la lectura.
+int compruebaHuellas(MiSistemaDeFicheros* miSistemaDeFicheros, const uint32_t* refs, BOOLEAN reparar, int maxEscritos, int* reparados);
+
+#endif	/* HUELLAS_H */
@@ -0,0 +1,279 @@
+#include "lote.h"
+#include "util.h"
+#include "metadatos.h"
+#include "cache.h"
+#include "sumas.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Un archivo de la lista
+typedef struct ArchivoLote {
+	char* externo;
+	char* interno;
+} ArchivoLote;
+
+// Lo que comparten los hilos
+typedef struct Lote {
+	MiSistemaDeFicheros* miSistemaDeFicheros;
+	pthread_mutex_t cerrojo;          // Protege todo lo demás
+	pthread_cond_t confirmado;        // Se han cerrado todas las operaciones
+	ArchivoLote* archivos;
+	int numArchivos;
+	int siguiente;                    // Primer archivo sin repartir
+	int importados;
+} Lote;
+
+// Guarda en *rachas las extensiones del nodo-i en orden (con el cerrojo:
+// recorre el árbol a través de la caché). Saca de la caché lo que hubiera
+// en esos bloques, como escribeDatos. Devuelve el número de rachas o -1.
+static int rachasNodoI(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int numNodoI, RachaPendiente** rachas, int* maxRachas) {
+	EstructuraNodoI* nodoI = obtenNodoI(miSistemaDeFicheros, numNodoI);
+	CursorExtensiones cursor;
+	RachaPendiente* nuevas;
+	int bloque, n, numRachas = 0;
+	DISK_LBA idxBloque;
+
+	initCursorExtensiones(&cursor);
+	for (bloque = 0; bloque < nodoI->numBloques; bloque += n) {
+		idxBloque = buscaBloqueNodoI(miSistemaDeFicheros, nodoI, bloque, &n,
+				&cursor);
+		if (idxBloque == -1)
+			return -1;
+		if (numRachas == *maxRachas) {
+			nuevas = realloc(*rachas, (*maxRachas * 2 + 16)
+					* sizeof(RachaPendiente));
+			if (nuevas == NULL) {
+				perror("Falló realloc en rachasNodoI");
+				return -1;
+			}
+			*rachas = nuevas;
+			*maxRachas = *maxRachas * 2 + 16;
+		}
+		(*rachas)[numRachas].inicio = idxBloque;
+		(*rachas)[numRachas].numBloques = n;
+		numRachas++;
+		olvidaBloques(miSistemaDeFicheros, idxBloque, n);
+	}
+	return numRachas;
+}
+
+// Copia el archivo externo en las rachas (sin el cerrojo: solo toca el
+// archivo y unos bloques que nadie más usa). Como escribeDatos. Si sumas no
+// es NULL deja en él la de cada bloque, en orden, para anotarlas después con
+// el cerrojo.
+static int copiaRachas(MiSistemaDeFicheros* miSistemaDeFicheros, int handle,
+		const RachaPendiente* rachas, int numRachas, char* buffer,
+		uint32_t* sumas) {
+	DISK_LBA idxBloque;
+	ssize_t leidos;
+	char* destino;
+	int i, j, hechos, n;
+
+	posix_fadvise(handle, 0, 0, POSIX_FADV_SEQUENTIAL);
+	for (i = 0; i < numRachas; i++) {
+		for (hechos = 0; hechos < rachas[i].numBloques; hechos += n) {
+			n = rachas[i].numBloques - hechos;
+			if (n > MAX_BLOQUES_POR_ES)
+				n = MAX_BLOQUES_POR_ES;
+			idxBloque = rachas[i].inicio + hechos;
+			destino = miSistemaDeFicheros->imagen != NULL
+					? miSistemaDeFicheros->imagen + (size_t) idxBloque
+							* TAM_BLOQUE_BYTES : buffer;
+			leidos = leeCompleto(handle, destino, n * TAM_BLOQUE_BYTES);
+			if (leidos == -1) {
+				perror("Falló read en copiaRachas");
+				return -1;
+			}
+			memset(destino + leidos, 0, n * TAM_BLOQUE_BYTES - leidos);
+			for (j = 0; sumas != NULL && j < n; j++)
+				*sumas++ = sumaBloque(destino + (size_t) j * TAM_BLOQUE_BYTES);
+			if (destino == buffer && escribeBloques(miSistemaDeFicheros,
+					idxBloque, n, buffer) == -1)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static void* trabajador(void* arg) {
+	Lote* lote = arg;
+	MiSistemaDeFicheros* miSistemaDeFicheros = lote->miSistemaDeFicheros;
+	char* buffer = malloc(MAX_BLOQUES_POR_ES * TAM_BLOQUE_BYTES);
+	RachaPendiente* rachas = NULL;
+	uint32_t* sumas = NULL;
+	int maxRachas = 0, numRachas;
+	int i, j, ret, handle, numNodoI, numBloques;
+	BOOLEAN flujo;
+
+	if (buffer == NULL) {
+		perror("Falló malloc en trabajador");
+		return NULL;
+	}
+	pthread_mutex_lock(&lote->cerrojo);
+	while ((i = lote->siguiente) < lote->numArchivos) {
+		// Si el grupo ya está completo se espera a que lo confirme la última
+		// operación abierta; si no, podría no cerrarse nunca
+		if (grupoCompleto(miSistemaDeFicheros)
+				&& miSistemaDeFicheros->opsAbiertas > 0) {
+			pthread_cond_wait(&lote->confirmado, &lote->cerrojo);
+			continue;
+		}
+		lote->siguiente++;
+		ret = abreImportacion(miSistemaDeFicheros, lote->archivos[i].externo,
+				lote->archivos[i].interno, &handle, &numNodoI, &flujo);
+		// Un flujo va reservando bloques según llega: se copia con el
+		// cerrojo, como myImport. Con deduplicación o compresión todo va
+		// así, porque cada bloque se busca en el índice de huellas o se
+		// sabe cuánto ocupa después de comprimirlo.
+		if (ret == 0 && flujo) {
+			ret = terminaImportacionFlujo(miSistemaDeFicheros, handle,
+					numNodoI, lote->archivos[i].externo,
+					lote->archivos[i].interno);
+			if (ret == 0) {
+				lote->importados++;
+				continue;
+			}
+		}
+		if (ret != 0) {
+			fprintf(stderr, "Incapaz de importar el fichero externo %s como %s, código de error: %d\n",
+					lote->archivos[i].externo, lote->archivos[i].interno, ret);
+			continue;
+		}
+		numRachas = rachasNodoI(miSistemaDeFicheros, numNodoI, &rachas,
+				&maxRachas);
+		numBloques = obtenNodoI(miSistemaDeFicheros, numNodoI)->numBloques;
+		sumas = NULL;
+		if (numRachas != -1 && tieneSumas(miSistemaDeFicheros) && numBloques
+				> 0 && (sumas = malloc(numBloques * sizeof(uint32_t))) == NULL) {
+			perror("Falló malloc en trabajador");
+			numRachas = -1;
+		}
+		miSistemaDeFicheros->opsAbiertas++;
+		pthread_mutex_unlock(&lote->cerrojo);
+
+		if (numRachas != -1)
+			ret = copiaRachas(miSistemaDeFicheros, handle, rachas, numRachas,
+					buffer, sumas);
+		close(handle);
+
+		pthread_mutex_lock(&lote->cerrojo);
+		for (j = 0, numBloques = 0; sumas != NULL && ret != -1
+				&& j < numRachas; j++) {
+			if (anotaSumasCalculadas(miSistemaDeFicheros, rachas[j].inicio,
+					rachas[j].numBloques, sumas + numBloques) == -1)
+				ret = -1;
+			numBloques += rachas[j].numBloques;
+		}
+		free(sumas);
+		miSistemaDeFicheros->opsAbiertas--;
+		if (numRachas == -1 || ret == -1) {
+			// Como en myImport: myRm lo deshace todo en la misma operación,
+			// y la cierra
+			fprintf(stderr, "Incapaz de copiar los datos de %s\n",
+					lote->archivos[i].externo);
+			myRm(miSistemaDeFicheros, lote->archivos[i].interno);
+		} else {
+			lote->importados++;
+			cierraOperacion(miSistemaDeFicheros);
+		}
+		if (miSistemaDeFicheros->opsAbiertas == 0)
+			pthread_cond_broadcast(&lote->confirmado);
+	}
+	pthread_mutex_unlock(&lote->cerrojo);
+	free(rachas);
+	free(buffer);
+	return NULL;
+}
+
+// Lee la lista de archivos. Devuelve cuántos hay o -1.
+static int leeLista(const char* nombreLista, ArchivoLote** archivos) {
+	FILE* f = fopen(nombreLista, "r");
+	char* linea = NULL;
+	size_t tamLinea = 0;
+	int numArchivos = 0, maxArchivos = 0, numLinea = 0;
+	ArchivoLote a, *nuevos;
+	char resto;
+
+	*archivos = NULL;
+	if (f == NULL) {
+		perror(nombreLista);
+		return -1;
+	}
+	while (getline(&linea, &tamLinea, f) != -1) {
+		numLinea++;
+		a.externo = a.interno = NULL;
+		switch (sscanf(linea, "%ms %ms %c", &a.externo, &a.interno, &resto)) {
+		case EOF:
+			continue;
+		case 2:
+			break;
+		default:
+			fprintf(stderr, "%s:%d: se esperaba archivoExterno rutaInterna\n",
+					nombreLista, numLinea);
+			free(a.externo);
+			free(a.interno);
+			continue;
+		}
+		if (numArchivos == maxArchivos) {
+			nuevos = realloc(*archivos, (maxArchivos * 2 + 64)
+					* sizeof(ArchivoLote));
+			if (nuevos == NULL) {
+				perror("Falló realloc en leeLista");
+				free(a.externo);
+				free(a.interno);
+				break;
+			}
+			*archivos = nuevos;
+			maxArchivos = maxArchivos * 2 + 64;
+		}
+		(*archivos)[numArchivos++] = a;
+	}
+	free(linea);
+	fclose(f);
+	return numArchivos;
+}
+
+int myImportMany(MiSistemaDeFicheros* miSistemaDeFicheros, char* nombreLista,
+		int numHilos) {
+	pthread_t* hilos;
+	Lote lote;
+	int i, creados = 0;
+
+	lote.numArchivos = leeLista(nombreLista, &lote.archivos);
+	if (lote.numArchivos == -1)
+		return 1;
+	lote.miSistemaDeFicheros = miSistemaDeFicheros;
+	lote.siguiente = 0;
+	lote.importados = 0;
+	pthread_mutex_init(&lote.cerrojo, NULL);
+	pthread_cond_init(&lote.confirmado, NULL);
+
+	if (numHilos > lote.numArchivos)
+		numHilos = lote.numArchivos;
+	hilos = malloc(numHilos * sizeof(pthread_t));
+	if (hilos != NULL) {
+		for (creados = 0; creados < numHilos; creados++) {
+			if (pthread_create(&hilos[creados], NULL, trabajador, &lote) != 0)
+				break;
+		}
+	}
+	// Sin hilos (o si no se ha podido crear ninguno) se importa aquí
+	if (creados == 0)
+		trabajador(&lote);
+	for (i = 0; i < creados; i++)
+		pthread_join(hilos[i], NULL);
+
+	printf("Importados %d de %d archivos con %d hilos\n", lote.importados,
+			lote.numArchivos, creados > 0 ? creados : 1);
+	for (i = 0; i < lote.numArchivos; i++) {
+		free(lote.archivos[i].externo);
+		free(lote.archivos[i].interno);
+	}
+	free(lote.archivos);
+	free(hilos);
+	pthread_mutex_destroy(&lote.cerrojo);
+	pthread_cond_destroy(&lote.confirmado);
+	return lote.importados == lote.numArchivos ? 0 : 2;
+}
@@ -0,0 +1,30 @@
+#ifndef LOTE_H
+#define	LOTE_H
+
+#include "common.h"
+
+// Importación de muchos archivos a la vez con varios hilos.
+//
+// Casi todo lo que cuesta importar un archivo es copiar sus datos: leerlos
+// del archivo externo y escribirlos en sus bloques. Eso es lo único que
+// hacen los hilos en paralelo. Los metadatos (mapas, nodos-i, directorios,
+// caché y la transacción en curso) están en una sola estructura, y cada
+// hilo los toca con un cerrojo: reserva el nodo-i, los bloques y la entrada
+// del directorio (abreImportacion), anota dónde están los bloques y suelta
+// el cerrojo para copiar. Al terminar lo vuelve a coger para cerrar la
+// operación.
+//
+// Mientras un hilo copia, su operación está a medias (opsAbiertas) y no se
+// puede confirmar el grupo, porque la transacción no sería atómica. La
+// confirma la última operación que se cierra; entretanto, si el grupo ya
+// está completo, los hilos esperan antes de empezar otra.
+//
+// Los datos se copian con pread/pwrite o en la proyección, nunca con el
+// anillo de io_uring, que no se comparte entre hilos.
+
+// Importa los archivos de la lista nombreLista: una línea por archivo, con
+// el nombre externo y la ruta interna separados por espacios. Devuelve 0 si
+// se importan todos, 1 si no se puede leer la lista y 2 si falla alguno.
+int myImportMany(MiSistemaDeFicheros* miSistemaDeFicheros, char* nombreLista, int numHilos);
+
+#endif	/* LOTE_H */
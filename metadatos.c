@@ -0,0 +1,423 @@
+#include "metadatos.h"
+#include "diario.h"
+#include "cache.h"
+#include "sumas.h"
+#include <stdlib.h>
+#include <string.h>
+
+void initMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	miSistemaDeFicheros->rangosSucios = NULL;
+	miSistemaDeFicheros->numRangosSucios = 0;
+	miSistemaDeFicheros->maxRangosSucios = 0;
+	miSistemaDeFicheros->indiceCopias = NULL;
+	miSistemaDeFicheros->tamIndiceCopias = 0;
+	miSistemaDeFicheros->numCopias = 0;
+	miSistemaDeFicheros->bytesPendientes = 0;
+	miSistemaDeFicheros->liberaciones = NULL;
+	miSistemaDeFicheros->numLiberaciones = 0;
+	miSistemaDeFicheros->maxLiberaciones = 0;
+	miSistemaDeFicheros->opsPorGrupo = 1;
+	miSistemaDeFicheros->segundosPorGrupo = MAX_SEGUNDOS_GRUPO;
+	miSistemaDeFicheros->opsPendientes = 0;
+	miSistemaDeFicheros->opsAbiertas = 0;
+	miSistemaDeFicheros->inicioGrupo = 0;
+	miSistemaDeFicheros->diarioActivo = false;
+	miSistemaDeFicheros->checkpointPendiente = false;
+	miSistemaDeFicheros->posDiario = 0;
+	miSistemaDeFicheros->secuenciaDiario = 0;
+}
+
+// Añade un rango vacío al final de la lista y lo devuelve
+static RangoSucio* nuevoRango(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	RangoSucio* r;
+
+	if (miSistemaDeFicheros->numRangosSucios
+			== miSistemaDeFicheros->maxRangosSucios) {
+		int max = miSistemaDeFicheros->maxRangosSucios ? 2
+				* miSistemaDeFicheros->maxRangosSucios : 32;
+		r = realloc(miSistemaDeFicheros->rangosSucios, max * sizeof(RangoSucio));
+		if (r == NULL) {
+			perror("Falló realloc en nuevoRango");
+			return NULL;
+		}
+		miSistemaDeFicheros->rangosSucios = r;
+		miSistemaDeFicheros->maxRangosSucios = max;
+	}
+	return &miSistemaDeFicheros->rangosSucios[miSistemaDeFicheros->numRangosSucios++];
+}
+
+int marcaSucio(MiSistemaDeFicheros* miSistemaDeFicheros, off_t pos,
+		const void* memoria, size_t tam) {
+	RangoSucio* r;
+	int i;
+
+	miSistemaDeFicheros->bytesPendientes += tam;
+
+	// Si toca o se solapa con un rango ya anotado, y memoria y disco guardan
+	// la misma correspondencia, lo ampliamos en lugar de añadir otro
+	for (i = 0; i < miSistemaDeFicheros->numRangosSucios; i++) {
+		r = &miSistemaDeFicheros->rangosSucios[i];
+		if (!r->propio && (intptr_t) r->memoria - r->pos == (intptr_t) memoria
+				- pos && pos <= r->pos + (off_t) r->tam && r->pos <= pos
+				+ (off_t) tam) {
+			off_t inicio = pos < r->pos ? pos : r->pos;
+			off_t fin = pos + tam > r->pos + r->tam ? pos + tam : r->pos
+					+ r->tam;
+			r->memoria -= r->pos - inicio;
+			r->pos = inicio;
+			r->tam = fin - inicio;
+			return 0;
+		}
+	}
+
+	if ((r = nuevoRango(miSistemaDeFicheros)) == NULL)
+		return -1;
+	r->pos = pos;
+	r->memoria = memoria;
+	r->tam = tam;
+	r->propio = false;
+	return 0;
+}
+
+int marcaSucioCampo(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA idxBloque, const void* estructura, const void* campo,
+		size_t tam) {
+	return marcaSucio(miSistemaDeFicheros, (off_t) idxBloque * TAM_BLOQUE_BYTES
+			+ ((const char*) campo - (const char*) estructura), campo, tam);
+}
+
+// Las copias propias se localizan por su bloque con una tabla hash de
+// direccionamiento abierto; cada posición guarda el índice del rango + 1
+static unsigned posIndiceCopias(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA idxBloque) {
+	return ((unsigned) idxBloque * 2654435761u)
+			& (miSistemaDeFicheros->tamIndiceCopias - 1);
+}
+
+static void indexaCopia(MiSistemaDeFicheros* miSistemaDeFicheros, int rango) {
+	unsigned i = posIndiceCopias(miSistemaDeFicheros,
+			miSistemaDeFicheros->rangosSucios[rango].pos / TAM_BLOQUE_BYTES);
+
+	while (miSistemaDeFicheros->indiceCopias[i] != 0)
+		i = (i + 1) & (miSistemaDeFicheros->tamIndiceCopias - 1);
+	miSistemaDeFicheros->indiceCopias[i] = rango + 1;
+}
+
+// Deja sitio en el índice para una copia más, como mucho medio lleno
+static int ampliaIndiceCopias(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	int tam = miSistemaDeFicheros->tamIndiceCopias;
+	int* indice;
+	int i;
+
+	if (2 * (miSistemaDeFicheros->numCopias + 1) <= tam)
+		return 0;
+	tam = tam ? 2 * tam : 64;
+	if ((indice = calloc(tam, sizeof(int))) == NULL) {
+		perror("Falló calloc en ampliaIndiceCopias");
+		return -1;
+	}
+	free(miSistemaDeFicheros->indiceCopias);
+	miSistemaDeFicheros->indiceCopias = indice;
+	miSistemaDeFicheros->tamIndiceCopias = tam;
+	for (i = 0; i < miSistemaDeFicheros->numRangosSucios; i++) {
+		if (miSistemaDeFicheros->rangosSucios[i].propio)
+			indexaCopia(miSistemaDeFicheros, i);
+	}
+	return 0;
+}
+
+// Copia del bloque idxBloque pendiente de confirmar, o NULL si no hay
+static RangoSucio* buscaCopia(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA idxBloque) {
+	off_t pos = (off_t) idxBloque * TAM_BLOQUE_BYTES;
+	RangoSucio* r;
+	unsigned i;
+
+	if (miSistemaDeFicheros->numCopias == 0)
+		return NULL;
+	for (i = posIndiceCopias(miSistemaDeFicheros, idxBloque);
+			miSistemaDeFicheros->indiceCopias[i] != 0;
+			i = (i + 1) & (miSistemaDeFicheros->tamIndiceCopias - 1)) {
+		r = &miSistemaDeFicheros->rangosSucios[miSistemaDeFicheros->indiceCopias[i]
+				- 1];
+		if (r->pos == pos)
+			return r;
+	}
+	return NULL;
+}
+
+int escribeBloqueMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA idxBloque, const void* buffer) {
+	RangoSucio* r = buscaCopia(miSistemaDeFicheros, idxBloque);
+	char* copia;
+
+	if (r != NULL) {
+		memcpy((char*) r->memoria, buffer, TAM_BLOQUE_BYTES);
+		return 0;
+	}
+	if (ampliaIndiceCopias(miSistemaDeFicheros) == -1)
+		return -1;
+	if ((copia = malloc(TAM_BLOQUE_BYTES)) == NULL) {
+		perror("Falló malloc en escribeBloqueMetadatos");
+		return -1;
+	}
+	if ((r = nuevoRango(miSistemaDeFicheros)) == NULL) {
+		free(copia);
+		return -1;
+	}
+	memcpy(copia, buffer, TAM_BLOQUE_BYTES);
+	r->pos = (off_t) idxBloque * TAM_BLOQUE_BYTES;
+	r->memoria = copia;
+	r->tam = TAM_BLOQUE_BYTES;
+	r->propio = true;
+	indexaCopia(miSistemaDeFicheros, r - miSistemaDeFicheros->rangosSucios);
+	miSistemaDeFicheros->numCopias++;
+	miSistemaDeFicheros->bytesPendientes += TAM_BLOQUE_BYTES;
+	return 0;
+}
+
+int leeBloqueMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA idxBloque, void* buffer) {
+	RangoSucio* r = buscaCopia(miSistemaDeFicheros, idxBloque);
+
+	if (r == NULL)
+		return leeBloqueCache(miSistemaDeFicheros, idxBloque, buffer);
+	memcpy(buffer, r->memoria, TAM_BLOQUE_BYTES);
+	return 0;
+}
+
+const void* fijaBloqueMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA idxBloque) {
+	RangoSucio* r = buscaCopia(miSistemaDeFicheros, idxBloque);
+
+	return r != NULL ? r->memoria : fijaBloque(miSistemaDeFicheros, idxBloque);
+}
+
+void sueltaBloqueMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const void* bloque) {
+	sueltaBloque(miSistemaDeFicheros, bloque);
+}
+
+int leeBloquesMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA inicio, int numBloques, void* buffer) {
+	RangoSucio* r;
+	int i;
+
+	if (leeBloquesCache(miSistemaDeFicheros, inicio, numBloques, buffer) == -1)
+		return -1;
+	for (i = 0; i < numBloques && miSistemaDeFicheros->numCopias > 0; i++) {
+		r = buscaCopia(miSistemaDeFicheros, inicio + i);
+		if (r != NULL)
+			memcpy((char*) buffer + (size_t) i * TAM_BLOQUE_BYTES, r->memoria,
+					TAM_BLOQUE_BYTES);
+	}
+	return 0;
+}
+
+void liberaRachaDiferida(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA inicio, int numBloques, BOOLEAN enDiario) {
+	RachaPendiente* r;
+
+	if (!miSistemaDeFicheros->diarioActivo) {
+		olvidaBloques(miSistemaDeFicheros, inicio, numBloques);
+		cambiaRachaMapa(miSistemaDeFicheros, inicio, numBloques, false);
+		return;
+	}
+	// Si se reutilizaran antes de vaciar el diario, reproducirlo pisaría
+	// su nuevo contenido con la copia antigua
+	if (enDiario)
+		miSistemaDeFicheros->checkpointPendiente = true;
+
+	if (miSistemaDeFicheros->numLiberaciones > 0) {
+		r = &miSistemaDeFicheros->liberaciones[miSistemaDeFicheros->numLiberaciones
+				- 1];
+		if (r->inicio + r->numBloques == inicio) {
+			r->numBloques += numBloques;
+			return;
+		}
+	}
+	if (miSistemaDeFicheros->numLiberaciones
+			== miSistemaDeFicheros->maxLiberaciones) {
+		int max = miSistemaDeFicheros->maxLiberaciones ? 2
+				* miSistemaDeFicheros->maxLiberaciones : 32;
+		r = realloc(miSistemaDeFicheros->liberaciones, max
+				* sizeof(RachaPendiente));
+		if (r == NULL) {
+			// Perder los bloques es preferible a reutilizarlos antes de tiempo
+			perror("Falló realloc en liberaRachaDiferida");
+			return;
+		}
+		miSistemaDeFicheros->liberaciones = r;
+		miSistemaDeFicheros->maxLiberaciones = max;
+	}
+	r = &miSistemaDeFicheros->liberaciones[miSistemaDeFicheros->numLiberaciones++];
+	r->inicio = inicio;
+	r->numBloques = numBloques;
+}
+
+BOOLEAN grupoCompleto(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	size_t limite = 0;
+
+	if (miSistemaDeFicheros->opsPendientes == 0)
+		return false;
+	if (miSistemaDeFicheros->diarioActivo)
+		limite = (size_t) (miSistemaDeFicheros->superBloque.numBloquesDiario
+				- 1) * TAM_BLOQUE_BYTES / 2;
+	return miSistemaDeFicheros->opsPendientes >= miSistemaDeFicheros->opsPorGrupo
+			|| miSistemaDeFicheros->bytesPendientes >= limite
+			|| (miSistemaDeFicheros->segundosPorGrupo > 0 && time(NULL)
+					- miSistemaDeFicheros->inicioGrupo
+					>= miSistemaDeFicheros->segundosPorGrupo);
+}
+
+int cierraOperacion(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	if (miSistemaDeFicheros->opsPendientes++ == 0)
+		miSistemaDeFicheros->inicioGrupo = time(NULL);
+	// Con otras operaciones a medias la transacción no sería atómica: la
+	// confirma la última que se cierre
+	if (grupoCompleto(miSistemaDeFicheros)
+			&& miSistemaDeFicheros->opsAbiertas == 0)
+		return confirmaMetadatos(miSistemaDeFicheros);
+	return 0;
+}
+
+int escribeRangos(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const RangoSucio* rangos, int n) {
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (escribeDisco(miSistemaDeFicheros, rangos[i].pos, rangos[i].memoria,
+				rangos[i].tam) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static int comparaRangos(const void* a, const void* b) {
+	off_t posA = ((const RangoSucio*) a)->pos;
+	off_t posB = ((const RangoSucio*) b)->pos;
+	return (posA > posB) - (posA < posB);
+}
+
+int confirmaMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	RangoSucio* rangos;
+	int n, i, j;
+	int ret = 1;
+
+	// Los bloques liberados vuelven al mapa de bits en la misma transacción
+	// que deja de apuntar a ellos. Lo que tuvieran en la caché ya no debe
+	// llegar a disco, donde pisaría a quien los reutilice.
+	for (i = 0; i < miSistemaDeFicheros->numLiberaciones; i++) {
+		olvidaBloques(miSistemaDeFicheros,
+				miSistemaDeFicheros->liberaciones[i].inicio,
+				miSistemaDeFicheros->liberaciones[i].numBloques);
+		cambiaRachaMapa(miSistemaDeFicheros,
+				miSistemaDeFicheros->liberaciones[i].inicio,
+				miSistemaDeFicheros->liberaciones[i].numBloques, false);
+	}
+	if (miSistemaDeFicheros->numLiberaciones > 0)
+		escribeSuperBloque(miSistemaDeFicheros);
+	// La lista se vacía tras la transacción: si no cabe en el diario, los
+	// bloques que libera no valen para escribirla fuera
+
+	// Las sumas de los bloques tocados van en la misma transacción
+	if (anotaSumasMetadatos(miSistemaDeFicheros) == -1) {
+		miSistemaDeFicheros->numLiberaciones = 0;
+		return -1;
+	}
+
+	n = miSistemaDeFicheros->numRangosSucios;
+	miSistemaDeFicheros->opsPendientes = 0;
+	if (n == 0) {
+		miSistemaDeFicheros->numLiberaciones = 0;
+		return 0;
+	}
+
+	// Ordenamos por posición y juntamos los rangos contiguos en disco que
+	// también lo son en memoria, para escribir cada uno con una llamada.
+	// Las copias propias se quedan aparte para poder liberarlas luego.
+	rangos = malloc(n * sizeof(RangoSucio));
+	if (rangos == NULL) {
+		perror("Falló malloc en confirmaMetadatos");
+		miSistemaDeFicheros->numLiberaciones = 0;
+		return -1;
+	}
+	memcpy(rangos, miSistemaDeFicheros->rangosSucios, n * sizeof(RangoSucio));
+	qsort(rangos, n, sizeof(RangoSucio), comparaRangos);
+	for (i = 0, j = 0; i < n; i++) {
+		if (j > 0 && !rangos[i].propio && !rangos[j - 1].propio && rangos[j
+				- 1].pos + (off_t) rangos[j - 1].tam >= rangos[i].pos
+				&& (intptr_t) rangos[j - 1].memoria - rangos[j - 1].pos
+						== (intptr_t) rangos[i].memoria - rangos[i].pos) {
+			off_t fin = rangos[i].pos + rangos[i].tam;
+			if (fin > rangos[j - 1].pos + (off_t) rangos[j - 1].tam)
+				rangos[j - 1].tam = fin - rangos[j - 1].pos;
+		} else {
+			rangos[j++] = rangos[i];
+		}
+	}
+	n = j;
+
+	if (miSistemaDeFicheros->diarioActivo) {
+		// Una vez confirmada la transacción ya se puede escribir cualquier
+		// cosa en su sitio. Las copias pasan a la caché, que las escribirá
+		// al sacarlas o en el checkpoint; el resto espera al checkpoint.
+		ret = escribeTransaccion(miSistemaDeFicheros, rangos, n);
+		for (i = 0; ret == 0 && i < n; i++) {
+			if (rangos[i].propio && guardaBloqueCache(miSistemaDeFicheros,
+					rangos[i].pos / TAM_BLOQUE_BYTES, rangos[i].memoria, true)
+					== -1)
+				ret = -1;
+		}
+		if (ret == 0 && miSistemaDeFicheros->checkpointPendiente
+				&& reproduceDiario(miSistemaDeFicheros) == -1)
+			ret = -1;
+		miSistemaDeFicheros->checkpointPendiente = false;
+		if (ret == 1)
+			fprintf(stderr, "Aviso: la transacción no cabe en el diario ni "
+				"quedan bloques libres para escribirla fuera; se escribe en su "
+				"sitio sin protección frente a caídas\n");
+	}
+	miSistemaDeFicheros->numLiberaciones = 0;
+	if (ret == 1) {
+		// Sin diario (o sin sitio para la transacción) se escribe todo en su
+		// sitio. Una única sincronización hace duraderos los metadatos y
+		// también los datos escritos antes sobre la misma imagen.
+		ret = escribeRangos(miSistemaDeFicheros, rangos, n);
+		if (ret == 0 && sincronizaDisco(miSistemaDeFicheros) == -1) {
+			perror("Falló la sincronización en confirmaMetadatos");
+			ret = -1;
+		}
+		for (i = 0; ret == 0 && i < n; i++) {
+			if (rangos[i].propio)
+				guardaBloqueCache(miSistemaDeFicheros, rangos[i].pos
+						/ TAM_BLOQUE_BYTES, rangos[i].memoria, false);
+		}
+	}
+	free(rangos);
+
+	for (i = 0; i < miSistemaDeFicheros->numRangosSucios; i++) {
+		if (miSistemaDeFicheros->rangosSucios[i].propio)
+			free((char*) miSistemaDeFicheros->rangosSucios[i].memoria);
+	}
+	miSistemaDeFicheros->numRangosSucios = 0;
+	miSistemaDeFicheros->bytesPendientes = 0;
+	if (miSistemaDeFicheros->numCopias > 0)
+		memset(miSistemaDeFicheros->indiceCopias, 0,
+				miSistemaDeFicheros->tamIndiceCopias * sizeof(int));
+	miSistemaDeFicheros->numCopias = 0;
+	return ret;
+}
+
+void liberaMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	int i;
+
+	for (i = 0; i < miSistemaDeFicheros->numRangosSucios; i++) {
+		if (miSistemaDeFicheros->rangosSucios[i].propio)
+			free((char*) miSistemaDeFicheros->rangosSucios[i].memoria);
+	}
+	free(miSistemaDeFicheros->rangosSucios);
+	free(miSistemaDeFicheros->indiceCopias);
+	free(miSistemaDeFicheros->liberaciones);
+	initMetadatos(miSistemaDeFicheros);
+}
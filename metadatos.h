@@ -0,0 +1,69 @@
+#ifndef METADATOS_H
+#define	METADATOS_H
+
+#include "common.h"
+
+// Capa de escritura diferida de metadatos.
+//
+// Las funciones escribe* de common.c ya no escriben en disco: solo anotan
+// qué bytes de la copia en memoria (superbloque, mapa de bits, tabla de
+// nodos-i) han cambiado. Los nodos del árbol de extensiones y los bloques
+// de los directorios, que no están en memoria, se anotan como copias con
+// escribeBloqueMetadatos y se leen a través de la caché de bloques.
+// confirmaMetadatos lleva todo lo anotado a disco de forma atómica, como una
+// transacción del diario (ver diario.h), y lo hace duradero con un único
+// fdatasync (o msync, si la imagen está proyectada).
+//
+// Varias operaciones pueden compartir una transacción (ver cierraOperacion).
+// Mientras no se confirme, los bloques liberados no se reutilizan: si el
+// sistema se cae, el disco sigue apuntando a ellos.
+
+#define MAX_SEGUNDOS_GRUPO 1 // Antigüedad máx. de una operación sin confirmar (por defecto)
+
+// Deja vacías las listas de cambios pendientes y el diario sin activar
+void initMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+// Anota que los tam bytes de memoria se corresponden con la posición pos del
+// disco y han cambiado. La memoria tiene que seguir siendo válida hasta la
+// siguiente confirmación.
+int marcaSucio(MiSistemaDeFicheros* miSistemaDeFicheros, off_t pos, const void* memoria, size_t tam);
+
+// Igual que marcaSucio, para un campo de una estructura que está en disco a
+// partir del bloque idxBloque
+int marcaSucioCampo(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA idxBloque,
+		const void* estructura, const void* campo, size_t tam);
+
+// Escribe un bloque de metadatos que no vive en memoria: se guarda una copia
+// hasta la confirmación. leeBloqueMetadatos ve esa copia antes que el disco.
+int escribeBloqueMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA idxBloque, const void* buffer);
+int leeBloqueMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA idxBloque, void* buffer);
+// Igual para numBloques bloques consecutivos, con una sola lectura
+int leeBloquesMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio, int numBloques, void* buffer);
+// Devuelve el bloque sin copiarlo, de la copia pendiente o fijado en la
+// caché (ver cache.h), hasta sueltaBloqueMetadatos. No se puede modificar.
+const void* fijaBloqueMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA idxBloque);
+void sueltaBloqueMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros, const void* bloque);
+
+// Libera la racha en el mapa de bits al confirmar. enDiario indica que los
+// bloques eran metadatos y pueden tener copias en el diario.
+void liberaRachaDiferida(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio, int numBloques, BOOLEAN enDiario);
+
+// Indica si ya hay opsPorGrupo operaciones sin confirmar, si la más
+// antigua lleva segundosPorGrupo (si no es 0) o si lo anotado ocupa la mitad
+// del diario
+BOOLEAN grupoCompleto(MiSistemaDeFicheros* miSistemaDeFicheros);
+// Fin de una operación: confirma si el grupo está completo y no queda
+// ninguna otra a medias (opsAbiertas)
+int cierraOperacion(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+// Escribe cada rango en su sitio, sin sincronizar
+int escribeRangos(MiSistemaDeFicheros* miSistemaDeFicheros, const RangoSucio* rangos, int n);
+
+// Escribe los cambios anotados, ordenados y fusionados, y sincroniza
+int confirmaMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+// Libera las listas de cambios pendientes (sin escribirlos)
+void liberaMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+#endif	/* METADATOS_H */
+
@@ -5,7 +5,7 @@
  * Accepts: nothing
  * Returns: parse information structure
  */
-#define MAXLINE 81
+#define MAXLINE 1025
 
 void init_info(parseInfo *p) {
     int i;
@@ -125,7 +125,7 @@ parseInfo *parse(char *cmdline) {
                 return NULL;
             }
             if (com_pos == MAXLINE - 1) {
-                fprintf(stderr, "Error. The command length exceeds the limit 80\n");
+                fprintf(stderr, "Error. The command length exceeds the limit %d\n", MAXLINE - 1);
                 free_info(Result);
                 return NULL;
             }
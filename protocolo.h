@@ -0,0 +1,63 @@
+#ifndef PROTOCOLO_H
+#define	PROTOCOLO_H
+
+#include <stdint.h>
+
+// Protocolo de sfs-servidor, por un socket Unix (SOCK_STREAM).
+//
+// Cada petición es una PeticionSFS seguida de tam bytes: primero la ruta
+// (lonRuta bytes, sin '\0') y después los datos. Cada respuesta es una
+// RespuestaSFS seguida de tam bytes. Los enteros van en el orden de la
+// máquina: cliente y servidor están en la misma.
+//
+// Un cliente puede mandar muchas peticiones sin esperar a las respuestas.
+// Las respuestas no tienen por qué llegar en orden: llevan el id de su
+// petición.
+
+// Operaciones (PeticionSFS.op)
+#define OP_BUSCA 1      // ruta -> EstadoSFS
+#define OP_ABRE 2       // ruta, num = opciones de sfs_open -> estado = descriptor, EstadoSFS
+#define OP_CIERRA 3     // descriptor
+#define OP_LEE 4        // descriptor, pos, num = bytes -> los bytes leídos (estado = cuántos)
+#define OP_ESCRIBE 5    // descriptor, pos, datos -> estado = bytes escritos
+#define OP_IMPORTA 6    // ruta, datos = nombre del archivo externo (en el servidor)
+#define OP_BORRA 7      // ruta
+#define OP_LISTA 8      // ruta -> una EntradaListaSFS y su nombre por cada entrada
+
+// Lo más que puede ocupar una petición o una lectura
+#define MAX_DATOS_PETICION (16 << 20)
+
+typedef struct PeticionSFS {
+	uint32_t tam;                     // Bytes detrás de la cabecera
+	uint32_t id;                      // Se devuelve en la respuesta
+	uint16_t op;
+	uint16_t lonRuta;
+	int32_t descriptor;
+	int64_t pos;
+	uint32_t num;
+	uint32_t relleno;
+} PeticionSFS;
+
+typedef struct RespuestaSFS {
+	uint32_t tam;                     // Bytes detrás de la cabecera
+	uint32_t id;
+	int32_t estado;                   // >= 0 si va bien; si no, -errno
+	uint32_t relleno;
+} RespuestaSFS;
+
+typedef struct EstadoSFS {
+	int64_t tam;
+	int64_t tiempoModificado;
+	int32_t numNodoI;
+	int32_t numBloques;
+	int32_t esDirectorio;
+	int32_t relleno;
+} EstadoSFS;
+
+typedef struct EntradaListaSFS {
+	EstadoSFS estado;
+	uint32_t lonNombre;               // Bytes del nombre, que va detrás
+	uint32_t relleno;
+} EntradaListaSFS;
+
+#endif	/* PROTOCOLO_H */
@@ -0,0 +1,226 @@
+// Prueba de sfs-servidor con dos conexiones a la vez. La primera escribe en
+// /a y lo cierra, con las dos peticiones encadenadas, una y otra vez; la
+// segunda abre y cierra /b sin escribir nada. Si el servidor cerrase el
+// descriptor de /a antes de acabar la escritura, la segunda podría recibir
+// el mismo número y la escritura acabaría en /b, que tiene que seguir vacío.
+//
+// Después, una tercera conexión pide muchas lecturas grandes de /c seguidas
+// y tarda en leer las respuestas: el servidor deja de leer de ella mientras
+// tanto, pero tienen que llegar todas.
+//
+//   ./prueba-servidor rutaSocket
+//
+// La imagen tiene que estar recién formateada. Devuelve 0 si todo va bien.
+#include "protocolo.h"
+#include "sfs.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RONDAS_PRUEBA 10000
+#define TAM_ESCRITURA_PRUEBA 4096
+#define LECTURAS_PRUEBA 256
+#define TAM_LECTURA_PRUEBA (1 << 20)
+
+static const char* rutaSocket;
+static int conexionC, fdC;            // Los de la prueba de lecturas
+
+static int conecta(void) {
+	struct sockaddr_un dir;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	memset(&dir, 0, sizeof(dir));
+	dir.sun_family = AF_UNIX;
+	strncpy(dir.sun_path, rutaSocket, sizeof(dir.sun_path) - 1);
+	if (fd == -1 || connect(fd, (struct sockaddr*) &dir, sizeof(dir)) == -1) {
+		perror(rutaSocket);
+		exit(1);
+	}
+	return fd;
+}
+
+static void escribeTodo(int fd, const void* datos, size_t tam) {
+	ssize_t n;
+
+	for (; tam > 0; datos = (const char*) datos + n, tam -= n) {
+		if ((n = write(fd, datos, tam)) == -1) {
+			perror("Falló write en escribeTodo");
+			exit(1);
+		}
+	}
+}
+
+static void leeTodo(int fd, void* datos, size_t tam) {
+	ssize_t n;
+
+	for (; tam > 0; datos = (char*) datos + n, tam -= n) {
+		if ((n = read(fd, datos, tam)) <= 0) {
+			fprintf(stderr, "El servidor ha cerrado la conexión\n");
+			exit(1);
+		}
+	}
+}
+
+// Añade a buffer una petición con la ruta y los datos. Devuelve lo que ocupa.
+static size_t peticion(char* buffer, uint32_t id, uint16_t op, int32_t descriptor,
+		uint32_t num, const char* ruta, const void* datos, uint32_t tamDatos) {
+	PeticionSFS p;
+	uint16_t lonRuta = ruta != NULL ? strlen(ruta) : 0;
+
+	memset(&p, 0, sizeof(p));
+	p.tam = lonRuta + tamDatos;
+	p.id = id;
+	p.op = op;
+	p.lonRuta = lonRuta;
+	p.descriptor = descriptor;
+	p.num = num;
+	memcpy(buffer, &p, sizeof(p));
+	memcpy(buffer + sizeof(p), ruta, lonRuta);
+	memcpy(buffer + sizeof(p) + lonRuta, datos, tamDatos);
+	return sizeof(p) + p.tam;
+}
+
+// Lee una respuesta y se queda con su cuerpo, si cabe en cuerpo
+static RespuestaSFS respuesta(int fd, void* cuerpo, size_t tamCuerpo) {
+	static char resto[MAX_DATOS_PETICION];
+	RespuestaSFS r;
+
+	leeTodo(fd, &r, sizeof(r));
+	leeTodo(fd, r.tam <= tamCuerpo ? cuerpo : resto, r.tam);
+	return r;
+}
+
+static void* abreYCierra(void* arg) {
+	char buffer[256];
+	EstadoSFS estado;
+	RespuestaSFS r;
+	int conexion = conecta();
+	int i;
+
+	for (i = 0; i < RONDAS_PRUEBA; i++) {
+		escribeTodo(conexion, buffer, peticion(buffer, i, OP_ABRE, 0,
+				SFS_CREAR, "/b", NULL, 0));
+		if ((r = respuesta(conexion, &estado, sizeof(estado))).estado < 0) {
+			fprintf(stderr, "No se puede abrir /b: %s\n", strerror(-r.estado));
+			exit(1);
+		}
+		escribeTodo(conexion, buffer, peticion(buffer, i, OP_CIERRA,
+				r.estado, 0, NULL, NULL, 0));
+		respuesta(conexion, NULL, 0);
+	}
+	close(conexion);
+	return NULL;
+}
+
+// Pide las lecturas de /c sin esperar las respuestas
+static void* pideLecturas(void* arg) {
+	char buffer[sizeof(PeticionSFS)];
+	int i;
+
+	for (i = 0; i < LECTURAS_PRUEBA; i++)
+		escribeTodo(conexionC, buffer, peticion(buffer, i, OP_LEE, fdC,
+				TAM_LECTURA_PRUEBA, NULL, NULL, 0));
+	return NULL;
+}
+
+static int pruebaLecturas(void) {
+	static char buffer[sizeof(PeticionSFS) + 8 + TAM_LECTURA_PRUEBA];
+	static char datos[TAM_LECTURA_PRUEBA];
+	EstadoSFS estado;
+	RespuestaSFS r;
+	pthread_t hilo;
+	int i, completas = 0;
+
+	conexionC = conecta();
+	escribeTodo(conexionC, buffer, peticion(buffer, 0, OP_ABRE, 0, SFS_CREAR,
+			"/c", NULL, 0));
+	if ((fdC = respuesta(conexionC, &estado, sizeof(estado)).estado) < 0) {
+		fprintf(stderr, "No se puede abrir /c: %s\n", strerror(-fdC));
+		return 1;
+	}
+	memset(datos, 'C', sizeof(datos));
+	escribeTodo(conexionC, buffer, peticion(buffer, 0, OP_ESCRIBE, fdC, 0,
+			NULL, datos, sizeof(datos)));
+	if (respuesta(conexionC, NULL, 0).estado != TAM_LECTURA_PRUEBA) {
+		fprintf(stderr, "No se puede escribir en /c\n");
+		return 1;
+	}
+
+	pthread_create(&hilo, NULL, pideLecturas, NULL);
+	// Para que se acumule la salida
+	usleep(200000);
+	for (i = 0; i < LECTURAS_PRUEBA; i++) {
+		memset(datos, 0, sizeof(datos));
+		r = respuesta(conexionC, datos, sizeof(datos));
+		if (r.estado == TAM_LECTURA_PRUEBA && datos[0] == 'C'
+				&& datos[TAM_LECTURA_PRUEBA - 1] == 'C')
+			completas++;
+	}
+	pthread_join(hilo, NULL);
+	close(conexionC);
+	printf("%d de %d lecturas de /c completas\n", completas, LECTURAS_PRUEBA);
+	return completas == LECTURAS_PRUEBA ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+	static char buffer[3 * sizeof(PeticionSFS) + TAM_ESCRITURA_PRUEBA + 16];
+	char datos[TAM_ESCRITURA_PRUEBA];
+	EstadoSFS estado;
+	RespuestaSFS r;
+	pthread_t hilo;
+	size_t tam;
+	int conexion, fd, i, j, escrituras = 0;
+
+	if (argc != 2) {
+		fprintf(stderr, "%s rutaSocket\n", argv[0]);
+		return 2;
+	}
+	rutaSocket = argv[1];
+	conexion = conecta();
+	memset(datos, 'A', sizeof(datos));
+	escribeTodo(conexion, buffer, peticion(buffer, 0, OP_ABRE, 0, SFS_CREAR,
+			"/a", NULL, 0));
+	if ((fd = respuesta(conexion, &estado, sizeof(estado)).estado) < 0) {
+		fprintf(stderr, "No se puede abrir /a: %s\n", strerror(-fd));
+		return 1;
+	}
+
+	pthread_create(&hilo, NULL, abreYCierra, NULL);
+	for (i = 0; i < RONDAS_PRUEBA; i++) {
+		// Escribe, cierra y vuelve a abrir, sin esperar entre medias
+		tam = peticion(buffer, 1, OP_ESCRIBE, fd, 0, NULL, datos, sizeof(datos));
+		tam += peticion(buffer + tam, 2, OP_CIERRA, fd, 0, NULL, NULL, 0);
+		tam += peticion(buffer + tam, 3, OP_ABRE, 0, 0, "/a", NULL, 0);
+		escribeTodo(conexion, buffer, tam);
+		for (j = 0; j < 3; j++) {
+			r = respuesta(conexion, &estado, sizeof(estado));
+			if (r.id == 1 && r.estado == TAM_ESCRITURA_PRUEBA)
+				escrituras++;
+			else if (r.id == 3 && (fd = r.estado) < 0) {
+				fprintf(stderr, "No se puede abrir /a: %s\n", strerror(-fd));
+				return 1;
+			}
+		}
+	}
+	pthread_join(hilo, NULL);
+
+	escribeTodo(conexion, buffer, peticion(buffer, 0, OP_BUSCA, 0, 0, "/b",
+			NULL, 0));
+	if ((r = respuesta(conexion, &estado, sizeof(estado))).estado < 0) {
+		fprintf(stderr, "No se encuentra /b: %s\n", strerror(-r.estado));
+		return 1;
+	}
+	close(conexion);
+	printf("%d de %d escrituras en /a; /b tiene %lld bytes\n", escrituras,
+			RONDAS_PRUEBA, (long long) estado.tam);
+	if (estado.tam != 0) {
+		fprintf(stderr, "Una escritura en /a ha acabado en /b\n");
+		return 1;
+	}
+	return pruebaLecturas();
+}
@@ -0,0 +1,713 @@
+// sfs-servidor: monta una imagen una sola vez y la sirve por un socket Unix,
+// para que la usen varios procesos a la vez (ver protocolo.h).
+//
+//   ./sfs-servidor imagen rutaSocket [numHilos] [-mmap]
+//
+// El hilo principal atiende los sockets con epoll: acepta conexiones, lee
+// lo que llega y pone en la cola cada petición completa. Los trabajadores
+// las sacan, las hacen con la biblioteca (sfs.h) y dejan la respuesta en
+// la salida de su conexión. El bucle envía la salida de cada conexión con
+// una sola escritura, así que las peticiones encadenadas se contestan
+// también juntas. De un cliente que no lee las respuestas, o que manda
+// peticiones más deprisa de lo que se hacen, se deja de leer hasta que se
+// ponga al día. Con SIGINT o SIGTERM termina lo que hay en la cola y
+// desmonta.
+#define _GNU_SOURCE
+#include "sfs.h"
+#include "protocolo.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_EVENTOS 64
+#define TAM_LECTURA (64 << 10)
+// Lo que se lee de una conexión en cada vuelta del bucle, como mucho (más
+// una lectura): una petición completa
+#define MAX_ENTRADA (sizeof(PeticionSFS) + MAX_DATOS_PETICION + UINT16_MAX)
+// Con más peticiones en curso o más salida por enviar se deja de leer
+#define MAX_PENDIENTES 32
+#define MAX_SALIDA (4 << 20)
+
+typedef struct Buffer {
+	char* datos;
+	size_t usados;
+	size_t tam;
+} Buffer;
+
+// Un descriptor abierto por una conexión. No se cierra mientras se lee o
+// escribe con él: otra conexión podría abrir el mismo número y recibir la
+// escritura.
+typedef struct Descriptor {
+	int fd;
+	int usos;                         // Lecturas y escrituras en curso
+	int cerrando;                     // OP_CIERRA espera a que no haya usos
+} Descriptor;
+
+typedef struct Conexion {
+	int fd;                           // -1 si ya está cerrada
+	Buffer entrada;                   // Solo la toca el bucle
+	int retenida;                     // Ídem; quedan peticiones sin encolar
+	Buffer salida;
+	int pendientes;                   // Peticiones en la cola o en curso
+	int enListaEscritura;
+	uint32_t eventos;                 // Los que vigila epoll
+	int sinMemoria;                   // Se ha perdido una respuesta: hay que cerrarla
+	Descriptor* descriptores;         // Los que ha abierto esta conexión
+	int numDescriptores;
+	int maxDescriptores;
+	struct Conexion* siguienteEscritura;
+	struct Conexion* siguienteCerrada;
+	struct Conexion* siguienteRetenida;
+} Conexion;
+
+typedef struct Trabajo {
+	Conexion* conexion;
+	PeticionSFS peticion;
+	char* cuerpo;                     // Ruta y datos
+	struct Trabajo* siguiente;
+} Trabajo;
+
+static SFS* sfs;
+static int epollFd, avisoFd;
+// Protege la cola, las salidas, pendientes y descriptores de las conexiones
+static pthread_mutex_t cerrojo = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hayTrabajo = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sinUsos = PTHREAD_COND_INITIALIZER;
+static Trabajo* primero;
+static Trabajo* ultimo;
+static Conexion* porEscribir;         // Conexiones con respuestas nuevas
+static Conexion* cerradas;            // Conexiones cerradas por liberar
+static int terminar;
+
+// Para distinguir en epoll los descriptores que no son conexiones
+static int marcaEscucha, marcaAviso, marcaSenal;
+
+static int anade(Buffer* b, const void* datos, size_t tam) {
+	char* nuevos;
+	size_t nuevoTam;
+
+	if (b->usados + tam > b->tam) {
+		nuevoTam = b->tam * 2 > b->usados + tam ? b->tam * 2 : b->usados + tam;
+		if ((nuevos = realloc(b->datos, nuevoTam)) == NULL)
+			return -1;
+		b->datos = nuevos;
+		b->tam = nuevoTam;
+	}
+	if (datos != NULL)
+		memcpy(b->datos + b->usados, datos, tam);
+	b->usados += tam;
+	return 0;
+}
+
+// Con el cerrojo cogido, como las siguientes
+static void liberaConexion(Conexion* c) {
+	int i;
+
+	for (i = 0; i < c->numDescriptores; i++)
+		sfs_close(sfs, c->descriptores[i].fd);
+	free(c->descriptores);
+	free(c->entrada.datos);
+	free(c->salida.datos);
+	free(c);
+}
+
+// Deja de atender la conexión. No se libera aquí: puede quedar algún evento
+// suyo en la tanda que se está atendiendo (ver liberaCerradas).
+static void cierraConexion(Conexion* c) {
+	if (c->fd == -1)
+		return;
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	c->siguienteCerrada = cerradas;
+	cerradas = c;
+}
+
+// Libera las conexiones cerradas que ya no tienen nada en curso. El bucle
+// lo hace al acabar cada tanda de eventos, cuando ya no apunta a ellas.
+static void liberaCerradas(void) {
+	Conexion** p = &cerradas;
+	Conexion* c;
+
+	pthread_mutex_lock(&cerrojo);
+	while ((c = *p) != NULL) {
+		if (c->pendientes == 0 && !c->enListaEscritura) {
+			*p = c->siguienteCerrada;
+			liberaConexion(c);
+		} else {
+			p = &c->siguienteCerrada;
+		}
+	}
+	pthread_mutex_unlock(&cerrojo);
+}
+
+// Cierto si la conexión no va demasiado retrasada para leer más
+static int admiteMas(Conexion* c) {
+	return c->salida.usados < MAX_SALIDA && c->pendientes < MAX_PENDIENTES;
+}
+
+// Vigila EPOLLOUT si queda salida por enviar, y EPOLLIN solo si admite más
+static void actualizaEventos(Conexion* c) {
+	struct epoll_event ev;
+
+	ev.events = c->salida.usados > 0 ? EPOLLOUT : 0;
+	if (admiteMas(c))
+		ev.events |= EPOLLIN;
+	if (ev.events != c->eventos) {
+		c->eventos = ev.events;
+		ev.data.ptr = c;
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, c->fd, &ev);
+	}
+}
+
+// Envía lo que se pueda de la salida y actualiza lo que vigila epoll. Si
+// falla, o se ha perdido una respuesta, cierra la conexión.
+static void enviaSalida(Conexion* c) {
+	size_t enviados = 0;
+	ssize_t n;
+
+	if (c->sinMemoria) {
+		cierraConexion(c);
+		return;
+	}
+	while (enviados < c->salida.usados) {
+		n = write(c->fd, c->salida.datos + enviados, c->salida.usados
+				- enviados);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && errno != EAGAIN) {
+			cierraConexion(c);
+			return;
+		}
+		if (n == -1)
+			break;
+		enviados += n;
+	}
+	// Lo enviado se quita para que la salida no crezca sin límite
+	if (enviados > 0) {
+		memmove(c->salida.datos, c->salida.datos + enviados, c->salida.usados
+				- enviados);
+		c->salida.usados -= enviados;
+	}
+	actualizaEventos(c);
+}
+
+static int buscaDescriptor(Conexion* c, int fd) {
+	int i;
+
+	for (i = 0; i < c->numDescriptores; i++) {
+		if (c->descriptores[i].fd == fd)
+			return i;
+	}
+	return -1;
+}
+
+static void anadeEntradaLista(const char* nombre, const SFSStat* st,
+		void* arg) {
+	EntradaListaSFS e;
+
+	memset(&e, 0, sizeof(e));
+	e.estado.tam = st->tam;
+	e.estado.tiempoModificado = st->tiempoModificado;
+	e.estado.numNodoI = st->numNodoI;
+	e.estado.numBloques = st->numBloques;
+	e.estado.esDirectorio = st->esDirectorio;
+	e.lonNombre = strlen(nombre);
+	anade(arg, &e, sizeof(e));
+	anade(arg, nombre, e.lonNombre);
+}
+
+// Hace la petición y deja la respuesta, con su cabecera, en r
+static void atiende(Trabajo* t, Buffer* r) {
+	PeticionSFS* p = &t->peticion;
+	Conexion* c = t->conexion;
+	RespuestaSFS* cabecera;
+	EstadoSFS estado;
+	SFSStat st;
+	char* ruta = malloc(p->lonRuta + 1);
+	char* datos = t->cuerpo + p->lonRuta;
+	char* externo;
+	size_t tamDatos = p->tam - p->lonRuta;
+	int ret = -1, propio, usado = 0;
+	Descriptor* d;
+
+	anade(r, NULL, sizeof(RespuestaSFS));
+	if (ruta == NULL || r->datos == NULL) {
+		errno = ENOMEM;
+		goto fin;
+	}
+	memcpy(ruta, t->cuerpo, p->lonRuta);
+	ruta[p->lonRuta] = '\0';
+
+	// Los descriptores solo sirven en la conexión que los ha abierto. Las
+	// peticiones de una conexión se hacen a la vez: OP_CIERRA lo quita de
+	// la lista (y lo cierra) cuando acaban las lecturas y escrituras que ya
+	// lo usan, y las que llegan después no lo encuentran.
+	if (p->op == OP_LEE || p->op == OP_ESCRIBE || p->op == OP_CIERRA) {
+		pthread_mutex_lock(&cerrojo);
+		propio = buscaDescriptor(c, p->descriptor);
+		if (propio != -1 && c->descriptores[propio].cerrando)
+			propio = -1;
+		if (propio != -1 && p->op == OP_CIERRA) {
+			c->descriptores[propio].cerrando = 1;
+			// Mientras se espera, otro OP_CIERRA puede moverlo en la lista
+			while (c->descriptores[propio = buscaDescriptor(c,
+					p->descriptor)].usos > 0)
+				pthread_cond_wait(&sinUsos, &cerrojo);
+			c->descriptores[propio] = c->descriptores[--c->numDescriptores];
+		} else if (propio != -1) {
+			c->descriptores[propio].usos++;
+			usado = 1;
+		}
+		pthread_mutex_unlock(&cerrojo);
+		if (propio == -1) {
+			errno = EBADF;
+			goto fin;
+		}
+	}
+
+	switch (p->op) {
+	case OP_BUSCA:
+	case OP_ABRE:
+		if (p->op == OP_ABRE) {
+			if ((ret = sfs_open(sfs, ruta, p->num)) == -1)
+				break;
+			// Sin el estado no hay respuesta, y el cliente no sabría que
+			// tiene el descriptor abierto
+			if (sfs_stat(sfs, ruta, &st) == -1) {
+				int error = errno;
+				sfs_close(sfs, ret);
+				errno = error;
+				ret = -1;
+				break;
+			}
+			pthread_mutex_lock(&cerrojo);
+			if (c->numDescriptores == c->maxDescriptores) {
+				Descriptor* nuevos = realloc(c->descriptores,
+						(c->maxDescriptores * 2 + 8) * sizeof(Descriptor));
+				if (nuevos != NULL) {
+					c->descriptores = nuevos;
+					c->maxDescriptores = c->maxDescriptores * 2 + 8;
+				}
+			}
+			if (c->numDescriptores < c->maxDescriptores) {
+				d = &c->descriptores[c->numDescriptores++];
+				d->fd = ret;
+				d->usos = 0;
+				d->cerrando = 0;
+			} else {
+				sfs_close(sfs, ret);
+				errno = ENOMEM;
+				ret = -1;
+			}
+			pthread_mutex_unlock(&cerrojo);
+			if (ret == -1)
+				break;
+		} else if ((ret = sfs_stat(sfs, ruta, &st)) == -1)
+			break;
+		memset(&estado, 0, sizeof(estado));
+		estado.tam = st.tam;
+		estado.tiempoModificado = st.tiempoModificado;
+		estado.numNodoI = st.numNodoI;
+		estado.numBloques = st.numBloques;
+		estado.esDirectorio = st.esDirectorio;
+		anade(r, &estado, sizeof(estado));
+		break;
+	case OP_CIERRA:
+		ret = sfs_close(sfs, p->descriptor);
+		break;
+	case OP_LEE:
+		if (p->num > MAX_DATOS_PETICION) {
+			errno = EINVAL;
+			break;
+		}
+		if (anade(r, NULL, p->num) == -1) {
+			errno = ENOMEM;
+			break;
+		}
+		ret = sfs_pread(sfs, p->descriptor, r->datos + sizeof(RespuestaSFS),
+				p->num, p->pos);
+		r->usados = sizeof(RespuestaSFS) + (ret > 0 ? ret : 0);
+		break;
+	case OP_ESCRIBE:
+		ret = sfs_pwrite(sfs, p->descriptor, datos, tamDatos, p->pos);
+		break;
+	case OP_IMPORTA:
+		if ((externo = strndup(datos, tamDatos)) == NULL) {
+			errno = ENOMEM;
+			break;
+		}
+		ret = sfs_import(sfs, externo, ruta);
+		free(externo);
+		break;
+	case OP_BORRA:
+		ret = sfs_unlink(sfs, ruta);
+		break;
+	case OP_LISTA:
+		ret = sfs_list(sfs, ruta, anadeEntradaLista, r);
+		if (ret == 0 && r->datos == NULL) {
+			errno = ENOMEM;
+			ret = -1;
+		}
+		break;
+	default:
+		errno = EINVAL;
+	}
+
+	fin: free(ruta);
+	if (usado) {
+		pthread_mutex_lock(&cerrojo);
+		d = &c->descriptores[buscaDescriptor(c, p->descriptor)];
+		if (--d->usos == 0 && d->cerrando)
+			pthread_cond_broadcast(&sinUsos);
+		pthread_mutex_unlock(&cerrojo);
+	}
+	if (r->datos == NULL)
+		return;
+	if (ret == -1)
+		r->usados = sizeof(RespuestaSFS);
+	cabecera = (RespuestaSFS*) r->datos;
+	cabecera->tam = r->usados - sizeof(RespuestaSFS);
+	cabecera->id = p->id;
+	cabecera->estado = ret == -1 ? -errno : ret;
+	cabecera->relleno = 0;
+}
+
+static void* trabajador(void* arg) {
+	Buffer r = { NULL, 0, 0 };
+	Trabajo* t;
+	Conexion* c;
+	uint64_t uno = 1;
+
+	pthread_mutex_lock(&cerrojo);
+	for (;;) {
+		while (primero == NULL && !terminar)
+			pthread_cond_wait(&hayTrabajo, &cerrojo);
+		if ((t = primero) == NULL)
+			break;
+		if ((primero = t->siguiente) == NULL)
+			ultimo = NULL;
+		pthread_mutex_unlock(&cerrojo);
+
+		r.usados = 0;
+		atiende(t, &r);
+		c = t->conexion;
+
+		pthread_mutex_lock(&cerrojo);
+		c->pendientes--;
+		// La conexión la cierra el bucle, que puede estar leyendo de ella
+		if (c->fd != -1 && (r.datos == NULL || anade(&c->salida, r.datos,
+				r.usados) == -1))
+			c->sinMemoria = 1;
+		if (!c->enListaEscritura) {
+			// El bucle envía la salida de todas las conexiones de la lista
+			// (y libera las cerradas); solo hay que avisarle si estaba vacía
+			if (porEscribir == NULL && write(avisoFd, &uno, sizeof(uno))
+					== -1)
+				perror("Falló write en trabajador");
+			c->enListaEscritura = 1;
+			c->siguienteEscritura = porEscribir;
+			porEscribir = c;
+		}
+		free(t->cuerpo);
+		free(t);
+	}
+	pthread_mutex_unlock(&cerrojo);
+	free(r.datos);
+	return NULL;
+}
+
+static void aceptaConexiones(int escucha) {
+	struct epoll_event ev;
+	Conexion* c;
+	int fd;
+
+	while ((fd = accept4(escucha, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC))
+			!= -1) {
+		if ((c = calloc(1, sizeof(Conexion))) == NULL) {
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		c->eventos = ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			perror("Falló epoll_ctl en aceptaConexiones");
+			close(fd);
+			free(c);
+		}
+	}
+}
+
+// Lee lo que haya llegado, hasta MAX_ENTRADA, y encola las peticiones
+// completas mientras no pase de MAX_PENDIENTES. Lo demás espera.
+static void leeConexion(Conexion* c) {
+	Trabajo* nuevos = NULL;
+	Trabajo** final = &nuevos;
+	Trabajo* t;
+	PeticionSFS p;
+	size_t usado = 0;
+	ssize_t n;
+	int numNuevos = 0, cerrar = 0, libres;
+
+	// Los trabajadores solo pueden bajarlo
+	pthread_mutex_lock(&cerrojo);
+	libres = MAX_PENDIENTES - c->pendientes;
+	pthread_mutex_unlock(&cerrojo);
+	c->retenida = 0;
+
+	while (c->entrada.usados < MAX_ENTRADA) {
+		if (anade(&c->entrada, NULL, TAM_LECTURA) == -1) {
+			cerrar = 1;
+			break;
+		}
+		c->entrada.usados -= TAM_LECTURA;
+		n = read(c->fd, c->entrada.datos + c->entrada.usados, TAM_LECTURA);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1) {
+			cerrar = errno != EAGAIN;
+			break;
+		}
+		if (n == 0) {
+			cerrar = 1;
+			break;
+		}
+		c->entrada.usados += n;
+	}
+
+	while (!cerrar && c->entrada.usados - usado >= sizeof(PeticionSFS)) {
+		if (numNuevos >= libres) {
+			c->retenida = 1;
+			break;
+		}
+		memcpy(&p, c->entrada.datos + usado, sizeof(p));
+		if (p.tam > MAX_DATOS_PETICION + UINT16_MAX || p.lonRuta > p.tam) {
+			fprintf(stderr, "Petición no válida; se cierra la conexión\n");
+			cerrar = 1;
+			break;
+		}
+		if (c->entrada.usados - usado < sizeof(p) + p.tam)
+			break;
+		if ((t = malloc(sizeof(Trabajo))) == NULL || (t->cuerpo = malloc(
+				p.tam + 1)) == NULL) {
+			free(t);
+			cerrar = 1;
+			break;
+		}
+		t->conexion = c;
+		t->peticion = p;
+		memcpy(t->cuerpo, c->entrada.datos + usado + sizeof(p), p.tam);
+		t->siguiente = NULL;
+		*final = t;
+		final = &t->siguiente;
+		numNuevos++;
+		usado += sizeof(p) + p.tam;
+	}
+	memmove(c->entrada.datos, c->entrada.datos + usado, c->entrada.usados
+			- usado);
+	c->entrada.usados -= usado;
+
+	pthread_mutex_lock(&cerrojo);
+	if (nuevos != NULL) {
+		if (ultimo != NULL)
+			ultimo->siguiente = nuevos;
+		else
+			primero = nuevos;
+		for (ultimo = nuevos; ultimo->siguiente != NULL; ultimo
+				= ultimo->siguiente)
+			;
+		c->pendientes += numNuevos;
+		if (numNuevos > 1)
+			pthread_cond_broadcast(&hayTrabajo);
+		else
+			pthread_cond_signal(&hayTrabajo);
+	}
+	if (cerrar)
+		cierraConexion(c);
+	else
+		actualizaEventos(c);
+	pthread_mutex_unlock(&cerrojo);
+}
+
+// Envía las respuestas que han dejado los trabajadores
+static void enviaPendientes(void) {
+	Conexion* retenidas = NULL;
+	uint64_t avisos;
+	Conexion* c;
+
+	if (read(avisoFd, &avisos, sizeof(avisos)) == -1 && errno != EAGAIN)
+		perror("Falló read en enviaPendientes");
+	pthread_mutex_lock(&cerrojo);
+	while ((c = porEscribir) != NULL) {
+		porEscribir = c->siguienteEscritura;
+		c->enListaEscritura = 0;
+		if (c->fd != -1)
+			enviaSalida(c);
+		// Las peticiones que se quedaron sin encolar ya pueden entrar
+		if (c->fd != -1 && c->retenida && admiteMas(c)) {
+			c->siguienteRetenida = retenidas;
+			retenidas = c;
+		}
+	}
+	pthread_mutex_unlock(&cerrojo);
+	for (c = retenidas; c != NULL; c = c->siguienteRetenida)
+		leeConexion(c);
+}
+
+static int abreSocket(const char* ruta) {
+	struct sockaddr_un dir;
+	struct stat st;
+	int fd;
+
+	if (strlen(ruta) >= sizeof(dir.sun_path)) {
+		fprintf(stderr, "Ruta del socket demasiado larga: %s\n", ruta);
+		return -1;
+	}
+	// Un socket que quede de una ejecución anterior se reemplaza; cualquier
+	// otra cosa no se toca
+	if (stat(ruta, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(ruta);
+	memset(&dir, 0, sizeof(dir));
+	dir.sun_family = AF_UNIX;
+	strcpy(dir.sun_path, ruta);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1 || bind(fd, (struct sockaddr*) &dir, sizeof(dir)) == -1
+			|| listen(fd, SOMAXCONN) == -1) {
+		perror(ruta);
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int vigila(int fd, void* marca) {
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = marca;
+	return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int main(int argc, char** argv) {
+	struct epoll_event eventos[MAX_EVENTOS];
+	struct signalfd_siginfo info;
+	pthread_t* hilos;
+	sigset_t senales;
+	int escucha, senalFd;
+	int numHilos = sysconf(_SC_NPROCESSORS_ONLN);
+	int opciones = 0;
+	int i, n, creados;
+
+	if (argc > 1 && strcmp(argv[argc - 1], "-mmap") == 0) {
+		opciones = SFS_MMAP;
+		argc--;
+	}
+	if (argc == 4)
+		numHilos = atoi(argv[3]);
+	if ((argc != 3 && argc != 4) || numHilos < 1) {
+		fprintf(stderr, "%s imagen rutaSocket [numHilos] [-mmap]\n", argv[0]);
+		return -1;
+	}
+
+	// Las señales se atienden en el bucle; ningún hilo las recibe
+	signal(SIGPIPE, SIG_IGN);
+	sigemptyset(&senales);
+	sigaddset(&senales, SIGINT);
+	sigaddset(&senales, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &senales, NULL);
+
+	if ((sfs = sfs_mount(argv[1], opciones)) == NULL) {
+		fprintf(stderr, "Incapaz de montar %s: %s\n", argv[1], strerror(errno));
+		return -1;
+	}
+	if ((escucha = abreSocket(argv[2])) == -1) {
+		sfs_umount(sfs);
+		return -1;
+	}
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	avisoFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	senalFd = signalfd(-1, &senales, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (epollFd == -1 || avisoFd == -1 || senalFd == -1 || vigila(escucha,
+			&marcaEscucha) == -1 || vigila(avisoFd, &marcaAviso) == -1
+			|| vigila(senalFd, &marcaSenal) == -1) {
+		perror("Falló epoll en main");
+		sfs_umount(sfs);
+		return -1;
+	}
+
+	hilos = malloc(numHilos * sizeof(pthread_t));
+	for (creados = 0; hilos != NULL && creados < numHilos; creados++) {
+		if (pthread_create(&hilos[creados], NULL, trabajador, NULL) != 0)
+			break;
+	}
+	if (creados == 0) {
+		fprintf(stderr, "No se ha podido crear ningún trabajador\n");
+		sfs_umount(sfs);
+		return -1;
+	}
+	fprintf(stderr, "Sirviendo %s en %s con %d hilos\n", argv[1], argv[2],
+			creados);
+
+	while (!terminar) {
+		n = epoll_wait(epollFd, eventos, MAX_EVENTOS, -1);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1) {
+			perror("Falló epoll_wait en main");
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			void* marca = eventos[i].data.ptr;
+
+			if (marca == &marcaEscucha) {
+				aceptaConexiones(escucha);
+			} else if (marca == &marcaAviso) {
+				enviaPendientes();
+			} else if (marca == &marcaSenal) {
+				if (read(senalFd, &info, sizeof(info)) > 0)
+					terminar = 1;
+			} else {
+				Conexion* c = marca;
+				int leer = eventos[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR);
+
+				// Puede haberse cerrado antes en esta misma tanda
+				if (c->fd != -1 && eventos[i].events & EPOLLOUT) {
+					pthread_mutex_lock(&cerrojo);
+					enviaSalida(c);
+					// Con la salida enviada pueden entrar las retenidas
+					if (c->fd != -1 && c->retenida && admiteMas(c))
+						leer = 1;
+					pthread_mutex_unlock(&cerrojo);
+				}
+				if (c->fd != -1 && leer)
+					leeConexion(c);
+			}
+		}
+		liberaCerradas();
+	}
+
+	// Se termina lo que ya está en la cola antes de desmontar
+	fprintf(stderr, "Terminando\n");
+	close(escucha);
+	unlink(argv[2]);
+	pthread_mutex_lock(&cerrojo);
+	terminar = 1;
+	pthread_cond_broadcast(&hayTrabajo);
+	pthread_mutex_unlock(&cerrojo);
+	for (i = 0; i < creados; i++)
+		pthread_join(hilos[i], NULL);
+	free(hilos);
+	return sfs_umount(sfs) == 0 ? 0 : -1;
+}
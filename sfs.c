@@ -0,0 +1,830 @@
+#include "sfs.h"
+#include "common.h"
+#include "util.h"
+#include "metadatos.h"
+#include "directorio.h"
+#include "cache.h"
+#include "huellas.h"
+#include "compresion.h"
+#include "sumas.h"
+#include <pthread.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bloques [bloqueLogico, bloqueLogico+numBloques) de un archivo, que están
+// seguidos en disco a partir de inicio
+typedef struct TramoArchivo {
+	int bloqueLogico;
+	DISK_LBA inicio;
+	int numBloques;
+} TramoArchivo;
+
+// Un nodo-i abierto, compartido por todos sus descriptores
+typedef struct NodoAbierto {
+	int numNodoI;
+	EstructuraNodoI* nodoI;           // En la tabla de nodos-i
+	int referencias;
+	TramoArchivo* tramos;             // Todas sus extensiones, en orden
+	int numTramos;
+	int maxTramos;
+	BOOLEAN separado;                 // Ya no comparte bloques (ver separaArchivo)
+	int64_t* tramas;                  // Dónde empieza cada trama, si está comprimido
+	int numTramas;
+	struct NodoAbierto* siguiente;
+} NodoAbierto;
+
+struct SFS {
+	MiSistemaDeFicheros miSistemaDeFicheros;
+	// sfs_pread lo coge para leer; lo demás, para escribir
+	pthread_rwlock_t cerrojo;
+	NodoAbierto** descriptores;       // NULL si el descriptor está libre
+	int numDescriptores;
+	NodoAbierto* abiertos;
+};
+
+// Para rellenar lo que crece un archivo (solo se lee)
+static char ceros[16 * TAM_BLOQUE_BYTES];
+
+// Recorre el árbol de extensiones del nodo-i y guarda sus tramos
+static int cargaTramos(MiSistemaDeFicheros* miSistemaDeFicheros,
+		NodoAbierto* a) {
+	CursorExtensiones cursor;
+	TramoArchivo* nuevos;
+	DISK_LBA idxBloque;
+	int bloque, n;
+
+	initCursorExtensiones(&cursor);
+	a->numTramos = 0;
+	for (bloque = 0; bloque < a->nodoI->numBloques; bloque += n) {
+		idxBloque = buscaBloqueNodoI(miSistemaDeFicheros, a->nodoI, bloque, &n,
+				&cursor);
+		if (idxBloque == -1) {
+			errno = EIO;
+			return -1;
+		}
+		if (a->numTramos == a->maxTramos) {
+			nuevos = realloc(a->tramos, (a->maxTramos * 2 + 8)
+					* sizeof(TramoArchivo));
+			if (nuevos == NULL)
+				return -1;
+			a->tramos = nuevos;
+			a->maxTramos = a->maxTramos * 2 + 8;
+		}
+		a->tramos[a->numTramos].bloqueLogico = bloque;
+		a->tramos[a->numTramos].inicio = idxBloque;
+		a->tramos[a->numTramos].numBloques = n;
+		a->numTramos++;
+	}
+	return 0;
+}
+
+// Devuelve el tramo que tiene el bloque lógico
+static int buscaTramo(const NodoAbierto* a, int bloque) {
+	int izq = 0, der = a->numTramos - 1, medio;
+
+	while (izq < der) {
+		medio = (izq + der + 1) / 2;
+		if (a->tramos[medio].bloqueLogico <= bloque)
+			izq = medio;
+		else
+			der = medio - 1;
+	}
+	return izq;
+}
+
+// Lee o escribe los bytes [pos, pos+tam) del archivo, que tiene que tener
+// sus bloques, directamente en la imagen (o en el nodo-i si no tiene
+// bloques: ver cambiaTamano). Lo que se escribe anota sus sumas; lo que se
+// lee no se comprueba, porque las lecturas van a la vez y los bloques de la
+// tabla se cargan al consultarlos.
+static int copiaTramos(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const NodoAbierto* a, off_t pos, size_t tam, void* buffer,
+		BOOLEAN escribir) {
+	int t = buscaTramo(a, pos / TAM_BLOQUE_BYTES);
+	const TramoArchivo* tramo;
+	off_t posDisco, finTramo;
+	size_t n;
+	int ret;
+
+	if (a->nodoI->numBloques == 0) {
+		if (escribir)
+			memcpy(a->nodoI->enLinea + pos, buffer, tam);
+		else
+			memcpy(buffer, a->nodoI->enLinea + pos, tam);
+		return 0;
+	}
+	for (; tam > 0; t++) {
+		tramo = &a->tramos[t];
+		finTramo = (off_t) (tramo->bloqueLogico + tramo->numBloques)
+				* TAM_BLOQUE_BYTES;
+		posDisco = (off_t) tramo->inicio * TAM_BLOQUE_BYTES + pos
+				- (off_t) tramo->bloqueLogico * TAM_BLOQUE_BYTES;
+		n = (off_t) tam < finTramo - pos ? tam : (size_t) (finTramo - pos);
+		if (escribir)
+			ret = escribeDisco(miSistemaDeFicheros, posDisco, buffer, n) == -1
+					? -1 : anotaSumasEscritura(miSistemaDeFicheros, posDisco,
+							buffer, n);
+		else
+			ret = leeDisco(miSistemaDeFicheros, posDisco, buffer, n);
+		if (ret == -1) {
+			errno = EIO;
+			return -1;
+		}
+		buffer = (char*) buffer + n;
+		pos += n;
+		tam -= n;
+	}
+	return 0;
+}
+
+// Lee las cabeceras de las tramas de un archivo comprimido y guarda dónde
+// empieza cada una, para leer solo las que hagan falta
+static int cargaTramas(MiSistemaDeFicheros* miSistemaDeFicheros,
+		NodoAbierto* a) {
+	EstructuraTrama trama;
+	int64_t pos = 0;
+	int i;
+
+	a->numTramas = 0;
+	if (a->nodoI->tamComprimido == 0)
+		return 0;
+	a->tramas = malloc((a->nodoI->tamArchivo + TAM_TRAMA - 1) / TAM_TRAMA
+			* sizeof(int64_t));
+	if (a->tramas == NULL)
+		return -1;
+	for (i = 0; (int64_t) i * TAM_TRAMA < a->nodoI->tamArchivo; i++) {
+		if (pos + (int64_t) sizeof(trama) > a->nodoI->tamComprimido
+				|| copiaTramos(miSistemaDeFicheros, a, pos, sizeof(trama),
+						&trama, false) == -1
+				|| trama.tamGuardado > TAM_TRAMA) {
+			errno = EIO;
+			return -1;
+		}
+		a->tramas[i] = pos;
+		pos += sizeof(trama) + trama.tamGuardado;
+	}
+	a->numTramas = i;
+	if (pos != a->nodoI->tamComprimido) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+// Lee los bytes [pos, pos+tam) de un archivo comprimido: descomprime cada
+// trama que tocan, directamente en el buffer si se lee entera
+static int leeComprimido(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const NodoAbierto* a, off_t pos, size_t tam, char* buffer) {
+	char* guardado = malloc(sizeof(EstructuraTrama) + TAM_TRAMA);
+	char* original = malloc(TAM_TRAMA);
+	int i = pos / TAM_TRAMA, ret = -1;
+	size_t tamGuardado, desde, n;
+	char* destino;
+
+	if (guardado == NULL || original == NULL)
+		goto fin;
+	for (; tam > 0; i++) {
+		tamGuardado = (i + 1 < a->numTramas ? a->tramas[i + 1]
+				: a->nodoI->tamComprimido) - a->tramas[i];
+		desde = pos - (off_t) i * TAM_TRAMA;
+		n = tam < TAM_TRAMA - desde ? tam : TAM_TRAMA - desde;
+		destino = n == TAM_TRAMA ? buffer : original;
+		if (copiaTramos(miSistemaDeFicheros, a, a->tramas[i], tamGuardado,
+				guardado, false) == -1 || descomprimeTrama(guardado,
+				tamGuardado, destino) == -1) {
+			errno = EIO;
+			goto fin;
+		}
+		if (destino == original)
+			memcpy(buffer, original + desde, n);
+		buffer += n;
+		pos += n;
+		tam -= n;
+	}
+	ret = 0;
+
+	fin: free(guardado);
+	free(original);
+	return ret;
+}
+
+// Deja el archivo con tam bytes, reservando o liberando bloques. Lo que
+// crece se rellena con ceros hasta finCeros; de lo demás se ocupa quien
+// llama. Después hay que cerrar la operación (ver cierraCambio).
+//
+// Un archivo sin bloques de hasta MAX_TAM_EN_LINEA bytes se queda en el
+// nodo-i, como los que importa myImport; al crecer más se pasa a bloques.
+// Uno con bloques no vuelve al nodo-i aunque se acorte.
+static int cambiaTamano(MiSistemaDeFicheros* miSistemaDeFicheros,
+		NodoAbierto* a, int64_t tam, int64_t finCeros) {
+	EstructuraNodoI* nodoI = a->nodoI;
+	int64_t antes = nodoI->tamArchivo;
+	int bloquesAntes = nodoI->numBloques;
+	int numBloques = (tam + TAM_BLOQUE_BYTES - 1) / TAM_BLOQUE_BYTES;
+	char enLinea[MAX_TAM_EN_LINEA];
+	int t, n;
+	size_t trozo;
+
+	if (tam < 0 || tam > (int64_t) TAM_BLOQUE_BYTES * MAX_BLOQUES_POR_ARCHIVO) {
+		errno = EFBIG;
+		return -1;
+	}
+	if (bloquesAntes == 0 && tam <= MAX_TAM_EN_LINEA) {
+		if (tam > antes)
+			memset(nodoI->enLinea + antes, 0, tam - antes);
+		nodoI->tamArchivo = tam;
+		return 0;
+	}
+	if (numBloques > bloquesAntes) {
+		// Las extensiones van donde estaban los datos
+		if (bloquesAntes == 0) {
+			memcpy(enLinea, nodoI->enLinea, antes);
+			memset(nodoI->enLinea, 0, sizeof(nodoI->enLinea));
+		}
+		if (reservaBloquesNodosI(miSistemaDeFicheros, nodoI, numBloques
+				- bloquesAntes) == -1) {
+			if (bloquesAntes == 0)
+				memcpy(nodoI->enLinea, enLinea, antes);
+			errno = ENOSPC;
+			return -1;
+		}
+	} else if (numBloques < bloquesAntes && truncaNodoI(miSistemaDeFicheros,
+			nodoI, numBloques) == -1) {
+		errno = EIO;
+		return -1;
+	}
+	if (numBloques != bloquesAntes && cargaTramos(miSistemaDeFicheros, a)
+			== -1)
+		return -1;
+	// Los bloques nuevos pueden haber sido metadatos (ver escribeDatos)
+	for (t = numBloques > bloquesAntes ? buscaTramo(a, bloquesAntes)
+			: a->numTramos; t < a->numTramos; t++) {
+		n = a->tramos[t].bloqueLogico < bloquesAntes ? bloquesAntes
+				- a->tramos[t].bloqueLogico : 0;
+		olvidaBloques(miSistemaDeFicheros, a->tramos[t].inicio + n,
+				a->tramos[t].numBloques - n);
+	}
+	nodoI->tamArchivo = tam;
+	if (bloquesAntes == 0 && copiaTramos(miSistemaDeFicheros, a, 0, antes,
+			enLinea, true) == -1)
+		return -1;
+
+	if (finCeros > tam)
+		finCeros = tam;
+	for (; antes < finCeros; antes += trozo) {
+		trozo = finCeros - antes < (int64_t) sizeof(ceros) ? finCeros - antes
+				: sizeof(ceros);
+		if (copiaTramos(miSistemaDeFicheros, a, antes, trozo, ceros,
+				true) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+// Antes de modificar un archivo comprimido, lo pasa a bloques sin
+// comprimir, que se pueden escribir en su sitio: un árbol nuevo, como en
+// separaArchivo, y el de antes se libera al final. Así se queda aunque
+// luego se acorte.
+static int descomprimeArchivo(MiSistemaDeFicheros* miSistemaDeFicheros,
+		NodoAbierto* a) {
+	EstructuraNodoI* nodoI = a->nodoI;
+	EstructuraNodoI antes;
+	NodoAbierto comprimido;
+	char* original;
+	size_t n;
+	int i, t;
+
+	if (nodoI->tamComprimido == 0)
+		return 0;
+	if (nodoI->tamArchivo > (int64_t) TAM_BLOQUE_BYTES
+			* MAX_BLOQUES_POR_ARCHIVO) {
+		errno = EFBIG;
+		return -1;
+	}
+	if ((original = malloc(TAM_TRAMA)) == NULL)
+		return -1;
+	antes = *nodoI;
+	comprimido = *a;
+	comprimido.nodoI = &antes;
+	nodoI->numBloques = 0;
+	nodoI->tamComprimido = 0;
+	nodoI->cabecera.numEntradas = 0;
+	nodoI->cabecera.maxEntradas = EXTENSIONES_EN_NODOI;
+	nodoI->cabecera.profundidad = 0;
+	a->tramos = NULL;
+	a->numTramos = a->maxTramos = 0;
+	if (reservaBloquesNodosI(miSistemaDeFicheros, nodoI, (nodoI->tamArchivo
+			+ TAM_BLOQUE_BYTES - 1) / TAM_BLOQUE_BYTES) == -1) {
+		errno = ENOSPC;
+		goto error;
+	}
+	if (cargaTramos(miSistemaDeFicheros, a) == -1)
+		goto errorReservado;
+	for (t = 0; t < a->numTramos; t++)
+		olvidaBloques(miSistemaDeFicheros, a->tramos[t].inicio,
+				a->tramos[t].numBloques);
+	for (i = 0; i < comprimido.numTramas; i++) {
+		n = nodoI->tamArchivo - (int64_t) i * TAM_TRAMA < TAM_TRAMA
+				? nodoI->tamArchivo - (int64_t) i * TAM_TRAMA : TAM_TRAMA;
+		if (leeComprimido(miSistemaDeFicheros, &comprimido, (off_t) i
+				* TAM_TRAMA, n, original) == -1 || copiaTramos(
+				miSistemaDeFicheros, a, (off_t) i * TAM_TRAMA, n, original,
+				true) == -1) {
+			errno = EIO;
+			goto errorReservado;
+		}
+	}
+	liberaBloquesNodoI(miSistemaDeFicheros, &antes);
+	free(comprimido.tramos);
+	free(comprimido.tramas);
+	a->tramas = NULL;
+	a->numTramas = 0;
+	// Los bloques nuevos no están en el índice de huellas
+	a->separado = true;
+	free(original);
+	return 0;
+
+	errorReservado: liberaBloquesNodoI(miSistemaDeFicheros, nodoI);
+	error: free(a->tramos);
+	*nodoI = antes;
+	a->tramos = comprimido.tramos;
+	a->numTramos = comprimido.numTramos;
+	a->maxTramos = comprimido.maxTramos;
+	free(original);
+	return -1;
+}
+
+// Antes de modificar un archivo de un sistema que deduplica, lo deja sin
+// bloques en el índice de huellas: lo que se escriba no coincidiría con su
+// huella. Si solo son suyos basta con sacarlos del índice; si comparte
+// alguno, el archivo entero pasa a bloques nuevos y los de antes pierden
+// una referencia.
+static int separaArchivo(MiSistemaDeFicheros* miSistemaDeFicheros,
+		NodoAbierto* a) {
+	EstructuraNodoI* nodoI = a->nodoI;
+	EstructuraNodoI antes;
+	TramoArchivo* tramos = a->tramos;
+	int numTramos = a->numTramos, maxTramos = a->maxTramos;
+	BOOLEAN compartido = false;
+	char* buffer;
+	int t, i, n, ref;
+
+	if (a->separado || !deduplica(miSistemaDeFicheros))
+		return 0;
+	for (t = 0; t < numTramos; t++) {
+		for (i = 0; i < tramos[t].numBloques; i++) {
+			ref = referenciasBloque(miSistemaDeFicheros, tramos[t].inicio + i);
+			if (ref == -1) {
+				errno = EIO;
+				return -1;
+			}
+			compartido |= ref > 1;
+		}
+	}
+	if (!compartido) {
+		for (t = 0; t < numTramos; t++)
+			for (i = 0; i < tramos[t].numBloques; i++)
+				quitaHuella(miSistemaDeFicheros, tramos[t].inicio + i);
+		a->separado = true;
+		return 0;
+	}
+
+	// Un árbol nuevo con sus propios bloques; el de antes se libera al final
+	if ((buffer = malloc(MAX_BLOQUES_POR_ES * TAM_BLOQUE_BYTES)) == NULL)
+		return -1;
+	antes = *nodoI;
+	nodoI->numBloques = 0;
+	nodoI->cabecera.numEntradas = 0;
+	nodoI->cabecera.maxEntradas = EXTENSIONES_EN_NODOI;
+	nodoI->cabecera.profundidad = 0;
+	a->tramos = NULL;
+	a->numTramos = a->maxTramos = 0;
+	if (reservaBloquesNodosI(miSistemaDeFicheros, nodoI, antes.numBloques)
+			== -1) {
+		errno = ENOSPC;
+		goto error;
+	}
+	if (cargaTramos(miSistemaDeFicheros, a) == -1)
+		goto errorReservado;
+	for (t = 0; t < a->numTramos; t++)
+		olvidaBloques(miSistemaDeFicheros, a->tramos[t].inicio,
+				a->tramos[t].numBloques);
+	for (t = 0; t < numTramos; t++) {
+		for (i = 0; i < tramos[t].numBloques; i += n) {
+			n = tramos[t].numBloques - i < MAX_BLOQUES_POR_ES
+					? tramos[t].numBloques - i : MAX_BLOQUES_POR_ES;
+			if (leeBloques(miSistemaDeFicheros, tramos[t].inicio + i, n,
+					buffer) == -1 || copiaTramos(miSistemaDeFicheros, a,
+					(off_t) (tramos[t].bloqueLogico + i) * TAM_BLOQUE_BYTES,
+					(size_t) n * TAM_BLOQUE_BYTES, buffer, true) == -1) {
+				errno = EIO;
+				goto errorReservado;
+			}
+		}
+	}
+	liberaBloquesNodoI(miSistemaDeFicheros, &antes);
+	free(tramos);
+	free(buffer);
+	a->separado = true;
+	return 0;
+
+	errorReservado: liberaBloquesNodoI(miSistemaDeFicheros, nodoI);
+	error: free(a->tramos);
+	*nodoI = antes;
+	a->tramos = tramos;
+	a->numTramos = numTramos;
+	a->maxTramos = maxTramos;
+	free(buffer);
+	return -1;
+}
+
+// Anota el nodo-i modificado y cierra la operación
+static int cierraCambio(MiSistemaDeFicheros* miSistemaDeFicheros,
+		NodoAbierto* a) {
+	a->nodoI->tiempoModificado = time(0);
+	if (escribeNodoI(miSistemaDeFicheros, a->numNodoI, a->nodoI) == -1
+			|| escribeSuperBloque(miSistemaDeFicheros) == -1
+			|| cierraOperacion(miSistemaDeFicheros) == -1) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+// Rellena st con el nodo-i
+static void copiaEstado(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int numNodoI, SFSStat* st) {
+	EstructuraNodoI* nodoI = obtenNodoI(miSistemaDeFicheros, numNodoI);
+
+	st->numNodoI = numNodoI;
+	st->esDirectorio = nodoI->tipo == TIPO_DIRECTORIO;
+	st->tam = nodoI->tamArchivo;
+	st->numBloques = nodoI->numBloques;
+	st->tiempoModificado = nodoI->tiempoModificado;
+}
+
+// Devuelve el nodo abierto del descriptor (con el cerrojo cogido)
+static NodoAbierto* descriptor(SFS* sfs, int fd) {
+	if (fd < 0 || fd >= sfs->numDescriptores || sfs->descriptores[fd] == NULL) {
+		errno = EBADF;
+		return NULL;
+	}
+	return sfs->descriptores[fd];
+}
+
+SFS* sfs_mount(const char* nombreImagen, int opciones) {
+	SFS* sfs = calloc(1, sizeof(SFS));
+	MiSistemaDeFicheros* miSistemaDeFicheros;
+	char* nombre = strdup(nombreImagen);
+
+	if (sfs == NULL || nombre == NULL) {
+		free(sfs);
+		free(nombre);
+		return NULL;
+	}
+	miSistemaDeFicheros = &sfs->miSistemaDeFicheros;
+	miSistemaDeFicheros->mapaDeBits = NULL;
+	miSistemaDeFicheros->mapaNodosI = NULL;
+	miSistemaDeFicheros->bloquesNodosI = NULL;
+	miSistemaDeFicheros->bloquesHuellas = NULL;
+	miSistemaDeFicheros->bloquesSumas = NULL;
+	miSistemaDeFicheros->directorios = NULL;
+	miSistemaDeFicheros->usoDirectorios = 0;
+	miSistemaDeFicheros->modoAcceso = opciones & SFS_MMAP ? ACCESO_MMAP
+			: ACCESO_FD;
+	miSistemaDeFicheros->imagen = NULL;
+	miSistemaDeFicheros->tamImagen = 0;
+	miSistemaDeFicheros->anillo = NULL;
+	miSistemaDeFicheros->estadisticas = NULL;
+	initMetadatos(miSistemaDeFicheros);
+	if (initCache(miSistemaDeFicheros, MARCOS_CACHE_DEFECTO) == -1) {
+		free(sfs);
+		free(nombre);
+		return NULL;
+	}
+	if (myMount(miSistemaDeFicheros, nombre) != 0) {
+		liberaCache(miSistemaDeFicheros);
+		free(sfs);
+		free(nombre);
+		errno = EIO;
+		return NULL;
+	}
+	free(nombre);
+	pthread_rwlock_init(&sfs->cerrojo, NULL);
+	return sfs;
+}
+
+int sfs_umount(SFS* sfs) {
+	NodoAbierto* a;
+	int ret;
+
+	while ((a = sfs->abiertos) != NULL) {
+		sfs->abiertos = a->siguiente;
+		free(a->tramos);
+		free(a->tramas);
+		free(a);
+	}
+	free(sfs->descriptores);
+	ret = myUmount(&sfs->miSistemaDeFicheros);
+	pthread_rwlock_destroy(&sfs->cerrojo);
+	free(sfs);
+	if (ret != 0)
+		errno = EIO;
+	return ret == 0 ? 0 : -1;
+}
+
+int sfs_open(SFS* sfs, const char* ruta, int opciones) {
+	MiSistemaDeFicheros* miSistemaDeFicheros = &sfs->miSistemaDeFicheros;
+	char nombre[MAX_TAM_NOMBRE_ARCHIVO + 1];
+	NodoAbierto* a;
+	NodoAbierto** nuevos;
+	int idxDirectorio, numNodoI, fd = -1;
+
+	pthread_rwlock_wrlock(&sfs->cerrojo);
+	idxDirectorio = resuelveRuta(miSistemaDeFicheros, ruta, nombre);
+	if (idxDirectorio == -1) {
+		errno = ENOENT;
+		goto fin;
+	}
+	if (nombre[0] == '\0') {
+		errno = EISDIR;
+		goto fin;
+	}
+	numNodoI = buscaEntradaDirectorio(miSistemaDeFicheros, idxDirectorio,
+			nombre);
+	if (numNodoI == -1) {
+		if (!(opciones & SFS_CREAR)) {
+			errno = ENOENT;
+			goto fin;
+		}
+		// Como myImport, con el archivo vacío
+		if ((numNodoI = buscaNodoLibre(miSistemaDeFicheros)) == -1) {
+			errno = ENOSPC;
+			goto fin;
+		}
+		if (ocupaNodoI(miSistemaDeFicheros, numNodoI) == NULL) {
+			errno = EIO;
+			goto fin;
+		}
+		escribeNodoI(miSistemaDeFicheros, numNodoI, obtenNodoI(
+				miSistemaDeFicheros, numNodoI));
+		if (anadeEntradaDirectorio(miSistemaDeFicheros, idxDirectorio, nombre,
+				numNodoI) == -1) {
+			liberaNodoI(miSistemaDeFicheros, numNodoI);
+			escribeSuperBloque(miSistemaDeFicheros);
+			cierraOperacion(miSistemaDeFicheros);
+			errno = ENOSPC;
+			goto fin;
+		}
+		escribeSuperBloque(miSistemaDeFicheros);
+		cierraOperacion(miSistemaDeFicheros);
+	} else if (obtenNodoI(miSistemaDeFicheros, numNodoI)->tipo
+			== TIPO_DIRECTORIO) {
+		errno = EISDIR;
+		goto fin;
+	}
+
+	for (a = sfs->abiertos; a != NULL && a->numNodoI != numNodoI; a
+			= a->siguiente)
+		;
+	if (a == NULL) {
+		if ((a = calloc(1, sizeof(NodoAbierto))) == NULL)
+			goto fin;
+		a->numNodoI = numNodoI;
+		a->nodoI = obtenNodoI(miSistemaDeFicheros, numNodoI);
+		if (cargaTramos(miSistemaDeFicheros, a) == -1
+				|| cargaTramas(miSistemaDeFicheros, a) == -1) {
+			free(a->tramos);
+			free(a->tramas);
+			free(a);
+			goto fin;
+		}
+		a->siguiente = sfs->abiertos;
+		sfs->abiertos = a;
+	}
+
+	for (fd = 0; fd < sfs->numDescriptores && sfs->descriptores[fd] != NULL; fd++)
+		;
+	if (fd == sfs->numDescriptores) {
+		nuevos = realloc(sfs->descriptores, (sfs->numDescriptores * 2 + 8)
+				* sizeof(NodoAbierto*));
+		if (nuevos == NULL) {
+			fd = -1;
+			if (a->referencias == 0) {
+				sfs->abiertos = a->siguiente;
+				free(a->tramos);
+				free(a->tramas);
+				free(a);
+			}
+			goto fin;
+		}
+		memset(nuevos + sfs->numDescriptores, 0, (sfs->numDescriptores + 8)
+				* sizeof(NodoAbierto*));
+		sfs->descriptores = nuevos;
+		sfs->numDescriptores = sfs->numDescriptores * 2 + 8;
+	}
+	sfs->descriptores[fd] = a;
+	a->referencias++;
+
+	fin: pthread_rwlock_unlock(&sfs->cerrojo);
+	return fd;
+}
+
+int sfs_close(SFS* sfs, int fd) {
+	NodoAbierto* a;
+	NodoAbierto** p;
+	int ret = -1;
+
+	pthread_rwlock_wrlock(&sfs->cerrojo);
+	if ((a = descriptor(sfs, fd)) != NULL) {
+		sfs->descriptores[fd] = NULL;
+		if (--a->referencias == 0) {
+			for (p = &sfs->abiertos; *p != a; p = &(*p)->siguiente)
+				;
+			*p = a->siguiente;
+			free(a->tramos);
+			free(a->tramas);
+			free(a);
+		}
+		ret = 0;
+	}
+	pthread_rwlock_unlock(&sfs->cerrojo);
+	return ret;
+}
+
+ssize_t sfs_pread(SFS* sfs, int fd, void* buffer, size_t tam, off_t pos) {
+	NodoAbierto* a;
+	ssize_t ret = -1;
+
+	if (pos < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_rwlock_rdlock(&sfs->cerrojo);
+	if ((a = descriptor(sfs, fd)) == NULL)
+		goto fin;
+	if (pos >= a->nodoI->tamArchivo)
+		tam = 0;
+	else if ((off_t) tam > a->nodoI->tamArchivo - pos)
+		tam = a->nodoI->tamArchivo - pos;
+	if (a->nodoI->tamComprimido > 0) {
+		if (leeComprimido(&sfs->miSistemaDeFicheros, a, pos, tam, buffer)
+				== 0)
+			ret = tam;
+	} else if (copiaTramos(&sfs->miSistemaDeFicheros, a, pos, tam, buffer,
+			false) == 0)
+		ret = tam;
+
+	fin: pthread_rwlock_unlock(&sfs->cerrojo);
+	return ret;
+}
+
+ssize_t sfs_pwrite(SFS* sfs, int fd, const void* buffer, size_t tam,
+		off_t pos) {
+	MiSistemaDeFicheros* miSistemaDeFicheros = &sfs->miSistemaDeFicheros;
+	NodoAbierto* a;
+	ssize_t ret = -1;
+
+	if (pos < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	// Sin nada que escribir no se toca el archivo, ni siquiera si pos está
+	// más allá del final
+	if (tam == 0)
+		return 0;
+	pthread_rwlock_wrlock(&sfs->cerrojo);
+	if ((a = descriptor(sfs, fd)) == NULL
+			|| descomprimeArchivo(miSistemaDeFicheros, a) == -1
+			|| separaArchivo(miSistemaDeFicheros, a) == -1)
+		goto fin;
+	if (pos + (off_t) tam > a->nodoI->tamArchivo && cambiaTamano(
+			miSistemaDeFicheros, a, pos + tam, pos) == -1)
+		goto fin;
+	if (copiaTramos(miSistemaDeFicheros, a, pos, tam, (void*) buffer, true)
+			== 0)
+		ret = tam;
+	if (cierraCambio(miSistemaDeFicheros, a) == -1)
+		ret = -1;
+
+	fin: pthread_rwlock_unlock(&sfs->cerrojo);
+	return ret;
+}
+
+int sfs_truncate(SFS* sfs, int fd, off_t tam) {
+	MiSistemaDeFicheros* miSistemaDeFicheros = &sfs->miSistemaDeFicheros;
+	NodoAbierto* a;
+	int ret = -1;
+
+	pthread_rwlock_wrlock(&sfs->cerrojo);
+	if ((a = descriptor(sfs, fd)) != NULL && descomprimeArchivo(
+			miSistemaDeFicheros, a) == 0 && separaArchivo(miSistemaDeFicheros,
+			a) == 0 && cambiaTamano(miSistemaDeFicheros, a, tam, tam) == 0)
+		ret = cierraCambio(miSistemaDeFicheros, a);
+	pthread_rwlock_unlock(&sfs->cerrojo);
+	return ret;
+}
+
+int sfs_stat(SFS* sfs, const char* ruta, SFSStat* st) {
+	int numNodoI;
+
+	pthread_rwlock_wrlock(&sfs->cerrojo);
+	numNodoI = buscaRuta(&sfs->miSistemaDeFicheros, ruta);
+	if (numNodoI != -1)
+		copiaEstado(&sfs->miSistemaDeFicheros, numNodoI, st);
+	pthread_rwlock_unlock(&sfs->cerrojo);
+	if (numNodoI == -1) {
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+typedef struct Listado {
+	void (*funcion)(const char* nombre, const SFSStat* st, void* arg);
+	void* arg;
+} Listado;
+
+static void listaEntrada(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraEntradaDirectorio* entrada, void* arg) {
+	Listado* listado = arg;
+	SFSStat st;
+
+	copiaEstado(miSistemaDeFicheros, entrada->idxNodoI, &st);
+	listado->funcion(entrada->nombreArchivo, &st, listado->arg);
+}
+
+int sfs_list(SFS* sfs, const char* ruta, void (*funcion)(const char* nombre,
+		const SFSStat* st, void* arg), void* arg) {
+	MiSistemaDeFicheros* miSistemaDeFicheros = &sfs->miSistemaDeFicheros;
+	Listado listado = { funcion, arg };
+	int idxDirectorio, ret = -1;
+
+	pthread_rwlock_wrlock(&sfs->cerrojo);
+	idxDirectorio = buscaRuta(miSistemaDeFicheros, ruta);
+	if (idxDirectorio == -1)
+		errno = ENOENT;
+	else if (obtenNodoI(miSistemaDeFicheros, idxDirectorio)->tipo
+			!= TIPO_DIRECTORIO)
+		errno = ENOTDIR;
+	else if (recorreDirectorio(miSistemaDeFicheros, idxDirectorio,
+			listaEntrada, &listado) == -1)
+		errno = EIO;
+	else
+		ret = 0;
+	pthread_rwlock_unlock(&sfs->cerrojo);
+	return ret;
+}
+
+int sfs_import(SFS* sfs, const char* nombreExterno, const char* ruta) {
+	// errno según el código de error de myImport
+	static const int errores[] = { 0, ENOENT, EIO, ENOSPC, EFBIG, ENOENT,
+			EEXIST, ENOSPC, ENOSPC, ENOSPC, EIO };
+	char* externo = strdup(nombreExterno);
+	char* interno = strdup(ruta);
+	int ret = -1;
+
+	if (externo != NULL && interno != NULL) {
+		pthread_rwlock_wrlock(&sfs->cerrojo);
+		ret = myImport(externo, &sfs->miSistemaDeFicheros, interno);
+		pthread_rwlock_unlock(&sfs->cerrojo);
+		if (ret != 0) {
+			errno = ret > 0 && ret < (int) (sizeof(errores) / sizeof(int))
+					? errores[ret] : EIO;
+			ret = -1;
+		}
+	}
+	free(externo);
+	free(interno);
+	return ret;
+}
+
+int sfs_unlink(SFS* sfs, const char* ruta) {
+	MiSistemaDeFicheros* miSistemaDeFicheros = &sfs->miSistemaDeFicheros;
+	char* copia = strdup(ruta);
+	NodoAbierto* a;
+	int numNodoI, ret = -1;
+
+	if (copia == NULL)
+		return -1;
+	pthread_rwlock_wrlock(&sfs->cerrojo);
+	numNodoI = buscaRuta(miSistemaDeFicheros, ruta);
+	for (a = sfs->abiertos; a != NULL && a->numNodoI != numNodoI; a
+			= a->siguiente)
+		;
+	if (numNodoI == -1)
+		errno = ENOENT;
+	else if (obtenNodoI(miSistemaDeFicheros, numNodoI)->tipo
+			== TIPO_DIRECTORIO)
+		errno = EISDIR;
+	else if (a != NULL)
+		errno = EBUSY;
+	else if (myRm(miSistemaDeFicheros, copia) != 0)
+		errno = EIO;
+	else
+		ret = 0;
+	pthread_rwlock_unlock(&sfs->cerrojo);
+	free(copia);
+	return ret;
+}
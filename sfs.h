@@ -0,0 +1,69 @@
+#ifndef SFS_H
+#define	SFS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+// Biblioteca para usar el sistema de ficheros desde otros programas
+// (libsfs.a y libsfs.so), sin pasar por el intérprete de comandos ni copiar
+// archivos enteros con import/export.
+//
+// Se monta una imagen con sfs_mount y se abren sus archivos con sfs_open,
+// que devuelve un descriptor. Con él se lee y escribe cualquier trozo
+// (sfs_pread, sfs_pwrite) y se cambia el tamaño (sfs_truncate).
+//
+// Se puede llamar desde varios hilos. Las lecturas se hacen a la vez: al
+// abrir un archivo se guarda en memoria dónde están sus bloques, y leer
+// solo copia de la imagen. Todo lo demás toca los metadatos y va de uno en
+// uno. Cada escritura o cambio de tamaño es una operación, que se confirma
+// en grupo como las del intérprete.
+//
+// Si algo falla se devuelve -1 (NULL en sfs_mount) y errno dice por qué.
+
+typedef struct SFS SFS;
+
+// Opciones de sfs_mount
+#define SFS_MMAP 1                        // Proyecta la imagen (como -acceso mmap)
+
+// Opciones de sfs_open
+#define SFS_CREAR 1                       // Crea el archivo, vacío, si no existe
+
+typedef struct SFSStat {
+	int numNodoI;
+	int esDirectorio;
+	int64_t tam;                          // En bytes
+	int numBloques;
+	time_t tiempoModificado;
+} SFSStat;
+
+// Monta la imagen nombreImagen, ya formateada
+SFS* sfs_mount(const char* nombreImagen, int opciones);
+// Confirma lo pendiente y desmonta. Los descriptores abiertos se cierran.
+int sfs_umount(SFS* sfs);
+
+// Abre el archivo ruta (no un directorio) y devuelve su descriptor
+int sfs_open(SFS* sfs, const char* ruta, int opciones);
+int sfs_close(SFS* sfs, int fd);
+
+// Lee hasta tam bytes desde la posición pos. Devuelve los bytes leídos, 0
+// a partir del final del archivo.
+ssize_t sfs_pread(SFS* sfs, int fd, void* buffer, size_t tam, off_t pos);
+// Escribe tam bytes en la posición pos, alargando el archivo si hace falta
+// (con ceros entre el final anterior y pos). Devuelve tam; con tam 0 no
+// hace nada.
+ssize_t sfs_pwrite(SFS* sfs, int fd, const void* buffer, size_t tam, off_t pos);
+// Deja el archivo con tam bytes (con ceros si crece)
+int sfs_truncate(SFS* sfs, int fd, off_t tam);
+
+int sfs_stat(SFS* sfs, const char* ruta, SFSStat* st);
+
+// Llama a funcion con cada entrada del directorio ruta. funcion no puede
+// llamar a la biblioteca.
+int sfs_list(SFS* sfs, const char* ruta, void (*funcion)(const char* nombre, const SFSStat* st, void* arg), void* arg);
+
+// Como import y rm. No se puede borrar un archivo abierto (EBUSY).
+int sfs_import(SFS* sfs, const char* nombreExterno, const char* ruta);
+int sfs_unlink(SFS* sfs, const char* ruta);
+
+#endif	/* SFS_H */
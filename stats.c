@@ -0,0 +1,151 @@
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char* nombresEstadisticas[NUM_ESTADISTICAS] = {
+	"pread", "pwrite", "preadv", "pwritev", "fdatasync", "msync",
+	"reservaBloques", "buscaDirectorio",
+	// Comandos
+	"import", "import-many", "export", "ls", "rm", "mkdir", "rmdir", "quota",
+	"cache", "sync", "stats", "scrub", "fsck", "defrag", "otros"
+};
+
+// Para volcarlas al salir
+static MiSistemaDeFicheros* sistemaSalida;
+static char* archivoSalida;
+
+static int cubeta(uint64_t ns) {
+	int exponente, desplazamiento;
+
+	if (ns < (1 << BITS_SUBCUBETAS))
+		return ns;
+	exponente = 63 - __builtin_clzll(ns);
+	desplazamiento = exponente - BITS_SUBCUBETAS;
+	return ((desplazamiento + 1) << BITS_SUBCUBETAS)
+			+ ((ns >> desplazamiento) & ((1 << BITS_SUBCUBETAS) - 1));
+}
+
+// Menor valor que cae en la cubeta i
+static uint64_t inicioCubeta(int i) {
+	int desplazamiento = (i >> BITS_SUBCUBETAS) - 1;
+
+	if (desplazamiento < 0)
+		return i;
+	return (uint64_t) ((1 << BITS_SUBCUBETAS) + (i & ((1 << BITS_SUBCUBETAS)
+			- 1))) << desplazamiento;
+}
+
+void anotaMedida(Estadisticas* estadisticas, int que, uint64_t ns,
+		uint64_t bytes) {
+	Histograma* h = &estadisticas->histogramas[que];
+	uint64_t max = __atomic_load_n(&h->maxNs, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&h->num, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sumaNs, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->cubetas[cubeta(ns)], 1, __ATOMIC_RELAXED);
+	while (ns > max && !__atomic_compare_exchange_n(&h->maxNs, &max, ns, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+void reiniciaEstadisticas(Estadisticas* estadisticas) {
+	memset(estadisticas->histogramas, 0, sizeof(estadisticas->histogramas));
+	estadisticas->inicioNs = relojNs();
+}
+
+int activaEstadisticas(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	Estadisticas* estadisticas;
+
+	if (miSistemaDeFicheros->estadisticas != NULL)
+		return 0;
+	estadisticas = malloc(sizeof(Estadisticas));
+	if (estadisticas == NULL) {
+		perror("Falló malloc en activaEstadisticas");
+		return -1;
+	}
+	reiniciaEstadisticas(estadisticas);
+	miSistemaDeFicheros->estadisticas = estadisticas;
+	return 0;
+}
+
+void desactivaEstadisticas(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	free(miSistemaDeFicheros->estadisticas);
+	miSistemaDeFicheros->estadisticas = NULL;
+}
+
+int estadisticaComando(const char* nombre) {
+	int i;
+
+	for (i = EST_PRIMER_COMANDO; i < NUM_ESTADISTICAS - 1; i++) {
+		if (strcmp(nombre, nombresEstadisticas[i]) == 0)
+			return i;
+	}
+	return NUM_ESTADISTICAS - 1;
+}
+
+// Valor del percentil p (entre 0 y 1): el centro de la cubeta donde cae
+static double percentilNs(const Histograma* h, double p) {
+	uint64_t rango = (uint64_t) (p * h->num + 0.5), acumulado = 0;
+	int i;
+
+	if (rango == 0)
+		rango = 1;
+	for (i = 0; i < NUM_CUBETAS; i++) {
+		acumulado += h->cubetas[i];
+		if (acumulado >= rango)
+			break;
+	}
+	if (i + 1 >= NUM_CUBETAS
+			|| (inicioCubeta(i) + inicioCubeta(i + 1)) / 2 > h->maxNs)
+		return h->maxNs;
+	return (inicioCubeta(i) + inicioCubeta(i + 1)) / 2.0;
+}
+
+void imprimeEstadisticas(const Estadisticas* estadisticas, FILE* f) {
+	const Histograma* h;
+	int i;
+
+	fprintf(f, "Estadísticas de los últimos %.1f s (tiempos en us)\n",
+			(relojNs() - estadisticas->inicioNs) / 1e9);
+	// Los anchos de número y máx cuentan el byte de más de la tilde
+	fprintf(f, "%-16s %11s %12s %10s %10s %10s %10s %10s %11s\n", "",
+			"número", "KB", "media", "p50", "p90", "p99", "p999", "máx");
+	for (i = 0; i < NUM_ESTADISTICAS; i++) {
+		h = &estadisticas->histogramas[i];
+		if (h->num == 0)
+			continue;
+		fprintf(f, "%-16s %10llu %12llu %10.1f %10.1f %10.1f %10.1f %10.1f "
+				"%10.1f\n", nombresEstadisticas[i], (unsigned long long) h->num,
+				(unsigned long long) h->bytes / 1024, h->sumaNs / 1e3 / h->num,
+				percentilNs(h, 0.5) / 1e3, percentilNs(h, 0.9) / 1e3,
+				percentilNs(h, 0.99) / 1e3, percentilNs(h, 0.999) / 1e3,
+				h->maxNs / 1e3);
+	}
+}
+
+static void vuelca(void) {
+	FILE* f;
+
+	if (sistemaSalida->estadisticas == NULL)
+		return;
+	if (strcmp(archivoSalida, "-") == 0) {
+		imprimeEstadisticas(sistemaSalida->estadisticas, stderr);
+		return;
+	}
+	if ((f = fopen(archivoSalida, "w")) == NULL) {
+		perror(archivoSalida);
+		return;
+	}
+	imprimeEstadisticas(sistemaSalida->estadisticas, f);
+	fclose(f);
+}
+
+void vuelcaEstadisticasAlSalir(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const char* nombre) {
+	if (archivoSalida == NULL)
+		atexit(vuelca);
+	free(archivoSalida);
+	archivoSalida = strdup(nombre);
+	sistemaSalida = miSistemaDeFicheros;
+}
@@ -0,0 +1,92 @@
+#ifndef STATS_H
+#define	STATS_H
+
+#include "common.h"
+#include <stdint.h>
+#include <time.h>
+
+// Contadores y latencias de los caminos calientes: cada llamada al sistema
+// sobre la imagen, la reserva de bloques, la búsqueda en directorios y cada
+// comando del intérprete.
+//
+// Las latencias van a histogramas como los HDR: cada potencia de 2 se parte
+// en 2^BITS_SUBCUBETAS cubetas iguales, así que el error de cualquier
+// percentil es menor que 1/2^BITS_SUBCUBETAS del valor, desde nanosegundos
+// hasta horas, con un número fijo de contadores.
+//
+// Solo se mide con miSistemaDeFicheros->estadisticas distinto de NULL (con
+// -stats o el comando stats on). Si no, cada punto de medida cuesta una
+// comparación. Los contadores se suman de forma atómica: se puede medir
+// desde varios hilos (import-many, libsfs).
+
+// Qué se mide
+enum {
+	EST_PREAD,
+	EST_PWRITE,
+	EST_PREADV,
+	EST_PWRITEV,
+	EST_FDATASYNC,
+	EST_MSYNC,
+	EST_RESERVA_BLOQUES,              // reservaBloquesNodosI
+	EST_BUSCA_DIRECTORIO,             // buscaEntradaDirectorio
+	EST_PRIMER_COMANDO,               // Un histograma por comando (ver
+	                                  // nombresEstadisticas), el último para
+	                                  // los desconocidos
+	NUM_ESTADISTICAS = EST_PRIMER_COMANDO + 15
+};
+
+#define BITS_SUBCUBETAS 4
+#define NUM_CUBETAS ((64 - BITS_SUBCUBETAS + 1) << BITS_SUBCUBETAS)
+
+typedef struct Histograma {
+	uint64_t num;
+	uint64_t bytes;
+	uint64_t sumaNs;
+	uint64_t maxNs;
+	uint64_t cubetas[NUM_CUBETAS];
+} Histograma;
+
+typedef struct Estadisticas {
+	uint64_t inicioNs;                // Desde cuándo se mide
+	Histograma histogramas[NUM_ESTADISTICAS];
+} Estadisticas;
+
+static inline uint64_t relojNs(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+void anotaMedida(Estadisticas* estadisticas, int que, uint64_t ns, uint64_t bytes);
+
+// Marca de tiempo con que empieza una medida, o 0 si no se mide
+static inline uint64_t empiezaMedida(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	return miSistemaDeFicheros->estadisticas != NULL ? relojNs() : 0;
+}
+
+// Anota lo que ha tardado desde empiezaMedida (nada si devolvió 0 o si se
+// ha dejado de medir entretanto)
+static inline void terminaMedida(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int que, uint64_t inicio, uint64_t bytes) {
+	if (inicio != 0 && miSistemaDeFicheros->estadisticas != NULL)
+		anotaMedida(miSistemaDeFicheros->estadisticas, que, relojNs() - inicio,
+				bytes);
+}
+
+// Empieza a medir (con todo a cero) o deja de hacerlo
+int activaEstadisticas(MiSistemaDeFicheros* miSistemaDeFicheros);
+void desactivaEstadisticas(MiSistemaDeFicheros* miSistemaDeFicheros);
+void reiniciaEstadisticas(Estadisticas* estadisticas);
+
+// Histograma del comando nombre (el de "otros" si no es uno conocido)
+int estadisticaComando(const char* nombre);
+
+// Escribe una tabla con lo medido
+void imprimeEstadisticas(const Estadisticas* estadisticas, FILE* f);
+
+// Al salir del programa, escribe las estadísticas en el archivo nombre
+// ("-" para la salida de error)
+void vuelcaEstadisticasAlSalir(MiSistemaDeFicheros* miSistemaDeFicheros, const char* nombre);
+
+#endif	/* STATS_H */
@@ -0,0 +1,566 @@
+#include "sumas.h"
+#include "metadatos.h"
+#include "diario.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define POLINOMIO_CRC32C 0x82f63b78 // Castagnoli, con los bits al revés
+// Bytes de cada una de las tres cadenas: tres caben en un bloque
+#define TAM_CADENA 1360
+
+// tablaCrc[k][b]: el CRC de b seguido de k bytes a cero (para ir de 8 en 8)
+static uint32_t tablaCrc[8][256];
+// tablaSaltaCadena[k][b]: lo que queda de b << 8k tras TAM_CADENA bytes a
+// cero (para juntar las cadenas)
+static uint32_t tablaSaltaCadena[4][256];
+static BOOLEAN conSSE42;
+static pthread_once_t tablasPreparadas = PTHREAD_ONCE_INIT;
+
+static const char ceros[TAM_BLOQUE_BYTES];
+
+static void preparaTablas(void) {
+	uint32_t salto[32];
+	uint32_t c;
+	int i, j, k;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = c & 1 ? (c >> 1) ^ POLINOMIO_CRC32C : c >> 1;
+		tablaCrc[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		for (k = 1; k < 8; k++)
+			tablaCrc[k][i] = (tablaCrc[k - 1][i] >> 8)
+					^ tablaCrc[0][tablaCrc[k - 1][i] & 0xff];
+
+	// Pasar TAM_CADENA bytes a cero es lineal: basta con ver qué hace con
+	// cada bit
+	for (k = 0; k < 32; k++) {
+		c = (uint32_t) 1 << k;
+		for (j = 0; j < TAM_CADENA; j++)
+			c = tablaCrc[0][c & 0xff] ^ (c >> 8);
+		salto[k] = c;
+	}
+	for (k = 0; k < 4; k++) {
+		for (i = 0; i < 256; i++) {
+			for (c = 0, j = 0; j < 8; j++)
+				if (i & (1 << j))
+					c ^= salto[8 * k + j];
+			tablaSaltaCadena[k][i] = c;
+		}
+	}
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	conSSE42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static inline uint64_t lee64(const char* p) {
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t crcTablas(uint32_t crc, const char* p, size_t tam) {
+	uint64_t v;
+
+	for (; tam >= 8; tam -= 8, p += 8) {
+		v = lee64(p) ^ crc;
+		crc = tablaCrc[7][v & 0xff] ^ tablaCrc[6][(v >> 8) & 0xff]
+				^ tablaCrc[5][(v >> 16) & 0xff] ^ tablaCrc[4][(v >> 24) & 0xff]
+				^ tablaCrc[3][(v >> 32) & 0xff] ^ tablaCrc[2][(v >> 40) & 0xff]
+				^ tablaCrc[1][(v >> 48) & 0xff] ^ tablaCrc[0][v >> 56];
+	}
+	for (; tam > 0; tam--)
+		crc = tablaCrc[0][(crc ^ *(const unsigned char*) p++) & 0xff]
+				^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__)
+static inline uint32_t saltaCadena(uint32_t crc) {
+	return tablaSaltaCadena[0][crc & 0xff]
+			^ tablaSaltaCadena[1][(crc >> 8) & 0xff]
+			^ tablaSaltaCadena[2][(crc >> 16) & 0xff]
+			^ tablaSaltaCadena[3][crc >> 24];
+}
+
+// La instrucción tarda 3 ciclos pero se puede lanzar una por ciclo: con
+// tres cadenas independientes no se espera a ninguna. Sin invertir el
+// registro, el CRC de A seguido de B es el de A seguido de ceros más el de
+// B, así que cada cadena se junta con la anterior saltando sus ceros.
+__attribute__((target("sse4.2")))
+static uint32_t crcSSE42(uint32_t crc, const char* p, size_t tam) {
+	uint64_t c0 = crc, c1, c2;
+	int i;
+
+	for (; tam >= 3 * TAM_CADENA; tam -= 3 * TAM_CADENA, p += 3 * TAM_CADENA) {
+		c1 = c2 = 0;
+		for (i = 0; i < TAM_CADENA; i += 8) {
+			c0 = _mm_crc32_u64(c0, lee64(p + i));
+			c1 = _mm_crc32_u64(c1, lee64(p + TAM_CADENA + i));
+			c2 = _mm_crc32_u64(c2, lee64(p + 2 * TAM_CADENA + i));
+		}
+		c0 = saltaCadena(c0) ^ c1;
+		c0 = saltaCadena(c0) ^ c2;
+	}
+	for (; tam >= 8; tam -= 8, p += 8)
+		c0 = _mm_crc32_u64(c0, lee64(p));
+	for (; tam > 0; tam--)
+		c0 = _mm_crc32_u8(c0, *p++);
+	return c0;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void* datos, size_t tam) {
+	pthread_once(&tablasPreparadas, preparaTablas);
+#if defined(__x86_64__)
+	if (conSSE42)
+		return ~crcSSE42(~crc, datos, tam);
+#endif
+	return ~crcTablas(~crc, datos, tam);
+}
+
+uint32_t sumaBloque(const void* bloque) {
+	return crc32c(0, bloque, TAM_BLOQUE_BYTES);
+}
+
+int bloquesTablaSumas(int numBloques) {
+	return (numBloques + SUMAS_POR_BLOQUE - 1) / SUMAS_POR_BLOQUE;
+}
+
+BOOLEAN tieneSumas(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	return miSistemaDeFicheros->superBloque.numBloquesSumas > 0;
+}
+
+int initSumas(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	liberaSumas(miSistemaDeFicheros);
+	if (!tieneSumas(miSistemaDeFicheros))
+		return 0;
+	miSistemaDeFicheros->bloquesSumas = calloc(
+			miSistemaDeFicheros->superBloque.numBloquesSumas, sizeof(char*));
+	if (miSistemaDeFicheros->bloquesSumas == NULL) {
+		perror("Falló calloc en initSumas");
+		return -1;
+	}
+	return 0;
+}
+
+void liberaSumas(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	int i;
+
+	if (miSistemaDeFicheros->bloquesSumas == NULL)
+		return;
+	for (i = 0; i < miSistemaDeFicheros->superBloque.numBloquesSumas; i++)
+		free(miSistemaDeFicheros->bloquesSumas[i]);
+	free(miSistemaDeFicheros->bloquesSumas);
+	miSistemaDeFicheros->bloquesSumas = NULL;
+}
+
+// Bloque i de la tabla, leyéndolo si aún no está en memoria (como en
+// ranuraNodoI, lo que hay en disco es lo último confirmado)
+static uint32_t* bloqueSumas(MiSistemaDeFicheros* miSistemaDeFicheros, int i) {
+	char* bloque = miSistemaDeFicheros->bloquesSumas[i];
+
+	if (bloque == NULL) {
+		bloque = malloc(TAM_BLOQUE_BYTES);
+		if (bloque == NULL) {
+			perror("Falló malloc en bloqueSumas");
+			return NULL;
+		}
+		if (leeBloques(miSistemaDeFicheros,
+				miSistemaDeFicheros->superBloque.idxSumas + i, 1, bloque)
+				== -1) {
+			free(bloque);
+			return NULL;
+		}
+		miSistemaDeFicheros->bloquesSumas[i] = bloque;
+	}
+	return (uint32_t*) bloque;
+}
+
+// Cierto si el bloque tiene suma: ni el diario ni la propia tabla la tienen
+static BOOLEAN conSuma(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA idxBloque) {
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+
+	return !(idxBloque >= sb->idxDiario && idxBloque < sb->idxDiario
+			+ sb->numBloquesDiario) && !(idxBloque >= sb->idxSumas && idxBloque
+			< sb->idxSumas + sb->numBloquesSumas);
+}
+
+// Anota las sumas de los bloques [inicio, inicio+numBloques): las de sumas o,
+// si es NULL, las de los bloques de datos. Una llamada a marcaSucio por
+// bloque de la tabla.
+static int anota(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio,
+		int numBloques, const char* datos, const uint32_t* sumas) {
+	uint32_t* tabla;
+	int hechos, n, desde, i;
+
+	if (!tieneSumas(miSistemaDeFicheros))
+		return 0;
+	for (hechos = 0; hechos < numBloques; hechos += n) {
+		desde = (inicio + hechos) % SUMAS_POR_BLOQUE;
+		n = numBloques - hechos < (int) SUMAS_POR_BLOQUE - desde ? numBloques
+				- hechos : (int) SUMAS_POR_BLOQUE - desde;
+		tabla = bloqueSumas(miSistemaDeFicheros, (inicio + hechos)
+				/ SUMAS_POR_BLOQUE);
+		if (tabla == NULL)
+			return -1;
+		for (i = 0; i < n; i++)
+			tabla[desde + i] = sumas != NULL ? sumas[hechos + i] : sumaBloque(
+					datos + (size_t) (hechos + i) * TAM_BLOQUE_BYTES);
+		if (marcaSucio(miSistemaDeFicheros, (off_t)
+				(miSistemaDeFicheros->superBloque.idxSumas + (inicio + hechos)
+						/ SUMAS_POR_BLOQUE) * TAM_BLOQUE_BYTES + desde
+				* sizeof(uint32_t), tabla + desde, n * sizeof(uint32_t)) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+int anotaSumas(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio,
+		int numBloques, const void* datos) {
+	return anota(miSistemaDeFicheros, inicio, numBloques, datos, NULL);
+}
+
+int anotaSumasCalculadas(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA inicio, int numBloques, const uint32_t* sumas) {
+	return anota(miSistemaDeFicheros, inicio, numBloques, NULL, sumas);
+}
+
+// Anota la suma del bloque tal como está en disco
+static int anotaSumaDisco(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA idxBloque) {
+	char bloque[TAM_BLOQUE_BYTES];
+
+	if (leeBloques(miSistemaDeFicheros, idxBloque, 1, bloque) == -1)
+		return -1;
+	return anotaSumas(miSistemaDeFicheros, idxBloque, 1, bloque);
+}
+
+int anotaSumasEscritura(MiSistemaDeFicheros* miSistemaDeFicheros, off_t pos,
+		const void* datos, size_t tam) {
+	DISK_LBA primero = pos / TAM_BLOQUE_BYTES;
+	DISK_LBA ultimo = (pos + tam - 1) / TAM_BLOQUE_BYTES;
+	// Bloques escritos enteros
+	DISK_LBA primeroEntero = (pos + TAM_BLOQUE_BYTES - 1) / TAM_BLOQUE_BYTES;
+	DISK_LBA finEnteros = (pos + tam) / TAM_BLOQUE_BYTES;
+
+	if (!tieneSumas(miSistemaDeFicheros) || tam == 0)
+		return 0;
+	if (finEnteros <= primeroEntero)
+		return anotaSumaDisco(miSistemaDeFicheros, primero) == -1
+				|| (ultimo != primero && anotaSumaDisco(miSistemaDeFicheros,
+						ultimo) == -1) ? -1 : 0;
+	if (primero < primeroEntero && anotaSumaDisco(miSistemaDeFicheros,
+			primero) == -1)
+		return -1;
+	if (anotaSumas(miSistemaDeFicheros, primeroEntero, finEnteros
+			- primeroEntero, (const char*) datos + ((off_t) primeroEntero
+			* TAM_BLOQUE_BYTES - pos)) == -1)
+		return -1;
+	if (ultimo >= finEnteros && anotaSumaDisco(miSistemaDeFicheros, ultimo)
+			== -1)
+		return -1;
+	return 0;
+}
+
+// Bloque tocado por un cambio pendiente: el bloque y el rango que lo toca
+typedef struct BloqueTocado {
+	DISK_LBA idxBloque;
+	int rango;
+} BloqueTocado;
+
+static int comparaTocados(const void* a, const void* b) {
+	DISK_LBA idxA = ((const BloqueTocado*) a)->idxBloque;
+	DISK_LBA idxB = ((const BloqueTocado*) b)->idxBloque;
+	return (idxA > idxB) - (idxA < idxB);
+}
+
+// Suma del bloque tocado, con todo su contenido en memoria: la copia propia,
+// o la parte que le corresponde de la copia en memoria del rango (las de
+// los mapas, los nodos-i y las huellas ocupan bloques enteros). Del
+// superbloque solo está la estructura; el resto del bloque está a ceros.
+static uint32_t sumaTocado(MiSistemaDeFicheros* miSistemaDeFicheros,
+		const BloqueTocado* tocado) {
+	const RangoSucio* r = &miSistemaDeFicheros->rangosSucios[tocado->rango];
+	uint32_t crc;
+
+	if (r->propio)
+		return sumaBloque(r->memoria);
+	if (tocado->idxBloque == SUPERBLOQUE_IDX) {
+		crc = crc32c(0, &miSistemaDeFicheros->superBloque,
+				sizeof(EstructuraSuperBloque));
+		return crc32c(crc, ceros, TAM_BLOQUE_BYTES
+				- sizeof(EstructuraSuperBloque));
+	}
+	return sumaBloque(r->memoria - (r->pos - (off_t) tocado->idxBloque
+			* TAM_BLOQUE_BYTES));
+}
+
+int anotaSumasMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	int numRangos = miSistemaDeFicheros->numRangosSucios;
+	BloqueTocado* tocados = NULL;
+	uint32_t* sumas = NULL;
+	const RangoSucio* r;
+	DISK_LBA idxBloque;
+	int numTocados = 0, maxTocados = 0, i, j, n, ret = -1;
+	BloqueTocado* nuevos;
+
+	if (!tieneSumas(miSistemaDeFicheros) || numRangos == 0)
+		return 0;
+	// El superbloque se escribe entero, para que en disco quede lo mismo que
+	// se suma. Se junta con lo ya anotado de él: no añade rangos.
+	for (i = 0; i < numRangos; i++) {
+		if (miSistemaDeFicheros->rangosSucios[i].pos
+				< (off_t) sizeof(EstructuraSuperBloque)) {
+			if (marcaSucio(miSistemaDeFicheros, (off_t) SUPERBLOQUE_IDX
+					* TAM_BLOQUE_BYTES, &miSistemaDeFicheros->superBloque,
+					sizeof(EstructuraSuperBloque)) == -1)
+				return -1;
+			break;
+		}
+	}
+	numRangos = miSistemaDeFicheros->numRangosSucios;
+	for (i = 0; i < numRangos; i++) {
+		r = &miSistemaDeFicheros->rangosSucios[i];
+		for (idxBloque = r->pos / TAM_BLOQUE_BYTES; (off_t) idxBloque
+				* TAM_BLOQUE_BYTES < r->pos + (off_t) r->tam; idxBloque++) {
+			if (!conSuma(miSistemaDeFicheros, idxBloque))
+				continue;
+			if (numTocados == maxTocados) {
+				nuevos = realloc(tocados, (maxTocados * 2 + 64)
+						* sizeof(BloqueTocado));
+				if (nuevos == NULL) {
+					perror("Falló realloc en anotaSumasMetadatos");
+					goto fin;
+				}
+				tocados = nuevos;
+				maxTocados = maxTocados * 2 + 64;
+			}
+			tocados[numTocados].idxBloque = idxBloque;
+			tocados[numTocados].rango = i;
+			numTocados++;
+		}
+	}
+	qsort(tocados, numTocados, sizeof(BloqueTocado), comparaTocados);
+	if (numTocados > 0 && (sumas = malloc(numTocados * sizeof(uint32_t)))
+			== NULL) {
+		perror("Falló malloc en anotaSumasMetadatos");
+		goto fin;
+	}
+	// Cada racha de bloques seguidos se anota de una vez; un bloque que
+	// tocan varios rangos se suma una sola vez
+	for (i = 0; i < numTocados; i = j) {
+		n = 0;
+		for (j = i; j < numTocados && tocados[j].idxBloque <= tocados[i].idxBloque
+				+ n; j++) {
+			if (j > i && tocados[j].idxBloque == tocados[j - 1].idxBloque)
+				continue;
+			sumas[n++] = sumaTocado(miSistemaDeFicheros, &tocados[j]);
+		}
+		if (anotaSumasCalculadas(miSistemaDeFicheros, tocados[i].idxBloque, n,
+				sumas) == -1)
+			goto fin;
+	}
+	ret = 0;
+
+	fin: free(tocados);
+	free(sumas);
+	return ret;
+}
+
+int compruebaSumas(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio,
+		int numBloques, const void* datos) {
+	uint32_t* tabla = NULL;
+	uint32_t suma;
+	DISK_LBA idxBloque;
+	int i;
+
+	if (!tieneSumas(miSistemaDeFicheros))
+		return 0;
+	for (i = 0; i < numBloques; i++) {
+		idxBloque = inicio + i;
+		if (!conSuma(miSistemaDeFicheros, idxBloque))
+			continue;
+		if (tabla == NULL || idxBloque % SUMAS_POR_BLOQUE == 0)
+			if ((tabla = bloqueSumas(miSistemaDeFicheros, idxBloque
+					/ SUMAS_POR_BLOQUE)) == NULL)
+				return -1;
+		suma = sumaBloque((const char*) datos + (size_t) i * TAM_BLOQUE_BYTES);
+		if (suma != tabla[idxBloque % SUMAS_POR_BLOQUE]) {
+			fprintf(stderr, "Bloque %d dañado: su suma de comprobación no coincide\n",
+					idxBloque);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int formateaSumas(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	uint32_t sumaCeros = sumaBloque(ceros);
+	uint32_t* sumas;
+	int i, ret;
+
+	if (!tieneSumas(miSistemaDeFicheros))
+		return 0;
+	if ((sumas = malloc(sb->tamDiscoEnBloques * sizeof(uint32_t))) == NULL) {
+		perror("Falló malloc en formateaSumas");
+		return -1;
+	}
+	for (i = 0; i < sb->tamDiscoEnBloques; i++)
+		sumas[i] = sumaCeros;
+	ret = anotaSumasCalculadas(miSistemaDeFicheros, 0, sb->tamDiscoEnBloques,
+			sumas);
+	free(sumas);
+	return ret;
+}
+
+/// SCRUB
+
+// Lo que comparten los hilos de myScrub. Los trozos se reparten de uno en
+// uno según terminan, así ninguno se queda sin trabajo mientras otro tiene
+// mucho.
+typedef struct Scrub {
+	MiSistemaDeFicheros* miSistemaDeFicheros;
+	int numTrozos;
+	int siguiente;                    // Primer trozo sin repartir
+	long long comprobados;            // Bloques comprobados
+	int danados;                      // ... que no coinciden
+	BOOLEAN fallo;                    // Alguna lectura ha fallado
+} Scrub;
+
+// Cierto si algún bloque de [inicio, inicio+numBloques) está ocupado (el
+// trozo empieza en una palabra del mapa)
+static BOOLEAN trozoOcupado(MiSistemaDeFicheros* miSistemaDeFicheros,
+		DISK_LBA inicio, int numBloques) {
+	size_t i;
+
+	for (i = inicio / BITS_POR_PALABRA; i < (inicio + numBloques
+			+ BITS_POR_PALABRA - 1) / BITS_POR_PALABRA; i++)
+		if (miSistemaDeFicheros->mapaDeBits[i] != 0)
+			return true;
+	return false;
+}
+
+static void* trabajadorScrub(void* arg) {
+	Scrub* s = arg;
+	MiSistemaDeFicheros* miSistemaDeFicheros = s->miSistemaDeFicheros;
+	char* buffer = malloc(MAX_BLOQUES_POR_ES * TAM_BLOQUE_BYTES);
+	const uint32_t* tabla;
+	const char* datos;
+	DISK_LBA inicio, idxBloque;
+	int t, n, i;
+	long long comprobados = 0;
+
+	if (buffer == NULL) {
+		perror("Falló malloc en trabajadorScrub");
+		__atomic_store_n(&s->fallo, true, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	while ((t = __atomic_fetch_add(&s->siguiente, 1, __ATOMIC_RELAXED))
+			< s->numTrozos) {
+		inicio = t * MAX_BLOQUES_POR_ES;
+		n = miSistemaDeFicheros->superBloque.tamDiscoEnBloques - inicio;
+		if (n > MAX_BLOQUES_POR_ES)
+			n = MAX_BLOQUES_POR_ES;
+		if (!trozoOcupado(miSistemaDeFicheros, inicio, n))
+			continue;
+		// Con la imagen proyectada se comprueba en su sitio
+		if (miSistemaDeFicheros->imagen != NULL)
+			datos = miSistemaDeFicheros->imagen + (size_t) inicio
+					* TAM_BLOQUE_BYTES;
+		else if (leeBloques(miSistemaDeFicheros, inicio, n, buffer) == -1) {
+			__atomic_store_n(&s->fallo, true, __ATOMIC_RELAXED);
+			continue;
+		} else
+			datos = buffer;
+		for (i = 0; i < n; i++) {
+			idxBloque = inicio + i;
+			if (!leeBitMapa(miSistemaDeFicheros, idxBloque) || !conSuma(
+					miSistemaDeFicheros, idxBloque))
+				continue;
+			comprobados++;
+			// Los bloques de la tabla ya están todos en memoria
+			tabla = (const uint32_t*)
+					miSistemaDeFicheros->bloquesSumas[idxBloque
+							/ SUMAS_POR_BLOQUE];
+			if (sumaBloque(datos + (size_t) i * TAM_BLOQUE_BYTES)
+					!= tabla[idxBloque % SUMAS_POR_BLOQUE]) {
+				fprintf(stderr, "Bloque %d dañado: su suma de comprobación no coincide\n",
+						idxBloque);
+				__atomic_fetch_add(&s->danados, 1, __ATOMIC_RELAXED);
+			}
+		}
+	}
+	__atomic_fetch_add(&s->comprobados, comprobados, __ATOMIC_RELAXED);
+	free(buffer);
+	return NULL;
+}
+
+int myScrub(MiSistemaDeFicheros* miSistemaDeFicheros, int numHilos) {
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	pthread_t* hilos;
+	Scrub s;
+	struct timespec t0, t1;
+	double segundos;
+	int i, creados = 0;
+
+	if (!tieneSumas(miSistemaDeFicheros)) {
+		fprintf(stderr, "La imagen no tiene sumas de comprobación\n");
+		return 1;
+	}
+	// Lo que se compruebe tiene que estar en su sitio: se confirma lo
+	// pendiente y se vacía el diario, como al desmontar
+	if (confirmaMetadatos(miSistemaDeFicheros) == -1
+			|| (miSistemaDeFicheros->diarioActivo && reproduceDiario(
+					miSistemaDeFicheros) == -1))
+		return 3;
+	for (i = 0; i < sb->numBloquesSumas; i++)
+		if (bloqueSumas(miSistemaDeFicheros, i) == NULL)
+			return 3;
+
+	s.miSistemaDeFicheros = miSistemaDeFicheros;
+	s.numTrozos = (sb->tamDiscoEnBloques + MAX_BLOQUES_POR_ES - 1)
+			/ MAX_BLOQUES_POR_ES;
+	s.siguiente = 0;
+	s.comprobados = 0;
+	s.danados = 0;
+	s.fallo = false;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (numHilos > s.numTrozos)
+		numHilos = s.numTrozos;
+	hilos = malloc(numHilos * sizeof(pthread_t));
+	if (hilos != NULL) {
+		for (creados = 0; creados < numHilos; creados++) {
+			if (pthread_create(&hilos[creados], NULL, trabajadorScrub, &s) != 0)
+				break;
+		}
+	}
+	if (creados == 0)
+		trabajadorScrub(&s);
+	for (i = 0; i < creados; i++)
+		pthread_join(hilos[i], NULL);
+	free(hilos);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	segundos = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	printf("Comprobados %lld bloques (%lld MB) en %.3f s, %.1f MB/s con %d hilos: %d dañados\n",
+			s.comprobados, s.comprobados * TAM_BLOQUE_BYTES >> 20, segundos,
+			segundos > 0 ? s.comprobados * TAM_BLOQUE_BYTES / 1e6 / segundos
+					: 0.0, creados > 0 ? creados : 1, s.danados);
+	if (s.fallo) {
+		fprintf(stderr, "No se ha podido leer toda la imagen\n");
+		return 3;
+	}
+	return s.danados > 0 ? 2 : 0;
+}
@@ -0,0 +1,72 @@
+#ifndef SUMAS_H
+#define	SUMAS_H
+
+#include "common.h"
+
+// Sumas de comprobación de los bloques (CRC32C; se puede formatear sin
+// ellas con -sumas off).
+//
+// La tabla de sumas va detrás del índice de huellas y tiene un uint32_t por
+// cada bloque del disco: el CRC32C de su contenido. La tabla y el diario no
+// tienen suma (el diario lleva la suya por transacción); todos los demás
+// bloques ocupados sí.
+//
+// - Los datos: quien los escribe anota sus sumas (anotaSumas), que se
+//   confirman con la operación, como el resto de metadatos.
+// - Los metadatos: confirmaMetadatos calcula la suma de cada bloque que toca
+//   la transacción, sobre su contenido completo en memoria
+//   (anotaSumasMetadatos).
+//
+// Se comprueban al exportar, al leer de disco un bloque de metadatos (un
+// fallo de la caché, un bloque de nodos-i o de huellas, y al montar el
+// superbloque y los mapas) y, de toda la imagen, con myScrub. Con la
+// imagen proyectada, lo que se lee a través de la caché no se comprueba:
+// no hay lectura, solo un puntero a la proyección.
+//
+// Los bloques de tabla se leen al consultarlos y se quedan en memoria, como
+// los de nodos-i. El CRC se calcula con la instrucción crc32 de SSE4.2 si
+// el procesador la tiene (tres cadenas a la vez, que se juntan al final) y
+// si no con tablas, 8 bytes por vuelta.
+
+#define SUMAS_POR_BLOQUE (TAM_BLOQUE_BYTES / sizeof(uint32_t))
+
+// CRC32C de tam bytes, siguiendo a crc (0 para empezar)
+uint32_t crc32c(uint32_t crc, const void* datos, size_t tam);
+// La suma de un bloque
+uint32_t sumaBloque(const void* bloque);
+
+// Bloques de la tabla para un disco de numBloques bloques
+int bloquesTablaSumas(int numBloques);
+
+// Prepara la tabla vacía: sus bloques se leen al consultarlos
+int initSumas(MiSistemaDeFicheros* miSistemaDeFicheros);
+void liberaSumas(MiSistemaDeFicheros* miSistemaDeFicheros);
+// Al formatear: anota para todos los bloques la suma de un bloque a ceros,
+// que es lo que tiene la imagen recién creada
+int formateaSumas(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+// Cierto si la imagen tiene sumas
+BOOLEAN tieneSumas(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+// Anota las sumas de numBloques bloques recién escritos desde datos, o ya
+// calculadas en sumas (una por bloque)
+int anotaSumas(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio, int numBloques, const void* datos);
+int anotaSumasCalculadas(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio, int numBloques, const uint32_t* sumas);
+// Igual, tras escribir tam bytes en la posición pos del disco: los bloques
+// que no se han escrito enteros se vuelven a leer
+int anotaSumasEscritura(MiSistemaDeFicheros* miSistemaDeFicheros, off_t pos, const void* datos, size_t tam);
+// Para confirmaMetadatos: anota las sumas de todos los bloques que tocan los
+// cambios pendientes
+int anotaSumasMetadatos(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+// Comprueba numBloques bloques leídos de disco en datos. Si alguno no
+// coincide lo dice y devuelve -1.
+int compruebaSumas(MiSistemaDeFicheros* miSistemaDeFicheros, DISK_LBA inicio, int numBloques, const void* datos);
+
+// Lleva todo a su sitio y comprueba las sumas de todos los bloques
+// ocupados, con numHilos hilos que leen la imagen de MAX_BLOQUES_POR_ES en
+// MAX_BLOQUES_POR_ES bloques. Devuelve 0, 1 si la imagen no tiene sumas,
+// 2 si algún bloque no coincide o 3 si falla la lectura.
+int myScrub(MiSistemaDeFicheros* miSistemaDeFicheros, int numHilos);
+
+#endif	/* SUMAS_H */
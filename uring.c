@@ -0,0 +1,297 @@
+#include "uring.h"
+#include "cache.h"
+#include "sumas.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define TAM_TROZO (BLOQUES_POR_PETICION * TAM_BLOQUE_BYTES)
+
+struct AnilloES {
+	int fd;
+	int profundidad;                  // Trozos en vuelo como mucho
+	char* buffers;                    // Un trozo por cada uno
+	// Cola de envío
+	unsigned* sqCola;
+	unsigned* sqMascara;
+	unsigned* sqIndices;
+	struct io_uring_sqe* sqes;
+	// Cola de compleciones
+	unsigned* cqCabeza;
+	unsigned* cqCola;
+	unsigned* cqMascara;
+	struct io_uring_cqe* cqes;
+	void* mapaSq;
+	size_t tamMapaSq;
+	void* mapaCq;                     // == mapaSq si el núcleo las junta
+	size_t tamMapaCq;
+	size_t tamSqes;
+};
+
+// Trozo en vuelo: una lectura y su escritura
+typedef struct TrozoES {
+	int pendientes;                   // Compleciones que faltan (0 si está libre)
+	unsigned tamLectura;
+	unsigned tamEscritura;
+	off_t posArchivo;                 // Dónde está en el archivo externo
+	DISK_LBA idxBloque;               // ... y en la imagen
+	int numBloques;
+} TrozoES;
+
+int initAnillo(MiSistemaDeFicheros* miSistemaDeFicheros, int profundidad) {
+	struct io_uring_params p;
+	struct AnilloES* a = calloc(1, sizeof(struct AnilloES));
+
+	if (a == NULL) {
+		perror("Falló calloc en initAnillo");
+		return -1;
+	}
+	memset(&p, 0, sizeof(p));
+	// Dos entradas por trozo: la lectura y la escritura
+	a->fd = syscall(__NR_io_uring_setup, 2 * profundidad, &p);
+	if (a->fd == -1) {
+		perror("Falló io_uring_setup en initAnillo");
+		free(a);
+		return -1;
+	}
+	a->profundidad = profundidad;
+	a->tamMapaSq = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	a->tamMapaCq = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (a->tamMapaCq > a->tamMapaSq)
+			a->tamMapaSq = a->tamMapaCq;
+		a->tamMapaCq = a->tamMapaSq;
+	}
+	a->tamSqes = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	a->mapaSq = mmap(NULL, a->tamMapaSq, PROT_READ | PROT_WRITE, MAP_SHARED
+			| MAP_POPULATE, a->fd, IORING_OFF_SQ_RING);
+	a->mapaCq = (p.features & IORING_FEAT_SINGLE_MMAP) ? a->mapaSq : mmap(
+			NULL, a->tamMapaCq, PROT_READ | PROT_WRITE, MAP_SHARED
+					| MAP_POPULATE, a->fd, IORING_OFF_CQ_RING);
+	a->sqes = mmap(NULL, a->tamSqes, PROT_READ | PROT_WRITE, MAP_SHARED
+			| MAP_POPULATE, a->fd, IORING_OFF_SQES);
+	a->buffers = malloc((size_t) profundidad * TAM_TROZO);
+	if (a->mapaSq == MAP_FAILED || a->mapaCq == MAP_FAILED || a->sqes
+			== MAP_FAILED || a->buffers == NULL) {
+		perror("Falló mmap en initAnillo");
+		miSistemaDeFicheros->anillo = a;
+		liberaAnillo(miSistemaDeFicheros);
+		return -1;
+	}
+	a->sqCola = (unsigned*) ((char*) a->mapaSq + p.sq_off.tail);
+	a->sqMascara = (unsigned*) ((char*) a->mapaSq + p.sq_off.ring_mask);
+	a->sqIndices = (unsigned*) ((char*) a->mapaSq + p.sq_off.array);
+	a->cqCabeza = (unsigned*) ((char*) a->mapaCq + p.cq_off.head);
+	a->cqCola = (unsigned*) ((char*) a->mapaCq + p.cq_off.tail);
+	a->cqMascara = (unsigned*) ((char*) a->mapaCq + p.cq_off.ring_mask);
+	a->cqes = (struct io_uring_cqe*) ((char*) a->mapaCq + p.cq_off.cqes);
+	miSistemaDeFicheros->anillo = a;
+	return 0;
+}
+
+void liberaAnillo(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	struct AnilloES* a = miSistemaDeFicheros->anillo;
+
+	if (a == NULL)
+		return;
+	if (a->sqes != NULL && a->sqes != MAP_FAILED)
+		munmap(a->sqes, a->tamSqes);
+	if (a->mapaCq != NULL && a->mapaCq != MAP_FAILED && a->mapaCq != a->mapaSq)
+		munmap(a->mapaCq, a->tamMapaCq);
+	if (a->mapaSq != NULL && a->mapaSq != MAP_FAILED)
+		munmap(a->mapaSq, a->tamMapaSq);
+	free(a->buffers);
+	close(a->fd);
+	free(a);
+	miSistemaDeFicheros->anillo = NULL;
+}
+
+// Pone en la cola de envío una lectura o escritura (sin enviarla aún)
+static void preparaES(struct AnilloES* a, int op, int fd, void* buffer,
+		unsigned tam, off_t pos, unsigned flags, uint64_t datos) {
+	unsigned cola = *a->sqCola;
+	unsigned i = cola & *a->sqMascara;
+	struct io_uring_sqe* sqe = &a->sqes[i];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t) buffer;
+	sqe->len = tam;
+	sqe->off = pos;
+	sqe->flags = flags;
+	sqe->user_data = datos;
+	a->sqIndices[i] = i;
+	// El núcleo no debe ver la nueva cola antes que la entrada
+	__atomic_store_n(a->sqCola, cola + 1, __ATOMIC_RELEASE);
+}
+
+// Copia los bloques del nodo-i entre el archivo externo y la imagen, en
+// trozos de hasta BLOQUES_POR_PETICION bloques que no cruzan extensiones.
+// Al exportar con sumas la escritura no va enlazada a la lectura: se
+// prepara cuando la lectura termina y sus bloques están comprobados.
+static int copiaAnillo(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraNodoI* nodoI, int archivo, BOOLEAN importar) {
+	struct AnilloES* a = miSistemaDeFicheros->anillo;
+	TrozoES* trozos = calloc(a->profundidad, sizeof(TrozoES));
+	CursorExtensiones* cursor = malloc(sizeof(CursorExtensiones));
+	struct io_uring_cqe* cqe;
+	int bloque = 0, restantesRacha = 0, enVuelo = 0, porEnviar = 0;
+	int t, n, ret;
+	unsigned cabeza, cola;
+	DISK_LBA idxRacha = 0;
+	off_t posArchivo;
+	char* buffer;
+	BOOLEAN error = false;
+	BOOLEAN comprobar = !importar && tieneSumas(miSistemaDeFicheros);
+
+	if (trozos == NULL || cursor == NULL) {
+		perror("Falló malloc en copiaAnillo");
+		free(trozos);
+		free(cursor);
+		return -1;
+	}
+	initCursorExtensiones(cursor);
+
+	for (;;) {
+		// Se llenan los huecos con los trozos siguientes
+		for (t = 0; !error && t < a->profundidad && bloque
+				< nodoI->numBloques && (off_t) bloque * TAM_BLOQUE_BYTES
+				< nodoI->tamArchivo; t++) {
+			if (trozos[t].pendientes > 0)
+				continue;
+			if (restantesRacha == 0) {
+				idxRacha = buscaBloqueNodoI(miSistemaDeFicheros, nodoI, bloque,
+						&restantesRacha, cursor);
+				if (idxRacha == -1) {
+					error = true;
+					break;
+				}
+			}
+			n = restantesRacha < BLOQUES_POR_PETICION ? restantesRacha
+					: BLOQUES_POR_PETICION;
+			posArchivo = (off_t) bloque * TAM_BLOQUE_BYTES;
+			buffer = a->buffers + (size_t) t * TAM_TROZO;
+			trozos[t].posArchivo = posArchivo;
+			trozos[t].idxBloque = idxRacha;
+			trozos[t].numBloques = n;
+
+			// En el archivo externo el último trozo acaba con el archivo; en
+			// la imagen se escriben bloques enteros, rellenos con ceros
+			if (importar) {
+				trozos[t].tamLectura = nodoI->tamArchivo - posArchivo
+						< (off_t) n * TAM_BLOQUE_BYTES ? nodoI->tamArchivo
+						- posArchivo : n * TAM_BLOQUE_BYTES;
+				trozos[t].tamEscritura = n * TAM_BLOQUE_BYTES;
+				if (trozos[t].tamLectura < trozos[t].tamEscritura)
+					memset(buffer + trozos[t].tamLectura, 0,
+							trozos[t].tamEscritura - trozos[t].tamLectura);
+				// Como en escribeDatos, la caché no debe conservar lo que
+				// hubiera antes en estos bloques
+				olvidaBloques(miSistemaDeFicheros, idxRacha, n);
+				preparaES(a, IORING_OP_READ, archivo, buffer,
+						trozos[t].tamLectura, posArchivo, IOSQE_IO_LINK, 2 * t);
+				preparaES(a, IORING_OP_WRITE, miSistemaDeFicheros->discoVirtual,
+						buffer, trozos[t].tamEscritura, (off_t) idxRacha
+								* TAM_BLOQUE_BYTES, 0, 2 * t + 1);
+				porEnviar++;
+			} else {
+				trozos[t].tamLectura = n * TAM_BLOQUE_BYTES;
+				trozos[t].tamEscritura = nodoI->tamArchivo - posArchivo
+						< (off_t) n * TAM_BLOQUE_BYTES ? nodoI->tamArchivo
+						- posArchivo : n * TAM_BLOQUE_BYTES;
+				preparaES(a, IORING_OP_READ, miSistemaDeFicheros->discoVirtual,
+						buffer, trozos[t].tamLectura, (off_t) idxRacha
+								* TAM_BLOQUE_BYTES, comprobar ? 0
+								: IOSQE_IO_LINK, 2 * t);
+				if (!comprobar) {
+					preparaES(a, IORING_OP_WRITE, archivo, buffer,
+							trozos[t].tamEscritura, posArchivo, 0, 2 * t + 1);
+					porEnviar++;
+				}
+			}
+			trozos[t].pendientes = 2;
+			porEnviar++;
+			enVuelo++;
+			bloque += n;
+			idxRacha += n;
+			restantesRacha -= n;
+		}
+		if (enVuelo == 0)
+			break;
+
+		// Se envía lo nuevo y se espera a que termine algo
+		ret = syscall(__NR_io_uring_enter, a->fd, porEnviar, 1,
+				IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			// Sin poder enviar ni esperar no se puede saber qué queda en
+			// vuelo, y los buffers no se pueden reutilizar
+			perror("Falló io_uring_enter en copiaAnillo");
+			free(trozos);
+			free(cursor);
+			liberaAnillo(miSistemaDeFicheros);
+			return -1;
+		}
+		porEnviar -= ret;
+
+		// Se recogen todas las compleciones que haya
+		cabeza = *a->cqCabeza;
+		cola = __atomic_load_n(a->cqCola, __ATOMIC_ACQUIRE);
+		for (; cabeza != cola; cabeza++) {
+			cqe = &a->cqes[cabeza & *a->cqMascara];
+			t = cqe->user_data / 2;
+			if (cqe->res != (int) (cqe->user_data % 2 ? trozos[t].tamEscritura
+					: trozos[t].tamLectura) && !error) {
+				// Una lectura corta cancela su escritura (-ECANCELED)
+				fprintf(stderr, "Falló la %s de un trozo en copiaAnillo: %s\n",
+						cqe->user_data % 2 ? "escritura" : "lectura",
+						cqe->res < 0 ? strerror(-cqe->res) : "incompleta");
+				error = true;
+			}
+			buffer = a->buffers + (size_t) t * TAM_TROZO;
+			if (comprobar && cqe->user_data % 2 == 0) {
+				// La escritura se envía si los bloques leídos están bien; si
+				// no, ya no llegará
+				if (!error && compruebaSumas(miSistemaDeFicheros,
+						trozos[t].idxBloque, trozos[t].numBloques, buffer)
+						== -1)
+					error = true;
+				if (error) {
+					trozos[t].pendientes--;
+				} else {
+					preparaES(a, IORING_OP_WRITE, archivo, buffer,
+							trozos[t].tamEscritura, trozos[t].posArchivo, 0,
+							2 * t + 1);
+					porEnviar++;
+				}
+			}
+			if (--trozos[t].pendientes == 0) {
+				enVuelo--;
+				if (importar && !error && anotaSumas(miSistemaDeFicheros,
+						trozos[t].idxBloque, trozos[t].numBloques, buffer)
+						== -1)
+					error = true;
+			}
+		}
+		__atomic_store_n(a->cqCabeza, cabeza, __ATOMIC_RELEASE);
+	}
+	free(trozos);
+	free(cursor);
+	return error ? -1 : 0;
+}
+
+int escribeDatosAnillo(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int archivoExterno, EstructuraNodoI* nodoI) {
+	return copiaAnillo(miSistemaDeFicheros, nodoI, archivoExterno, true);
+}
+
+int exportaDatosAnillo(MiSistemaDeFicheros* miSistemaDeFicheros, int handle,
+		EstructuraNodoI* nodoI) {
+	return copiaAnillo(miSistemaDeFicheros, nodoI, handle, false);
+}
@@ -0,0 +1,29 @@
+#ifndef URING_H
+#define	URING_H
+
+#include "common.h"
+
+// Copia de los datos de los archivos con io_uring (ACCESO_URING).
+//
+// escribeDatos y exportaDatos copian un trozo detrás de otro: leen, escriben
+// y solo entonces piden el siguiente, así que la lectura de un lado nunca
+// se solapa con la escritura del otro. Con el anillo se mantienen hasta
+// profundidad trozos de BLOQUES_POR_PETICION bloques en vuelo. Cada trozo
+// es una lectura encadenada (IOSQE_IO_LINK) a su escritura: el núcleo lanza
+// la escritura al terminar la lectura sin volver al proceso. Las
+// compleciones se recogen todas las que haya de una vez, y cada trozo
+// terminado deja sitio para el siguiente.
+//
+// Se usan directamente las llamadas al sistema (no hace falta liburing).
+// Si el núcleo no tiene io_uring o no lo permite, initAnillo falla y se
+// sigue con pread/pwrite. Los metadatos no pasan por aquí.
+
+// Crea el anillo con sitio para profundidad trozos en vuelo
+int initAnillo(MiSistemaDeFicheros* miSistemaDeFicheros, int profundidad);
+void liberaAnillo(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+// Como escribeDatos y exportaDatos, para el nodo-i ya reservado
+int escribeDatosAnillo(MiSistemaDeFicheros* miSistemaDeFicheros, int archivoExterno, EstructuraNodoI* nodoI);
+int exportaDatosAnillo(MiSistemaDeFicheros* miSistemaDeFicheros, int handle, EstructuraNodoI* nodoI);
+
+#endif	/* URING_H */
@@ -1,101 +1,400 @@
 #include "util.h"
+#include "metadatos.h"
+#include "diario.h"
+#include "directorio.h"
+#include "cache.h"
+#include "uring.h"
+#include "stats.h"
+#include "huellas.h"
+#include "compresion.h"
+#include "sumas.h"
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <sys/uio.h>
 
 // Formatea el disco virtual. Guarda el mapa de bits del super bloque 
-// y el directorio único.
+// y el directorio raíz.
 
-int myMkfs(MiSistemaDeFicheros* miSistemaDeFicheros, int tamDisco,
-		char* nombreArchivo) {
+int myMkfs(MiSistemaDeFicheros* miSistemaDeFicheros, off_t tamDisco,
+		int bytesPorNodoI, BOOLEAN deduplicar, BOOLEAN comprimir,
+		BOOLEAN sumas, char* nombreArchivo) {
 	// Creamos el disco virtual:
 	miSistemaDeFicheros->discoVirtual = open(nombreArchivo, O_CREAT | O_RDWR,
 			S_IRUSR | S_IWUSR);
 
-	int i;
-	int numBloques = tamDisco / TAM_BLOQUE_BYTES;
-	int minNumBloques = 3 + MAX_BLOQUES_CON_NODOSI + 1;
-	int maxNumBloques = NUM_BITS;
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	size_t i;
+	off_t numBloques = tamDisco / TAM_BLOQUE_BYTES;
+	off_t numNodosI;
+	int minNumBloques;
+	int maxNumBloques = MAX_BLOQUES_DISCO;
+	int numBloquesMapaBits;
+	int numBloquesMapaNodosI;
+	int numBloquesNodosI;
+	int numBloquesDiario;
+	int numBloquesHuellas = 0;
+	int numBloquesInverso = 0;
+	int numBloquesSumas = 0;
 
 	// Algunas comprobaciones mínimas:
 	assert(sizeof (EstructuraSuperBloque) <= TAM_BLOQUE_BYTES);
-	assert(sizeof (EstructuraDirectorio) <= TAM_BLOQUE_BYTES);
+	assert(sizeof (EstructuraDirectorio) == TAM_BLOQUE_BYTES);
+	assert(sizeof (EstructuraCubeta) == TAM_BLOQUE_BYTES);
+	assert(sizeof (EstructuraBloqueArbol) == TAM_BLOQUE_BYTES);
+
+	if (numBloques > maxNumBloques) {
+		perror("Numero de bloques demasiado grande");
+		return 2;
+	}
 
+	/// DISPOSICIÓN
+	// Superbloque, mapa de bits (tantos bloques como haga falta para cubrir
+	// el disco), mapa de nodos-i, nodos-i (uno por cada bytesPorNodoI bytes
+	// de disco), diario y, si se deduplica, el índice de huellas con su
+	// inverso (una entrada por bloque de disco en cada uno) y, con sumas, su
+	// tabla (ver sumas.h), uno detrás de otro. El directorio va en bloques
+	// de datos, como un archivo más.
+	numBloquesMapaBits = (numBloques + BITS_POR_BLOQUE_MAPA - 1)
+			/ BITS_POR_BLOQUE_MAPA;
+	numNodosI = tamDisco / bytesPorNodoI;
+	if (numNodosI > MAX_NODOSI)
+		numNodosI = MAX_NODOSI;
+	numBloquesNodosI = (numNodosI + NODOSI_POR_BLOQUE - 1) / NODOSI_POR_BLOQUE;
+	if (numBloquesNodosI < 1)
+		numBloquesNodosI = 1;
+	// Los nodos-i llenan sus bloques
+	numNodosI = (off_t) numBloquesNodosI * NODOSI_POR_BLOQUE;
+	numBloquesMapaNodosI = (numNodosI + BITS_POR_BLOQUE_MAPA - 1)
+			/ BITS_POR_BLOQUE_MAPA;
+	numBloquesDiario = numBloques / BLOQUES_DISCO_POR_BLOQUE_DIARIO;
+	if (numBloquesDiario < MIN_BLOQUES_DIARIO)
+		numBloquesDiario = MIN_BLOQUES_DIARIO;
+	if (numBloquesDiario > MAX_BLOQUES_DIARIO)
+		numBloquesDiario = MAX_BLOQUES_DIARIO;
+	if (deduplicar) {
+		numBloquesHuellas = bloquesIndiceHuellas(numBloques);
+		numBloquesInverso = bloquesInversoHuellas(numBloques);
+	}
+	if (sumas)
+		numBloquesSumas = bloquesTablaSumas(numBloques);
+
+	// Además hacen falta los 3 bloques del raíz y uno para datos
+	minNumBloques = 1 + numBloquesMapaBits + numBloquesMapaNodosI
+			+ numBloquesNodosI + numBloquesDiario + numBloquesHuellas
+			+ numBloquesInverso + numBloquesSumas + 3 + 1;
 	if (numBloques < minNumBloques) {
 		perror("Numero de bloques demasiado pequeño");
 		return 1;
 	}
-	if (numBloques >= maxNumBloques) {
-		perror("Numero de bloques demasiado grande");
-		return 2;
+
+	sb->numBloquesMapaBits = numBloquesMapaBits;
+	sb->idxMapaNodosI = MAPA_BITS_IDX + numBloquesMapaBits;
+	sb->numBloquesMapaNodosI = numBloquesMapaNodosI;
+	sb->idxNodosI = sb->idxMapaNodosI + numBloquesMapaNodosI;
+	sb->numBloquesNodosI = numBloquesNodosI;
+	sb->numNodosI = numNodosI;
+	sb->numNodosLibres = numNodosI;
+	sb->bytesPorNodoI = bytesPorNodoI;
+	sb->idxDiario = sb->idxNodosI + numBloquesNodosI;
+	sb->numBloquesDiario = numBloquesDiario;
+	sb->idxHuellas = sb->idxDiario + numBloquesDiario;
+	sb->numBloquesHuellas = numBloquesHuellas;
+	sb->numBloquesInverso = numBloquesInverso;
+	sb->comprimir = comprimir;
+	sb->idxSumas = sb->idxHuellas + numBloquesHuellas + numBloquesInverso;
+	sb->numBloquesSumas = numBloquesSumas;
+
+	// Descartamos el contenido anterior de la imagen; el archivo queda
+	// disperso hasta que se escriban los bloques
+	if (ftruncate(miSistemaDeFicheros->discoVirtual, 0) == -1
+			|| ftruncate(miSistemaDeFicheros->discoVirtual, numBloques
+					* TAM_BLOQUE_BYTES) == -1) {
+		perror("Falló ftruncate en myMkfs");
+		return 3;
 	}
 
 	/// MAPA DE BITS
 	// Inicializamos el mapa de bits
-	for (i = 0; i < NUM_BITS; i++) {
-		miSistemaDeFicheros->mapaDeBits[i] = 0;
+	miSistemaDeFicheros->numPalabrasMapa = numBloquesMapaBits
+			* PALABRAS_POR_BLOQUE_MAPA;
+	free(miSistemaDeFicheros->mapaDeBits);
+	miSistemaDeFicheros->mapaDeBits = calloc(
+			miSistemaDeFicheros->numPalabrasMapa, sizeof(BIT));
+	if (miSistemaDeFicheros->mapaDeBits == NULL) {
+		perror("Falló calloc en myMkfs");
+		return 3;
 	}
 
-	// Los primeros tres bloques tendrán el superbloque, mapa de bits y directorio
-	miSistemaDeFicheros->mapaDeBits[SUPERBLOQUE_IDX] = 1;
-	miSistemaDeFicheros->mapaDeBits[MAPA_BITS_IDX] = 1;
-	miSistemaDeFicheros->mapaDeBits[DIRECTORIO_IDX] = 1;
-	// Los siguientes NUM_INODE_BLOCKS contendrán nodos-i
-	for (i = 3; i < 3 + MAX_BLOQUES_CON_NODOSI; i++) {
-		miSistemaDeFicheros->mapaDeBits[i] = 1;
-	}
+	// Los bloques de metadatos están todos al principio del disco. Los bits
+	// que caen fuera del disco se marcan como ocupados para que nunca se
+	// asignen.
+	cambiaRachaMapa(miSistemaDeFicheros, SUPERBLOQUE_IDX, sb->idxSumas
+			+ numBloquesSumas, true);
+	if (numBloques < miSistemaDeFicheros->numPalabrasMapa * BITS_POR_PALABRA)
+		cambiaRachaMapa(miSistemaDeFicheros, numBloques,
+				miSistemaDeFicheros->numPalabrasMapa * BITS_POR_PALABRA
+						- numBloques, true);
 	escribeMapaDeBits(miSistemaDeFicheros);
 
-	/// DIRECTORIO
-	// Inicializamos el directorio (numArchivos, archivos[i].libre) y lo escribimos en disco
-	miSistemaDeFicheros->directorio.numArchivos = 0;
-	int j;
-	for (j = 0; j < MAX_ARCHIVOS_POR_DIRECTORIO; j++) {
-		miSistemaDeFicheros->directorio.archivos[j].libre = 1;
-
-	}
-	escribeDirectorio(miSistemaDeFicheros);
-
 	/// NODOS-I
-	EstructuraNodoI nodoActual; //auxiliar para inicializacions
-	nodoActual.libre = 1;
-	// Escribimos nodoActual MAX_NODOSI veces en disco
-	for (i = 0; i < MAX_NODOSI; i++) {
-		escribeNodoI(miSistemaDeFicheros, i, &nodoActual);
-		//Poner array nodos-i a NULL
-		miSistemaDeFicheros->nodosI[i] = NULL;
+	// Todos libres en su mapa, salvo los bits que sobran al final. La tabla
+	// no hace falta escribirla: la imagen está a ceros y el contenido de un
+	// nodo-i libre no importa.
+	miSistemaDeFicheros->numPalabrasMapaNodosI = numBloquesMapaNodosI
+			* PALABRAS_POR_BLOQUE_MAPA;
+	free(miSistemaDeFicheros->mapaNodosI);
+	miSistemaDeFicheros->mapaNodosI = calloc(
+			miSistemaDeFicheros->numPalabrasMapaNodosI, sizeof(BIT));
+	if (miSistemaDeFicheros->mapaNodosI == NULL) {
+		perror("Falló calloc en myMkfs");
+		return 3;
+	}
+	for (i = numNodosI; i < miSistemaDeFicheros->numPalabrasMapaNodosI
+			* BITS_POR_PALABRA; i++) {
+		miSistemaDeFicheros->mapaNodosI[i / BITS_POR_PALABRA] |= (BIT) 1 << (i
+				% BITS_POR_PALABRA);
 	}
+	escribeMapaNodosI(miSistemaDeFicheros);
+	if (initNodosI(miSistemaDeFicheros) == -1)
+		return 3;
+
+	/// HUELLAS
+	// Como la tabla de nodos-i: a ceros, las dos tablas están vacías
+	if (initHuellas(miSistemaDeFicheros) == -1)
+		return 3;
 
 	/// SUPERBLOQUE
-	// Inicializamos el superbloque (ver common.c) y lo escribimos en disco
+	// Inicializamos el superbloque (ver common.c)
+	miSistemaDeFicheros->superBloque.numeroMagico = NUMERO_MAGICO;
+	miSistemaDeFicheros->superBloque.version = VERSION_FORMATO;
 	initSuperBloque(miSistemaDeFicheros, tamDisco);
+
+	/// SUMAS
+	// La imagen está a ceros: todos los bloques tienen la misma suma. Las
+	// de lo que se escriba desde aquí se anotan al confirmarlo.
+	if (initSumas(miSistemaDeFicheros) == -1
+			|| formateaSumas(miSistemaDeFicheros) == -1)
+		return 3;
+	// Ya se sabe el tamaño de la imagen: si se va a usar proyectada, a
+	// partir de aquí se escribe a través de la proyección
+	if (miSistemaDeFicheros->modoAcceso == ACCESO_MMAP
+			&& proyectaImagen(miSistemaDeFicheros) == -1)
+		return 3;
+
+	/// DIRECTORIO
+	// El directorio raíz, vacío, ocupa el nodo-i NODOI_RAIZ y sus primeros
+	// bloques de datos. Después ya se puede escribir el superbloque.
+	if (creaDirectorio(miSistemaDeFicheros, NODOI_RAIZ) == -1)
+		return 3;
 	escribeSuperBloque(miSistemaDeFicheros);
-	sync();
+
+	/// DIARIO
+	// El formato se escribe directamente; a partir de aquí los metadatos
+	// pasan por el diario
+	if (initDiario(miSistemaDeFicheros) == -1
+			|| confirmaMetadatos(miSistemaDeFicheros) == -1)
+		return 3;
+	miSistemaDeFicheros->diarioActivo = true;
 
 	// Al finalizar tenemos al menos un bloque
 	assert(myQuota(miSistemaDeFicheros) >= 1);
 
-	printf("SF: %s, %d B (%d B/bloque), %d bloques\n", nombreArchivo, tamDisco,
-			TAM_BLOQUE_BYTES, numBloques);
+	printf("SF: %s, %lld B (%d B/bloque), %lld bloques\n", nombreArchivo,
+			(long long) tamDisco, TAM_BLOQUE_BYTES, (long long) numBloques);
 	printf("1 bloque para SUPERBLOQUE (%lu B)\n", sizeof(EstructuraSuperBloque));
-	printf("1 bloque para MAPA DE BITS, que cubre %lu bloques, %lu B\n",
-			NUM_BITS, NUM_BITS * TAM_BLOQUE_BYTES);
-	printf("1 bloque para DIRECTORIO (%lu B)\n", sizeof(EstructuraDirectorio));
-	printf("%d bloques para nodos-i (a %lu B/nodo-i, %lu nodos-i)\n",
-			MAX_BLOQUES_CON_NODOSI, sizeof(EstructuraNodoI), MAX_NODOSI);
-	printf("%d bloques para datos (%d B)\n",
-			miSistemaDeFicheros->superBloque.numBloquesLibres, TAM_BLOQUE_BYTES
+	printf("%d bloque(s) para MAPA DE BITS, que cubre(n) %lu bloques, %lu B\n",
+			numBloquesMapaBits, miSistemaDeFicheros->numPalabrasMapa
+					* BITS_POR_PALABRA, miSistemaDeFicheros->numPalabrasMapa
+					* BITS_POR_PALABRA * TAM_BLOQUE_BYTES);
+	printf("%d bloque(s) para MAPA DE NODOS-I\n", numBloquesMapaNodosI);
+	printf("%d bloques para nodos-i (a %lu B/nodo-i, %lld nodos-i, 1 por cada %d B)\n",
+			numBloquesNodosI, sizeof(EstructuraNodoI), (long long) numNodosI,
+			bytesPorNodoI);
+	printf("%d bloques para DIARIO\n", numBloquesDiario);
+	if (deduplicar)
+		printf("%d bloques para ÍNDICE DE HUELLAS (%lu entradas) y %d para su inverso\n",
+				numBloquesHuellas, numBloquesHuellas * HUELLAS_POR_BLOQUE,
+				numBloquesInverso);
+	if (comprimir)
+		printf("Los archivos importados se comprimen en tramas de %d B\n",
+				TAM_TRAMA);
+	if (sumas)
+		printf("%d bloques para SUMAS de comprobación (CRC32C)\n",
+				numBloquesSumas);
+	printf("%d bloques para DIRECTORIO raíz (nodo-i %d, nombres de hasta %d B)\n",
+			obtenNodoI(miSistemaDeFicheros, NODOI_RAIZ)->numBloques, NODOI_RAIZ,
+			MAX_TAM_NOMBRE_ARCHIVO);
+	printf("%d bloques para datos (%lld B)\n",
+			miSistemaDeFicheros->superBloque.numBloquesLibres, (long long)
+					TAM_BLOQUE_BYTES
 					* miSistemaDeFicheros->superBloque.numBloquesLibres);
 	printf("¡Formato completado!\n");
 	return 0;
 }
 
-int myImport(char* nombreArchivoExterno,
-		MiSistemaDeFicheros* miSistemaDeFicheros, char* nombreArchivoInterno) {
+int myMount(MiSistemaDeFicheros* miSistemaDeFicheros, char* nombreArchivo) {
+	EstructuraSuperBloque* sb = &miSistemaDeFicheros->superBloque;
+	DirectorioAbierto* raiz;
+	char bloque[TAM_BLOQUE_BYTES];
+	char relleno[TAM_BLOQUE_BYTES];
+	struct iovec vector[4];
 	struct stat stStat;
-	int handle = open(nombreArchivoExterno, O_RDONLY);
-	if (handle == -1) {
+	int i;
+
+	miSistemaDeFicheros->discoVirtual = open(nombreArchivo, O_RDWR);
+	if (miSistemaDeFicheros->discoVirtual == -1) {
+		perror("Falló open en myMount");
+		return 1;
+	}
+
+	/// SUPERBLOQUE
+	// Lo leemos y comprobamos que describe una imagen que sabemos montar
+	if (leeBloques(miSistemaDeFicheros, SUPERBLOQUE_IDX, 1, bloque) == -1
+			|| fstat(miSistemaDeFicheros->discoVirtual, &stStat) == -1) {
+		cierraImagen(miSistemaDeFicheros);
+		return 3;
+	}
+	memcpy(sb, bloque, sizeof(EstructuraSuperBloque));
+	if (sb->numeroMagico != NUMERO_MAGICO || sb->version != VERSION_FORMATO
+			|| sb->tamSuperBloque != sizeof(EstructuraSuperBloque)
+			|| sb->tamDirectorio != sizeof(EstructuraDirectorio)
+			|| sb->tamNodoI != sizeof(EstructuraNodoI)
+			|| sb->tamBloque != TAM_BLOQUE_BYTES
+			|| sb->numBloquesMapaBits != (sb->tamDiscoEnBloques
+					+ BITS_POR_BLOQUE_MAPA - 1) / BITS_POR_BLOQUE_MAPA
+			|| sb->numNodosI < 1 || sb->numNodosI > MAX_NODOSI
+					+ (int) NODOSI_POR_BLOQUE
+			|| sb->numNodosLibres < 0 || sb->numNodosLibres > sb->numNodosI
+			|| sb->idxMapaNodosI != MAPA_BITS_IDX + sb->numBloquesMapaBits
+			|| sb->numBloquesMapaNodosI != (sb->numNodosI
+					+ BITS_POR_BLOQUE_MAPA - 1) / BITS_POR_BLOQUE_MAPA
+			|| sb->idxNodosI != sb->idxMapaNodosI + sb->numBloquesMapaNodosI
+			|| sb->numBloquesNodosI != (sb->numNodosI + NODOSI_POR_BLOQUE - 1)
+					/ NODOSI_POR_BLOQUE
+			|| sb->idxDiario != sb->idxNodosI + sb->numBloquesNodosI
+			|| sb->numBloquesDiario < MIN_BLOQUES_DIARIO
+			|| sb->numBloquesDiario > MAX_BLOQUES_DIARIO
+			|| sb->idxHuellas != sb->idxDiario + sb->numBloquesDiario
+			|| (sb->numBloquesHuellas != 0 && (sb->numBloquesHuellas
+					!= bloquesIndiceHuellas(sb->tamDiscoEnBloques)
+					|| sb->numBloquesInverso
+							!= bloquesInversoHuellas(sb->tamDiscoEnBloques)))
+			|| (sb->numBloquesHuellas == 0 && sb->numBloquesInverso != 0)
+			|| (sb->comprimir != false && sb->comprimir != true)
+			|| sb->idxSumas != sb->idxHuellas + sb->numBloquesHuellas
+					+ sb->numBloquesInverso
+			|| (sb->numBloquesSumas != 0 && sb->numBloquesSumas
+					!= bloquesTablaSumas(sb->tamDiscoEnBloques))
+			|| sb->idxSumas + sb->numBloquesSumas > sb->tamDiscoEnBloques
+			|| stStat.st_size < (off_t) sb->tamDiscoEnBloques
+					* TAM_BLOQUE_BYTES) {
+		fprintf(stderr, "%s no es una imagen válida\n", nombreArchivo);
+		cierraImagen(miSistemaDeFicheros);
+		return 2;
+	}
+	if (miSistemaDeFicheros->modoAcceso == ACCESO_MMAP
+			&& proyectaImagen(miSistemaDeFicheros) == -1) {
+		cierraImagen(miSistemaDeFicheros);
+		return 3;
+	}
+
+	/// DIARIO
+	// Llevamos a su sitio lo que quedó confirmado en el diario; la
+	// disposición no cambia nunca, así que el superbloque leído basta para
+	// encontrarlo
+	miSistemaDeFicheros->posDiario = 0;
+	i = reproduceDiario(miSistemaDeFicheros);
+	if (i == -1) {
+		cierraImagen(miSistemaDeFicheros);
+		return 3;
+	}
+	if (i > 0)
+		printf("Diario: %d transacciones recuperadas\n", i);
+
+	/// SUPERBLOQUE Y MAPAS DE BITS Y DE NODOS-I
+	// Están seguidos en disco, así que los leemos con una sola llamada
+	miSistemaDeFicheros->numPalabrasMapa = sb->numBloquesMapaBits
+			* PALABRAS_POR_BLOQUE_MAPA;
+	miSistemaDeFicheros->numPalabrasMapaNodosI = sb->numBloquesMapaNodosI
+			* PALABRAS_POR_BLOQUE_MAPA;
+	free(miSistemaDeFicheros->mapaDeBits);
+	free(miSistemaDeFicheros->mapaNodosI);
+	miSistemaDeFicheros->mapaDeBits = malloc(
+			miSistemaDeFicheros->numPalabrasMapa * sizeof(BIT));
+	miSistemaDeFicheros->mapaNodosI = malloc(
+			miSistemaDeFicheros->numPalabrasMapaNodosI * sizeof(BIT));
+	if (miSistemaDeFicheros->mapaDeBits == NULL
+			|| miSistemaDeFicheros->mapaNodosI == NULL) {
+		perror("Falló malloc en myMount");
+		cierraImagen(miSistemaDeFicheros);
+		return 4;
+	}
+	vector[0].iov_base = sb;
+	vector[0].iov_len = sizeof(EstructuraSuperBloque);
+	vector[1].iov_base = relleno;
+	vector[1].iov_len = TAM_BLOQUE_BYTES - sizeof(EstructuraSuperBloque);
+	vector[2].iov_base = miSistemaDeFicheros->mapaDeBits;
+	vector[2].iov_len = miSistemaDeFicheros->numPalabrasMapa * sizeof(BIT);
+	vector[3].iov_base = miSistemaDeFicheros->mapaNodosI;
+	vector[3].iov_len = miSistemaDeFicheros->numPalabrasMapaNodosI * sizeof(BIT);
+	if (leeDiscoVector(miSistemaDeFicheros, vector, 4, (off_t) SUPERBLOQUE_IDX
+			* TAM_BLOQUE_BYTES) == -1) {
+		cierraImagen(miSistemaDeFicheros);
+		return 3;
+	}
+
+	// Los bloques de nodos-i, de las huellas y de las sumas se leen al
+	// consultarlos (ver ranuraNodoI)
+	if (initNodosI(miSistemaDeFicheros) == -1
+			|| initHuellas(miSistemaDeFicheros) == -1
+			|| initSumas(miSistemaDeFicheros) == -1) {
+		cierraImagen(miSistemaDeFicheros);
+		return 4;
+	}
+	// Del superbloque y los mapas depende todo lo demás: se comprueban ya
+	memcpy(bloque, sb, sizeof(EstructuraSuperBloque));
+	memcpy(bloque + sizeof(EstructuraSuperBloque), relleno, TAM_BLOQUE_BYTES
+			- sizeof(EstructuraSuperBloque));
+	if (compruebaSumas(miSistemaDeFicheros, SUPERBLOQUE_IDX, 1, bloque) == -1
+			|| compruebaSumas(miSistemaDeFicheros, MAPA_BITS_IDX,
+					sb->numBloquesMapaBits, miSistemaDeFicheros->mapaDeBits)
+					== -1 || compruebaSumas(miSistemaDeFicheros,
+			sb->idxMapaNodosI, sb->numBloquesMapaNodosI,
+			miSistemaDeFicheros->mapaNodosI) == -1) {
+		fprintf(stderr, "Los metadatos de %s están dañados\n", nombreArchivo);
+		cierraImagen(miSistemaDeFicheros);
+		return 5;
+	}
+
+	/// DIRECTORIO
+	// Cabecera y tabla de cubetas del raíz; los demás directorios se cargan
+	// al recorrer las rutas, y las cubetas al usarlas
+	if ((raiz = abreDirectorio(miSistemaDeFicheros, NODOI_RAIZ)) == NULL) {
+		fprintf(stderr, "Falta el directorio raíz\n");
+		cierraImagen(miSistemaDeFicheros);
+		return 3;
+	}
+	miSistemaDeFicheros->diarioActivo = true;
+
+	printf("SF: %s, %d bloques (%d B/bloque), %d libres, %d archivos en el raíz\n",
+			nombreArchivo, sb->tamDiscoEnBloques, TAM_BLOQUE_BYTES,
+			sb->numBloquesLibres, raiz->cabecera.numArchivos);
+	return 0;
+}
+
+int abreImportacion(MiSistemaDeFicheros* miSistemaDeFicheros,
+		char* nombreArchivoExterno, char* nombreArchivoInterno, int* handle,
+		int* numNodoI, BOOLEAN* flujo) {
+	char nombre[MAX_TAM_NOMBRE_ARCHIVO + 1];
+	int idxDirectorio;
+	ssize_t leidos;
+	off_t tamReserva;
+	struct stat stStat;
+	*handle = strcmp(nombreArchivoExterno, "-") == 0 ? dup(STDIN_FILENO)
+			: open(nombreArchivoExterno, O_RDONLY);
+	if (*handle == -1) {
 		printf("Error, leyendo archivo %s\n", nombreArchivoExterno);
 		return 1;
 	}
@@ -103,124 +402,210 @@ int myImport(char* nombreArchivoExterno,
 	int nodoLibre = buscaNodoLibre(miSistemaDeFicheros);
 
 	/// Comprobamos que podemos abrir el archivo a importar
-	if (stat(nombreArchivoExterno, &stStat) != false) {
+	if (fstat(*handle, &stStat) != false) {
 		perror("stat");
 		fprintf(stderr, "Error, ejecutando stat en archivo %s\n",
 				nombreArchivoExterno);
+		close(*handle);
 		return 2;
 	}
-
-	/// Comprobamos que hay suficiente espacio
-	if (stStat.st_size > miSistemaDeFicheros->superBloque.numBloquesLibres
+	/// De una tubería o un socket no se sabe el tamaño: los bloques se
+	/// reservan según llegan los datos (ver escribeFlujo). Si se deduplica
+	/// o se comprime, también: hasta leer cada bloque no se sabe si hace
+	/// falta.
+	if (!S_ISREG(stStat.st_mode))
+		stStat.st_size = 0;
+	*flujo = !S_ISREG(stStat.st_mode) || deduplica(miSistemaDeFicheros)
+			|| comprime(miSistemaDeFicheros);
+	tamReserva = *flujo ? 0 : stStat.st_size;
+
+	/// Comprobamos que hay suficiente espacio. Los bloques liberados por
+	/// operaciones aún sin confirmar no cuentan hasta que se confirmen (si
+	/// no hay otras a medias, que no se pueden confirmar todavía).
+	if (tamReserva > (off_t) miSistemaDeFicheros->superBloque.numBloquesLibres
+			* TAM_BLOQUE_BYTES && miSistemaDeFicheros->numLiberaciones > 0
+			&& miSistemaDeFicheros->opsAbiertas == 0)
+		confirmaMetadatos(miSistemaDeFicheros);
+	if (tamReserva > (off_t) miSistemaDeFicheros->superBloque.numBloquesLibres
 			* TAM_BLOQUE_BYTES) {
 		fprintf(stderr, "No hay suficiente espacio en disco\n");
+		close(*handle);
 		return 3;
 	}
 
 	/// Comprobamos que el tamaño total es suficientemente pequeño
 	/// para ser almacenado en MAX_BLOCKS_PER_FILE
-	if (stStat.st_size > (TAM_BLOQUE_BYTES * MAX_BLOQUES_POR_ARCHIVO)) {
+	if (stStat.st_size > ((off_t) TAM_BLOQUE_BYTES * MAX_BLOQUES_POR_ARCHIVO)) {
 		fprintf(stderr, "El archivo a copiar es demasido grande\n");
+		close(*handle);
 		return 4;
 	}
 
-	/// Comprobamos que la longitud del nombre del archivo es adecuada
-	if (strlen(nombreArchivoInterno) > MAX_TAM_NOMBRE_ARCHIVO) {
-		fprintf(stderr, "Nombre de archivo demasiado grande\n");
+	/// Comprobamos que existe el directorio donde va y que la longitud de
+	/// los nombres de la ruta es adecuada
+	idxDirectorio = resuelveRuta(miSistemaDeFicheros, nombreArchivoInterno,
+			nombre);
+	if (idxDirectorio == -1 || nombre[0] == '\0') {
+		fprintf(stderr, "Ruta no válida: %s\n", nombreArchivoInterno);
+		close(*handle);
 		return 5;
 	}
 
 	/// Comprobamos que el fichero no existe ya
-	if (buscaPosDirectorio(miSistemaDeFicheros, nombreArchivoInterno) != -1) {
+	if (buscaEntradaDirectorio(miSistemaDeFicheros, idxDirectorio, nombre)
+			!= -1) {
 		fprintf(stderr, "El archivo a copiar ya existe\n");
+		close(*handle);
 		return 6;
 	}
 
 	/// Comprobamos si existe un nodo-i libre
 	if (nodoLibre == -1) {
 		fprintf(stderr, "No existen nodos-i libres\n");
+		close(*handle);
 		return 7;
 	}
 
-	/// Comprobamos que todavía cabe un archivo en el directorio (MAX_ARCHIVOS_POR_DIRECTORIO)
-	if (miSistemaDeFicheros->directorio.numArchivos
-			== MAX_ARCHIVOS_POR_DIRECTORIO) {
-		fprintf(stderr, "No caben mas archivos en el directorio\n");
-		return 8;
-	}
-
 	/// Actualizamos toda la información:
-	/// mapa de bits, directorio, nodo-i, bloques de datos, superbloque ...
+	/// mapa de bits, directorio, nodo-i, superbloque ...
 	/****************Nodo-i***********************/
-	EstructuraNodoI *nodo = malloc(sizeof(EstructuraNodoI));
-
-	nodo->tamArchivo = stStat.st_size;
-	nodo->numBloques = ((stStat.st_size + (TAM_BLOQUE_BYTES - 1))
-			/ TAM_BLOQUE_BYTES);
-	nodo->libre = 0;
-	nodo->tiempoModificado = time(0);
-	miSistemaDeFicheros->nodosI[nodoLibre] = nodo;
-	miSistemaDeFicheros->numNodosLibres--;
-
-	reservaBloquesNodosI(miSistemaDeFicheros, nodo->idxBloques,
-			nodo->numBloques);
+	EstructuraNodoI *nodo = ocupaNodoI(miSistemaDeFicheros, nodoLibre);
+	if (nodo == NULL) {
+		close(*handle);
+		return 7;
+	}
+	nodo->tamArchivo = tamReserva;
+
+	/// Un archivo diminuto se guarda en el nodo-i: no gasta ningún bloque
+	/// y exportarlo no lee nada más
+	if (tamReserva <= MAX_TAM_EN_LINEA) {
+		leidos = leeCompleto(*handle, nodo->enLinea, tamReserva);
+		if (leidos == -1) {
+			perror("read");
+			fprintf(stderr, "Error, leyendo archivo %s\n", nombreArchivoExterno);
+			liberaNodoI(miSistemaDeFicheros, nodoLibre);
+			close(*handle);
+			return 2;
+		}
+		nodo->tamArchivo = leidos;
+	/// Si no, reservamos los bloques en rachas contiguas
+	} else if (reservaBloquesNodosI(miSistemaDeFicheros, nodo, (tamReserva
+			+ (TAM_BLOQUE_BYTES - 1)) / TAM_BLOQUE_BYTES) == -1) {
+		fprintf(stderr, "No hay suficiente espacio en disco\n");
+		liberaNodoI(miSistemaDeFicheros, nodoLibre);
+		close(*handle);
+		return 9;
+	}
 
 	escribeNodoI(miSistemaDeFicheros, nodoLibre, nodo);
-	/***************bloque de datos*****************/
 
-	escribeDatos(miSistemaDeFicheros, handle, nodoLibre);
+	/// Comprobamos que todavía cabe un archivo en el directorio; si no,
+	/// deshacemos lo anterior
+	if (anadeEntradaDirectorio(miSistemaDeFicheros, idxDirectorio, nombre,
+			nodoLibre) == -1) {
+		fprintf(stderr, "No caben mas archivos en el directorio\n");
+		liberaBloquesNodoI(miSistemaDeFicheros, nodo);
+		liberaNodoI(miSistemaDeFicheros, nodoLibre);
+		escribeSuperBloque(miSistemaDeFicheros);
+		cierraOperacion(miSistemaDeFicheros);
+		close(*handle);
+		return 8;
+	}
+	escribeSuperBloque(miSistemaDeFicheros);
+	*numNodoI = nodoLibre;
+	return 0;
+}
 
-	escribeMapaDeBits(miSistemaDeFicheros);
+int terminaImportacionFlujo(MiSistemaDeFicheros* miSistemaDeFicheros,
+		int handle, int numNodoI, char* nombreArchivoExterno,
+		char* nombreArchivoInterno) {
+	int ret = escribeFlujo(miSistemaDeFicheros, handle, numNodoI);
 
-	miSistemaDeFicheros->directorio.numArchivos++;
-	miSistemaDeFicheros->directorio.archivos[nodoLibre].libre = 0;
-	strcpy(miSistemaDeFicheros->directorio.archivos[nodoLibre].nombreArchivo,
-			nombreArchivoInterno);
-	escribeDirectorio(miSistemaDeFicheros);
-	miSistemaDeFicheros->superBloque.numBloquesLibres -= nodo->numBloques;
-	escribeSuperBloque(miSistemaDeFicheros);
+	close(handle);
+	if (ret == 0) {
+		cierraOperacion(miSistemaDeFicheros);
+		return 0;
+	}
+	// Se deshace todo (la entrada, los bloques y el nodo-i) dentro de la
+	// misma operación, que cierra myRm
+	if (ret == -2)
+		fprintf(stderr, "No hay suficiente espacio en disco\n");
+	else
+		fprintf(stderr, "Incapaz de leer %s\n", nombreArchivoExterno);
+	myRm(miSistemaDeFicheros, nombreArchivoInterno);
+	return ret == -2 ? 9 : 10;
+}
 
-	sync();
+int myImport(char* nombreArchivoExterno,
+		MiSistemaDeFicheros* miSistemaDeFicheros, char* nombreArchivoInterno) {
+	int handle, numNodoI;
+	BOOLEAN flujo;
+	int ret = abreImportacion(miSistemaDeFicheros, nombreArchivoExterno,
+			nombreArchivoInterno, &handle, &numNodoI, &flujo);
+
+	if (ret != 0)
+		return ret;
+	if (flujo)
+		return terminaImportacionFlujo(miSistemaDeFicheros, handle, numNodoI,
+				nombreArchivoExterno, nombreArchivoInterno);
+	/***************bloque de datos*****************/
+	// Nada de lo anotado llega a disco antes de cerrar la operación, así
+	// que da igual que la entrada del directorio vaya antes que los datos
+	ret = escribeDatos(miSistemaDeFicheros, handle, numNodoI);
 	close(handle);
+	if (ret == -1) {
+		// myRm lo deshace todo en la misma operación, y la cierra
+		fprintf(stderr, "Incapaz de copiar %s\n", nombreArchivoExterno);
+		myRm(miSistemaDeFicheros, nombreArchivoInterno);
+		return 10;
+	}
+
+	// Fin de la operación: se confirma con las siguientes (ver cierraOperacion)
+	cierraOperacion(miSistemaDeFicheros);
 	return 0;
 }
 
 int myExport(MiSistemaDeFicheros* miSistemaDeFicheros,
-		char* nombreArchivoInterno, char* nombreArchivoExterno) {
+		char* nombreArchivoInterno, char* nombreArchivoExterno, BOOLEAN preguntar) {
 	int handle;
+	char option = 'n';
 
 	/// Buscamos el archivo nombreArchivoInterno en miSistemaDeFicheros
-	int posDirectorio = buscaPosDirectorio(miSistemaDeFicheros,
-			nombreArchivoInterno);
-	if (posDirectorio == -1) {
+	int idxNodoI = buscaRuta(miSistemaDeFicheros, nombreArchivoInterno);
+	if (idxNodoI == -1) {
 		perror(" El archivo a exportar no existe");
 		return 1;
 	}
+	if (obtenNodoI(miSistemaDeFicheros, idxNodoI)->tipo == TIPO_DIRECTORIO) {
+		fprintf(stderr, "%s es un directorio\n", nombreArchivoInterno);
+		return 2;
+	}
 	// ...
 
-	/// Si ya existe el archivo nombreArchivoExterno en linux preguntamos si sobreescribir
-	handle = open(nombreArchivoExterno, O_WRONLY, 0664);
-	if (handle != -1) {
+	/// Si ya existe el archivo nombreArchivoExterno en linux preguntamos si
+	/// sobreescribir: si no se contesta que sí (o no hay respuesta) no se
+	/// exporta. Sin preguntar, se sobreescribe.
+	if (preguntar && access(nombreArchivoExterno, F_OK) == 0) {
 		printf("El archivo ya existe,desea sobreescribir?(y/N):\n");
-		char option;
-		scanf("%c", &option);
-		if (option == 'n' || option == 'N') {
-			printf("%s", "Escribe otro nombre de archivo:\n");
-			scanf("%s", nombreArchivoExterno);
-			handle = creat(nombreArchivoExterno, 0644);
-		} else if (option == 'y' || option == 'Y') {
-			handle = open(nombreArchivoExterno, O_WRONLY|O_TRUNC, 0664);
+		fflush(stdout);
+		if (scanf(" %c", &option) != 1 || (option != 'y' && option != 'Y')) {
+			fprintf(stderr, "No se sobreescribe %s\n", nombreArchivoExterno);
+			return 4;
 		}
-	} else {
-		handle = creat(nombreArchivoExterno, 0644);
+	}
+	handle = open(nombreArchivoExterno, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (handle == -1) {
+		perror(nombreArchivoExterno);
+		return 5;
 	}
 
 	/// Copiamos bloque a bloque del archivo interno al externo
-	int idxNodoI =
-			miSistemaDeFicheros->directorio.archivos[posDirectorio].idxNodoI;
+	// (falla también si algún bloque no coincide con su suma)
+	if (exportaDatos(miSistemaDeFicheros, handle, idxNodoI) == -1) {
+		close(handle);
+		return 3;
+	}
 
-	exportaDatos(miSistemaDeFicheros, handle, idxNodoI);
-	
 	if (close(handle) == -1) {
 		perror("myExport close");
 		printf("Error, myExport close.\n");
@@ -230,80 +615,219 @@ int myExport(MiSistemaDeFicheros* miSistemaDeFicheros,
 }
 
 int myRm(MiSistemaDeFicheros* miSistemaDeFicheros, char* nombreArchivo) {
-	/// Completar:
-	// Busca el archivo con nombre "nombreArchivo"
-	int posDirectorio = buscaPosDirectorio(miSistemaDeFicheros, nombreArchivo);
-	if (posDirectorio == -1) {
+	char nombre[MAX_TAM_NOMBRE_ARCHIVO + 1];
+	int idxDirectorio = resuelveRuta(miSistemaDeFicheros, nombreArchivo, nombre);
+	int posNodoI = idxDirectorio == -1 || nombre[0] == '\0' ? -1
+			: buscaEntradaDirectorio(miSistemaDeFicheros, idxDirectorio, nombre);
+
+	// Busca el archivo con nombre "nombreArchivo" y lo quita del directorio
+	if (posNodoI == -1) {
 		fprintf(stderr, "El archivo a borrar no existe\n");
 		return 1;
 	}
-
-	// Obtiene el nodo-i asociado y lo actualiza
-	int posNodoI =
-			miSistemaDeFicheros->directorio.archivos[posDirectorio].idxNodoI;
-	EstructuraNodoI *nodoI = miSistemaDeFicheros->nodosI[posNodoI];
-	nodoI->libre = 1;
-
-	// Actualiza el superbloque (numBloquesLibres) y el mapa de bits
-	miSistemaDeFicheros->superBloque.numBloquesLibres += nodoI->numBloques;
-	int i;
-	for (i = 0; i < nodoI->numBloques; i++) {
-		miSistemaDeFicheros->mapaDeBits[nodoI->idxBloques[i]] = 0;
+	if (obtenNodoI(miSistemaDeFicheros, posNodoI)->tipo == TIPO_DIRECTORIO) {
+		fprintf(stderr, "%s es un directorio (usa rmdir)\n", nombreArchivo);
+		return 2;
 	}
-	// Libera el puntero y lo hace NULL
+	if (borraEntradaDirectorio(miSistemaDeFicheros, idxDirectorio, nombre)
+			== -1)
+		return 3;
 
+	// Obtiene el nodo-i asociado
+	EstructuraNodoI *nodoI = obtenNodoI(miSistemaDeFicheros, posNodoI);
 
-	// Actualiza el archivo
-	miSistemaDeFicheros->directorio.archivos[posDirectorio].libre = 1;
-	// Finalmente, actualiza en disco el directorio, nodoi, mapa de bits y superbloque
+	// Actualiza el mapa de bits (y con él numBloquesLibres en el superbloque)
+	liberaBloquesNodoI(miSistemaDeFicheros, nodoI);
 
-	escribeNodoI(miSistemaDeFicheros, posNodoI, nodoI);
-	escribeMapaDeBits(miSistemaDeFicheros);
+	// Finalmente, libera el nodo-i en su mapa y anota el superbloque
+	liberaNodoI(miSistemaDeFicheros, posNodoI);
 	escribeSuperBloque(miSistemaDeFicheros);
-	// ...
-	free(nodoI);
+	cierraOperacion(miSistemaDeFicheros);
 
 	return 0;
 }
 
-void myLs(MiSistemaDeFicheros* miSistemaDeFicheros) {
+// Imprime una línea de myLs
+static void imprimeEntrada(MiSistemaDeFicheros* miSistemaDeFicheros,
+		EstructuraEntradaDirectorio* entrada, void* arg) {
+	EstructuraNodoI* nodoI = obtenNodoI(miSistemaDeFicheros, entrada->idxNodoI);
+	struct tm *tlocal = localtime(&nodoI->tiempoModificado);
+	char output[128];
+
+	printf("%s%s\t", entrada->nombreArchivo,
+			nodoI->tipo == TIPO_DIRECTORIO ? "/" : "");
+	printf("%lld\t", (long long) nodoI->tamArchivo);
+	strftime(output, 128, "%d/%m/%y %H:%M:%S", tlocal);
+	printf("%s\n", output);
+	(*(int*) arg)++;
+}
+
+int myLs(MiSistemaDeFicheros* miSistemaDeFicheros, char* ruta) {
 	int numArchivosEncontrados = 0;
-	//EstructuraNodoI nodoActual;
-	int i;
-	// Recorre el sistema de ficheros, listando los archivos encontrados
+	int idxDirectorio = buscaRuta(miSistemaDeFicheros, ruta);
+
+	if (idxDirectorio == -1) {
+		fprintf(stderr, "No existe %s\n", ruta);
+		return 1;
+	}
+	if (obtenNodoI(miSistemaDeFicheros, idxDirectorio)->tipo
+			!= TIPO_DIRECTORIO) {
+		fprintf(stderr, "%s no es un directorio\n", ruta);
+		return 2;
+	}
+
+	// Recorre el directorio, listando los archivos encontrados
 	printf("%s\n", "Lista de archivos");
 
-	for (i = 0; i < MAX_ARCHIVOS_POR_DIRECTORIO; i++) {
-		if (miSistemaDeFicheros->directorio.archivos[i].libre == 0) {
-			printf("%s\t",
-					miSistemaDeFicheros->directorio.archivos[i].nombreArchivo);
-			printf("%d\t", miSistemaDeFicheros->nodosI[i]->tamArchivo);
+	if (recorreDirectorio(miSistemaDeFicheros, idxDirectorio, imprimeEntrada,
+			&numArchivosEncontrados) == -1)
+		return 3;
 
-			struct tm *tlocal = localtime(
-					&miSistemaDeFicheros->nodosI[i]->tiempoModificado);
-			char output[128];
-			strftime(output, 128, "%d/%m/%y %H:%M:%S", tlocal);
-			printf("%s\n", output);
+	if (numArchivosEncontrados == 0) {
+		printf("Directorio vacío\n");
+	} else {
+		printf("Número total de archivos:%d\n", numArchivosEncontrados);
+	}
+	return 0;
+}
 
-			numArchivosEncontrados++;
-		}
+int myMkdir(MiSistemaDeFicheros* miSistemaDeFicheros, char* ruta) {
+	char nombre[MAX_TAM_NOMBRE_ARCHIVO + 1];
+	int idxDirectorio = resuelveRuta(miSistemaDeFicheros, ruta, nombre);
+	int nodoLibre;
+	EstructuraNodoI* nodoI;
 
+	if (idxDirectorio == -1 || nombre[0] == '\0') {
+		fprintf(stderr, "Ruta no válida: %s\n", ruta);
+		return 1;
+	}
+	if (buscaEntradaDirectorio(miSistemaDeFicheros, idxDirectorio, nombre)
+			!= -1) {
+		fprintf(stderr, "%s ya existe\n", ruta);
+		return 2;
+	}
+	if ((nodoLibre = buscaNodoLibre(miSistemaDeFicheros)) == -1) {
+		fprintf(stderr, "No existen nodos-i libres\n");
+		return 3;
 	}
 
-	if (numArchivosEncontrados == 0) {
-		printf("Directorio vacío\n");
+	// El directorio nuevo ocupa su nodo-i y sus bloques antes de enlazarlo;
+	// si no cabe en el padre se deshace
+	if (creaDirectorio(miSistemaDeFicheros, nodoLibre) == -1)
+		return 4;
+	if (anadeEntradaDirectorio(miSistemaDeFicheros, idxDirectorio, nombre,
+			nodoLibre) == -1) {
+		fprintf(stderr, "No caben mas archivos en el directorio\n");
+		cierraDirectorio(miSistemaDeFicheros, nodoLibre);
+		nodoI = obtenNodoI(miSistemaDeFicheros, nodoLibre);
+		liberaBloquesNodoI(miSistemaDeFicheros, nodoI);
+		liberaNodoI(miSistemaDeFicheros, nodoLibre);
+		escribeSuperBloque(miSistemaDeFicheros);
+		cierraOperacion(miSistemaDeFicheros);
+		return 5;
+	}
+	escribeSuperBloque(miSistemaDeFicheros);
+	cierraOperacion(miSistemaDeFicheros);
+	return 0;
+}
+
+int myRmdir(MiSistemaDeFicheros* miSistemaDeFicheros, char* ruta) {
+	char nombre[MAX_TAM_NOMBRE_ARCHIVO + 1];
+	int idxDirectorio = resuelveRuta(miSistemaDeFicheros, ruta, nombre);
+	int idxNodoI = idxDirectorio == -1 || nombre[0] == '\0' ? -1
+			: buscaEntradaDirectorio(miSistemaDeFicheros, idxDirectorio, nombre);
+	DirectorioAbierto* d;
+	EstructuraNodoI* nodoI;
+
+	if (idxNodoI == -1) {
+		fprintf(stderr, "El directorio a borrar no existe\n");
+		return 1;
+	}
+	nodoI = obtenNodoI(miSistemaDeFicheros, idxNodoI);
+	if (nodoI->tipo != TIPO_DIRECTORIO) {
+		fprintf(stderr, "%s no es un directorio\n", ruta);
+		return 2;
+	}
+	if ((d = abreDirectorio(miSistemaDeFicheros, idxNodoI)) == NULL)
+		return 3;
+	if (d->cabecera.numArchivos > 0) {
+		fprintf(stderr, "El directorio %s no está vacío\n", ruta);
+		return 4;
+	}
+	if (borraEntradaDirectorio(miSistemaDeFicheros, idxDirectorio, nombre)
+			== -1)
+		return 3;
+
+	// Sus bloques son metadatos y pueden estar en el diario (ver truncaNodoI)
+	cierraDirectorio(miSistemaDeFicheros, idxNodoI);
+	liberaBloquesNodoI(miSistemaDeFicheros, nodoI);
+	liberaNodoI(miSistemaDeFicheros, idxNodoI);
+	escribeSuperBloque(miSistemaDeFicheros);
+	cierraOperacion(miSistemaDeFicheros);
+	return 0;
+}
+
+void myCache(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	CacheBloques* cache = &miSistemaDeFicheros->cache;
+	unsigned long long accesos = cache->aciertos + cache->fallos;
+
+	fprintf(stderr, "Caché: %d bloques (%d KB), %d sucios\n", cache->numMarcos,
+			cache->numMarcos * (TAM_BLOQUE_BYTES / 1024), cache->numSucios);
+	fprintf(stderr, "Aciertos: %llu, fallos: %llu (%.1f%% de aciertos)\n",
+			cache->aciertos, cache->fallos, accesos ? 100.0 * cache->aciertos
+					/ accesos : 0.0);
+	fprintf(stderr, "Leídos por adelantado: %llu, usados después: %llu\n",
+			cache->anticipados, cache->anticipadosUsados);
+	fprintf(stderr, "Expulsados: %llu, escritos a disco: %llu\n",
+			cache->expulsiones, cache->escrituras);
+}
+
+int myStats(MiSistemaDeFicheros* miSistemaDeFicheros, char* opcion) {
+	if (opcion != NULL && strcmp(opcion, "on") == 0)
+		return activaEstadisticas(miSistemaDeFicheros) == -1 ? 1 : 0;
+	if (opcion != NULL && strcmp(opcion, "off") == 0) {
+		desactivaEstadisticas(miSistemaDeFicheros);
+		return 0;
+	}
+	if (miSistemaDeFicheros->estadisticas == NULL) {
+		fprintf(stderr, "No se está midiendo (stats on)\n");
+		return 2;
+	}
+	if (opcion == NULL) {
+		imprimeEstadisticas(miSistemaDeFicheros->estadisticas, stderr);
+	} else if (strcmp(opcion, "reset") == 0) {
+		reiniciaEstadisticas(miSistemaDeFicheros->estadisticas);
 	} else {
-		printf("Número total de archivos:%d\n",
-				miSistemaDeFicheros->directorio.numArchivos);
+		return 3;
 	}
+	return 0;
+}
+
+int myUmount(MiSistemaDeFicheros* miSistemaDeFicheros) {
+	int ret;
+
+	// Al desmontar se confirma lo pendiente y se vacía el diario, para que
+	// la imagen quede con todo en su sitio
+	ret = confirmaMetadatos(miSistemaDeFicheros);
+	if (ret == 0 && miSistemaDeFicheros->diarioActivo
+			&& reproduceDiario(miSistemaDeFicheros) == -1)
+		ret = -1;
+	liberaMetadatos(miSistemaDeFicheros);
+	cierraImagen(miSistemaDeFicheros);
+	free(miSistemaDeFicheros->mapaDeBits);
+	miSistemaDeFicheros->mapaDeBits = NULL;
+	free(miSistemaDeFicheros->mapaNodosI);
+	miSistemaDeFicheros->mapaNodosI = NULL;
+	liberaNodosI(miSistemaDeFicheros);
+	liberaHuellas(miSistemaDeFicheros);
+	liberaSumas(miSistemaDeFicheros);
+	liberaDirectorios(miSistemaDeFicheros);
+	liberaCache(miSistemaDeFicheros);
+	liberaAnillo(miSistemaDeFicheros);
+	return ret;
 }
 
 void myExit(MiSistemaDeFicheros* miSistemaDeFicheros) {
-	int i;
-	close(miSistemaDeFicheros->discoVirtual);
-	for (i = 0; i < MAX_NODOSI; i++) {
-		free(miSistemaDeFicheros->nodosI[i]);
-		miSistemaDeFicheros->nodosI[i] = NULL;
-	}
+	myUmount(miSistemaDeFicheros);
 	exit(1);
 }
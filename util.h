@@ -7,24 +7,65 @@
 #include "common.h"
 
 // Formatea el disco virtual. Guarda el mapa de bits del super bloque 
-// y el directorio único.
-int myMkfs(MiSistemaDeFicheros* miSistemaDeFicheros, int tamDisco, char* nombreArchivo);
+// y el directorio raíz. Reserva un nodo-i por cada bytesPorNodoI bytes de disco.
+// Con deduplicar, reserva también el índice de huellas (ver huellas.h); con
+// comprimir, lo que se importe se guardará comprimido (ver compresion.h); con
+// sumas, cada bloque lleva su suma de comprobación (ver sumas.h).
+int myMkfs(MiSistemaDeFicheros* miSistemaDeFicheros, off_t tamDisco, int bytesPorNodoI, BOOLEAN deduplicar, BOOLEAN comprimir, BOOLEAN sumas, char* nombreArchivo);
+
+// Monta una imagen ya formateada. Lee el superbloque, y si es válido lee
+// con una sola llamada el mapa de bits y el de nodos-i. Si la imagen tiene
+// sumas y alguno de ellos no coincide devuelve 5.
+int myMount(MiSistemaDeFicheros* miSistemaDeFicheros, char* nombreArchivo);
 
 // Importa el fichero externo nombreArchivoExterno en nuestro sistema de ficheros,
-// con el nombre nombreArchivoInterno
+// con el nombre nombreArchivoInterno (una ruta dentro de un directorio que ya existe).
+// nombreArchivoExterno puede ser una tubería o "-" (la entrada estándar), que
+// se leen hasta el final.
 int myImport(char* nombreArchivoExterno, MiSistemaDeFicheros* miSistemaDeFicheros, char* nombreArchivoInterno);
 
+// La primera parte de myImport: hace las comprobaciones y anota el nodo-i,
+// sus bloques y la entrada en el directorio, pero no copia los datos ni
+// cierra la operación. Devuelve los mismos códigos de error que myImport; si
+// todo va bien deja el archivo externo abierto en *handle y el nodo-i en
+// *numNodoI. Si el archivo externo no es un archivo normal o si el sistema
+// deduplica o comprime, *flujo es cierto y el nodo-i queda vacío, para
+// escribeFlujo.
+int abreImportacion(MiSistemaDeFicheros* miSistemaDeFicheros, char* nombreArchivoExterno, char* nombreArchivoInterno, int* handle, int* numNodoI, BOOLEAN* flujo);
+// La segunda parte de myImport para un flujo: copia los datos, cierra el
+// archivo externo y cierra la operación. Si falla, deshace la importación.
+int terminaImportacionFlujo(MiSistemaDeFicheros* miSistemaDeFicheros, int handle, int numNodoI, char* nombreArchivoExterno, char* nombreArchivoInterno);
+
 // Exporta el fichero interno nombreArchivoInterno al sistema de ficheros del PC, con el
-// nombre nombreArchivoExterno
-int myExport(MiSistemaDeFicheros* miSistemaDeFicheros, char* nombreArchivoInterno, char* nombreArchivoExterno);
+// nombre nombreArchivoExterno. Si ya existe y preguntar, pregunta si sobreescribirlo y
+// devuelve 4 si no se contesta que sí; sin preguntar (en un script), lo sobreescribe.
+// Devuelve 5 si no se puede crear.
+int myExport(MiSistemaDeFicheros* miSistemaDeFicheros, char* nombreArchivoInterno, char* nombreArchivoExterno, BOOLEAN preguntar);
 
 // Borra el fichero de nombre nombreArchivo
 int myRm(MiSistemaDeFicheros* miSistemaDeFicheros, char* nombreArchivo);
 
-// Itera sobre los ficheros del directorio y muestra sus nombres
-void myLs(MiSistemaDeFicheros* miSistemaDeFicheros);
+// Itera sobre los ficheros del directorio ruta y muestra sus nombres
+int myLs(MiSistemaDeFicheros* miSistemaDeFicheros, char* ruta);
+
+// Crea el directorio ruta, vacío
+int myMkdir(MiSistemaDeFicheros* miSistemaDeFicheros, char* ruta);
+
+// Borra el directorio ruta, que tiene que estar vacío
+int myRmdir(MiSistemaDeFicheros* miSistemaDeFicheros, char* ruta);
+
+// Muestra el uso de la caché de bloques de metadatos
+void myCache(MiSistemaDeFicheros* miSistemaDeFicheros);
+
+// Muestra lo medido (ver stats.h). Con opcion "on" empieza a medir, con
+// "off" deja de hacerlo y con "reset" pone todo a cero.
+int myStats(MiSistemaDeFicheros* miSistemaDeFicheros, char* opcion);
+
+// Confirma lo pendiente, libera memoria (también la caché y el anillo) y
+// cierra la imagen
+int myUmount(MiSistemaDeFicheros* miSistemaDeFicheros);
 
-// Libera memoria y cierra el sistema de ficheros
+// Desmonta y termina
 void myExit(MiSistemaDeFicheros* miSistemaDeFicheros);
 
 #endif	/* UTIL_H */